@@ -23,15 +23,20 @@ libdir = lib
 bindir = bin
 
 
+# Compiler and linker flags for OpenMP (BaseAlgorithm::predictBatch and the
+# RBM_New sweep run on all cores).
+OPENMP_CFLAGS = -fopenmp
+OPENMP_LDFLAGS = -fopenmp
+
 # Default compiler flags (for C and C++)
 override CFLAGS += -Wall -Wextra -I$(incdir) -march=core-avx2 -m64 -O3 \
 -flto -fomit-frame-pointer -pipe -Wno-reorder -Wno-unused-function \
--Wno-parentheses
+-Wno-parentheses $(OPENMP_CFLAGS)
 # Default compiler flags for C++
 override CXXFLAGS += $(CFLAGS) -std=c++11 -Wno-write-strings
 # Default linker flags
 override LD_FLAGS += -L$(libdir) -Wl,-O3,--sort-common,--as-needed,-z,relro \
--flto -std=c++11
+-flto -std=c++11 $(OPENMP_LDFLAGS)
 
 # Extra linker flags for Armadillo.
 ARMA_LDFLAGS = -larmadillo
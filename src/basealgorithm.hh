@@ -1,12 +1,26 @@
 #ifndef __BASEALGORITHM_HH__
 #define __BASEALGORITHM_HH__
 
+#include <algorithm>
 #include <armadillo>
+#include <climits>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <netflix.hh>
+#include <ratingstore.hh>
 
 using namespace arma;
 
 typedef float data_t;
 
+// The number of points handled by one task of predictBatch(). A chunk's
+// ids and outputs (16 bytes per point) fit comfortably in L2, and chunks are
+// large enough that a run of one user's ratings rarely straddles two tasks.
+#define PREDICT_BATCH_CHUNK 4096
+
 class BaseAlgorithm 
 {
 public:
@@ -34,13 +48,191 @@ public:
         this->train(data);
     }
 
+    /**
+     * Trains on the ratings of a view of a rating store (e.g. some
+     * combination of sets), in the store's order. The default materializes
+     * the view as a matrix, which copies it unless it's a single run. SVD,
+     * SVD++, Time-SVD++ and kNN override this to walk the view's runs, so
+     * they never copy it.
+     *
+     */
+    virtual void train(const RatingView &view)
+    {
+        this->train(view.matrix());
+    }
+
+    /**
+     * Trains on the users, items and dates of a view, but with ratings[i]
+     * standing in for the rating of the view's i-th rating. This lets a
+     * combination of algorithms train a later model on residuals without
+     * touching (or copying) the shared training set.
+     *
+     * The default materializes a copy of the view with the ratings swapped
+     * in. SVD, SVD++, Time-SVD++ and kNN override this to read the ratings
+     * directly, so only the RBMs pay for the copy.
+     *
+     */
+    virtual void trainWithRatings(const RatingView &view,
+                                  const data_t *ratings)
+    {
+        Mat<data_t> copy(netflix::COLUMNS, view.size());
+        size_t i = 0;
+        view.forEach([&copy, &i, ratings](const float *rating)
+                {
+                    std::copy(rating, rating + netflix::COLUMNS,
+                              copy.colptr(i));
+                    copy.at(netflix::RATING_ROW, i) = ratings[i];
+                    i++;
+                });
+        this->train(copy);
+    }
+
     /**
      * Note: Some algorithms do not use the date aspect, but this has been
      * added for consistency across all BaseAlgorithms.
      */
     virtual float predict(int user, int item, int date, bool bound) = 0;
 
+    /**
+     * Predicts n ratings at once, writing the prediction for (users[i],
+     * items[i], dates[i]) to output[i]. The default implementation splits
+     * the batch into chunks of PREDICT_BATCH_CHUNK points and hands the
+     * chunks to OpenMP threads, each of which calls predictRange(). Points
+     * sorted by user (like all of our data sets) let the per-class
+     * predictRange() kernels reuse their per-user work.
+     *
+     * Algorithms whose predict() is not safe to call concurrently must
+     * override this to run serially (and call checkIds() themselves).
+     *
+     */
+    virtual void predictBatch(const int *users, const int *items,
+                              const int *dates, float *output, size_t n,
+                              bool bound)
+    {
+        checkIds(users, items, dates, n);
+
+        const long numChunks = (long) ((n + PREDICT_BATCH_CHUNK - 1)
+                                       / PREDICT_BATCH_CHUNK);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (long chunk = 0; chunk < numChunks; chunk++)
+        {
+            size_t start = (size_t) chunk * PREDICT_BATCH_CHUNK;
+            size_t count = std::min((size_t) PREDICT_BATCH_CHUNK, n - start);
+
+            predictRange(users + start, items + start, dates + start,
+                         output + start, count, bound);
+        }
+    }
+
+    /**
+     * Predicts every rating in data (laid out as described in train()),
+     * writing data.n_cols predictions to output.
+     *
+     */
+    void predictAll(const Mat<data_t> &data, float *output, bool bound)
+    {
+        predictAll(RatingView(data), output, bound);
+    }
+
+    /**
+     * Predicts every rating of a view, in order, writing view.size()
+     * predictions to output. The ids are converted to ints in blocks and
+     * passed on to predictBatch().
+     *
+     */
+    void predictAll(const RatingView &view, float *output, bool bound)
+    {
+        const size_t blockSize = 64 * PREDICT_BATCH_CHUNK;
+        const size_t numPoints = view.size();
+        RatingCursor cursor(view);
+
+        std::vector<int> users, items, dates;
+        users.reserve(std::min(blockSize, numPoints));
+        items.reserve(std::min(blockSize, numPoints));
+        dates.reserve(std::min(blockSize, numPoints));
+
+        for (size_t start = 0; start < numPoints; start += blockSize)
+        {
+            size_t count = std::min(blockSize, numPoints - start);
+
+            users.resize(count);
+            items.resize(count);
+            dates.resize(count);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                const data_t *column = cursor.next();
+                users[i] = netflix::roundToInt(column[netflix::USER_ROW]);
+                items[i] = netflix::roundToInt(column[netflix::MOVIE_ROW]);
+                dates[i] = netflix::roundToInt(column[netflix::DATE_ROW]);
+            }
+
+            predictBatch(users.data(), items.data(), dates.data(),
+                         output + start, count, bound);
+        }
+    }
+
     virtual ~BaseAlgorithm() {}
+
+protected:
+    /**
+     * The number of users, items and dates the model was sized for (i.e.
+     * one more than the largest ID it can predict for). The default puts
+     * no limit on any of them; models that index their parameters by ID
+     * override this.
+     *
+     */
+    virtual void idBounds(int &numUsers, int &numItems, int &numDates) const
+    {
+        numUsers = numItems = numDates = INT_MAX;
+    }
+
+    /**
+     * Throws out_of_range if any of n points has an ID outside of the
+     * model's idBounds(). predictBatch() checks its points up front, since
+     * the threads predicting them can't throw, and an ID past the end of a
+     * parameter matrix would otherwise be read silently.
+     *
+     */
+    void checkIds(const int *users, const int *items, const int *dates,
+                  size_t n) const
+    {
+        int numUsers, numItems, numDates;
+        idBounds(numUsers, numItems, numDates);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (users[i] < 0 || users[i] >= numUsers || items[i] < 0
+                || items[i] >= numItems || dates[i] < 0
+                || dates[i] >= numDates)
+            {
+                throw std::out_of_range("Can't predict user " +
+                    std::to_string(users[i]) + ", item " +
+                    std::to_string(items[i]) + ", date " +
+                    std::to_string(dates[i]) + " with a model of " +
+                    std::to_string(numUsers) + " users, " +
+                    std::to_string(numItems) + " items and " +
+                    std::to_string(numDates) + " dates!");
+            }
+        }
+    }
+
+    /**
+     * Predicts the n points of one chunk of predictBatch(). This is called
+     * concurrently for disjoint chunks, so it must only read model state.
+     * The default just calls predict() for each point.
+     *
+     */
+    virtual void predictRange(const int *users, const int *items,
+                              const int *dates, float *output, size_t n,
+                              bool bound)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            output[i] = predict(users[i], items[i], dates[i], bound);
+        }
+    }
 };
 
 #endif // __BASEALGORITHM_HH__
@@ -0,0 +1,610 @@
+/**
+ * Benchmarks every algorithm end to end on synthetic data (see
+ * synthdata.hh), and writes the results as JSON. "make bench" builds it
+ * without debug output (which would skew the timings) and runs it. Usage:
+ *
+ *      benchmark [--sizes F,...] [--algos A,...] [--threads T,...]
+ *                [--iters N] [--workdir DIR] [--out FILE]
+ *                [--baseline FILE] [--tolerance X]
+ *
+ * Each size is a fraction of the Netflix data: users and ratings scale
+ * with it, and movies with its square root. A dataset of each size is
+ * generated under the work directory, in the same layout as "data" (and
+ * reused by later runs with the same settings). Every algorithm (svd,
+ * svdpp, timesvdpp, globals, knn and rbm_new) is then run on it with each
+ * thread count, each in a process of its own so its peak RSS is its own.
+ * A run trains on base + hidden + valid and predicts probe, and reports:
+ *
+ *      load_seconds            mapping the store and copying the
+ *                              training sets out of it
+ *      setup_seconds           constructing the model (including reading
+ *                              N and the like)
+ *      train_seconds           training (for KNN, mostly calcP())
+ *      ratings_per_second      training ratings per second of each epoch
+ *      predictions_per_second  probe predictions per second (batched)
+ *      probe_rmse              to catch speedups that break the model
+ *      peak_rss_kb             the run's peak resident set size
+ *      speedup                 over the same run with the fewest threads
+ *
+ * The output has one run per line. With --baseline, every run is compared
+ * with the same run (algorithm, size and threads) in an earlier output,
+ * and the program exits with status 2 if throughput fell, or peak RSS
+ * grew, by more than the tolerance (a fraction; 0.1 by default).
+ *
+ */
+
+#include <algorithm>
+#include <armadillo>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <omp.h>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <netflix.hh>
+#include <basealgorithm.hh>
+#include <globals.hh>
+#include <knn.hh>
+#include <ratingsort.hh>
+#include <ratingstore.hh>
+#include <rbm_new.hh>
+#include <svd.hh>
+#include <svdpp.hh>
+#include <synthdata.hh>
+#include <telemetry.hh>
+#include <timesvdpp.hh>
+
+using namespace std;
+using namespace std::chrono;
+using namespace arma;
+using namespace netflix; // challenge-related constants/functions.
+
+
+/* Constants */
+
+// The sets every algorithm trains on, and the set it predicts.
+const set<int> TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
+
+// Model settings. These are smaller than the drivers' (see e.g.
+// svd_test.cc), so that a run takes minutes rather than hours; only the
+// cost per rating matters here.
+const int NUM_FACTORS = 50;
+const int NUM_TIME_BINS = 30;
+const int GLOBALS_LEVEL = 10;
+const int KNN_MIN_COMMON = 24;
+const unsigned int KNN_MAX_WEIGHT = 30;
+const string KNN_P_PATH = "data/knn_cached/knn-p.dta";
+const int RBM_NUM_FACTORS = 100;
+const float RBM_LEARNING_RATE = 0.001;
+
+// The Netflix data has this many ratings, qual included.
+const size_t NETFLIX_NUM_RATINGS = 102416306;
+
+// Defaults for the command line.
+const vector<string> ALGORITHMS = {"svd", "svdpp", "timesvdpp", "globals",
+                                   "knn", "rbm_new"};
+const vector<double> DEFAULT_SIZES = {0.01, 0.05};
+const int DEFAULT_ITERATIONS = 3;
+const string DEFAULT_WORKDIR = "bench";
+const double DEFAULT_TOLERANCE = 0.1;
+
+// The metrics compared with a baseline, and whether more is better.
+const vector<pair<string, bool> > COMPARED_METRICS = {
+    {"ratings_per_second", true},
+    {"predictions_per_second", true},
+    {"peak_rss_kb", false}};
+
+
+static double secondsSince(time_point<steady_clock> start)
+{
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+
+// Splits a comma-separated list.
+static vector<string> splitList(const string &list)
+{
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ','))
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+
+// Reads the value of a field of a one-line JSON object written by this
+// program (a number, or a string without escapes).
+static bool jsonField(const string &line, const string &key, string &value)
+{
+    string pattern = "\"" + key + "\": ";
+    size_t start = line.find(pattern);
+    if (start == string::npos)
+    {
+        return false;
+    }
+    start += pattern.size();
+
+    if (line[start] == '"')
+    {
+        size_t end = line.find('"', start + 1);
+        value = line.substr(start + 1, end - start - 1);
+    }
+    else
+    {
+        size_t end = line.find_first_of(",}", start);
+        value = line.substr(start, end - start);
+    }
+    return true;
+}
+
+static double jsonNumber(const string &line, const string &key)
+{
+    string value;
+    return jsonField(line, key, value) ? atof(value.c_str()) : NAN;
+}
+
+
+static void makeDir(const string &dir)
+{
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw runtime_error("Couldn't create " + dir + ": " +
+                            string(strerror(errno)));
+    }
+}
+
+
+/**
+ * Constructs an algorithm by name, with the settings above.
+ */
+static unique_ptr<BaseAlgorithm> makeAlgorithm(const string &name,
+                                               const RatingStore &ratings,
+                                               int numIterations)
+{
+    const int numUsers = ratings.numUsers(), numItems = ratings.numItems();
+
+    if (name == "svd")
+    {
+        return unique_ptr<BaseAlgorithm>(
+            new SVD(numUsers, numItems, MEAN_RATING_TRAINING_SET,
+                    NUM_FACTORS, numIterations));
+    }
+    if (name == "svdpp")
+    {
+        return unique_ptr<BaseAlgorithm>(
+            new SVDPP(numUsers, numItems, MEAN_RATING_TRAINING_SET,
+                      NUM_FACTORS, numIterations, N_FN));
+    }
+    if (name == "timesvdpp")
+    {
+        return unique_ptr<BaseAlgorithm>(
+            new TimeSVDPP(numUsers, numItems, ratings.numDates(),
+                          MEAN_RATING_TRAINING_SET, NUM_FACTORS,
+                          numIterations, NUM_TIME_BINS, true, N_FN,
+                          HAT_DEV_U_T_FN, F_U_T_FN));
+    }
+    if (name == "globals")
+    {
+        return unique_ptr<BaseAlgorithm>(
+            new Globals(numUsers, numItems, GLOBALS_LEVEL, TRAIN_SETS));
+    }
+    if (name == "knn")
+    {
+        return unique_ptr<BaseAlgorithm>(
+            new KNN(numUsers, numItems, KNN_MIN_COMMON, KNN_MAX_WEIGHT,
+                    false, false, KNN_P_PATH));
+    }
+    if (name == "rbm_new")
+    {
+        return unique_ptr<BaseAlgorithm>(
+            new RBM_New(numUsers, numItems, MEAN_RATING_TRAINING_SET,
+                        MAX_RATING, RBM_NUM_FACTORS, RBM_LEARNING_RATE,
+                        numIterations));
+    }
+
+    throw invalid_argument("Unknown algorithm " + name);
+}
+
+
+/**
+ * Runs one algorithm on the dataset in the current directory, and writes
+ * its results to jsonPath as a one-line JSON object.
+ */
+static void runOne(const string &name, int numThreads, int numIterations,
+                   const string &jsonPath)
+{
+    omp_set_num_threads(numThreads);
+
+    // Keep probe scoring out of the training time, and write each run's
+    // epoch records (see telemetry.hh) next to its results.
+    telemetry::setProbeInterval(0);
+    telemetry::open(jsonPath.substr(0, jsonPath.rfind('.'))
+                    + ".telemetry.jsonl");
+
+    time_point<steady_clock> start = steady_clock::now();
+    RatingStore ratings(RATINGS_STORE);
+    RatingView trainingSet = ratings.view(TRAIN_SETS);
+    RatingView probeSet = ratings.view(PROBE_IDX);
+    double loadSeconds = secondsSince(start);
+
+    start = steady_clock::now();
+    unique_ptr<BaseAlgorithm> algo = makeAlgorithm(name, ratings,
+                                                   numIterations);
+    double setupSeconds = secondsSince(start);
+
+    start = steady_clock::now();
+    algo->train(trainingSet);
+    double trainSeconds = secondsSince(start);
+
+    // Only the factor models and the RBM make several passes.
+    int numEpochs = (name == "globals" || name == "knn") ? 1
+                                                         : numIterations;
+
+    vector<float> predictions(probeSet.size());
+    start = steady_clock::now();
+    algo->predictAll(probeSet, predictions.data(), true);
+    double predictSeconds = secondsSince(start);
+
+    double squaredError = 0.0;
+    size_t ratingNum = 0;
+    probeSet.forEach([&](const float *rating)
+    {
+        double error = rating[RATING_ROW] - predictions[ratingNum++];
+        squaredError += error * error;
+    });
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    ofstream json(jsonPath);
+    json << setprecision(6)
+         << "{\"algorithm\": \"" << name << "\", "
+         << "\"threads\": " << numThreads << ", "
+         << "\"ratings\": " << trainingSet.size() << ", "
+         << "\"epochs\": " << numEpochs << ", "
+         << "\"load_seconds\": " << loadSeconds << ", "
+         << "\"setup_seconds\": " << setupSeconds << ", "
+         << "\"train_seconds\": " << trainSeconds << ", "
+         << "\"ratings_per_second\": "
+         << trainingSet.size() * (double) numEpochs / trainSeconds << ", "
+         << "\"predictions\": " << probeSet.size() << ", "
+         << "\"predictions_per_second\": "
+         << probeSet.size() / predictSeconds << ", "
+         << "\"probe_rmse\": "
+         << sqrt(squaredError / max<size_t>(probeSet.size(), 1)) << ", "
+         << "\"peak_rss_kb\": " << usage.ru_maxrss << "}" << endl;
+}
+
+
+/**
+ * Generates the dataset of the given size under dir, unless the one there
+ * was generated with the same settings.
+ */
+static void prepareDataset(const string &dir, double size)
+{
+    SynthConfig config;
+    config.numUsers = max(1, (int) lround(NUM_USERS * size));
+    config.numMovies = max(1, (int) lround(NUM_MOVIES * sqrt(size)));
+    config.numRatings = (size_t) llround(NETFLIX_NUM_RATINGS * size);
+
+    ostringstream settings;
+    settings << config.numUsers << " " << config.numMovies << " "
+             << config.numDates << " " << config.numRatings << " "
+             << config.seed << endl;
+
+    const string stampPath = dir + "/settings";
+    ifstream stamp(stampPath);
+    stringstream stamped;
+    stamped << stamp.rdbuf();
+    if (stamped.str() == settings.str())
+    {
+        return;
+    }
+
+    cout << "Generating the dataset of size " << size << " in " << dir
+         << "..." << endl;
+
+    makeDir(dir);
+    makeDir(dir + "/data");
+    makeDir(dir + "/data/um");
+    makeDir(dir + "/data/mu");
+
+    SynthData data = generateSynthData(config);
+    const string root = dir + "/";
+    writeSynthText(data, root + DATA_PATH, root + INDEX_PATH,
+                   root + QUAL_DATA_FN, root + "data/um/new_qual_ratings.dta",
+                   root + N_FN);
+    writeSynthTimeFiles(data, root + HAT_DEV_U_T_FN, root + F_U_T_FN);
+    writeSynthStore(data, root + RATINGS_STORE);
+
+    RatingStore store(root + RATINGS_STORE);
+    writePermutedStore(store, sortRatings(store, RatingOrder::MOVIE_USER),
+                       root + MU_RATINGS_STORE);
+
+    ofstream(stampPath) << settings.str();
+}
+
+
+/**
+ * Compares runs with the same runs in a baseline, and returns the number
+ * of regressions.
+ */
+static int compareWithBaseline(const vector<string> &runs,
+                               const string &baselinePath, double tolerance)
+{
+    ifstream baselineFile(baselinePath);
+    if (baselineFile.fail())
+    {
+        throw runtime_error("Couldn't find the baseline at " +
+                            baselinePath);
+    }
+
+    // The baseline's runs by (algorithm, size, threads).
+    map<string, string> baseline;
+    string line, algorithm, size, threads;
+    while (getline(baselineFile, line))
+    {
+        if (jsonField(line, "algorithm", algorithm)
+            && jsonField(line, "size", size)
+            && jsonField(line, "threads", threads))
+        {
+            baseline[algorithm + " " + size + " " + threads] = line;
+        }
+    }
+
+    cout << "\nCompared with " << baselinePath << ":" << endl;
+
+    int numRegressions = 0;
+    for (const string &run : runs)
+    {
+        jsonField(run, "algorithm", algorithm);
+        jsonField(run, "size", size);
+        jsonField(run, "threads", threads);
+        string key = algorithm + " " + size + " " + threads;
+
+        if (baseline.count(key) == 0)
+        {
+            continue;
+        }
+
+        for (const pair<string, bool> &metric : COMPARED_METRICS)
+        {
+            double now = jsonNumber(run, metric.first);
+            double before = jsonNumber(baseline[key], metric.first);
+            if (std::isnan(now) || std::isnan(before) || before == 0.0)
+            {
+                continue;
+            }
+
+            double change = now / before - 1.0;
+            bool regressed = metric.second ? change < -tolerance
+                                           : change > tolerance;
+            numRegressions += regressed;
+
+            cout << "  " << left << setw(28) << key << setw(24)
+                 << metric.first << right << showpos << fixed
+                 << setprecision(1) << setw(8) << 100.0 * change << "%"
+                 << noshowpos << (regressed ? "  REGRESSION" : "")
+                 << endl;
+        }
+    }
+
+    return numRegressions;
+}
+
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [--sizes F,...] [--algos A,...] "
+         << "[--threads T,...] [--iters N] [--workdir DIR] [--out FILE] "
+         << "[--baseline FILE] [--tolerance X]" << endl;
+}
+
+
+int main(int argc, char **argv)
+{
+    vector<double> sizes = DEFAULT_SIZES;
+    vector<string> algorithms = ALGORITHMS;
+    vector<int> threadCounts;
+    int numIterations = DEFAULT_ITERATIONS;
+    string workdir = DEFAULT_WORKDIR, outPath, baselinePath, runAlgorithm;
+    string jsonPath;
+    double tolerance = DEFAULT_TOLERANCE;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (i + 1 == argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        string value = argv[++i];
+
+        if (arg == "--sizes")
+        {
+            sizes.clear();
+            for (const string &size : splitList(value))
+            {
+                sizes.push_back(atof(size.c_str()));
+            }
+        }
+        else if (arg == "--algos")
+        {
+            algorithms = splitList(value);
+        }
+        else if (arg == "--threads")
+        {
+            for (const string &count : splitList(value))
+            {
+                threadCounts.push_back(atoi(count.c_str()));
+            }
+        }
+        else if (arg == "--iters")
+        {
+            numIterations = atoi(value.c_str());
+        }
+        else if (arg == "--workdir")
+        {
+            workdir = value;
+        }
+        else if (arg == "--out")
+        {
+            outPath = value;
+        }
+        else if (arg == "--baseline")
+        {
+            baselinePath = value;
+        }
+        else if (arg == "--tolerance")
+        {
+            tolerance = atof(value.c_str());
+        }
+        else if (arg == "--run")
+        {
+            // Internal: a single run (see runOne()).
+            runAlgorithm = value;
+        }
+        else if (arg == "--json")
+        {
+            jsonPath = value;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // By default, 1 thread and every power of two up to all of them.
+    if (threadCounts.empty())
+    {
+        const int maxThreads = omp_get_max_threads();
+        for (int count = 1; count < maxThreads; count *= 2)
+        {
+            threadCounts.push_back(count);
+        }
+        threadCounts.push_back(maxThreads);
+    }
+    sort(threadCounts.begin(), threadCounts.end());
+
+    if (!runAlgorithm.empty())
+    {
+        runOne(runAlgorithm, threadCounts[0], numIterations, jsonPath);
+        return 0;
+    }
+
+    if (outPath.empty())
+    {
+        outPath = workdir + "/results.json";
+    }
+
+    // Runs re-execute this binary from inside each dataset's directory.
+    char selfPath[4096];
+    ssize_t selfLength = readlink("/proc/self/exe", selfPath,
+                                  sizeof(selfPath) - 1);
+    if (selfLength < 0)
+    {
+        throw runtime_error("Couldn't find the benchmark binary!");
+    }
+    selfPath[selfLength] = '\0';
+
+    makeDir(workdir);
+
+    vector<string> runs;
+    int numFailures = 0;
+
+    for (double size : sizes)
+    {
+        ostringstream dirName;
+        dirName << workdir << "/size_" << size;
+        const string dir = dirName.str();
+        prepareDataset(dir, size);
+
+        for (const string &algorithm : algorithms)
+        {
+            double baseSeconds = NAN;
+
+            for (int threads : threadCounts)
+            {
+                const string tag = algorithm + "_" + to_string(threads);
+                ostringstream command;
+                command << "cd '" << dir << "' && '" << selfPath
+                        << "' --run " << algorithm << " --threads "
+                        << threads << " --iters " << numIterations
+                        << " --json " << tag << ".json > " << tag
+                        << ".log 2>&1";
+
+                cout << "Running " << algorithm << " on size " << size
+                     << " with " << threads << " threads..." << flush;
+                int status = system(command.str().c_str());
+
+                ifstream result(dir + "/" + tag + ".json");
+                string line;
+                if (status != 0 || !getline(result, line))
+                {
+                    cout << " failed (see " << dir << "/" << tag << ".log)"
+                         << endl;
+                    numFailures++;
+                    continue;
+                }
+
+                double trainSeconds = jsonNumber(line, "train_seconds");
+                if (std::isnan(baseSeconds))
+                {
+                    baseSeconds = trainSeconds;
+                }
+
+                ostringstream run;
+                run << "{\"size\": " << size << ", "
+                    << line.substr(1, line.size() - 2) << ", "
+                    << "\"speedup\": " << setprecision(4)
+                    << baseSeconds / trainSeconds << "}";
+                runs.push_back(run.str());
+
+                cout << " " << jsonNumber(line, "ratings_per_second")
+                     << " ratings/s, " << trainSeconds << " s" << endl;
+            }
+        }
+    }
+
+    ofstream out(outPath);
+    out << "{\n  \"runs\": [\n";
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        out << "    " << runs[i] << (i + 1 < runs.size() ? "," : "")
+            << "\n";
+    }
+    out << "  ]\n}" << endl;
+
+    cout << "\nWrote " << runs.size() << " runs to " << outPath << "."
+         << endl;
+
+    if (!baselinePath.empty()
+        && compareWithBaseline(runs, baselinePath, tolerance) > 0)
+    {
+        return 2;
+    }
+
+    return numFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <sys/stat.h>
+
+#include <chain_algo.hh>
+#include <ratingstore.hh>
+
+// FNV-1a parameters (64-bit).
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+/**
+ * Folds n bytes into an FNV-1a style hash. Whole 8-byte words are mixed in
+ * at a time, which is plenty for cache keys and fast enough to hash the
+ * full training set on every run.
+ */
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t n)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+
+    for (; i < n; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const std::string &str)
+{
+    // Include the length so that ("ab", "c") and ("a", "bc") differ.
+    uint64_t length = str.size();
+    hash = hashBytes(hash, &length, sizeof(length));
+    return hashBytes(hash, str.data(), str.size());
+}
+
+/**
+ * Maps a cached column if it exists and has the expected length. Anything
+ * else (missing, truncated, from a different data set) is a cache miss.
+ */
+static bool mapCached(FloatColumn &column, const std::string &fileName,
+                      size_t expectedSize)
+{
+    struct stat fileStat;
+    if (stat(fileName.c_str(), &fileStat) != 0)
+    {
+        return false;
+    }
+
+    try
+    {
+        column.map(fileName);
+    }
+    catch (const std::runtime_error &)
+    {
+        return false;
+    }
+
+    if (column.size() != expectedSize)
+    {
+        column.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Saves a column under a temporary name and renames it into place, so an
+ * interrupted run never leaves a truncated cache entry behind.
+ */
+static void saveCached(const std::string &fileName, const float *data,
+                       size_t n)
+{
+    const std::string tempFileName = fileName + ".tmp";
+    FloatColumn::save(tempFileName, data, n);
+
+    if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0)
+    {
+        throw std::runtime_error("Couldn't move " + tempFileName + " to "
+                                 + fileName);
+    }
+}
+
+
+Chain_Algo::Chain_Algo(const std::set<int> &trainingSets,
+        const std::string &cacheDir,
+        const int ratingSigFig) :
+    store(RATINGS_STORE),
+    trainingSet(store.view(trainingSets)),
+    cacheDir(cacheDir),
+    ratingSigFig(ratingSigFig)
+{
+    // Hash the runs in order, which hashes the same bytes as the training
+    // set laid out as a 4 x N matrix would.
+    trainingSetHash = FNV_OFFSET_BASIS;
+    for (const std::pair<size_t, size_t> &run : trainingSet.runs())
+    {
+        trainingSetHash = hashBytes(trainingSetHash,
+                                    store.data() + run.first * COLUMNS,
+                                    (run.second - run.first) * COLUMNS
+                                    * sizeof(float));
+    }
+
+    const uword numRows = COLUMNS;
+    trainingSetHash = hashBytes(trainingSetHash, &numRows, sizeof(numRows));
+
+    // Make sure the cache directory exists.
+    if (mkdir(cacheDir.c_str(), 0755) != 0)
+    {
+        struct stat dirStat;
+        if (stat(cacheDir.c_str(), &dirStat) != 0 || !S_ISDIR(dirStat.st_mode))
+        {
+            throw std::runtime_error("Couldn't create cache directory at "
+                                     + cacheDir);
+        }
+    }
+
+#ifndef NDEBUG
+    cout << "Set up Chain_Algo by loading " << trainingSet.size()
+        << " ratings (caching stages in " << cacheDir << ")" << endl;
+#endif
+}
+
+
+void Chain_Algo::addStage(const std::string &name,
+        const std::string &description,
+        BaseAlgorithm &algorithm)
+{
+    ChainStage stage;
+    stage.name = name;
+    stage.description = description;
+    stage.algorithm = &algorithm;
+    stages.push_back(stage);
+}
+
+
+std::string Chain_Algo::cacheFileName(uint64_t key,
+        const std::string &kind) const
+{
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) key);
+    return cacheDir + "/" + std::string(hex) + "." + kind + ".f32";
+}
+
+
+/**
+ * Returns one cache key per stage. Stage i's key covers the training set,
+ * the qual index and the descriptions of stages 0 through i, so it changes
+ * exactly when stage i's residuals or qual predictions could.
+ */
+std::vector<uint64_t> Chain_Algo::stageKeys(const Mat<int> &qualIndex) const
+{
+    uint64_t key = hashBytes(trainingSetHash, qualIndex.memptr(),
+                             qualIndex.n_elem * sizeof(int));
+
+    std::vector<uint64_t> keys;
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        key = hashString(key, stages[i].description);
+        keys.push_back(key);
+    }
+
+    return keys;
+}
+
+
+/**
+ * Runs the chain. The longest prefix of stages whose results are cached is
+ * skipped entirely (those algorithms are never trained); every later stage
+ * is trained on the residuals of the one before it, and its results are
+ * cached. The sum of all stages' qual predictions is bounded and written to
+ * outputFileName.
+ */
+void Chain_Algo::run(const std::string &qualFileName,
+        const std::string &outputFileName)
+{
+    if (stages.empty())
+    {
+        throw std::logic_error("Chain_Algo needs at least one stage!");
+    }
+
+    Mat<int> qualIndex = loadQualIndex(qualFileName);
+    std::vector<uint64_t> keys = stageKeys(qualIndex);
+
+    const size_t numPoints = trainingSet.size();
+    const size_t numQual = qualIndex.n_rows;
+
+    // residuals holds the target of the next stage to train (empty means
+    // the ratings themselves); qualSum holds the qual predictions summed
+    // over the stages so far.
+    FloatColumn residuals;
+    std::vector<float> qualSum(numQual, 0.0);
+
+    // Find the last stage with both of its results cached.
+    int resumeAfter = -1;
+    for (int i = (int) stages.size() - 1; i >= 0 && resumeAfter < 0; i--)
+    {
+        FloatColumn cachedQual;
+        if (mapCached(cachedQual, cacheFileName(keys[i], "qual"), numQual)
+            && mapCached(residuals, cacheFileName(keys[i], "resid"),
+                         numPoints))
+        {
+            std::copy(cachedQual.data(), cachedQual.data() + numQual,
+                      qualSum.begin());
+            resumeAfter = i;
+        }
+    }
+
+#ifndef NDEBUG
+    for (int i = 0; i <= resumeAfter; i++)
+    {
+        cout << "Stage " << i << " (" << stages[i].name << ") is cached."
+            << endl;
+    }
+#endif
+
+    std::vector<float> predictions(numQual);
+
+    for (size_t i = resumeAfter + 1; i < stages.size(); i++)
+    {
+        BaseAlgorithm &algorithm = *stages[i].algorithm;
+
+#ifndef NDEBUG
+        cout << "\nStarted training stage " << i << " (" << stages[i].name
+            << ")." << endl;
+#endif
+
+        if (residuals.empty())
+        {
+            algorithm.train(trainingSet);
+        }
+        else
+        {
+            algorithm.trainWithRatings(trainingSet, residuals.data());
+        }
+
+        // This stage's residuals are the next stage's target. Predict
+        // straight into the new column, then subtract in place.
+        std::vector<float> newResiduals(numPoints);
+        algorithm.predictAll(trainingSet, newResiduals.data(), false);
+
+        size_t j = 0;
+        trainingSet.forEach([&](const float *rating)
+                {
+                    float target = residuals.empty() ?
+                        rating[RATING_ROW] : residuals[j];
+                    newResiduals[j] = target - newResiduals[j];
+                    j++;
+                });
+
+        // Unbounded qual predictions, added onto the earlier stages'.
+        algorithm.predictBatch(qualIndex.colptr(USER_ROW),
+                               qualIndex.colptr(MOVIE_ROW),
+                               qualIndex.colptr(DATE_ROW),
+                               predictions.data(), numQual, false);
+
+        for (size_t j = 0; j < numQual; j++)
+        {
+            qualSum[j] += predictions[j];
+        }
+
+        saveCached(cacheFileName(keys[i], "resid"), newResiduals.data(),
+                   numPoints);
+        saveCached(cacheFileName(keys[i], "qual"), qualSum.data(), numQual);
+
+        residuals.assign(std::move(newResiduals));
+
+#ifndef NDEBUG
+        double squaredError = 0.0;
+        for (size_t j = 0; j < numPoints; j++)
+        {
+            squaredError += residuals[j] * residuals[j];
+        }
+        cout << "Finished stage " << i << " (" << stages[i].name << "); "
+            << "training RMSE of the chain so far: "
+            << sqrt(squaredError / numPoints) << endl;
+#endif
+    }
+
+    // Bound the combined predictions and write them out.
+    for (size_t j = 0; j < numQual; j++)
+    {
+        qualSum[j] = std::min(std::max(qualSum[j], (float) MIN_RATING),
+                              (float) MAX_RATING);
+    }
+
+    writePredictions(outputFileName, qualSum.data(), numQual, ratingSigFig);
+
+#ifndef NDEBUG
+    cout << "\nOutputted the chain's qual predictions to " << outputFileName
+        << "." << endl;
+#endif
+}
+
+
+Chain_Algo::~Chain_Algo()
+{
+    // No dynamically allocated resources to free at the moment.
+}
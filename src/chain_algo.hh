@@ -0,0 +1,96 @@
+/*
+ * This class chains any number of algorithms on the residuals of one
+ * another: stage 0 trains on the ratings, stage 1 on the residuals of stage
+ * 0, and so on. The final qual prediction is the (bounded) sum of every
+ * stage's qual predictions. It generalizes Two_Algo to N stages.
+ *
+ * Each stage's training residuals and cumulative qual predictions are
+ * cached as FloatColumns under a key that hashes the training set, the
+ * qual index and the descriptions of that stage and all stages before it.
+ * Re-running a chain therefore resumes after the longest prefix of stages
+ * whose results are already cached; changing one stage's description only
+ * recomputes that stage and its successors.
+ */
+
+#ifndef CHAIN_ALGO_HH
+#define CHAIN_ALGO_HH
+
+#include <armadillo>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <netflix.hh>
+#include <basealgorithm.hh>
+#include <floatcolumn.hh>
+#include <ratingstore.hh>
+
+using namespace arma;
+using namespace netflix; // challenge-related constants/functions.
+using std::cout;
+using std::endl;
+
+struct ChainStage
+{
+    // A short, human-readable name (used in log output).
+    std::string name;
+
+    // Everything that determines what this stage learns, e.g. its class
+    // and hyperparameters ("TimeSVDPP factors=60 iters=40 bins=30"). This
+    // is part of the cache key, so it must change whenever the stage's
+    // results would.
+    std::string description;
+
+    // The algorithm itself. Only trained if its results aren't cached.
+    BaseAlgorithm *algorithm;
+};
+
+class Chain_Algo
+{
+    private:
+        /* The rating store the training set is taken from. */
+        RatingStore store;
+
+        /*
+         * The training set, a view of the store. Models train on it (and
+         * predict it) without it ever being copied.
+         */
+        RatingView trainingSet;
+
+        /* Content hash of trainingSet. */
+        uint64_t trainingSetHash;
+
+        /* The stages, in the order they are chained. */
+        std::vector<ChainStage> stages;
+
+        /* Directory holding the per-stage caches. */
+        std::string cacheDir;
+
+        int ratingSigFig;
+
+        std::string cacheFileName(uint64_t key,
+                                  const std::string &kind) const;
+        std::vector<uint64_t> stageKeys(const Mat<int> &qualIndex) const;
+
+    public:
+        Chain_Algo(const std::set<int> &trainingSets,
+                   const std::string &cacheDir,
+                   const int ratingSigFig);
+
+        /* Append a stage to the end of the chain. */
+        void addStage(const std::string &name,
+                      const std::string &description,
+                      BaseAlgorithm &algorithm);
+
+        /*
+         * Train every stage that isn't cached, and write the chain's bounded
+         * qual predictions to outputFileName.
+         */
+        void run(const std::string &qualFileName,
+                 const std::string &outputFileName);
+
+        ~Chain_Algo();
+};
+
+#endif // CHAIN_ALGO_HH
@@ -0,0 +1,89 @@
+/** 
+ * kNN on the residuals of Time-SVD++, run through Chain_Algo. Stages whose
+ * results are already cached (in CACHE_DIR) are not retrained, so changing
+ * e.g. only the kNN parameters below just reruns kNN. Note that we're
+ * assuming that data is in the (user, movie) order. The main method to
+ * this script does not expect any arguments.
+ *
+ */
+
+#include <armadillo>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include <netflix.hh>
+#include <chain_algo.hh>
+#include <ratingstore.hh>
+#include <timesvdpp.hh>
+#include <knn.hh>
+
+using namespace std;
+using namespace arma;
+using namespace netflix; // challenge-related constants/functions.
+
+// The sets to train on (views of the rating store).
+const set<int> TRAIN_SETS = ALL_TRAIN_IDX;
+
+// The directory where each stage's residuals and qual predictions are
+// cached.
+const string CACHE_DIR = "data/chain_cached";
+
+// The number of factors to use for Time-SVD++.
+const int NUM_FACTORS = 60;
+
+// The number of iterations of Time-SVD++ to carry out.
+const int NUM_ITERATIONS = 40;
+
+// The number of time bins to use for movies in Time-SVD++.
+const int NUM_TIME_BINS = 30;
+
+// Whether we'll use userFacMatTime.
+const bool INCLUDE_USER_FAC_MAT_TIME = true;
+
+// Minimum common neighbors required for decent prediction.
+const int MIN_COMMON = 24;
+
+// Max weight elements to consider when predicting.
+const unsigned int MAX_WEIGHT = 400;
+
+// Pearson value file path. P is computed on the residuals it is trained
+// on, so it is not loaded from (or saved to) a file here.
+const string P_FN = "data/knn_cached/knn-p-chain.dta";
+
+// Sig-figs for output file.
+const int RATING_SIG_FIGS = 4;
+
+// The name of the output file to use (for predictions on "qual").
+const string OUTPUT_FN = "data/chain_predictions.dta";
+
+
+int main(void)
+{
+    RatingStore ratings(RATINGS_STORE);
+    Chain_Algo chain(TRAIN_SETS, CACHE_DIR, RATING_SIG_FIGS);
+
+    TimeSVDPP predAlgoTimeSVDPP(ratings.numUsers(), ratings.numItems(),
+                                ratings.numDates(),
+                                MEAN_RATING_TRAINING_SET, NUM_FACTORS,
+                                NUM_ITERATIONS, NUM_TIME_BINS,
+                                INCLUDE_USER_FAC_MAT_TIME,
+                                N_FN, HAT_DEV_U_T_FN, F_U_T_FN);
+    KNN predAlgoKNN(ratings.numUsers(), ratings.numItems(), MIN_COMMON,
+                    MAX_WEIGHT, false, false, P_FN);
+
+    // The descriptions are part of each stage's cache key, so they list
+    // every parameter that affects the stage's results.
+    ostringstream timeSVDPPDesc, knnDesc;
+    timeSVDPPDesc << "TimeSVDPP factors=" << NUM_FACTORS << " iterations="
+                  << NUM_ITERATIONS << " bins=" << NUM_TIME_BINS
+                  << " userFacMatTime=" << INCLUDE_USER_FAC_MAT_TIME;
+    knnDesc << "KNN minCommon=" << MIN_COMMON << " maxWeight="
+            << MAX_WEIGHT;
+
+    chain.addStage("Time-SVD++", timeSVDPPDesc.str(), predAlgoTimeSVDPP);
+    chain.addStage("kNN", knnDesc.str(), predAlgoKNN);
+
+    chain.run(QUAL_DATA_FN, OUTPUT_FN);
+}
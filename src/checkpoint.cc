@@ -0,0 +1,626 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include <checkpoint.hh>
+
+// Identifies a file written by CheckpointWriter.
+static const char CHECKPOINT_MAGIC[8] = {'N', 'F', 'X', 'C', 'K', 'P', 'T',
+                                         '\0'};
+
+// Bumped whenever the layout below changes incompatibly.
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+// Every payload starts on a multiple of this many bytes.
+static const uint64_t CHECKPOINT_ALIGNMENT = 64;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numSections;
+    uint64_t tableOffset;
+    uint32_t tableCRC;
+    uint32_t reserved;
+    char model[32];
+};
+
+static_assert(sizeof(CheckpointHeader) == 64,
+              "CheckpointHeader must be one cache line");
+
+
+/**
+ * Returns the size in bytes of one element of the given type.
+ */
+static size_t dtypeSize(uint32_t dtype)
+{
+    switch ((CheckpointDType) dtype)
+    {
+        case CheckpointDType::F32:
+            return sizeof(float);
+        case CheckpointDType::I32:
+            return sizeof(int32_t);
+        case CheckpointDType::U64:
+            return sizeof(uint64_t);
+        case CheckpointDType::U8:
+            return sizeof(uint8_t);
+    }
+
+    throw std::runtime_error("Unknown checkpoint element type!");
+}
+
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT
+           * CHECKPOINT_ALIGNMENT;
+}
+
+
+/**
+ * Computes the CRC-32C (Castagnoli) checksum of n bytes. This uses the
+ * SSE4.2 crc32 instruction when we're compiled for it (we normally are,
+ * since we build with -march=core-avx2), and a lookup table otherwise.
+ */
+static uint32_t crc32c(const void *data, size_t n)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint32_t crc = 0xFFFFFFFF;
+    size_t i = 0;
+
+#ifdef __SSE4_2__
+    uint64_t crc64 = crc;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+
+    for (; i < n; i++)
+    {
+        crc = _mm_crc32_u8(crc, bytes[i]);
+    }
+#else
+    // The table for the reflected Castagnoli polynomial, built on first use.
+    static const struct Table
+    {
+        uint32_t entries[256];
+
+        Table()
+        {
+            for (uint32_t b = 0; b < 256; b++)
+            {
+                uint32_t entry = b;
+                for (int k = 0; k < 8; k++)
+                {
+                    entry = (entry >> 1) ^ (0x82F63B78 & (0 - (entry & 1)));
+                }
+                entries[b] = entry;
+            }
+        }
+    } table;
+
+    for (; i < n; i++)
+    {
+        crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+#endif
+
+    return ~crc;
+}
+
+
+/**
+ * Creates an empty checkpoint for a model.
+ *
+ * @param model: A short name for the kind of model being saved (e.g.
+ *               "SVD++"). Loading checks this, so a checkpoint can't be
+ *               mistaken for another model's.
+ *
+ */
+CheckpointWriter::CheckpointWriter(const std::string &model) :
+    model(model)
+{
+    if (model.size() >= sizeof(CheckpointHeader().model))
+    {
+        throw std::invalid_argument("Checkpoint model name " + model +
+                                    " is too long!");
+    }
+}
+
+
+/**
+ * Adds a section. Its data isn't copied; it is read by write().
+ *
+ * @param name:     The section's name, unique within the checkpoint.
+ * @param dtype:    The type of each element.
+ * @param data:     The elements, in column-major order.
+ * @param rank:     The number of dimensions (1 to 3).
+ * @param dim0:     The size of the first dimension (e.g. number of rows).
+ * @param dim1:     The size of the second dimension, if any.
+ * @param dim2:     The size of the third dimension, if any.
+ *
+ */
+void CheckpointWriter::add(const std::string &name, CheckpointDType dtype,
+                           const void *data, uint32_t rank, uint64_t dim0,
+                           uint64_t dim1, uint64_t dim2)
+{
+    if (name.empty() || name.size() >= sizeof(CheckpointSection().name))
+    {
+        throw std::invalid_argument("Invalid checkpoint section name \"" +
+                                    name + "\"!");
+    }
+
+    if (rank < 1 || rank > 3)
+    {
+        throw std::invalid_argument("Checkpoint section " + name +
+                                    " must have 1 to 3 dimensions!");
+    }
+
+    for (const PendingSection &section : sections)
+    {
+        if (section.name == name)
+        {
+            throw std::invalid_argument("Duplicate checkpoint section " +
+                                        name);
+        }
+    }
+
+    PendingSection section;
+    section.name = name;
+    section.dtype = dtype;
+    section.rank = rank;
+    section.dims[0] = dim0;
+    section.dims[1] = rank > 1 ? dim1 : 1;
+    section.dims[2] = rank > 2 ? dim2 : 1;
+    section.data = data;
+    sections.push_back(section);
+}
+
+
+void CheckpointWriter::add(const std::string &name, const fmat &matrix)
+{
+    add(name, CheckpointDType::F32, matrix.memptr(), 2, matrix.n_rows,
+        matrix.n_cols);
+}
+
+
+void CheckpointWriter::add(const std::string &name, const fcube &cube)
+{
+    add(name, CheckpointDType::F32, cube.memptr(), 3, cube.n_rows,
+        cube.n_cols, cube.n_slices);
+}
+
+
+/**
+ * Copies the elements of every section that the writer doesn't own yet.
+ * After this, the writer doesn't depend on the caller's memory at all, so
+ * the caller can go on modifying it while the checkpoint is written.
+ */
+void CheckpointWriter::copySections()
+{
+    for (PendingSection &section : sections)
+    {
+        if (section.owner)
+        {
+            continue;
+        }
+
+        size_t size = section.dims[0] * section.dims[1] * section.dims[2]
+                      * dtypeSize((uint32_t) section.dtype);
+        const char *first = static_cast<const char *>(section.data);
+
+        std::shared_ptr<std::vector<char> > copy =
+            std::make_shared<std::vector<char> >(first, first + size);
+        section.data = copy->data();
+        section.owner = copy;
+    }
+}
+
+
+/**
+ * Writes the checkpoint. It is written under a temporary name and renamed
+ * into place, so an interrupted save never leaves a truncated checkpoint
+ * (or clobbers the previous one).
+ *
+ * @param fileName: Where to save the checkpoint.
+ *
+ */
+void CheckpointWriter::write(const std::string &fileName) const
+{
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.numSections = sections.size();
+    header.tableOffset = sizeof(CheckpointHeader);
+    strncpy(header.model, model.c_str(), sizeof(header.model) - 1);
+
+    // Lay out the payloads after the table and checksum them.
+    std::vector<CheckpointSection> table(sections.size());
+    uint64_t offset = header.tableOffset
+                      + sections.size() * sizeof(CheckpointSection);
+
+    for (size_t i = 0; i < sections.size(); i++)
+    {
+        const PendingSection &pending = sections[i];
+        CheckpointSection &entry = table[i];
+
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.name, pending.name.c_str(), sizeof(entry.name) - 1);
+        entry.dtype = (uint32_t) pending.dtype;
+        entry.rank = pending.rank;
+        memcpy(entry.dims, pending.dims, sizeof(entry.dims));
+        entry.size = pending.dims[0] * pending.dims[1] * pending.dims[2]
+                     * dtypeSize(entry.dtype);
+        entry.offset = alignUp(offset);
+        entry.crc = crc32c(pending.data, entry.size);
+
+        offset = entry.offset + entry.size;
+    }
+
+    header.tableCRC = crc32c(table.data(),
+                             table.size() * sizeof(CheckpointSection));
+
+    const std::string tempFileName = fileName + ".tmp";
+    FILE *file = fopen(tempFileName.c_str(), "wb");
+
+    if (file == NULL)
+    {
+        throw std::runtime_error("Couldn't open output file at " +
+                                 tempFileName);
+    }
+
+    static const char padding[CHECKPOINT_ALIGNMENT] = {0};
+    bool failed = fwrite(&header, sizeof(header), 1, file) != 1
+                  || fwrite(table.data(), sizeof(CheckpointSection),
+                            table.size(), file) != table.size();
+    offset = header.tableOffset + table.size() * sizeof(CheckpointSection);
+
+    for (size_t i = 0; i < table.size() && !failed; i++)
+    {
+        size_t paddingSize = table[i].offset - offset;
+        failed = fwrite(padding, 1, paddingSize, file) != paddingSize
+                 || fwrite(sections[i].data, 1, table[i].size, file)
+                    != table[i].size;
+        offset = table[i].offset + table[i].size;
+    }
+
+    if (fclose(file) != 0 || failed)
+    {
+        std::remove(tempFileName.c_str());
+        throw std::runtime_error("Couldn't write checkpoint to " +
+                                 tempFileName);
+    }
+
+    if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0)
+    {
+        throw std::runtime_error("Couldn't move " + tempFileName + " to "
+                                 + fileName);
+    }
+}
+
+
+BackgroundCheckpointWriter::BackgroundCheckpointWriter()
+{
+}
+
+
+BackgroundCheckpointWriter::~BackgroundCheckpointWriter()
+{
+    // A failure can't be reported from here; whoever cares about it should
+    // have called wait().
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+}
+
+
+/**
+ * Starts writing a checkpoint on a background thread. The sections are
+ * copied first (on the calling thread), which is the only part of the save
+ * that the caller has to wait for.
+ *
+ * @param writer:   The checkpoint to write. Its sections may refer to the
+ *                  caller's memory; they're copied before this returns.
+ * @param fileName: Where to save the checkpoint.
+ *
+ */
+void BackgroundCheckpointWriter::write(CheckpointWriter &&writer,
+                                       const std::string &fileName)
+{
+    wait();
+    writer.copySections();
+
+    std::shared_ptr<CheckpointWriter> pending =
+        std::make_shared<CheckpointWriter>(std::move(writer));
+
+    worker = std::thread([this, pending, fileName]()
+            {
+                try
+                {
+                    pending->write(fileName);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+            });
+}
+
+
+void BackgroundCheckpointWriter::wait()
+{
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+
+    if (error)
+    {
+        std::exception_ptr failure = error;
+        error = nullptr;
+        std::rethrow_exception(failure);
+    }
+}
+
+
+Checkpoint::Checkpoint()
+{
+}
+
+
+Checkpoint::~Checkpoint()
+{
+    close();
+}
+
+
+void Checkpoint::close()
+{
+    if (mapping != NULL)
+    {
+        munmap(mapping, mappingLength);
+        mapping = NULL;
+        mappingLength = 0;
+        table = NULL;
+        numSections = 0;
+    }
+}
+
+
+/**
+ * Maps a checkpoint file and validates it. The mapping is private and
+ * writable, so matrices backed by it can be modified (e.g. by further
+ * training) without changing the file.
+ *
+ * @param fileName: The checkpoint to open.
+ * @param model:    The model name it must have been written with.
+ * @param verify:   Whether to check every section's CRC. This reads the
+ *                  whole file once.
+ *
+ */
+void Checkpoint::open(const std::string &fileName, const std::string &model,
+                      bool verify)
+{
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        throw std::runtime_error("Couldn't open checkpoint at " + fileName);
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0
+        || (size_t) fileStat.st_size < sizeof(CheckpointHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("The checkpoint at " + fileName +
+                                 " is truncated!");
+    }
+
+    size_t length = fileStat.st_size;
+    void *newMapping = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (newMapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Couldn't map checkpoint at " + fileName);
+    }
+
+    const char *base = static_cast<const char *>(newMapping);
+    const CheckpointHeader *header =
+        reinterpret_cast<const CheckpointHeader *>(base);
+    const CheckpointSection *newTable =
+        reinterpret_cast<const CheckpointSection *>(base +
+                                                    header->tableOffset);
+    std::string error;
+
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+    {
+        error = "is not a checkpoint";
+    }
+    else if (header->version != CHECKPOINT_VERSION)
+    {
+        error = "has unsupported version " + std::to_string(header->version);
+    }
+    else if (strncmp(header->model, model.c_str(), sizeof(header->model))
+             != 0)
+    {
+        error = "holds a " +
+                std::string(header->model,
+                            strnlen(header->model, sizeof(header->model))) +
+                " model, not " + model;
+    }
+    else if (header->tableOffset > length
+             || header->numSections > (length - header->tableOffset)
+                                      / sizeof(CheckpointSection))
+    {
+        error = "is truncated";
+    }
+    else if (crc32c(newTable, header->numSections * sizeof(CheckpointSection))
+             != header->tableCRC)
+    {
+        error = "has a corrupt section table";
+    }
+
+    for (uint32_t i = 0; i < header->numSections && error.empty(); i++)
+    {
+        const CheckpointSection &section = newTable[i];
+        std::string name(section.name, strnlen(section.name,
+                                               sizeof(section.name)));
+
+        if (section.offset > length || section.size > length - section.offset)
+        {
+            error = "is truncated (section " + name + ")";
+        }
+        else if (verify && crc32c(base + section.offset, section.size)
+                           != section.crc)
+        {
+            error = "is corrupt (section " + name + " fails its checksum)";
+        }
+    }
+
+    if (!error.empty())
+    {
+        munmap(newMapping, length);
+        throw std::runtime_error("The file at " + fileName + " " + error +
+                                 "!");
+    }
+
+    close();
+    mapping = newMapping;
+    mappingLength = length;
+    this->fileName = fileName;
+    modelName = model;
+    table = newTable;
+    numSections = header->numSections;
+}
+
+
+const CheckpointSection &Checkpoint::section(const std::string &name) const
+{
+    for (uint32_t i = 0; i < numSections; i++)
+    {
+        if (strncmp(table[i].name, name.c_str(), sizeof(table[i].name)) == 0)
+        {
+            return table[i];
+        }
+    }
+
+    throw std::runtime_error("The checkpoint at " + fileName +
+                             " has no section " + name + "!");
+}
+
+
+bool Checkpoint::hasSection(const std::string &name) const
+{
+    for (uint32_t i = 0; i < numSections; i++)
+    {
+        if (strncmp(table[i].name, name.c_str(), sizeof(table[i].name)) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void *Checkpoint::payload(const CheckpointSection &section) const
+{
+    return static_cast<char *>(mapping) + section.offset;
+}
+
+
+/**
+ * Returns a section's elements after checking their type and count.
+ *
+ * @param name:     The section to look up.
+ * @param dtype:    The type its elements must have.
+ * @param numElems: The number of elements it must have.
+ *
+ */
+void *Checkpoint::data(const std::string &name, CheckpointDType dtype,
+                       size_t numElems) const
+{
+    const CheckpointSection &found = section(name);
+
+    if (found.dtype != (uint32_t) dtype)
+    {
+        throw std::runtime_error("Section " + name + " of the checkpoint at "
+                                 + fileName + " has the wrong element type!");
+    }
+
+    if (found.size != numElems * dtypeSize(found.dtype))
+    {
+        throw std::invalid_argument("Section " + name + " of the checkpoint "
+                                    "at " + fileName + " has " +
+                                    std::to_string(found.size /
+                                                   dtypeSize(found.dtype)) +
+                                    " elements, expected " +
+                                    std::to_string(numElems) + "!");
+    }
+
+    return payload(found);
+}
+
+
+/**
+ * Returns the elements of a float section after checking that it is
+ * numRows x numCols x numSlices.
+ */
+float *Checkpoint::floats(const std::string &name, size_t numRows,
+                          size_t numCols, size_t numSlices) const
+{
+    float *elems = static_cast<float *>(data(name, CheckpointDType::F32,
+                                             numRows * numCols * numSlices));
+    const CheckpointSection &found = section(name);
+
+    if (found.dims[0] != numRows || found.dims[1] != numCols
+        || found.dims[2] != numSlices)
+    {
+        throw std::invalid_argument("Section " + name + " of the checkpoint "
+                                    "at " + fileName + " has the wrong "
+                                    "shape!");
+    }
+
+    return elems;
+}
+
+
+fmat Checkpoint::matrix(const std::string &name, size_t numRows,
+                        size_t numCols) const
+{
+    // Don't copy the elements, and let Armadillo take its own copy if the
+    // matrix is ever resized.
+    return fmat(floats(name, numRows, numCols, 1), numRows, numCols, false,
+                false);
+}
+
+
+fcolvec Checkpoint::column(const std::string &name, size_t numElems) const
+{
+    return fcolvec(floats(name, numElems, 1, 1), numElems, false, false);
+}
+
+
+fcube Checkpoint::cube(const std::string &name, size_t numRows,
+                       size_t numCols, size_t numSlices) const
+{
+    return fcube(floats(name, numRows, numCols, numSlices), numRows, numCols,
+                 numSlices, false, false);
+}
@@ -0,0 +1,223 @@
+/*
+ * A single-file container for everything a trained model needs in order to
+ * predict. A checkpoint holds a set of named tensor sections (up to three
+ * dimensions, float32/int32/uint64/uint8 elements), each with its own
+ * CRC-32C checksum. It replaces the one-Armadillo-file-per-matrix caches the
+ * models used to write.
+ *
+ * On-disk layout (all integers little-endian, native float32):
+ *
+ *      [64-byte header]        magic, format version, model name, section
+ *                              count and the offset of the section table
+ *      [section table]         one 128-byte entry per section: name, dtype,
+ *                              rank, dims, payload offset, size and CRC
+ *      [payloads]              the raw elements of each section, each one
+ *                              starting on a 64-byte boundary
+ *
+ * Checkpoint maps a file privately (copy-on-write), so the matrices it hands
+ * out point straight into the page cache: a cached model is ready to predict
+ * as soon as it is opened, and continuing to train it never touches the
+ * file.
+ *
+ */
+
+#ifndef CHECKPOINT_HH
+#define CHECKPOINT_HH
+
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace arma;
+
+// The element type of a section.
+enum class CheckpointDType : uint32_t
+{
+    F32 = 1,
+    I32 = 2,
+    U64 = 3,
+    U8 = 4
+};
+
+// A section table entry, exactly as it is stored on disk.
+struct CheckpointSection
+{
+    char name[64];
+    uint32_t dtype;
+    uint32_t rank;
+    uint64_t dims[3];
+    uint64_t offset;
+    uint64_t size;
+    uint32_t crc;
+    char reserved[12];
+};
+
+static_assert(sizeof(CheckpointSection) == 128,
+              "CheckpointSection must be two cache lines");
+
+
+/*
+ * Collects sections and writes them out as one checkpoint. Sections added
+ * with add() refer to the caller's memory, which must stay valid (and
+ * unchanged) until write() returns, unless copySections() is called first.
+ */
+class CheckpointWriter
+{
+private:
+    struct PendingSection
+    {
+        std::string name;
+        CheckpointDType dtype;
+        uint32_t rank;
+        uint64_t dims[3];
+        const void *data;
+
+        // Keeps data alive if the writer owns it.
+        std::shared_ptr<void> owner;
+    };
+
+    std::string model;
+    std::vector<PendingSection> sections;
+
+    static CheckpointDType dtypeOf(const float *)
+    {
+        return CheckpointDType::F32;
+    }
+    static CheckpointDType dtypeOf(const int32_t *)
+    {
+        return CheckpointDType::I32;
+    }
+    static CheckpointDType dtypeOf(const uint64_t *)
+    {
+        return CheckpointDType::U64;
+    }
+    static CheckpointDType dtypeOf(const uint8_t *)
+    {
+        return CheckpointDType::U8;
+    }
+
+public:
+    CheckpointWriter(const std::string &model);
+
+    /* Add a section of rank 1-3 holding dims[0] x ... x dims[rank - 1]
+     * column-major elements of the given type. */
+    void add(const std::string &name, CheckpointDType dtype,
+             const void *data, uint32_t rank, uint64_t dim0,
+             uint64_t dim1 = 1, uint64_t dim2 = 1);
+
+    void add(const std::string &name, const fmat &matrix);
+    void add(const std::string &name, const fcube &cube);
+
+    /* Add a section whose elements are moved into the writer (e.g. ones
+     * that were flattened just to be saved). */
+    template <typename T>
+    void add(const std::string &name, std::vector<T> &&elems,
+             uint32_t rank, uint64_t dim0, uint64_t dim1 = 1,
+             uint64_t dim2 = 1)
+    {
+        std::shared_ptr<std::vector<T> > owned =
+            std::make_shared<std::vector<T> >(std::move(elems));
+        add(name, dtypeOf(owned->data()), owned->data(), rank, dim0, dim1,
+            dim2);
+        sections.back().owner = owned;
+    }
+
+    /* Take a private copy of every section that refers to the caller's
+     * memory, so the caller is free to change it. */
+    void copySections();
+
+    /* Write every section to fileName, replacing it atomically. */
+    void write(const std::string &fileName) const;
+};
+
+
+/*
+ * Writes checkpoints on a background thread, so that training can carry on
+ * while a snapshot is checksummed and written out. At most one write is in
+ * flight; starting another one waits for the previous one first.
+ */
+class BackgroundCheckpointWriter
+{
+private:
+    std::thread worker;
+    std::exception_ptr error;
+
+public:
+    BackgroundCheckpointWriter();
+    BackgroundCheckpointWriter(const BackgroundCheckpointWriter &) = delete;
+    BackgroundCheckpointWriter &operator=(const BackgroundCheckpointWriter &)
+        = delete;
+    ~BackgroundCheckpointWriter();
+
+    /* Copy writer's sections, then write them to fileName in the
+     * background. */
+    void write(CheckpointWriter &&writer, const std::string &fileName);
+
+    /* Wait for the write in flight (if any) to finish, and rethrow the
+     * error it failed with (if any). */
+    void wait();
+};
+
+
+/*
+ * A checkpoint file opened for reading.
+ */
+class Checkpoint
+{
+private:
+    void *mapping = NULL;
+    size_t mappingLength = 0;
+
+    std::string fileName;
+    std::string modelName;
+    const CheckpointSection *table = NULL;
+    uint32_t numSections = 0;
+
+    void *payload(const CheckpointSection &section) const;
+    float *floats(const std::string &name, size_t numRows, size_t numCols,
+                  size_t numSlices) const;
+
+public:
+    Checkpoint();
+    Checkpoint(const Checkpoint &) = delete;
+    Checkpoint &operator=(const Checkpoint &) = delete;
+    ~Checkpoint();
+
+    /* Map fileName, checking that it was written for the given model and
+     * (if verify is set) that every section matches its checksum. */
+    void open(const std::string &fileName, const std::string &model,
+              bool verify = true);
+
+    /* Unmap the file. Matrices handed out earlier must not be used after
+     * this. */
+    void close();
+
+    bool isOpen() const { return mapping != NULL; }
+
+    /* Look up a section by name (throws if there isn't one). */
+    const CheckpointSection &section(const std::string &name) const;
+
+    /* Whether there's a section with the given name. */
+    bool hasSection(const std::string &name) const;
+
+    /* The elements of a section, which must have the given type and number
+     * of elements. */
+    void *data(const std::string &name, CheckpointDType dtype,
+               size_t numElems) const;
+
+    /* Matrices and cubes backed directly by the mapped file. Their shapes
+     * must match the stored ones. */
+    fmat matrix(const std::string &name, size_t numRows,
+                size_t numCols) const;
+    fcolvec column(const std::string &name, size_t numElems) const;
+    fcube cube(const std::string &name, size_t numRows, size_t numCols,
+               size_t numSlices) const;
+};
+
+#endif // CHECKPOINT_HH
@@ -16,6 +16,7 @@
 #include <vector>
 
 #include <netflix.hh>
+#include <ratingstore.hh>
 #include <two_algo.hh>
 #include <globals.hh>
 #include <timesvdpp.hh>
@@ -24,14 +25,9 @@ using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
-// The Armadillo binary file to use for training.
-// Make sure that both UM and MU data are using the same
-// "type" of training resource (eg. probe, hidden, base, etc.)
-const string TRAIN_UM = VALID_BIN;
-
-// MU train matrix for global effect. Note that
-// the index type should match that of TRAIN_UM.
-const string TRAIN_MU = "data/valid-mu.mat";
+// The sets to train on (views of the rating store). Global effect reads the
+// same sets in MU order.
+const set<int> TRAIN_SETS = VALID_IDX;
 
 // The "level" of global effect we want to train on.
 // (See globals_README in "data" dir for more detail)
@@ -50,37 +46,48 @@ const int NUM_ITERATIONS = 5;
 // BellKor used 30 so we will too for now.
 const int NUM_TIME_BINS = 30;
 
-// Original output qual file for the TimeSVD++.
-const string TIMESVD_QUAL = "data/good_predictions/TIMESVDPP_QUAL_6.963.dta";
+// Whether we'll use userFacMatTime.
+const bool INCLUDE_USER_FAC_MAT_TIME = true;
+
+// A temporary file where the global effect's qual predictions are saved,
+// as an Armadillo binary fcolvec, and whether to delete it afterwards.
+const string INTERMED_PRED_FILE = "data/combine_test_intermed_pred_temp.mat";
+const bool DELETE_INTERMED_PRED_FILE = true;
+
+// The file where we'll store the residuals of global effect on the
+// training set, as a FloatColumn cache.
+const string RESIDUALS_FILE = "data/residualStore.f32";
 
 // Final output file for this combo algorithm.
 const string OUTPUT_FILENAME = "data/combine_test.dta";
 
 int main(void)
 {
-    Two_Algo combine(TRAIN_UM, RATING_SIG_FIGS);
-    cout << "Loaded training data from " << TRAIN_UM << "." << endl;
+    RatingStore ratings(RATINGS_STORE);
+    Two_Algo combine(TRAIN_SETS, INTERMED_PRED_FILE, RATING_SIG_FIGS,
+                     DELETE_INTERMED_PRED_FILE);
 
-    Globals predAlgoGE(NUM_USERS, NUM_MOVIES, level, TRAIN_MU);
+    {
+        Globals predAlgoGE(ratings.numUsers(), ratings.numItems(), level,
+                           TRAIN_SETS);
 
-    combine.trainFirst(predAlgoGE);
-
-    combine.firstResiduals(predAlgoGE);
+        combine.trainFirst(predAlgoGE);
+        combine.saveFirstQualPredictions(predAlgoGE, QUAL_DATA_FN);
+        combine.computeAndSaveFirstResiduals(predAlgoGE, RESIDUALS_FILE);
+    }
 
     float newAverage = combine.getAverage();
 
     cout << "New average is: " << newAverage << endl;
 
-    combine.saveResiduals("data/residualStore.dta");
-
-    TimeSVDPP predAlgoTimeSVD(NUM_USERS, NUM_MOVIES, NUM_DATES,
-                              newAverage, NUM_FACTORS,
+    TimeSVDPP predAlgoTimeSVD(ratings.numUsers(), ratings.numItems(),
+                              ratings.numDates(), newAverage, NUM_FACTORS,
                               NUM_ITERATIONS, NUM_TIME_BINS,
-                              N_FN, HAT_DEV_U_T_FN);
+                              INCLUDE_USER_FAC_MAT_TIME,
+                              N_FN, HAT_DEV_U_T_FN, F_U_T_FN);
 
     combine.trainSecond(predAlgoTimeSVD);
-    combine.outputQual(predAlgoTimeSVD,
-        QUAL_DATA_FN, TIMESVD_QUAL, OUTPUT_FILENAME);
+    combine.saveSecondQualPredictions(predAlgoTimeSVD, QUAL_DATA_FN,
+                                      OUTPUT_FILENAME);
     cout << "Output is in " << OUTPUT_FILENAME << " ." << endl;
 }
-
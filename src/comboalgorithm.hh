@@ -13,8 +13,8 @@ class ComboAlgorithm
         virtual void trainFirst(BaseAlgorithm &predAlgo) = 0;
 
         /* Compute the residuals of the first model on training set, and
-         * then save them (in Armadillo matrix format) to the specified
-         * file. If the file name is NULL, then saving isn't carried out.
+         * then save them (as a FloatColumn cache) to the specified file.
+         * If the file name is empty, then saving isn't carried out.
          */
         virtual void computeAndSaveFirstResiduals(
                 BaseAlgorithm &firstAlgo,
@@ -0,0 +1,63 @@
+/*
+ * The view of a trained latent factor model that ranking needs. Any model
+ * whose prediction for user u and item i has the form
+ *
+ *      rHat_{ui} = userBias_u + itemBias_i + q_i^T * x_u
+ *
+ * (where x_u is the user's effective factor vector, which may fold in
+ * implicit feedback) can hand out its item factors and build x_u, so that
+ * every item can be scored for a user with one matrix-vector product
+ * instead of one predict() call per item. SVD and SVDPP implement this.
+ *
+ */
+
+#ifndef FACTORMODEL_HH
+#define FACTORMODEL_HH
+
+#include <armadillo>
+
+#include <idmap.hh>
+
+using namespace arma;
+
+class FactorModel
+{
+public:
+    /**
+     * Whether the item factors and user queries below reflect a trained
+     * (and, where needed, frozen) model.
+     */
+    virtual bool readyForQueries() const = 0;
+
+    /**
+     * The item factors q_i, as a numFactors x numItems matrix. Column c
+     * belongs to item itemIds().external(c).
+     */
+    virtual const fmat &itemFactors() const = 0;
+
+    /**
+     * The per-item bias terms, one per column of itemFactors().
+     */
+    virtual const fcolvec &itemBiases() const = 0;
+
+    /**
+     * How items map to columns of itemFactors(), for models that renumber
+     * their items (see idmap.hh). By default, column i is item i.
+     */
+    virtual const IdMap &itemIds() const
+    {
+        static const IdMap identity;
+        return identity;
+    }
+
+    /**
+     * Writes the user's effective factor vector x_u (numFactors floats) to
+     * factors, and returns the user's bias term. This must be safe to call
+     * from several threads.
+     */
+    virtual float userQuery(int user, float *factors) const = 0;
+
+    virtual ~FactorModel() {}
+};
+
+#endif // FACTORMODEL_HH
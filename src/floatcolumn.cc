@@ -0,0 +1,163 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <floatcolumn.hh>
+
+// Identifies a cache file written by FloatColumn::save().
+static const char FLOAT_COLUMN_MAGIC[8] = {'F', 'L', 'T', 'C', 'O', 'L',
+                                           '0', '1'};
+
+// The on-disk header. It is padded to a cache line so that the values that
+// follow it are aligned when mapped.
+struct FloatColumnHeader
+{
+    char magic[8];
+    uint64_t count;
+    char padding[48];
+};
+
+static_assert(sizeof(FloatColumnHeader) == 64,
+              "FloatColumnHeader must be one cache line");
+
+
+FloatColumn::FloatColumn()
+{
+}
+
+
+FloatColumn::~FloatColumn()
+{
+    unmap();
+}
+
+
+void FloatColumn::unmap()
+{
+    if (mapping != NULL)
+    {
+        munmap(mapping, mappingLength);
+        mapping = NULL;
+        mappingLength = 0;
+    }
+}
+
+
+/**
+ * Replaces the contents of this column with newValues, which are moved in
+ * (no copy is made).
+ *
+ */
+void FloatColumn::assign(std::vector<float> &&newValues)
+{
+    unmap();
+    values = std::move(newValues);
+    first = values.data();
+    length = values.size();
+}
+
+
+/**
+ * Maps a file written by save() read-only and exposes its values. Pages
+ * are only read from disk when they are touched, and are shared with the
+ * page cache rather than copied.
+ *
+ * @param fileName: The cache file to map.
+ *
+ */
+void FloatColumn::map(const std::string &fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        throw std::runtime_error("Couldn't open float column at " + fileName);
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0
+        || (size_t) fileStat.st_size < sizeof(FloatColumnHeader))
+    {
+        close(fd);
+        throw std::runtime_error("The float column at " + fileName +
+                                 " is truncated!");
+    }
+
+    void *newMapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED,
+                            fd, 0);
+    close(fd);
+
+    if (newMapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Couldn't map float column at " + fileName);
+    }
+
+    const FloatColumnHeader *header =
+        static_cast<const FloatColumnHeader *>(newMapping);
+    size_t expected = sizeof(FloatColumnHeader) + header->count * sizeof(float);
+
+    if (memcmp(header->magic, FLOAT_COLUMN_MAGIC, sizeof(header->magic)) != 0
+        || (size_t) fileStat.st_size != expected)
+    {
+        munmap(newMapping, fileStat.st_size);
+        throw std::runtime_error("The file at " + fileName + " is not a "
+                                 "valid float column!");
+    }
+
+    // Values are read front to back by everything that uses a column.
+    madvise(newMapping, fileStat.st_size, MADV_SEQUENTIAL);
+
+    clear();
+    mapping = newMapping;
+    mappingLength = fileStat.st_size;
+    first = reinterpret_cast<const float *>(header + 1);
+    length = header->count;
+}
+
+
+void FloatColumn::clear()
+{
+    unmap();
+    std::vector<float>().swap(values);
+    first = NULL;
+    length = 0;
+}
+
+
+/**
+ * Writes n floats to fileName in the format expected by map().
+ *
+ * @param fileName: The file to (over)write.
+ * @param data:     The values to save.
+ * @param n:        The number of values.
+ *
+ */
+void FloatColumn::save(const std::string &fileName, const float *data,
+                       size_t n)
+{
+    FILE *file = fopen(fileName.c_str(), "wb");
+
+    if (file == NULL)
+    {
+        throw std::runtime_error("Couldn't open output file at " + fileName);
+    }
+
+    FloatColumnHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLOAT_COLUMN_MAGIC, sizeof(header.magic));
+    header.count = n;
+
+    bool failed = fwrite(&header, sizeof(header), 1, file) != 1
+                  || fwrite(data, sizeof(float), n, file) != n;
+
+    if (fclose(file) != 0 || failed)
+    {
+        throw std::runtime_error("Couldn't write float column to " + fileName);
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * A single column of floats (e.g. one value per training point) that is
+ * either owned in memory or memory-mapped read-only from a compact cache
+ * file. Two_Algo uses this to hold the first model's residuals next to the
+ * immutable training set, instead of keeping a second 4 x N matrix.
+ *
+ * The cache format is a 64-byte header (magic string and element count)
+ * followed by the raw float32 values, so the payload of a mapped file is
+ * cache line aligned.
+ *
+ */
+
+#ifndef FLOATCOLUMN_HH
+#define FLOATCOLUMN_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class FloatColumn
+{
+private:
+    // Values owned by this column (unused while a file is mapped).
+    std::vector<float> values;
+
+    // The mapped cache file, if any: the whole mapping and its length.
+    void *mapping = NULL;
+    size_t mappingLength = 0;
+
+    // Start and length of the column's values.
+    const float *first = NULL;
+    size_t length = 0;
+
+    void unmap();
+
+public:
+    FloatColumn();
+    FloatColumn(const FloatColumn &) = delete;
+    FloatColumn &operator=(const FloatColumn &) = delete;
+    ~FloatColumn();
+
+    /* Take ownership of in-memory values (e.g. freshly computed ones). */
+    void assign(std::vector<float> &&newValues);
+
+    /* Map a cache file written by save(). */
+    void map(const std::string &fileName);
+
+    /* Drop the values (and any mapping). */
+    void clear();
+
+    /* Write n values to a cache file that map() can read. */
+    static void save(const std::string &fileName, const float *data,
+                     size_t n);
+
+    const float *data() const { return first; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    float operator[](size_t i) const { return first[i]; }
+};
+
+#endif // FLOATCOLUMN_HH
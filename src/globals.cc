@@ -1,19 +1,23 @@
 #include <globals.hh>
+#include <ratingstore.hh>
 
 // Initialize.
 Globals::Globals (int numUsers, int numItems,
-                  int levels, const std::string &trainFileName) :
+                  int levels, const std::set<int> &trainSets) :
                   numUsers(numUsers), numItems(numItems),
                   level(levels), numUsersTrainingSet(numItems),
                   numItemsTrainingSet(numUsers)
 {
-    dataMU.load(trainFileName, arma_binary);
+    // The same ratings as train() gets, in MU order.
+    dataMU = loadRatings(trainSets, MU_RATINGS_STORE);
     level = levels; // Default level.
     // Initialize and fill first date vectors with high numbers.
     userFirstDates.resize(numUsers);
     movieFirstDates.resize(numItems);
     userLastDates.resize(numUsers);
     movieLastDates.resize(numItems);
+    userAverageDates.resize(numUsers);
+    movieAverageDates.resize(numItems);
     std::fill(userFirstDates.begin(), userFirstDates.end(), 999999);
     std::fill(movieFirstDates.begin(), movieFirstDates.end(), 999999);
     std::fill(userLastDates.begin(), userLastDates.end(), 0);
@@ -39,7 +43,7 @@ bool Globals::setAverages(const fmat &dataUM)
     userMovieSupportAverages.clear();
     float globalsum = 0;
     float sqrtmoviesum = 0;
-    int curr = 0;
+    size_t curr = 0;
     for(int i = 0; i < numItems; i++)
     {
         int count = numUsersTrainingSet[i];
@@ -238,12 +242,12 @@ void Globals::populateNumItemsTrainingSet(const fmat &data)
     cout << "Populated numItemsTrainingSet." << endl;
 #endif
     
-    for (unsigned int i = 0; i < data.n_cols; i++)
+    for (uword i = 0; i < data.n_cols; i++)
     {
         // Based on the user that this rating was by, increment the
         // appropriate element of numItemsTrainingSet.
         int user = roundToInt(data(USER_ROW, i));
-        numItemsTrainingSet(user)++;
+        numItemsTrainingSet[user]++;
     }
 }
 
@@ -258,12 +262,12 @@ void Globals::populateNumUsersTrainingSet(const fmat &data)
     cout << "Populated numUsersTrainingSet." << endl;
 #endif
     
-    for (unsigned int i = 0; i < data.n_cols; i++)
+    for (uword i = 0; i < data.n_cols; i++)
     {
         // Based on the movie that this rating was by, increment the
         // appropriate element of numUsersTrainingSet.
         int movie = roundToInt(data(MOVIE_ROW, i));
-        numUsersTrainingSet(movie)++;
+        numUsersTrainingSet[movie]++;
     }
 }
 
@@ -272,14 +276,14 @@ void Globals::initInternalData()
     // This is the count of the number of items rated by users
     // and number of users for each item in the given training
     // set. We'll set this to zero for now.
-    numItemsTrainingSet.zeros();
-    numUsersTrainingSet.zeros();
+    std::fill(numItemsTrainingSet.begin(), numItemsTrainingSet.end(), 0);
+    std::fill(numUsersTrainingSet.begin(), numUsersTrainingSet.end(), 0);
 }
 
 void Globals::setVariances(const fmat &dataUM){
     movieVariances.clear();
     userVariances.clear();
-    int curr = 0;
+    size_t curr = 0;
     for(int i = 0; i < numItems; i++)
     {
         int count = numUsersTrainingSet[i];
@@ -318,7 +322,7 @@ bool Globals::setThetas(const fmat &dataUM)
     // Movie effect
     float xysum = 0;
     float xxsum = 0;
-    int curr = 0;
+    size_t curr = 0;
 
     for(int i = 0; i < numItems; i++)
     {
@@ -762,6 +766,20 @@ void Globals::train(const fmat &data)
     setThetas(data);
 }
 
+
+/**
+ * Global effects read the ratings of their own MU ordered copy of the
+ * training set as well as data's, so there's no column of ratings they
+ * could take in place of the rating row. Rather than silently train on a
+ * mix of the two, this refuses.
+ *
+ */
+void Globals::trainWithRatings(const RatingView &, const float *)
+{
+    throw std::logic_error("Global effects can't be trained on ratings "
+                           "other than those of their training set!");
+}
+
 float Globals::predict(int user, int item, int date, bool bound)
 {
     float pred;
@@ -830,6 +848,115 @@ float Globals::predict(int user, int item, int date, bool bound)
     return pred;
 }
 
+/**
+ * Predicts one chunk of a batch (see BaseAlgorithm::predictBatch). This
+ * gives the same result as predict(), but points are expected to be grouped
+ * by user, so the per-user thetas, first date and support are fetched once
+ * per run of a user rather than once per point.
+ */
+void Globals::predictRange(const int *users, const int *items,
+                           const int *dates, float *output, size_t n,
+                           bool bound)
+{
+    int currUser = -1;
+    float userTerm = 0, userTimeUserTheta = 0, userTimeMovieTheta = 0;
+    float userMovieAverageTheta = 0, userMovieSupportTheta = 0;
+    float userMovieSupportAverage = 0, userAverage = 0, sqrtUserSupport = 0;
+    int userFirstDate = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int user = users[i];
+        int item = items[i];
+        int date = dates[i];
+
+        if (user != currUser)
+        {
+            currUser = user;
+            userTerm = globalAverage;
+            if(level >= 2)
+                userTerm += userThetas[user];
+            if(level >= 3)
+            {
+                userFirstDate = userFirstDates[user];
+                userTimeUserTheta = userTimeUserThetas[user];
+            }
+            if(level >= 4)
+                userTimeMovieTheta = userTimeMovieThetas[user];
+            if(level >= 7)
+                userMovieAverageTheta = userMovieAverageThetas[user];
+            if(level >= 8)
+            {
+                userMovieSupportTheta = userMovieSupportThetas[user];
+                userMovieSupportAverage = userMovieSupportAverages[user];
+            }
+            if(level >= 9)
+                userAverage = userAverages[user];
+            if(level >= 10)
+                sqrtUserSupport = std::sqrt(numItemsTrainingSet[user]);
+        }
+
+        float pred = userTerm;
+        if(level >= 1)
+            pred += movieThetas[item];
+        if(level >= 3)
+        {
+            pred += userTimeUserTheta *
+                (std::sqrt(std::max(date - userFirstDate, 0))
+                    - sqrtUserTimeUserAverage);
+        }
+        if(level >= 4)
+        {
+            pred += userTimeMovieTheta *
+                (std::sqrt(std::max(date - movieFirstDates[item], 0))
+                    - sqrtUserTimeMovieAverage);
+        }
+        if(level >= 5)
+        {
+            pred += movieTimeMovieThetas[item] *
+                (std::sqrt(std::max(date - movieFirstDates[item], 0))
+                    - sqrtMovieTimeMovieAverage);
+        }
+        if(level >= 6)
+        {
+            pred += movieTimeUserThetas[item] *
+                (std::sqrt(std::max(date - userFirstDate, 0))
+                    - sqrtMovieTimeUserAverage);
+        }
+        if(level >= 7)
+        {
+            pred += userMovieAverageTheta *
+                (movieAverages[item] - globalAverage);
+        }
+        if(level >= 8)
+        {
+            pred += userMovieSupportTheta *
+                (std::sqrt(numUsersTrainingSet[item])
+                    - userMovieSupportAverage);
+        }
+        if(level >= 9)
+        {
+            pred += movieUserAverageThetas[item] * (userAverage
+                - movieUserAverages[item]);
+        }
+        if(level >= 10)
+        {
+            pred += movieUserSupportThetas[item] *
+                (sqrtUserSupport - movieUserSupportAverages[item]);
+        }
+
+        if (bound)
+        {
+            if (pred < MIN_RATING)
+                pred = (float) MIN_RATING;
+            else if (pred > MAX_RATING)
+                pred = (float) MAX_RATING;
+        }
+
+        output[i] = pred;
+    }
+}
+
 Globals::~Globals()
 {
     // No dynamically allocated resources to free at the moment.
@@ -16,6 +16,7 @@
 #include <functional>
 #include <iterator>
 #include <random>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -80,11 +81,13 @@ private:
     std::vector<int> movieFirstDates;
     std::vector<int> userLastDates;
     std::vector<int> movieLastDates;
-    float userAverageDates[NUM_USERS];
-    float movieAverageDates[NUM_MOVIES];
+    std::vector<float> userAverageDates;
+    std::vector<float> movieAverageDates;
 
-    fcolvec numItemsTrainingSet;
-    fcolvec numUsersTrainingSet;
+    // The number of ratings of each user and of each movie. These are
+    // integers, since float counts stop being exact past 2^24.
+    std::vector<size_t> numItemsTrainingSet;
+    std::vector<size_t> numUsersTrainingSet;
 
     void initInternalData();
     void populateNumItemsTrainingSet(const fmat &data);
@@ -93,14 +96,25 @@ private:
     void setVariances(const fmat &dataUM);
     bool setThetas(const fmat &dataUM);
 
+protected:
+    void idBounds(int &users, int &items, int &dates) const
+    {
+        users = numUsers;
+        items = numItems;
+        dates = INT_MAX;
+    }
+
+    void predictRange(const int *users, const int *items, const int *dates,
+                      float *output, size_t n, bool bound);
 
 public:
     Globals(int numUsers, int numItems, int levels,
-        const std::string &trainFileName);
+        const std::set<int> &trainSets);
 
     ~Globals();
     
     void train(const fmat &data);
+    void trainWithRatings(const RatingView &data, const float *ratings);
     float predict(int user, int item, int date, bool bound);
 };
 
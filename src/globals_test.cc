@@ -17,16 +17,15 @@
 
 #include <netflix.hh>
 #include <globals.hh>
+#include <ratingstore.hh>
 
 using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
-// The Armadillo binary file to use for training.
-// Make sure that both UM and MU data are using the same
-// "type" of training resource (eg. probe, hidden, base, etc.)
-const string TRAIN_UM = ALL_TRAIN_BIN;
-const string TRAIN_MU = MU_ALL_TRAIN_BIN;
+// The sets to train on (views of the rating store). Globals reads the same
+// sets in MU order itself.
+const set<int> TRAIN_SETS = ALL_TRAIN_IDX;
 
 // The "level" of global effect we want to train on.
 // (See globals_README in "data" dir for more detail)
@@ -44,22 +43,21 @@ const int RATING_SIG_FIGS = 4;
 void testOnDataFile(Globals &predAlgo, const string &testFileName,
                     const string &outputFileName);
 
-// Helper function that carries out "predAlgo" on the test file specified
-// by testFileName (most likely the "probe" dataset), and calculates the
-// RMSE based on those results. Note that testFileName must refer to an
-// Armadillo binary in this case.
-float computeRMSE(Globals &predAlgo, const string &testFileName);
+// Helper function that carries out "predAlgo" on testSet (most likely the
+// "probe" dataset), and calculates the RMSE based on those results.
+float computeRMSE(Globals &predAlgo, const fmat &testSet);
 
 
 int main(void)
 {
-    // Load from binary.
-    fmat trainingSetUM;
-    trainingSetUM.load(TRAIN_UM, arma_binary);
-    cout << "Loaded training data from " << TRAIN_UM << "."
-        << endl;
-
-    Globals predAlgo(NUM_USERS, NUM_MOVIES, level, TRAIN_MU);
+    // Map the rating store, and view the training sets in it.
+    RatingStore ratings(RATINGS_STORE);
+    fmat trainingSetUM = ratings.view(TRAIN_SETS).matrix();
+    cout << "Loaded " << trainingSetUM.n_cols << " training ratings from "
+        << RATINGS_STORE << "." << endl;
+
+    Globals predAlgo(ratings.numUsers(), ratings.numItems(), level,
+                     TRAIN_SETS);
     
     predAlgo.train(trainingSetUM);
 
@@ -67,7 +65,7 @@ int main(void)
     testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
 
     // Get probe RMSE.
-    float probeRMSE = computeRMSE(predAlgo, PROBE_BIN);
+    float probeRMSE = computeRMSE(predAlgo, loadRatings(PROBE_IDX));
     
     cout << "\nProbe RMSE: " << probeRMSE << endl;
 }
@@ -75,40 +73,26 @@ int main(void)
 
 /**
  * Compute the RMSE of a given prediction algorithm on a certain set of
- * data. Note that testFileName must refer to an **Armadillo binary** in
- * this case. This binary must represent a 4 x N matrix, where N is the
- * number of test points.
+ * data: a 4 x N matrix, where N is the number of test points.
  *
  */
-float computeRMSE(Globals &predAlgo, const string &testFileName)
+float computeRMSE(Globals &predAlgo, const fmat &testSet)
 {
-    // Load from binary.
-    fmat testSet;
-    testSet.load(testFileName, arma_binary);
-
-    // The test set should have four rows.
-    if (testSet.n_rows != 4)
-    {
-        throw invalid_argument("File " + testFileName + " did not have " +
-                               "four rows!");
-    }
-
     // The number we divide by in computing the RMSE.
     int nMinusOne = testSet.n_cols - 1;
 
+    // Predict the whole test set in one batch.
+    vector<float> predictions(testSet.n_cols);
+    predAlgo.predictAll(testSet, predictions.data(), true);
+
     // Accumulator for RMSE (take square root at the end)
     float rmse = 0.0;
 
     for (unsigned int i = 0; i < testSet.n_cols; i ++)
     {
-        int user = roundToInt(testSet(USER_ROW, i));
-        int item = roundToInt(testSet(MOVIE_ROW, i));
-        int date = roundToInt(testSet(DATE_ROW, i));
         float actualRating = testSet(RATING_ROW, i);
         
-        float prediction = predAlgo.predict(user, item, date, true);
-        
-        rmse += pow(actualRating - prediction, 2.0)/nMinusOne;
+        rmse += pow(actualRating - predictions[i], 2.0)/nMinusOne;
     }
 
     return sqrt(rmse);
@@ -123,50 +107,20 @@ float computeRMSE(Globals &predAlgo, const string &testFileName)
 void testOnDataFile(Globals &predAlgo, const string &testFileName,
                     const string &outputFileName)
 {
-    ifstream testDataFile(testFileName);
-    ofstream outputFile(outputFileName); 
-    
-    if (testDataFile.fail())
-    {
-        throw runtime_error("Couldn't find test file at " + testFileName);
-    }
-
-    if (outputFile.fail())
-    {
-        throw runtime_error("Couldn't open output file at " 
-                            + outputFileName);
-    }
-
-    string testDataLine;
-    
     cout << "\nTesting on data in " << testFileName << "..." << endl;
 
-    while (getline(testDataFile, testDataLine))
-    {
-        // Read the line and split it.
-        vector<int> thisLineVec;
-        splitIntoInts(testDataLine, DELIMITER, thisLineVec);
-
-        if (thisLineVec.size() != 3)
-        {
-            throw logic_error("The line \"" + testDataLine + "\" did not "
-                              "contain three delimiter-separated "
-                              "entries!");
-        }
-        
-        // The first entry is the user ID, the second entry is the item ID,
-        // and the third entry is the date. All of these should be
-        // zero-indexed!
-        int user = thisLineVec[0];
-        int item = thisLineVec[1];
-        int date = thisLineVec[2];
-        
-        // Output the prediction to file.
-        float prediction = predAlgo.predict(user, item, date, true);
-        outputFile << setprecision(RATING_SIG_FIGS) << prediction << endl;
-    }
-    
-    outputFile.close();
+    // Load the (cached) binary index of the test file and predict it in
+    // one batch.
+    Mat<int> testIndex = loadQualIndex(testFileName);
+    vector<float> predictions(testIndex.n_rows);
+    predAlgo.predictBatch(testIndex.colptr(USER_ROW),
+                          testIndex.colptr(MOVIE_ROW),
+                          testIndex.colptr(DATE_ROW),
+                          predictions.data(), testIndex.n_rows, true);
+
+    // Output the predictions to file.
+    writePredictions(outputFileName, predictions.data(), predictions.size(),
+                     RATING_SIG_FIGS);
 
     cout << "\nOutputted predictions on " << testFileName << " to the " 
         "output file " << outputFileName << endl;
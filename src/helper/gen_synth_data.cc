@@ -0,0 +1,166 @@
+/**
+ * Generates a synthetic dataset shaped like the Netflix data (see
+ * synthdata.hh), for benchmarking without the real data. Usage:
+ *
+ *      gen_synth_data [--users N] [--movies N] [--dates N] [--ratings N]
+ *                     [--rank K] [--seed S] [--no-text] [--no-store]
+ *                     <output directory>
+ *
+ * The sizes default to the real data's. The files are laid out under the
+ * output directory as they are under "data" (um/new_all.dta, um/all.idx,
+ * um/new_qual.dta, N.dta, hat_dev_u_t.dta, f_u_t.dta and the rating stores
+ * um/ratings.ckpt and mu/ratings.ckpt), so generating into "data" lets
+ * every binary run on the synthetic data as is. The qual ratings are also
+ * written, to um/new_qual_ratings.dta, so predictions on qual can be
+ * scored. --no-text and --no-store skip the text files and the stores.
+ *
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+
+#include <netflix.hh>
+#include <ratingsort.hh>
+#include <ratingstore.hh>
+#include <synthdata.hh>
+
+using namespace std;
+using namespace netflix;
+
+// Note: All constants are specified in the netflix namespace.
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [--users N] [--movies N] [--dates N] "
+         << "[--ratings N] [--rank K] [--seed S] [--no-text] [--no-store] "
+         << "<output directory>" << endl;
+}
+
+// Where a file that lives at path under "data" goes under outputDir.
+static string underDir(const string &outputDir, const string &path)
+{
+    return outputDir + path.substr(path.find('/'));
+}
+
+static void makeDir(const string &dir)
+{
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw runtime_error("Couldn't create " + dir + ": " +
+                            string(strerror(errno)));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    SynthConfig config;
+    bool writeText = true, writeStore = true;
+    string outputDir;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--no-text")
+        {
+            writeText = false;
+        }
+        else if (arg == "--no-store")
+        {
+            writeStore = false;
+        }
+        else if (arg == "--users" && hasValue)
+        {
+            config.numUsers = atoi(argv[++i]);
+        }
+        else if (arg == "--movies" && hasValue)
+        {
+            config.numMovies = atoi(argv[++i]);
+        }
+        else if (arg == "--dates" && hasValue)
+        {
+            config.numDates = atoi(argv[++i]);
+        }
+        else if (arg == "--ratings" && hasValue)
+        {
+            config.numRatings = strtoull(argv[++i], NULL, 10);
+        }
+        else if (arg == "--rank" && hasValue)
+        {
+            config.rank = atoi(argv[++i]);
+        }
+        else if (arg == "--seed" && hasValue)
+        {
+            config.seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (arg[0] != '-' && outputDir.empty())
+        {
+            outputDir = arg;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (outputDir.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cout << "Generating about " << config.numRatings << " ratings of "
+         << config.numUsers << " users, " << config.numMovies
+         << " movies and " << config.numDates << " dates (seed "
+         << config.seed << ")..." << endl;
+
+    auto start = chrono::steady_clock::now();
+    SynthData data = generateSynthData(config);
+    auto end = chrono::steady_clock::now();
+
+    cout << "Generated " << data.size() << " ratings in "
+         << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+         << " ms." << endl;
+
+    makeDir(outputDir);
+    makeDir(outputDir + "/um");
+
+    if (writeText)
+    {
+        writeSynthText(data, underDir(outputDir, DATA_PATH),
+                       underDir(outputDir, INDEX_PATH),
+                       underDir(outputDir, QUAL_DATA_FN),
+                       outputDir + "/um/new_qual_ratings.dta",
+                       underDir(outputDir, N_FN));
+        writeSynthTimeFiles(data, underDir(outputDir, HAT_DEV_U_T_FN),
+                            underDir(outputDir, F_U_T_FN));
+        cout << "Saved the text files under " << outputDir << "." << endl;
+    }
+
+    if (writeStore)
+    {
+        string storePath = underDir(outputDir, RATINGS_STORE);
+        writeSynthStore(data, storePath);
+        cout << "Saved the rating store to " << storePath << "." << endl;
+
+        // The same ratings in MU order, as binarize_data makes them.
+        makeDir(outputDir + "/mu");
+        string muStorePath = underDir(outputDir, MU_RATINGS_STORE);
+        RatingStore store(storePath);
+        writePermutedStore(store,
+                           sortRatings(store, RatingOrder::MOVIE_USER),
+                           muStorePath);
+        cout << "Saved the MU rating store to " << muStorePath << "."
+             << endl;
+    }
+
+    return 0;
+}
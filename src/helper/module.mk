@@ -1 +1 @@
-BINS += user_avg binarize_data
+BINS += user_avg binarize_data sort_ratings shard_ratings gen_synth_data
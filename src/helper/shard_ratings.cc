@@ -0,0 +1,47 @@
+/**
+ * Splits a rating store into shards of whole users, for training without
+ * loading every rating at once (see shardsource.hh). Usage:
+ *
+ *      shard_ratings <number of shards> [manifest] [input store]
+ *
+ * The manifest defaults to RATING_SHARDS and the input store (which must be
+ * sorted by user) to RATINGS_STORE. Shard i is written next to the
+ * manifest, at "<manifest>.<i>".
+ *
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <netflix.hh>
+#include <ratingstore.hh>
+#include <shardsource.hh>
+
+using namespace std;
+using namespace netflix;
+
+// Note: All constants are specified in the netflix namespace.
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 4 || atoi(argv[1]) < 1)
+    {
+        cerr << "Usage: " << argv[0] << " <number of shards> [manifest] "
+             << "[input store]" << endl;
+        return 1;
+    }
+
+    int numShards = atoi(argv[1]);
+    string manifestPath = argc > 2 ? argv[2] : RATING_SHARDS;
+    string inputPath = argc > 3 ? argv[3] : RATINGS_STORE;
+
+    RatingStore store(inputPath);
+    cout << "Splitting " << store.size() << " ratings from " << inputPath
+         << " into " << numShards << " shards..." << endl;
+
+    ShardSource::write(store, numShards, manifestPath);
+    cout << "Saved the shards' manifest to " << manifestPath << "." << endl;
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * Reorders a rating store (see ratingsort.hh). Usage:
+ *
+ *      sort_ratings <um|mu|ud|active> <output> [input store] [--perm]
+ *
+ * um sorts by user then movie, mu by movie then user, ud by user then date,
+ * and active by user (most active users first) then movie. The input store
+ * defaults to RATINGS_STORE. With --perm, only the permutation is written
+ * (as a checkpoint with a single "permutation" section) instead of a new
+ * store.
+ *
+ */
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <netflix.hh>
+#include <ratingsort.hh>
+#include <ratingstore.hh>
+
+using namespace std;
+using namespace netflix;
+
+// Note: All constants are specified in the netflix namespace.
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " <um|mu|ud|active> <output> "
+         << "[input store] [--perm]" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    RatingOrder order;
+    string orderName = argv[1];
+    if (orderName == "um")
+    {
+        order = RatingOrder::USER_MOVIE;
+    }
+    else if (orderName == "mu")
+    {
+        order = RatingOrder::MOVIE_USER;
+    }
+    else if (orderName == "ud")
+    {
+        order = RatingOrder::USER_DATE;
+    }
+    else if (orderName == "active")
+    {
+        order = RatingOrder::USER_ACTIVITY;
+    }
+    else
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    string outputPath = argv[2];
+    string inputPath = RATINGS_STORE;
+    bool permOnly = false;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--perm") == 0)
+        {
+            permOnly = true;
+        }
+        else
+        {
+            inputPath = argv[i];
+        }
+    }
+
+    RatingStore store(inputPath);
+    cout << "Sorting " << store.size() << " ratings from " << inputPath
+         << "..." << endl;
+
+    auto start = chrono::steady_clock::now();
+    vector<size_t> perm = sortRatings(store, order);
+    auto end = chrono::steady_clock::now();
+
+    cout << "Sorted in "
+         << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+         << " ms." << endl;
+
+    if (permOnly)
+    {
+        writePermutation(perm, outputPath);
+        cout << "Saved the permutation to " << outputPath << "." << endl;
+    }
+    else
+    {
+        writePermutedStore(store, perm, outputPath);
+        cout << "Saved the sorted store to " << outputPath << "." << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * A latency histogram that many threads can record into at once. Latencies
+ * are kept in power-of-two buckets of microseconds (bucket b holds
+ * latencies in [2^(b - 1), 2^b) us, and bucket 0 those under 1 us), so
+ * quantiles are only known to within a factor of two, but recording is a
+ * couple of relaxed atomic adds and the histogram never grows.
+ *
+ */
+
+#ifndef HISTOGRAM_HH
+#define HISTOGRAM_HH
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// Enough buckets for latencies of over an hour.
+#define HISTOGRAM_NUM_BUCKETS 33
+
+class LatencyHistogram
+{
+private:
+    std::atomic<uint64_t> buckets[HISTOGRAM_NUM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sumMicros;
+    std::atomic<uint64_t> maxMicros;
+
+    static int bucketOf(uint64_t micros)
+    {
+        int bucket = 0;
+        while (micros != 0 && bucket < HISTOGRAM_NUM_BUCKETS - 1)
+        {
+            micros >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+public:
+    LatencyHistogram() : total(0), sumMicros(0), maxMicros(0)
+    {
+        for (int b = 0; b < HISTOGRAM_NUM_BUCKETS; b++)
+        {
+            buckets[b] = 0;
+        }
+    }
+
+    void record(uint64_t micros)
+    {
+        buckets[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sumMicros.fetch_add(micros, std::memory_order_relaxed);
+
+        uint64_t seen = maxMicros.load(std::memory_order_relaxed);
+        while (micros > seen
+               && !maxMicros.compare_exchange_weak(seen, micros,
+                                                   std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    double meanMicros() const
+    {
+        uint64_t n = count();
+        return n == 0 ? 0.0 : (double) sumMicros.load() / n;
+    }
+
+    /* An upper bound on the qth quantile (0 < q <= 1), in microseconds:
+     * the top of the bucket the quantile falls in. */
+    uint64_t quantileMicros(double q) const
+    {
+        uint64_t n = count();
+        uint64_t seen = 0;
+
+        for (int b = 0; b < HISTOGRAM_NUM_BUCKETS; b++)
+        {
+            seen += buckets[b].load(std::memory_order_relaxed);
+            if (n != 0 && seen >= q * n)
+            {
+                return (uint64_t) 1 << b;
+            }
+        }
+
+        return maxMicros.load();
+    }
+
+    /* One line of "name count=... mean_us=... p50_us=... p90_us=...
+     * p99_us=... max_us=...". */
+    std::string summary(const std::string &name) const
+    {
+        std::ostringstream line;
+        line << name << " count=" << count() << " mean_us=" << meanMicros()
+             << " p50_us=" << quantileMicros(0.5)
+             << " p90_us=" << quantileMicros(0.9)
+             << " p99_us=" << quantileMicros(0.99)
+             << " max_us=" << maxMicros.load();
+        return line.str();
+    }
+};
+
+#endif // HISTOGRAM_HH
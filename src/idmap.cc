@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include <netflix.hh>
+#include <idmap.hh>
+
+using namespace netflix; // challenge-related constants/functions.
+
+
+/**
+ * Adds the number of ratings of each ID in a row of data to counts, so
+ * that ratings seen a piece at a time can be counted (see fromCounts()).
+ *
+ * @param data:     The ratings.
+ * @param row:      The row holding the IDs to count (e.g. MOVIE_ROW).
+ * @param counts:   The counts to add to; every ID in data must be below
+ *                  its size.
+ *
+ */
+void IdMap::countIds(const RatingView &data, int row,
+                     std::vector<size_t> &counts)
+{
+    data.forEach([row, &counts](const float *rating)
+            {
+                int id = roundToInt(rating[row]);
+
+                if (id < 0 || (size_t) id >= counts.size())
+                {
+                    throw std::invalid_argument("Can't renumber ID " +
+                        std::to_string(id) + "; there are only " +
+                        std::to_string(counts.size()) + "!");
+                }
+
+                counts[id]++;
+            });
+}
+
+
+/**
+ * Numbers IDs by descending number of ratings, so the most rated ID becomes
+ * 0. Ties (including IDs that aren't rated at all) keep their original
+ * order.
+ *
+ * @param counts:   The number of ratings of each ID.
+ *
+ */
+IdMap IdMap::fromCounts(const std::vector<size_t> &counts)
+{
+    const int numIds = counts.size();
+
+    IdMap map;
+    map.externalIds.resize(numIds);
+    std::iota(map.externalIds.begin(), map.externalIds.end(), 0);
+    std::stable_sort(map.externalIds.begin(), map.externalIds.end(),
+                     [&counts](int32_t a, int32_t b)
+                     {
+                         return counts[a] > counts[b];
+                     });
+
+    map.internalIds.resize(numIds);
+    for (int internalId = 0; internalId < numIds; internalId++)
+    {
+        map.internalIds[map.externalIds[internalId]] = internalId;
+    }
+
+    return map;
+}
+
+
+/**
+ * Numbers the IDs in a row of data by descending number of ratings (see
+ * fromCounts()).
+ *
+ * @param data:     The ratings.
+ * @param row:      The row holding the IDs to renumber (e.g. MOVIE_ROW).
+ * @param numIds:   The number of IDs; every ID in data must be below this.
+ *
+ */
+IdMap IdMap::byFrequency(const RatingView &data, int row, int numIds)
+{
+    std::vector<size_t> counts(numIds, 0);
+    countIds(data, row, counts);
+    return fromCounts(counts);
+}
+
+
+/**
+ * Reads a map written by addTo().
+ *
+ * @param checkpoint:   An open checkpoint.
+ * @param name:         The section the map was stored in.
+ * @param numIds:       The number of IDs the map must cover.
+ *
+ */
+IdMap IdMap::load(const Checkpoint &checkpoint, const std::string &name,
+                  int numIds)
+{
+    IdMap map;
+
+    // Checkpoints from before renumbering, or of models trained without
+    // it, have no map.
+    if (!checkpoint.hasSection(name))
+    {
+        return map;
+    }
+
+    const int32_t *externalIds = static_cast<const int32_t *>(
+        checkpoint.data(name, CheckpointDType::I32, numIds));
+
+    map.externalIds.assign(externalIds, externalIds + numIds);
+    map.internalIds.assign(numIds, -1);
+
+    for (int internalId = 0; internalId < numIds; internalId++)
+    {
+        int32_t id = externalIds[internalId];
+
+        if (id < 0 || id >= numIds || map.internalIds[id] != -1)
+        {
+            throw std::runtime_error("The section " + name + " isn't a "
+                                     "permutation!");
+        }
+
+        map.internalIds[id] = internalId;
+    }
+
+    return map;
+}
+
+
+/**
+ * Adds the map to a checkpoint, as the original ID of each internal ID.
+ *
+ * @param writer:   The checkpoint to add to.
+ * @param name:     The name of the section to add.
+ *
+ */
+void IdMap::addTo(CheckpointWriter &writer, const std::string &name) const
+{
+    if (isIdentity())
+    {
+        return;
+    }
+
+    writer.add(name, std::vector<int32_t>(externalIds), 1,
+               externalIds.size());
+}
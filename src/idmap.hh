@@ -0,0 +1,74 @@
+/*
+ * A renumbering of IDs (e.g. movies) into the internal IDs a model indexes
+ * its parameters by. Movie IDs follow the original Netflix numbering, which
+ * has nothing to do with how often each movie is rated, so stochastic
+ * gradient descent touches item columns all over the factor matrices.
+ * Renumbering movies by descending popularity packs the hot columns
+ * together, so they share cache lines and pages.
+ *
+ * Models keep their map in their checkpoints, and translate IDs at their
+ * boundaries (training data, predict() and FactorModel queries), so callers
+ * only ever see the original IDs. An empty map is the identity.
+ *
+ */
+
+#ifndef IDMAP_HH
+#define IDMAP_HH
+
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <checkpoint.hh>
+#include <ratingstore.hh>
+
+using namespace arma;
+
+class IdMap
+{
+private:
+    // internalIds[id] is the internal ID of (original) ID id, and
+    // externalIds is its inverse. Both are empty for the identity.
+    std::vector<int32_t> internalIds;
+    std::vector<int32_t> externalIds;
+
+public:
+    IdMap() {}
+
+    /* Number the IDs in the given row of the ratings (e.g. MOVIE_ROW),
+     * which must be below numIds, by descending number of ratings. */
+    static IdMap byFrequency(const RatingView &data, int row, int numIds);
+
+    /* Add the number of ratings of each ID in the given row of the ratings
+     * to counts, for data that's only seen a piece at a time. */
+    static void countIds(const RatingView &data, int row,
+                         std::vector<size_t> &counts);
+
+    /* Number IDs by descending count, as byFrequency() does. */
+    static IdMap fromCounts(const std::vector<size_t> &counts);
+
+    /* The map stored in a checkpoint's section by addTo(), or the identity
+     * if the checkpoint doesn't have that section. */
+    static IdMap load(const Checkpoint &checkpoint, const std::string &name,
+                      int numIds);
+
+    bool isIdentity() const { return internalIds.empty(); }
+
+    int internal(int id) const
+    {
+        return internalIds.empty() ? id : internalIds[id];
+    }
+
+    int external(int id) const
+    {
+        return externalIds.empty() ? id : externalIds[id];
+    }
+
+    /* Store the map as a section of a checkpoint (nothing is stored for
+     * the identity). */
+    void addTo(CheckpointWriter &writer, const std::string &name) const;
+};
+
+#endif // IDMAP_HH
@@ -9,23 +9,14 @@ cdef extern from "svdpp.hh":
               int numFactors, int numIterations,
               const string &fileNameN)
 
-        # Constructor with cached files.
+        # Constructor with a cached checkpoint.
         SVDPP(int numUsers, int numItems, float meanRating,
               int numFactors, int numIterations, const string &fileNameN,
-              const string &fileNameBUser, const string &fileNameBItem,
-              const string &fileNameUserFacMat,
-              const string &fileNameItemFacMat,
-              const string &fileNameYMat,
-              const string &fileNameSumMovieWeights)
+              const string &fileNameCheckpoint)
         
         void train(const string &fileNameData)
         void trainAndCache(const string &fileNameData,
-                           const string &fileNameBUser,
-                           const string &fileNameBItem,
-                           const string &fileNameUserFacMat,
-                           const string &fileNameItemFacMat,
-                           const string &fileNameYMat,
-                           const string &fileNameSumMovieWeights)
+                           const string &fileNameCheckpoint)
     
         float predict(int user, int item, int date, bool_t bound)
 
@@ -38,18 +29,13 @@ cdef class PySVDPP:
 
 
     # We can't overload __cinit__, so we just have it take all of the
-    # parameters needed. If the file names (beyond that for N.dta) are
-    # None, then we use the non-caching constructor.
+    # parameters needed. If the checkpoint file name is None, then we use
+    # the non-caching constructor.
     def __cinit__(self, int numUsers, int numItems, float meanRating,
                   int numFactors, int numIterations,
-                  fileNameN, fileNameBUser = None,
-                  fileNameBItem = None, fileNameUserFacMat = None,
-                  fileNameItemFacMat = None, fileNameYMat = None,
-                  fileNameSumMovieWeights = None):
+                  fileNameN, fileNameCheckpoint = None):
         
-        if fileNameBUser == None or fileNameBItem == None or \
-            fileNameUserFacMat == None or fileNameItemFacMat == None or \
-            fileNameYMat == None or fileNameSumMovieWeights == None:
+        if fileNameCheckpoint == None:
 
             self.obj = new SVDPP(numUsers, numItems, meanRating,
                                  numFactors, numIterations, fileNameN)
@@ -58,9 +44,7 @@ cdef class PySVDPP:
             
             self.obj = new SVDPP(numUsers, numItems, meanRating,
                                  numFactors, numIterations, fileNameN,
-                                 fileNameBUser, fileNameBItem,
-                                 fileNameUserFacMat, fileNameItemFacMat,
-                                 fileNameYMat, fileNameSumMovieWeights)
+                                 fileNameCheckpoint)
     
     
     def __dealloc__(self):
@@ -72,12 +56,8 @@ cdef class PySVDPP:
 
 
     def trainAndCache(self, string fileNameData,
-                      string fileNameBUser, string fileNameBItem,
-                      string fileNameUserFacMat, string fileNameItemFacMat,
-                      string fileNameYMat, string fileNameSumMovieWeights):
-        self.obj.trainAndCache(fileNameData, fileNameBUser, fileNameBItem,
-                               fileNameUserFacMat, fileNameItemFacMat,
-                               fileNameYMat, fileNameSumMovieWeights)
+                      string fileNameCheckpoint):
+        self.obj.trainAndCache(fileNameData, fileNameCheckpoint)
     
     
     def predict(self, int user, int item, int date, bool_t bound):
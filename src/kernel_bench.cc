@@ -0,0 +1,522 @@
+/**
+ * Times the primitives in our models' inner loops, each side by side with
+ * its replacements (see microbench.hh for how). Usage:
+ *
+ *      kernel_bench [--filter S] [--samples N] [--json FILE]
+ *
+ * The primitives, with the variant the models used first listed first.
+ * Where a model's kernel is shared (simd.hh, and the inline kernels of
+ * knn.hh and rbm_new.hh), the benchmark calls it rather than a copy:
+ *
+ *      dot             q_i^T p_u, on copied fcolvecs (as SVD++ did), on
+ *                      column subviews, and with simd::dot on the columns
+ *      dot_of_sums     Time-SVD++'s factor term, a dot product of two sums
+ *                      of three vectors, summed with Armadillo against
+ *                      simd::dotOfSums()
+ *      user_date_bias  reading and updating b_{ut} in Time-SVD++'s sparse
+ *                      sp_fmat(date, user), against a per-user sorted
+ *                      (CSR) array searched by date, and against a slot
+ *                      known in advance (as a per-rating index would give)
+ *      hat_dev_u_t     Time-SVD++'s unordered_map<UserDate> lookup, against
+ *                      the same CSR search
+ *      n_of_u          summing over N(u) after copying it out with N[user]
+ *                      (as Time-SVD++ does), through a reference from
+ *                      N.find(user), and from one flat array
+ *      knn_select      picking KNN::predict's top maxWeight neighbors with
+ *                      a priority_queue (addHeaviestNeighbors()), against
+ *                      nth_element in place
+ *      rbm_softmax     RBM_New's rating distribution for a movie, with
+ *                      Armadillo (rbm_expected_rating()), against the flat
+ *                      float spans of rbm_predict() (rbm_expected_bin())
+ *
+ * The inputs are random, with the shapes of the real ones, and fixed by a
+ * seed. --filter runs only the benchmarks whose names contain S.
+ *
+ */
+
+#include <algorithm>
+#include <armadillo>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <netflix.hh>
+#include <knn.hh>
+#include <microbench.hh>
+#include <rbm_new.hh>
+#include <simd.hh>
+#include <timesvdpp.hh>
+
+using namespace std;
+using namespace arma;
+using namespace netflix; // challenge-related constants/functions.
+using microbench::doNotOptimize;
+
+
+/* Constants */
+
+// The shapes of the inputs.
+const int NUM_BENCH_USERS = 20000;
+const int NUM_BENCH_ITEMS = 4000;
+const int NUM_FACTORS = 50;
+const int DATES_PER_USER = 16;
+const int MAX_ITEMS_PER_USER = 400;
+const int NUM_CANDIDATES = 200;
+const unsigned int KNN_MAX_WEIGHT = 30;
+const int RBM_NUM_FACTORS = 100;
+
+// The number of precomputed inputs (a power of two) each benchmark cycles
+// through, so the inputs of an iteration are rarely in cache.
+const size_t NUM_INPUTS = 1 << 16;
+const size_t INPUT_MASK = NUM_INPUTS - 1;
+
+const int NUM_SAMPLES = 31;
+const double SAMPLE_SECONDS = 0.002;
+const unsigned int SEED = 1;
+
+
+/*
+ * (user, date) values stored as every user's dates in order, in one array,
+ * with the user's range given by an offset array.
+ */
+struct UserDateArray
+{
+    vector<size_t> userStart;
+    vector<unsigned short> dates;
+    vector<float> values;
+
+    // The slot of (user, date), which must be present.
+    size_t slotOf(int user, unsigned short date) const
+    {
+        const unsigned short *first = dates.data() + userStart[user];
+        const unsigned short *last = dates.data() + userStart[user + 1];
+        return lower_bound(first, last, date) - dates.data();
+    }
+};
+
+
+static void benchDot(microbench::Runner &runner, mt19937 &rng)
+{
+    fmat userFacMat(NUM_FACTORS, NUM_BENCH_USERS, fill::randu);
+    fmat itemFacMat(NUM_FACTORS, NUM_BENCH_ITEMS, fill::randu);
+
+    vector<int> users(NUM_INPUTS), items(NUM_INPUTS);
+    uniform_int_distribution<int> userDist(0, NUM_BENCH_USERS - 1);
+    uniform_int_distribution<int> itemDist(0, NUM_BENCH_ITEMS - 1);
+    for (size_t k = 0; k < NUM_INPUTS; k++)
+    {
+        users[k] = userDist(rng);
+        items[k] = itemDist(rng);
+    }
+
+    runner.run("dot/arma_copies", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        fcolvec userVec = userFacMat.col(users[k]);
+        fcolvec itemVec = itemFacMat.col(items[k]);
+        doNotOptimize(dot(itemVec, userVec));
+    });
+
+    runner.run("dot/arma_subviews", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        doNotOptimize(dot(itemFacMat.col(items[k]),
+                          userFacMat.col(users[k])));
+    });
+
+    runner.run("dot/simd_span", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        doNotOptimize(simd::dot(itemFacMat.colptr(items[k]),
+                                userFacMat.colptr(users[k]), NUM_FACTORS));
+    });
+
+    // Time-SVD++'s item factors are q_i + q_{i,Bin(t)} + q_{i,f}, and its
+    // user factors p_u + alpha_u dev_u(t) + p_{u,t}; the benchmark draws
+    // the extra components from the same matrices.
+    const float alpha = 0.25;
+
+    runner.run("dot_of_sums/arma_sums", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        size_t l = (i + 1) & INPUT_MASK;
+        size_t m = (i + 2) & INPUT_MASK;
+        fcolvec itemVec = itemFacMat.col(items[k]) +
+            itemFacMat.col(items[l]) + itemFacMat.col(items[m]);
+        fcolvec userVec = userFacMat.col(users[k]) +
+            alpha * userFacMat.col(users[l]) + userFacMat.col(users[m]);
+        doNotOptimize(dot(itemVec, userVec));
+    });
+
+    runner.run("dot_of_sums/simd", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        size_t l = (i + 1) & INPUT_MASK;
+        size_t m = (i + 2) & INPUT_MASK;
+        doNotOptimize(simd::dotOfSums(itemFacMat.colptr(items[k]),
+                                      itemFacMat.colptr(items[l]),
+                                      itemFacMat.colptr(items[m]),
+                                      userFacMat.colptr(users[k]), alpha,
+                                      userFacMat.colptr(users[l]),
+                                      userFacMat.colptr(users[m]),
+                                      NUM_FACTORS));
+    });
+}
+
+
+static void benchUserDate(microbench::Runner &runner, mt19937 &rng)
+{
+    // Every user rates on DATES_PER_USER distinct dates.
+    UserDateArray array;
+    array.userStart.push_back(0);
+    uniform_int_distribution<int> dateDist(0, NUM_DATES - 1);
+    normal_distribution<float> valueDist(0.0, 0.1);
+
+    for (int user = 0; user < NUM_BENCH_USERS; user++)
+    {
+        vector<unsigned short> dates;
+        while ((int) dates.size() < DATES_PER_USER)
+        {
+            unsigned short date = dateDist(rng);
+            if (find(dates.begin(), dates.end(), date) == dates.end())
+            {
+                dates.push_back(date);
+            }
+        }
+        sort(dates.begin(), dates.end());
+
+        for (unsigned short date : dates)
+        {
+            array.dates.push_back(date);
+            array.values.push_back(valueDist(rng));
+        }
+        array.userStart.push_back(array.dates.size());
+    }
+
+    // The same values as Time-SVD++ keeps them.
+    const size_t numEntries = array.dates.size();
+    umat locations(2, numEntries);
+    fcolvec values(numEntries);
+    unordered_map<UserDate, float, UserDateHasher> hatDevUT;
+    hatDevUT.reserve(numEntries);
+
+    for (int user = 0; user < NUM_BENCH_USERS; user++)
+    {
+        for (size_t s = array.userStart[user];
+             s < array.userStart[user + 1]; s++)
+        {
+            locations(0, s) = array.dates[s];
+            locations(1, s) = user;
+            values(s) = array.values[s];
+
+            UserDate userDate;
+            userDate.userID = user;
+            userDate.dateID = array.dates[s];
+            hatDevUT[userDate] = array.values[s];
+        }
+    }
+    sp_fmat bUserTime(locations, values, NUM_DATES, NUM_BENCH_USERS);
+
+    // Look up entries that exist, as training does.
+    vector<int> users(NUM_INPUTS);
+    vector<unsigned short> dates(NUM_INPUTS);
+    vector<size_t> slots(NUM_INPUTS);
+    uniform_int_distribution<size_t> entryDist(0, numEntries - 1);
+    for (size_t k = 0; k < NUM_INPUTS; k++)
+    {
+        size_t slot = entryDist(rng);
+        slots[k] = slot;
+        dates[k] = array.dates[slot];
+        users[k] = upper_bound(array.userStart.begin(),
+                               array.userStart.end(), slot)
+                   - array.userStart.begin() - 1;
+    }
+
+    runner.run("user_date_bias/sp_fmat_read", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        float value = bUserTime(dates[k], users[k]);
+        doNotOptimize(value);
+    });
+
+    runner.run("user_date_bias/sp_fmat_update", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        bUserTime(dates[k], users[k]) += 1e-6;
+    });
+
+    runner.run("user_date_bias/csr_read", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        doNotOptimize(array.values[array.slotOf(users[k], dates[k])]);
+    });
+
+    runner.run("user_date_bias/csr_update", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        array.values[array.slotOf(users[k], dates[k])] += 1e-6;
+        microbench::clobberMemory();
+    });
+
+    runner.run("user_date_bias/slot_read", [&](size_t i)
+    {
+        doNotOptimize(array.values[slots[i & INPUT_MASK]]);
+    });
+
+    runner.run("hat_dev_u_t/unordered_map", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        UserDate userDate;
+        userDate.userID = users[k];
+        userDate.dateID = dates[k];
+        doNotOptimize(hatDevUT.find(userDate)->second);
+    });
+
+    runner.run("hat_dev_u_t/csr", [&](size_t i)
+    {
+        size_t k = i & INPUT_MASK;
+        doNotOptimize(array.values[array.slotOf(users[k], dates[k])]);
+    });
+}
+
+
+static void benchImplicitFeedback(microbench::Runner &runner, mt19937 &rng)
+{
+    unordered_map<int, vector<int> > N;
+    vector<size_t> userStart(1, 0);
+    vector<int> flatItems;
+    uniform_int_distribution<int> sizeDist(1, MAX_ITEMS_PER_USER);
+    uniform_int_distribution<int> itemDist(0, NUM_BENCH_ITEMS - 1);
+
+    for (int user = 0; user < NUM_BENCH_USERS; user++)
+    {
+        vector<int> &items = N[user];
+        items.resize(sizeDist(rng));
+        for (int &item : items)
+        {
+            item = itemDist(rng);
+        }
+        flatItems.insert(flatItems.end(), items.begin(), items.end());
+        userStart.push_back(flatItems.size());
+    }
+
+    vector<int> users(NUM_INPUTS);
+    uniform_int_distribution<int> userDist(0, NUM_BENCH_USERS - 1);
+    for (int &user : users)
+    {
+        user = userDist(rng);
+    }
+
+    runner.run("n_of_u/operator[]_copy", [&](size_t i)
+    {
+        std::vector<int> nu = N[users[i & INPUT_MASK]];
+        int sum = 0;
+        for (int item : nu)
+        {
+            sum += item;
+        }
+        doNotOptimize(sum);
+    });
+
+    runner.run("n_of_u/find_reference", [&](size_t i)
+    {
+        const vector<int> &nu = N.find(users[i & INPUT_MASK])->second;
+        int sum = 0;
+        for (int item : nu)
+        {
+            sum += item;
+        }
+        doNotOptimize(sum);
+    });
+
+    runner.run("n_of_u/flat_array", [&](size_t i)
+    {
+        int user = users[i & INPUT_MASK];
+        int sum = 0;
+        for (size_t j = userStart[user]; j < userStart[user + 1]; j++)
+        {
+            sum += flatItems[j];
+        }
+        doNotOptimize(sum);
+    });
+}
+
+
+static void benchNeighborSelection(microbench::Runner &runner,
+                                   mt19937 &rng)
+{
+    // A few hundred neighbor lists, as KNN::predict fills them in.
+    const size_t numLists = 256;
+    vector<vector<s_neighbors> > lists(numLists);
+    uniform_real_distribution<float> unitDist(0.0, 1.0);
+
+    for (vector<s_neighbors> &list : lists)
+    {
+        list.resize(NUM_CANDIDATES);
+        for (s_neighbors &neighbor : list)
+        {
+            neighbor.common = 24 + (unsigned int) (1000 * unitDist(rng));
+            neighbor.m_avg = 3.0 + unitDist(rng);
+            neighbor.n_avg = 3.0 + unitDist(rng);
+            neighbor.n_rating = 1 + (int) (5 * unitDist(rng));
+            neighbor.pearson = 2 * unitDist(rng) - 1;
+            neighbor.p_lower = neighbor.pearson;
+            neighbor.weight = neighbor.p_lower * neighbor.p_lower
+                              * log(neighbor.common);
+        }
+    }
+
+    vector<s_neighbors> scratch(NUM_CANDIDATES);
+
+    runner.run("knn_select/priority_queue", [&](size_t i)
+    {
+        const vector<s_neighbors> &list = lists[i % numLists];
+        copy(list.begin(), list.end(), scratch.begin());
+
+        float prediction = 0, denom = 0;
+        addHeaviestNeighbors(scratch.data(), scratch.size(), KNN_MAX_WEIGHT,
+                             prediction, denom);
+        doNotOptimize(prediction / denom);
+    });
+
+    runner.run("knn_select/nth_element", [&](size_t i)
+    {
+        const vector<s_neighbors> &list = lists[i % numLists];
+        copy(list.begin(), list.end(), scratch.begin());
+
+        size_t numKept = min<size_t>(KNN_MAX_WEIGHT, scratch.size());
+        nth_element(scratch.begin(), scratch.begin() + numKept,
+                    scratch.end(),
+                    [](const s_neighbors &a, const s_neighbors &b)
+                    {
+                        return a.weight > b.weight;
+                    });
+
+        float prediction = 0, denom = 0;
+        for (size_t j = 0; j < numKept; j++)
+        {
+            addNeighbor(scratch[j], prediction, denom);
+        }
+        doNotOptimize(prediction / denom);
+    });
+}
+
+
+static void benchRBMSoftmax(microbench::Runner &runner, mt19937 &rng)
+{
+    // RBM_New's Armadillo parameters...
+    cube W(MAX_RATING, RBM_NUM_FACTORS, NUM_BENCH_ITEMS, fill::randn);
+    mat BV(MAX_RATING, NUM_BENCH_ITEMS, fill::randn);
+    vec Hu(RBM_NUM_FACTORS, fill::randu);
+    W *= 0.01;
+
+    // ...and the same as flat, padded float rows (see rbm_predict()).
+    const size_t stride = simd::paddedLength(RBM_NUM_FACTORS);
+    const size_t movieSize = MAX_RATING * stride;
+    vector<float> weights(NUM_BENCH_ITEMS * movieSize, 0.0);
+    vector<float> biases(NUM_BENCH_ITEMS * MAX_RATING);
+    vector<float> hidden(stride, 0.0);
+
+    for (int movie = 0; movie < NUM_BENCH_ITEMS; movie++)
+    {
+        for (int r = 0; r < MAX_RATING; r++)
+        {
+            biases[movie * MAX_RATING + r] = BV(r, movie);
+            for (int f = 0; f < RBM_NUM_FACTORS; f++)
+            {
+                weights[movie * movieSize + r * stride + f] =
+                    W(r, f, movie);
+            }
+        }
+    }
+    for (int f = 0; f < RBM_NUM_FACTORS; f++)
+    {
+        hidden[f] = Hu(f);
+    }
+
+    vector<int> movies(NUM_INPUTS);
+    uniform_int_distribution<int> movieDist(0, NUM_BENCH_ITEMS - 1);
+    for (int &movie : movies)
+    {
+        movie = movieDist(rng);
+    }
+
+    runner.run("rbm_softmax/arma", [&](size_t i)
+    {
+        int movie = movies[i & INPUT_MASK];
+        doNotOptimize(rbm_expected_rating(BV, W, Hu, movie));
+    });
+
+    runner.run("rbm_softmax/flat_span", [&](size_t i)
+    {
+        int movie = movies[i & INPUT_MASK];
+        doNotOptimize(rbm_expected_bin(hidden.data(),
+                                       biases.data() + movie * MAX_RATING,
+                                       weights.data() + movie * movieSize,
+                                       MAX_RATING, stride,
+                                       RBM_NUM_FACTORS));
+    });
+}
+
+
+static void usage(const char *name)
+{
+    cerr << "Usage: " << name << " [--filter S] [--samples N] [--json FILE]"
+         << endl;
+}
+
+
+int main(int argc, char **argv)
+{
+    string filter, jsonPath;
+    int numSamples = NUM_SAMPLES;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--filter" && hasValue)
+        {
+            filter = argv[++i];
+        }
+        else if (arg == "--samples" && hasValue)
+        {
+            numSamples = atoi(argv[++i]);
+        }
+        else if (arg == "--json" && hasValue)
+        {
+            jsonPath = argv[++i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    arma_rng::set_seed(SEED);
+    mt19937 rng(SEED);
+    microbench::Runner runner(numSamples, SAMPLE_SECONDS, filter);
+
+    benchDot(runner, rng);
+    benchUserDate(runner, rng);
+    benchImplicitFeedback(runner, rng);
+    benchNeighborSelection(runner, rng);
+    benchRBMSoftmax(runner, rng);
+
+    runner.printTable(cout);
+
+    if (!jsonPath.empty())
+    {
+        ofstream json(jsonPath);
+        runner.writeJson(json);
+        cout << "\nWrote the results to " << jsonPath << "." << endl;
+    }
+
+    return 0;
+}
@@ -1,11 +1,5 @@
 #include <knn.hh>
 
-// Comparison operator for s_neighors
-int operator<(const s_neighbors &a, const s_neighbors &b)
-{
-    return a.weight > b.weight;
-}
-
 
 KNN::KNN(const int numUsers, const int numItems, const int minCommon,
          const unsigned int maxWeight, bool loadPFromFile, 
@@ -45,15 +39,47 @@ KNN::KNN(const int numUsers, const int numItems, const int minCommon,
 
 void KNN::train(const fmat &data)
 {
-    unsigned int i;
+    train(RatingView(data), NULL);
+}
+
+
+/**
+ * Trains on a view of a rating store, walking its runs rather than copying
+ * them into a matrix.
+ */
+void KNN::train(const RatingView &view)
+{
+    train(view, NULL);
+}
+
+
+/**
+ * Trains on data's users and items with ratings taken from a separate
+ * column (e.g. the residuals of an earlier model), so that no copy of the
+ * training matrix is made.
+ */
+void KNN::trainWithRatings(const RatingView &data, const float *ratings)
+{
+    train(data, ratings);
+}
+
+
+/**
+ * Populates UM and MU from data, taking the i-th rating from ratings[i]
+ * (or from data itself if ratings is NULL), and then loads or computes P.
+ */
+void KNN::train(const RatingView &data, const float *ratings)
+{
+    RatingCursor cursor(data);
     int last_seen = 0, curr_count = -1;
     int user, item;
     float rating;
-    for(i = 0; i < data.n_cols; i++)
+    for(size_t i = 0; i < data.size(); i++)
     {
-        user = roundToInt(data(USER_ROW, i));
-        item = roundToInt(data(MOVIE_ROW, i));
-        rating = data(RATING_ROW, i);
+        const float *column = cursor.next();
+        user = roundToInt(column[USER_ROW]);
+        item = roundToInt(column[MOVIE_ROW]);
+        rating = ratings != NULL ? ratings[i] : column[RATING_ROW];
 
         if (last_seen == user)
         {
@@ -103,14 +129,15 @@ void KNN::train(const fmat &data)
 void KNN::calcP()
 {
     int i, u, m, user, z;
-    short movie;
+    uint32_t movie;
     float x, y, xy, xx, yy, denom;
     unsigned int n;
     char rating_i, rating_j;
     // Vector size
     int size1, size2;
-    // Intermediates for every movie pair
-    s_inter tmp[numItems];
+    // Intermediates for every movie pair (on the heap, since a catalog
+    // with many movies would overflow the stack)
+    std::vector<s_inter> tmp(numItems);
     float tmp_f;
 
 #ifndef NDEBUG
@@ -274,15 +301,54 @@ void KNN::loadP()
 
 
 float KNN::predict(int user, int item, int date, bool bound)
+{
+    // One slot per item the user rated, plus the dummy element.
+    std::vector<s_neighbors> neighbors(um[user].size() + 1);
+    return predictWithNeighbors(user, item, bound, neighbors.data());
+}
+
+
+/**
+ * Predicts one chunk of a batch (see BaseAlgorithm::predictBatch). The
+ * neighbor scratch array is sized once for the chunk's busiest user
+ * instead of being set up for every point.
+ */
+void KNN::predictRange(const int *users, const int *items,
+                       const int * /* dates */, float *output, size_t n,
+                       bool bound)
+{
+    std::vector<s_neighbors> neighbors;
+    int currUser = -1;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (users[i] != currUser)
+        {
+            currUser = users[i];
+            if (neighbors.size() < um[currUser].size() + 1)
+            {
+                neighbors.resize(um[currUser].size() + 1);
+            }
+        }
+
+        output[i] = predictWithNeighbors(currUser, items[i], bound,
+                                         neighbors.data());
+    }
+}
+
+
+/**
+ * Computes the kNN prediction for (user, item), using neighbors as scratch
+ * space. neighbors must have room for um[user].size() + 1 elements.
+ */
+float KNN::predictWithNeighbors(int user, int item, bool bound,
+                                s_neighbors *neighbors) const
 {
     // NOTE: making item and n unsigned ints might make it easier for
     // the compiler to implement branchless min().
-    float prediction = 0, denom = 0, diff, result;
+    float prediction = 0, denom = 0, result;
     int n;
     s_pear tmp;
-    s_neighbors neighbors[numItems];
-    std::priority_queue<s_neighbors> q;
-    s_neighbors tmp_pair;
     float p_lower, pearson;
     int common_users;
 
@@ -334,44 +400,9 @@ float KNN::predict(int user, int item, int date, bool bound)
     j++;
 
     // At this point we have an array of neighbors, length j.
-    // Let's find the maxWeight elements of the array.
-
-    // For each item-pair in neighbors
-    for (i = 0; i < j; i++)
-    {
-        // If there is place in queue, just push it
-        if (q.size() < maxWeight)
-        {
-            q.push(neighbors[i]);
-        }
-
-        // Else, push it only if this pair has a higher weight than the top
-        // (smallest in top-maxWeight).
-        // Remove the current top first
-        else
-        {
-            if (q.top().weight < neighbors[i].weight)
-            {
-                q.pop();
-                q.push(neighbors[i]);
-            }
-        }
-    }
-
-    // Now we can go ahead and calculate rating
-    size = q.size();
-    for (i = 0; i < size; i++)
-    {
-        tmp_pair = q.top();
-        q.pop();
-        diff = tmp_pair.n_rating - tmp_pair.n_avg;
-        if (tmp_pair.pearson < 0)
-        {
-            diff = -diff;
-        }
-        prediction += tmp_pair.pearson * (tmp_pair.m_avg + diff);
-        denom += tmp_pair.pearson;
-    }
+    // Let's find the maxWeight elements of the array, and go ahead and
+    // calculate rating from them.
+    addHeaviestNeighbors(neighbors, j, maxWeight, prediction, denom);
 
     // If result is nan, return avg
     if (std::abs(denom) < EPSILON)
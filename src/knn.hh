@@ -9,6 +9,7 @@
 #include <armadillo>
 #include <array>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -44,7 +45,7 @@ struct mu_pair
 
 struct um_pair
 {
-    unsigned short movie;
+    uint32_t movie;
     float rating;
 };
 
@@ -87,6 +88,61 @@ struct s_neighbors
     float weight;
 };
 
+// Orders neighbors heaviest first, so that a priority_queue of them has the
+// lightest one on top.
+inline bool operator<(const s_neighbors &a, const s_neighbors &b)
+{
+    return a.weight > b.weight;
+}
+
+// Adds a neighbor's term to the weighted sum of a prediction, and its
+// weight to denom.
+inline void addNeighbor(const s_neighbors &neighbor, float &prediction,
+                        float &denom)
+{
+    float diff = neighbor.n_rating - neighbor.n_avg;
+    if (neighbor.pearson < 0)
+    {
+        diff = -diff;
+    }
+    prediction += neighbor.pearson * (neighbor.m_avg + diff);
+    denom += neighbor.pearson;
+}
+
+// Adds the terms of the (up to) maxWeight heaviest of neighbors[0, n) to
+// prediction and denom, lightest first. This is the selection step of
+// KNN::predict(), kept here so kernel_bench times the same code.
+inline void addHeaviestNeighbors(const s_neighbors *neighbors,
+                                 unsigned int n, unsigned int maxWeight,
+                                 float &prediction, float &denom)
+{
+    std::priority_queue<s_neighbors> q;
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        // If there is place in queue, just push it
+        if (q.size() < maxWeight)
+        {
+            q.push(neighbors[i]);
+        }
+
+        // Else, push it only if this pair has a higher weight than the top
+        // (smallest in top-maxWeight).
+        // Remove the current top first
+        else if (q.top().weight < neighbors[i].weight)
+        {
+            q.pop();
+            q.push(neighbors[i]);
+        }
+    }
+
+    while (!q.empty())
+    {
+        addNeighbor(q.top(), prediction, denom);
+        q.pop();
+    }
+}
+
 class KNN : public BaseAlgorithm
 {
     private:
@@ -120,11 +176,29 @@ class KNN : public BaseAlgorithm
         std::vector<std::vector<s_pear>> P;
         std::vector<float> movieAvg;
 
+        float predictWithNeighbors(int user, int item, bool bound,
+                                   s_neighbors *neighbors) const;
+        void train(const RatingView &data, const float *ratings);
+
+    protected:
+        void idBounds(int &users, int &items, int &dates) const
+        {
+            users = numUsers;
+            items = numItems;
+            dates = INT_MAX;
+        }
+
+        void predictRange(const int *users, const int *items,
+                          const int *dates, float *output, size_t n,
+                          bool bound);
+
     public:
         KNN(const int numUsers, const int numItems, const int minCommon,
             const unsigned int maxWeight, bool loadPFromFile,
             bool savePToFile, const std::string &pFilename);
         void train(const fmat &data);
+        void train(const RatingView &view);
+        void trainWithRatings(const RatingView &data, const float *ratings);
         float predict(int user, int item, int date, bool bound);
         void calcP();
         void saveP();
@@ -16,6 +16,7 @@
 #include <vector>
 
 #include <netflix.hh>
+#include <ratingstore.hh>
 #include <two_algo.hh>
 #include <globals.hh>
 #include <knn.hh>
@@ -24,18 +25,11 @@ using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
-// The Armadillo binary file to use for training.
-// Make sure that both UM and MU data are using the same
-// "type" of training resource (eg. probe, hidden, base, etc.)
-// const string TRAIN_UM = VALID_BIN;
-const string TRAIN_UM = ALL_TRAIN_BIN;
-// const string TRAIN_UM = BASE_BIN;
-
-// MU train matrix for global effect. Note that
-// the index type should match that of TRAIN_UM.
-// const string TRAIN_MU = "data/valid-mu.mat";
-const string TRAIN_MU = MU_ALL_TRAIN_BIN;
-// const string TRAIN_MU = MU_BASE_BIN;
+// The sets to train on (views of the rating store). Global effect reads the
+// same sets in MU order.
+// const set<int> TRAIN_SETS = VALID_IDX;
+const set<int> TRAIN_SETS = ALL_TRAIN_IDX;
+// const set<int> TRAIN_SETS = BASE_IDX;
 
 // The "level" of global effect we want to train on.
 // (See globals_README in "data" dir for more detail)
@@ -51,18 +45,18 @@ const int MIN_COMMON = 24;
 const unsigned int MAX_WEIGHT = 30;
 
 // A temporary file where intermediate qual predictions (made by the
-// unbounded first algorithm) will be saved. These are stored in plain-text
-// format.
-const string INTERMED_PRED_FILE = "data/knn_ge_intermed_pred_temp.dta";
+// unbounded first algorithm) will be saved, as an Armadillo binary fcolvec.
+const string INTERMED_PRED_FILE = "data/knn_ge_intermed_pred_temp.mat";
 
 // If this is true, then we will delete the intermediate prediction file
 // mentioned above.
 const bool DELETE_INTERMED_PRED_FILE = false;
 
 // The file where we'll store the residuals of the first model on the
-// training set, in Armadillo's binary format. If this is uninitialized
+// training set, as a FloatColumn cache (one float per training point). It
+// is mapped rather than read when reused. If this is uninitialized
 // (i.e. the string is empty()), then the residuals will not be saved.
-const string RESIDUALS_FILE = "data/knn_ge_resid.mat";
+const string RESIDUALS_FILE = "data/knn_ge_resid.f32";
 
 // Whether we've cached the residuals of the first model, as well as the
 // intermediate qual predictions it generated (at the above-mentioned
@@ -84,6 +78,7 @@ const string OUTPUT_FILENAME = "data/globals_knn_combo_predictions.dta";
 
 int main(void)
 {
+    RatingStore ratings(RATINGS_STORE);
     Two_Algo *combine;
     
     // Setting up the first model.
@@ -97,19 +92,21 @@ int main(void)
                     "predictions if the first model is cached.");
         }
 
-        // Just construct the Two_Algo with the given residuals.
-        combine = new Two_Algo(RESIDUALS_FILE, INTERMED_PRED_FILE,
+        // Just construct the Two_Algo and map the given residuals.
+        combine = new Two_Algo(TRAIN_SETS, INTERMED_PRED_FILE,
                                RATING_SIG_FIGS, DELETE_INTERMED_PRED_FILE);
+        combine->loadResiduals(RESIDUALS_FILE);
         cout << "\nTwo_Algo is using cached residuals of the first model."
             << endl;
     }
     else
     {
         // Construct the Two_Algo to work with the training set.
-        combine = new Two_Algo(TRAIN_UM, INTERMED_PRED_FILE,
+        combine = new Two_Algo(TRAIN_SETS, INTERMED_PRED_FILE,
                                RATING_SIG_FIGS, DELETE_INTERMED_PRED_FILE);
 
-        Globals predAlgoGE(NUM_USERS, NUM_MOVIES, LEVEL, TRAIN_MU);
+        Globals predAlgoGE(ratings.numUsers(), ratings.numItems(), LEVEL,
+                           TRAIN_SETS);
     
         combine->trainFirst(predAlgoGE);
         combine->saveFirstQualPredictions(predAlgoGE, QUAL_DATA_FN);
@@ -118,8 +115,8 @@ int main(void)
     
     // Setting up the second model and outputting predictions.
     {
-        KNN predAlgoKNN(NUM_USERS, NUM_MOVIES, MIN_COMMON, MAX_WEIGHT, 
-                        LOAD_P, SAVE_P, P_FN);
+        KNN predAlgoKNN(ratings.numUsers(), ratings.numItems(), MIN_COMMON,
+                        MAX_WEIGHT, LOAD_P, SAVE_P, P_FN);
 
         combine->trainSecond(predAlgoKNN);
         combine->saveSecondQualPredictions(predAlgoKNN, QUAL_DATA_FN,
@@ -15,6 +15,7 @@
 #include <vector>
 
 #include <netflix.hh>
+#include <ratingstore.hh>
 #include <two_algo.hh>
 #include <timesvdpp.hh>
 #include <knn.hh>
@@ -23,10 +24,10 @@ using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
-// The UM-ordered Armadillo binary file to use for training.
-// const string TRAIN_UM = HIDDEN_BIN;
-// const string TRAIN_UM = BASE_HIDDEN_VALID_BIN;
-const string TRAIN_UM = ALL_TRAIN_BIN;
+// The sets to train on (views of the rating store).
+// const set<int> TRAIN_SETS = HIDDEN_IDX;
+// const set<int> TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
+const set<int> TRAIN_SETS = ALL_TRAIN_IDX;
 
 // The number of factors to use for Time-SVD++.
 const int NUM_FACTORS = 60;
@@ -52,19 +53,19 @@ const int MIN_COMMON = 24;
 const unsigned int MAX_WEIGHT = 400;
 
 // A temporary file where intermediate qual predictions (made by the
-// unbounded first algorithm) will be saved. These are stored in plain-text
-// format.
+// unbounded first algorithm) will be saved, as an Armadillo binary fcolvec.
 const string INTERMED_PRED_FILE = "data/knn_timesvdpp_intermed_pred_"
-                                  "temp.dta";
+                                  "temp.mat";
 
 // If this is true, then we will delete the intermediate prediction file
 // mentioned above.
 const bool DELETE_INTERMED_PRED_FILE = false;
 
 // The file where we'll store the residuals of the first model on the
-// training set, in Armadillo's binary format. If this is uninitialized
+// training set, as a FloatColumn cache (one float per training point). It
+// is mapped rather than read when reused. If this is uninitialized
 // (i.e. the string is empty()), then the residuals will not be saved.
-const string RESIDUALS_FILE = "data/knn_timesvdpp_resid.mat";
+const string RESIDUALS_FILE = "data/knn_timesvdpp_resid.f32";
 
 // Whether we've cached the residuals of the first model, as well as the
 // intermediate qual predictions it generated (at the above-mentioned
@@ -86,6 +87,7 @@ const string OUTPUT_FN = "data/knn_on_timesvdpp_predictions.dta";
 
 int main(void)
 {
+    RatingStore ratings(RATINGS_STORE);
     Two_Algo *combine;
     
     // Setting up the first model.
@@ -99,19 +101,21 @@ int main(void)
                     "predictions if the first model is cached.");
         }
 
-        // Just construct the Two_Algo with the given residuals.
-        combine = new Two_Algo(RESIDUALS_FILE, INTERMED_PRED_FILE,
+        // Just construct the Two_Algo and map the given residuals.
+        combine = new Two_Algo(TRAIN_SETS, INTERMED_PRED_FILE,
                                RATING_SIG_FIGS, DELETE_INTERMED_PRED_FILE);
+        combine->loadResiduals(RESIDUALS_FILE);
         cout << "\nTwo_Algo is using cached residuals of the first model."
             << endl;
     }
     else
     {
         // Construct the Two_Algo to work with the training set.
-        combine = new Two_Algo(TRAIN_UM, INTERMED_PRED_FILE,
+        combine = new Two_Algo(TRAIN_SETS, INTERMED_PRED_FILE,
                                RATING_SIG_FIGS, DELETE_INTERMED_PRED_FILE);
 
-        TimeSVDPP predAlgoTimeSVDPP(NUM_USERS, NUM_MOVIES, NUM_DATES,
+        TimeSVDPP predAlgoTimeSVDPP(ratings.numUsers(), ratings.numItems(),
+                                    ratings.numDates(),
                                     MEAN_RATING_TRAINING_SET, NUM_FACTORS,
                                     NUM_ITERATIONS, NUM_TIME_BINS,
                                     INCLUDE_USER_FAC_MAT_TIME,
@@ -125,8 +129,8 @@ int main(void)
 
     // Setting up the second model and outputting predictions.
     {
-        KNN predAlgoKNN(NUM_USERS, NUM_MOVIES, MIN_COMMON, MAX_WEIGHT, 
-                        LOAD_P, SAVE_P, P_FN);
+        KNN predAlgoKNN(ratings.numUsers(), ratings.numItems(), MIN_COMMON,
+                        MAX_WEIGHT, LOAD_P, SAVE_P, P_FN);
 
         combine->trainSecond(predAlgoKNN);
         combine->saveSecondQualPredictions(predAlgoKNN, QUAL_DATA_FN,
@@ -18,17 +18,16 @@
 
 #include <netflix.hh>
 #include <knn.hh>
+#include <ratingstore.hh>
 
 using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
 
-// The Armadillo binary file to use for training.
-// Make sure that both UM and MU data are using the same
-// "type" of training resource (eg. probe, hidden, base, etc.)
-// const string TRAIN_UM = VALID_BIN;
-const string TRAIN_UM = ALL_TRAIN_BIN;
+// The sets to train on (views of the rating store).
+// const set<int> TRAIN_SETS = VALID_IDX;
+const set<int> TRAIN_SETS = ALL_TRAIN_IDX;
 
 // Minimum common neighbors required for decent prediction.
 const int MIN_COMMON = 24;
@@ -57,27 +56,27 @@ void testOnDataFile(KNN &predAlgo, const string &testFileName,
                     const string &outputFileName);
 
 // Compute the probe RMSE of our KNN model.
-float computeRMSE(KNN &predAlgo, const string &testFileName);
+float computeRMSE(KNN &predAlgo, const fmat &testSet);
 
 int main(void)
 {
     cout << "Start KNN..." << endl;
     cout << "Load UM matrix..." << endl;
-    // Load from binary.
-    fmat trainingSetUM;
-    trainingSetUM.load(TRAIN_UM, arma_binary);
+    // Map the rating store, and view the training sets in it.
+    RatingStore ratings(RATINGS_STORE);
+    RatingView trainingSetUM = ratings.view(TRAIN_SETS);
     cout << "Finished loading UM matrix." << endl;
 
     // Initializing the KNN.
-    KNN knn(NUM_USERS, NUM_MOVIES, MIN_COMMON, MAX_WEIGHT,
-            LOAD_P, SAVE_P, P_PATH);
+    KNN knn(ratings.numUsers(), ratings.numItems(), MIN_COMMON,
+            MAX_WEIGHT, LOAD_P, SAVE_P, P_PATH);
     knn.train(trainingSetUM);
 
     // Go through qual.dta to produce a prediction file.
     testOnDataFile(knn, QUAL_DATA_FN, OUTPUT_FN);
 
     // Get probe RMSE.
-    float probeRMSE = computeRMSE(knn, PROBE_BIN);
+    float probeRMSE = computeRMSE(knn, loadRatings(PROBE_IDX));
 
     cout << "Probe RMSE: " << probeRMSE << endl;
     cout << "KNN completed.\n";
@@ -85,40 +84,26 @@ int main(void)
 
 /**
  * Compute the RMSE of a given prediction algorithm on a certain set of
- * data. Note that testFileName must refer to an **Armadillo binary** in
- * this case. This binary must represent a 4 x N matrix, where N is the
- * number of test points.
+ * data: a 4 x N matrix, where N is the number of test points.
  *
  */
-float computeRMSE(KNN &predAlgo, const string &testFileName)
+float computeRMSE(KNN &predAlgo, const fmat &testSet)
 {
-    // Load from binary.
-    fmat testSet;
-    testSet.load(testFileName, arma_binary);
-
-    // The test set should have four rows.
-    if (testSet.n_rows != 4)
-    {
-        throw invalid_argument("File " + testFileName + " did not have " +
-                               "four rows!");
-    }
-
     // The number we divide by in computing the RMSE.
     int nMinusOne = testSet.n_cols - 1;
 
+    // Predict the whole test set in one batch.
+    vector<float> predictions(testSet.n_cols);
+    predAlgo.predictAll(testSet, predictions.data(), true);
+
     // Accumulator for RMSE (take square root at the end)
     float rmse = 0.0;
 
     for (unsigned int i = 0; i < testSet.n_cols; i ++)
     {
-        int user = roundToInt(testSet(USER_ROW, i));
-        int item = roundToInt(testSet(MOVIE_ROW, i));
-        int date = roundToInt(testSet(DATE_ROW, i));
         float actualRating = testSet(RATING_ROW, i);
         
-        float prediction = predAlgo.predict(user, item, date, true);
-        
-        rmse += pow(actualRating - prediction, 2.0)/nMinusOne;
+        rmse += pow(actualRating - predictions[i], 2.0)/nMinusOne;
     }
 
     return sqrt(rmse);
@@ -133,50 +118,20 @@ float computeRMSE(KNN &predAlgo, const string &testFileName)
 void testOnDataFile(KNN &predAlgo, const string &testFileName,
                     const string &outputFileName)
 {
-    ifstream testDataFile(testFileName);
-    ofstream outputFile(outputFileName); 
-    
-    if (testDataFile.fail())
-    {
-        throw runtime_error("Couldn't find test file at " + testFileName);
-    }
-
-    if (outputFile.fail())
-    {
-        throw runtime_error("Couldn't open output file at " 
-                            + outputFileName);
-    }
-
-    string testDataLine;
-    
     cout << "\nTesting on data in " << testFileName << "..." << endl;
 
-    while (getline(testDataFile, testDataLine))
-    {
-        // Read the line and split it.
-        vector<int> thisLineVec;
-        splitIntoInts(testDataLine, DELIMITER, thisLineVec);
-
-        if (thisLineVec.size() != 3)
-        {
-            throw logic_error("The line \"" + testDataLine + "\" did not "
-                              "contain three delimiter-separated "
-                              "entries!");
-        }
-        
-        // The first entry is the user ID, the second entry is the item ID,
-        // and the third entry is the date. All of these should be
-        // zero-indexed!
-        int user = thisLineVec[0];
-        int item = thisLineVec[1];
-        int date = thisLineVec[2];
-        
-        // Output the prediction to file.
-        float prediction = predAlgo.predict(user, item, date, true);
-        outputFile << setprecision(RATING_SIG_FIGS) << prediction << endl;
-    }
-    
-    outputFile.close();
+    // Load the (cached) binary index of the test file and predict it in
+    // one batch.
+    Mat<int> testIndex = loadQualIndex(testFileName);
+    vector<float> predictions(testIndex.n_rows);
+    predAlgo.predictBatch(testIndex.colptr(USER_ROW),
+                          testIndex.colptr(MOVIE_ROW),
+                          testIndex.colptr(DATE_ROW),
+                          predictions.data(), testIndex.n_rows, true);
+
+    // Output the predictions to file.
+    writePredictions(outputFileName, predictions.data(), predictions.size(),
+                     RATING_SIG_FIGS);
 
     cout << "\nOutputted predictions on " << testFileName << " to the " 
         "output file " << outputFileName << endl;
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <iomanip>
+
+#include <microbench.hh>
+
+using namespace std;
+
+
+/* Allocation counting */
+
+// glibc's allocator, which the replacements below hand every call to.
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+}
+
+// Constant-initialized, so it's ready before any allocation.
+static atomic<uint64_t> numAllocations(0);
+
+static inline void countAllocation()
+{
+    numAllocations.fetch_add(1, memory_order_relaxed);
+}
+
+// These replace the C library's functions in the binary, so allocations
+// made by operator new and by Armadillo (which allocates with malloc or
+// posix_memalign) are counted alike. free() is left alone.
+extern "C"
+{
+    void *malloc(size_t size) noexcept
+    {
+        countAllocation();
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size) noexcept
+    {
+        countAllocation();
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size) noexcept
+    {
+        countAllocation();
+        return __libc_realloc(ptr, size);
+    }
+
+    void *memalign(size_t alignment, size_t size) noexcept
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        countAllocation();
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept
+    {
+        countAllocation();
+        void *memory = __libc_memalign(alignment, size);
+        if (memory == NULL)
+        {
+            return ENOMEM;
+        }
+        *ptr = memory;
+        return 0;
+    }
+}
+
+
+namespace microbench
+{
+    uint64_t allocationCount()
+    {
+        return numAllocations.load(memory_order_relaxed);
+    }
+
+
+    static double median(vector<double> values)
+    {
+        sort(values.begin(), values.end());
+        size_t mid = values.size() / 2;
+        return values.size() % 2 == 1 ? values[mid]
+                                      : (values[mid - 1] + values[mid]) / 2;
+    }
+
+
+    void Runner::record(const string &name, size_t batchSize,
+                        const vector<double> &nanos,
+                        const vector<double> &ticks,
+                        uint64_t allocations)
+    {
+        Result result;
+        result.name = name;
+        result.batchSize = batchSize;
+        result.iterations = batchSize * nanos.size();
+        result.medianNanos = median(nanos);
+        result.minNanos = *min_element(nanos.begin(), nanos.end());
+        result.medianCycles = median(ticks);
+        result.allocations = (double) allocations / result.iterations;
+
+        vector<double> deviations;
+        for (double n : nanos)
+        {
+            deviations.push_back(abs(n - result.medianNanos));
+        }
+        result.madNanos = median(deviations);
+
+        results.push_back(result);
+    }
+
+
+    void Runner::printTable(ostream &out) const
+    {
+        out << left << setw(36) << "benchmark" << right << setw(12)
+            << "ns/iter" << setw(9) << "+/-" << setw(12) << "min ns"
+            << setw(12) << "cycles" << setw(10) << "allocs" << setw(10)
+            << "relative" << endl;
+
+        // Each variant is compared with the first variant of its
+        // primitive (the part of the name before the '/').
+        string primitive;
+        double baseNanos = 0.0;
+
+        for (const Result &result : results)
+        {
+            string thisPrimitive = result.name.substr(0,
+                result.name.find('/'));
+            if (thisPrimitive != primitive)
+            {
+                primitive = thisPrimitive;
+                baseNanos = result.medianNanos;
+            }
+
+            out << left << setw(36) << result.name << right << fixed
+                << setprecision(2) << setw(12) << result.medianNanos
+                << setw(8) << 100.0 * result.madNanos / result.medianNanos
+                << "%" << setw(12) << result.minNanos << setw(12)
+                << setprecision(1) << result.medianCycles << setw(10)
+                << setprecision(2) << result.allocations << setw(9)
+                << setprecision(2) << baseNanos / result.medianNanos << "x"
+                << endl;
+        }
+    }
+
+
+    void Runner::writeJson(ostream &out) const
+    {
+        for (const Result &result : results)
+        {
+            out << defaultfloat << setprecision(6)
+                << "{\"name\": \"" << result.name << "\", "
+                << "\"batch_size\": " << result.batchSize << ", "
+                << "\"iterations\": " << result.iterations << ", "
+                << "\"ns_per_iter\": " << result.medianNanos << ", "
+                << "\"ns_mad\": " << result.madNanos << ", "
+                << "\"ns_min\": " << result.minNanos << ", "
+                << "\"cycles_per_iter\": " << result.medianCycles << ", "
+                << "\"allocs_per_iter\": " << result.allocations << "}"
+                << endl;
+        }
+    }
+}
@@ -0,0 +1,183 @@
+/*
+ * A small harness for timing the primitives our models are built on (a
+ * dot product, a sparse lookup, ...), one at a time and side by side with
+ * their replacements. It has no dependencies beyond the standard library.
+ *
+ * Each benchmark is a callable that runs one iteration, given the number of
+ * the iteration (so it can walk through its inputs). The harness first
+ * doubles the number of iterations per sample until a sample takes
+ * sampleSeconds (which also warms up caches and branch predictors), then
+ * takes numSamples samples. The time per iteration is reported as the
+ * median over the samples, with the median absolute deviation as its
+ * spread, so a stray interrupt or page fault doesn't skew the result.
+ *
+ * Each sample also counts cycles (with the time stamp counter on x86, so
+ * these are reference cycles, which don't follow frequency scaling) and
+ * memory allocations. Allocations are counted by microbench.cc, which
+ * replaces malloc and friends in any binary it's linked into.
+ *
+ */
+
+#ifndef MICROBENCH_HH
+#define MICROBENCH_HH
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace microbench
+{
+    /* The number of allocations made so far, by every thread. */
+    uint64_t allocationCount();
+
+    /* The time stamp counter, or 0 where there's none. */
+    inline uint64_t cycles()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    /* Keep the compiler from optimizing away the computation of value. */
+    template <typename T>
+    inline void doNotOptimize(const T &value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    /* Keep the compiler from optimizing away (or reordering) stores. */
+    inline void clobberMemory()
+    {
+        asm volatile("" : : : "memory");
+    }
+
+
+    struct Result
+    {
+        std::string name;
+
+        // The iterations per sample, and in all samples.
+        size_t batchSize;
+        size_t iterations;
+
+        // Per iteration: the median and fastest time of the samples and
+        // the median absolute deviation of their times, and the median
+        // cycles. Allocations are averaged over every iteration.
+        double medianNanos;
+        double minNanos;
+        double madNanos;
+        double medianCycles;
+        double allocations;
+    };
+
+
+    class Runner
+    {
+    private:
+        const int numSamples;
+        const double sampleSeconds;
+
+        // Only benchmarks whose names contain this are run.
+        const std::string filter;
+
+        std::vector<Result> results;
+
+        // Summarizes the samples of a benchmark into a Result.
+        void record(const std::string &name, size_t batchSize,
+                    const std::vector<double> &nanos,
+                    const std::vector<double> &ticks,
+                    uint64_t allocations);
+
+    public:
+        Runner(int numSamples = 31, double sampleSeconds = 0.002,
+               const std::string &filter = "")
+            : numSamples(numSamples), sampleSeconds(sampleSeconds),
+              filter(filter)
+        {
+        }
+
+        /* Benchmark body, which is called as body(i) for the ith
+         * iteration. Names are "primitive/variant", so that the variants
+         * of one primitive are listed together. */
+        template <typename Body>
+        void run(const std::string &name, Body body);
+
+        const std::vector<Result> &getResults() const { return results; }
+
+        /* Print the results as a table, with each variant's time relative
+         * to the first variant of its primitive. */
+        void printTable(std::ostream &out) const;
+
+        /* Write the results as JSON, one benchmark per line. */
+        void writeJson(std::ostream &out) const;
+    };
+
+
+    template <typename Body>
+    void Runner::run(const std::string &name, Body body)
+    {
+        using std::chrono::steady_clock;
+
+        if (name.find(filter) == std::string::npos)
+        {
+            return;
+        }
+
+        size_t next = 0;
+
+        // Find the batch size that makes a sample long enough.
+        size_t batchSize = 1;
+        while (true)
+        {
+            steady_clock::time_point start = steady_clock::now();
+            for (size_t i = 0; i < batchSize; i++)
+            {
+                body(next++);
+            }
+            std::chrono::duration<double> elapsed =
+                steady_clock::now() - start;
+
+            if (elapsed.count() >= sampleSeconds || batchSize >= (1u << 30))
+            {
+                break;
+            }
+            batchSize *= 2;
+        }
+
+        std::vector<double> nanos(numSamples), ticks(numSamples);
+        uint64_t allocations = 0;
+
+        for (int s = 0; s < numSamples; s++)
+        {
+            uint64_t allocationsBefore = allocationCount();
+            uint64_t cyclesBefore = cycles();
+            steady_clock::time_point start = steady_clock::now();
+
+            for (size_t i = 0; i < batchSize; i++)
+            {
+                body(next++);
+            }
+
+            steady_clock::time_point end = steady_clock::now();
+            uint64_t cyclesAfter = cycles();
+            allocations += allocationCount() - allocationsBefore;
+
+            nanos[s] = std::chrono::duration<double, std::nano>(
+                end - start).count() / batchSize;
+            ticks[s] = (double) (cyclesAfter - cyclesBefore) / batchSize;
+        }
+
+        record(name, batchSize, nanos, ticks, allocations);
+    }
+}
+
+#endif // MICROBENCH_HH
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include <mips.hh>
+#include <simd.hh>
+
+using std::cout;
+using std::endl;
+
+/**
+ * Clusters the columns of points into k clusters with Lloyd's algorithm,
+ * starting from k distinct random points. Clusters that end up empty are
+ * restarted at a random point. Returns the centroids (one per column), and
+ * writes each point's cluster to assignments.
+ */
+static fmat kMeans(const fmat &points, int k, int numIterations,
+                   std::mt19937 &engine, std::vector<int> &assignments)
+{
+    const int numPoints = points.n_cols;
+    std::uniform_int_distribution<int> randomPoint(0, numPoints - 1);
+
+    std::vector<int> order(numPoints);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), engine);
+
+    fmat centroids(points.n_rows, k);
+    for (int c = 0; c < k; c++)
+    {
+        centroids.col(c) = points.col(order[c]);
+    }
+
+    assignments.assign(numPoints, 0);
+
+    for (int iteration = 0; ; iteration++)
+    {
+        // Assign each point to its nearest centroid. |p - c|^2 = |p|^2 +
+        // |c|^2 - 2 p^T c, and |p|^2 doesn't change which c is nearest.
+        std::vector<float> centroidNorms(k);
+        for (int c = 0; c < k; c++)
+        {
+            centroidNorms[c] = simd::dot(centroids.colptr(c),
+                                         centroids.colptr(c),
+                                         centroids.n_rows);
+        }
+
+        fmat products = centroids.t() * points;
+
+        #pragma omp parallel for schedule(static)
+        for (int p = 0; p < numPoints; p++)
+        {
+            const float *pointProducts = products.colptr(p);
+            int nearest = 0;
+            float nearestDistance = centroidNorms[0] - 2 * pointProducts[0];
+
+            for (int c = 1; c < k; c++)
+            {
+                float distance = centroidNorms[c] - 2 * pointProducts[c];
+                if (distance < nearestDistance)
+                {
+                    nearest = c;
+                    nearestDistance = distance;
+                }
+            }
+
+            assignments[p] = nearest;
+        }
+
+        if (iteration == numIterations)
+        {
+            break;
+        }
+
+        // Move each centroid to the mean of its points.
+        std::vector<int> counts(k, 0);
+        centroids.zeros();
+
+        for (int p = 0; p < numPoints; p++)
+        {
+            simd::add(points.colptr(p), centroids.colptr(assignments[p]),
+                      points.n_rows);
+            counts[assignments[p]]++;
+        }
+
+        for (int c = 0; c < k; c++)
+        {
+            if (counts[c] == 0)
+            {
+                centroids.col(c) = points.col(randomPoint(engine));
+            }
+            else
+            {
+                centroids.col(c) /= (float) counts[c];
+            }
+        }
+    }
+
+    return centroids;
+}
+
+
+/**
+ * Builds the index (see mips.hh for how).
+ *
+ * @param model:            The model whose items are indexed. It must be
+ *                          ready for queries, and must outlive the index.
+ * @param numLists:         The number of inverted lists (k-means clusters).
+ *                          Around sqrt(numItems) is a good start.
+ * @param numSubspaces:     The number of pieces each item vector is split
+ *                          into for product quantization, i.e. the number
+ *                          of bytes stored per item.
+ * @param numIterations:    The number of k-means iterations to run (for
+ *                          the lists and for each subspace's codewords).
+ * @param seed:             Seed for k-means' random starting points.
+ *
+ */
+MipsIndex::MipsIndex(const FactorModel &model, int numLists,
+                     int numSubspaces, int numIterations, unsigned int seed) :
+    model(model),
+    numSubspaces(numSubspaces)
+{
+    if (!model.readyForQueries())
+    {
+        throw std::logic_error("Tried to index items, but the model isn't "
+                               "ready for queries!");
+    }
+
+    if (numLists < 1 || numSubspaces < 1 || numIterations < 0)
+    {
+        throw std::invalid_argument("An index needs at least one list and "
+                                    "one subspace!");
+    }
+
+    const fmat &itemFactors = model.itemFactors();
+    const fcolvec &itemBiases = model.itemBiases();
+    const int numFactors = itemFactors.n_rows;
+    const int numItems = itemFactors.n_cols;
+
+    dim = numFactors + 2;
+    subspaceDim = (dim + numSubspaces - 1) / numSubspaces;
+    paddedDim = subspaceDim * numSubspaces;
+    numLists = std::min(numLists, numItems);
+
+    // The augmented items [q_i; b_i; sqrt(maxNorm^2 - |q_i|^2 - b_i^2)],
+    // zero-padded to paddedDim.
+    fmat items(paddedDim, numItems, fill::zeros);
+    std::vector<float> norms(numItems);
+    float maxNorm = 0.0;
+
+    for (int item = 0; item < numItems; item++)
+    {
+        float *augmented = items.colptr(item);
+        std::copy(itemFactors.colptr(item),
+                  itemFactors.colptr(item) + numFactors, augmented);
+        augmented[numFactors] = itemBiases(item);
+
+        norms[item] = simd::dot(augmented, augmented, numFactors + 1);
+        maxNorm = std::max(maxNorm, norms[item]);
+    }
+
+    for (int item = 0; item < numItems; item++)
+    {
+        items(numFactors + 1, item) =
+            std::sqrt(std::max(maxNorm - norms[item], (float) 0.0));
+    }
+
+    std::mt19937 engine(seed);
+
+    // Cluster the items into lists.
+    std::vector<int> assignments;
+    centroids = kMeans(items, numLists, numIterations, engine, assignments);
+
+    centroidNorms.resize(numLists);
+    for (int list = 0; list < numLists; list++)
+    {
+        centroidNorms[list] = simd::dot(centroids.colptr(list),
+                                        centroids.colptr(list), paddedDim);
+    }
+
+    listOffsets.assign(numLists + 1, 0);
+    for (int item = 0; item < numItems; item++)
+    {
+        listOffsets[assignments[item] + 1]++;
+    }
+
+    for (int list = 0; list < numLists; list++)
+    {
+        listOffsets[list + 1] += listOffsets[list];
+    }
+
+    listItems.resize(numItems);
+    std::vector<size_t> next(listOffsets);
+    for (int item = 0; item < numItems; item++)
+    {
+        listItems[next[assignments[item]]++] = item;
+    }
+
+    // The residual of every item from its list's centroid, in list order.
+    fmat residuals(paddedDim, numItems);
+    for (int k = 0; k < numItems; k++)
+    {
+        int item = listItems[k];
+        residuals.col(k) = items.col(item) - centroids.col(assignments[item]);
+    }
+
+    // Learn each subspace's codewords, and encode the residuals.
+    const int numCodewords = std::min(MIPS_NUM_CODEWORDS, numItems);
+    codebooks.set_size(subspaceDim, MIPS_NUM_CODEWORDS, numSubspaces);
+    codebooks.zeros();
+    codes.resize((size_t) numItems * numSubspaces);
+
+    for (int m = 0; m < numSubspaces; m++)
+    {
+        fmat pieces = residuals.rows(m * subspaceDim,
+                                     (m + 1) * subspaceDim - 1);
+
+        std::vector<int> pieceCodes;
+        fmat codewords = kMeans(pieces, numCodewords, numIterations, engine,
+                                pieceCodes);
+        codebooks.slice(m).cols(0, numCodewords - 1) = codewords;
+
+        for (int k = 0; k < numItems; k++)
+        {
+            codes[(size_t) k * numSubspaces + m] = (uint8_t) pieceCodes[k];
+        }
+    }
+
+#ifndef NDEBUG
+    cout << "Built a MIPS index over " << numItems << " items (" << numLists
+         << " lists, " << numSubspaces << " bytes per item)." << endl;
+#endif
+}
+
+
+/**
+ * Returns the user's (approximately) n best items, best first. Only the
+ * numProbes lists nearest to the user are scanned, and only the numRerank
+ * best of their items (by approximate score) are scored exactly; see
+ * mips.hh. The scores returned are exact predicted ratings.
+ *
+ * @param user:         The user ID of interest.
+ * @param n:            The number of items to recommend.
+ * @param numProbes:    The number of lists to scan.
+ * @param numRerank:    The number of candidates to score exactly (at least
+ *                      n are).
+ * @param rated:        If given, items the user has rated are skipped.
+ *
+ */
+std::vector<Recommendation> MipsIndex::recommend(int user, size_t n,
+                                                 int numProbes,
+                                                 size_t numRerank,
+                                                 const RatedItems *rated)
+    const
+{
+    std::vector<Recommendation> recommendations;
+
+    if (n == 0)
+    {
+        return recommendations;
+    }
+
+    const fmat &itemFactors = model.itemFactors();
+    const fcolvec &itemBiases = model.itemBiases();
+    const IdMap &itemIds = model.itemIds();
+    const int numFactors = itemFactors.n_rows;
+
+    numProbes = std::max(1, std::min(numProbes, numLists()));
+    numRerank = std::max(numRerank, n);
+
+    // The augmented query [x_u; 1; 0].
+    fcolvec query(paddedDim, fill::zeros);
+    float userBias = model.userQuery(user, query.memptr());
+    query(numFactors) = 1.0;
+
+    // The lists nearest to the query: |query - c|^2 ranks like
+    // |c|^2 - 2 <query, c>.
+    fcolvec centroidScores = centroids.t() * query;
+
+    std::vector<std::pair<float, int> > listDistances(numLists());
+    for (int list = 0; list < numLists(); list++)
+    {
+        listDistances[list] = std::make_pair(
+            centroidNorms[list] - 2 * centroidScores(list), list);
+    }
+
+    std::partial_sort(listDistances.data(),
+                      listDistances.data() + numProbes,
+                      listDistances.data() + listDistances.size());
+
+    // <query piece, codeword> for every subspace and codeword.
+    std::vector<float> table((size_t) numSubspaces * MIPS_NUM_CODEWORDS);
+    for (int m = 0; m < numSubspaces; m++)
+    {
+        const float *queryPiece = query.memptr() + m * subspaceDim;
+
+        for (int c = 0; c < MIPS_NUM_CODEWORDS; c++)
+        {
+            table[m * MIPS_NUM_CODEWORDS + c] =
+                simd::dot(queryPiece, codebooks.slice(m).colptr(c),
+                          subspaceDim);
+        }
+    }
+
+    // Scan the lists, keeping the numRerank best approximate scores.
+    std::vector<Recommendation> candidates;
+    candidates.reserve(numRerank);
+
+    for (int probe = 0; probe < numProbes; probe++)
+    {
+        int list = listDistances[probe].second;
+
+        for (size_t k = listOffsets[list]; k < listOffsets[list + 1]; k++)
+        {
+            const uint8_t *itemCodes = codes.data() + k * numSubspaces;
+            float score = centroidScores(list);
+
+            for (int m = 0; m < numSubspaces; m++)
+            {
+                score += table[m * MIPS_NUM_CODEWORDS + itemCodes[m]];
+            }
+
+            // Only look up whether the user rated this item if it would
+            // make the cut.
+            if (candidates.size() == numRerank
+                && score <= candidates.front().score)
+            {
+                continue;
+            }
+
+            if (rated != NULL
+                && rated->hasRated(user, itemIds.external(listItems[k])))
+            {
+                continue;
+            }
+
+            Recommendation candidate;
+            candidate.item = listItems[k];
+            candidate.score = score;
+            offerRecommendation(candidates, numRerank, candidate);
+        }
+    }
+
+    // Score the candidates exactly, and keep the best n.
+    recommendations.reserve(n);
+
+    for (const Recommendation &candidate : candidates)
+    {
+        Recommendation exact;
+        exact.item = candidate.item;
+        exact.score = itemBiases(candidate.item) +
+            simd::dot(itemFactors.colptr(candidate.item), query.memptr(),
+                      numFactors);
+        offerRecommendation(recommendations, n, exact);
+    }
+
+    std::sort_heap(recommendations.begin(), recommendations.end(),
+                   betterRecommendation);
+
+    // Candidates are columns of itemFactors; hand out the original IDs.
+    for (Recommendation &recommendation : recommendations)
+    {
+        recommendation.item = itemIds.external(recommendation.item);
+        recommendation.score += userBias;
+    }
+
+    return recommendations;
+}
@@ -0,0 +1,87 @@
+/*
+ * An approximate maximum inner product search (MIPS) index over the items
+ * of a trained FactorModel: an inverted file (IVF) whose lists hold
+ * product-quantized (PQ) item vectors. It trades a little recall for
+ * scanning only a fraction of the items, and only a few bytes per item.
+ *
+ * Building the index:
+ *
+ *  1. Each item becomes a = [q_i; b_i; sqrt(maxNorm^2 - |q_i|^2 - b_i^2)].
+ *     A query [x_u; 1; 0] then has <query, a> = q_i^T x_u + b_i (the
+ *     item's score), and since every a has the same norm, the items with
+ *     the largest inner products are exactly the ones nearest to the
+ *     query in L2. This lets the index use ordinary (L2) k-means.
+ *  2. The items are clustered into numLists lists with k-means.
+ *  3. Each item's residual (a minus its list's centroid) is split into
+ *     numSubspaces pieces, and each piece is replaced by the nearest of
+ *     256 codewords learned (again with k-means) for that subspace.
+ *
+ * Searching: the numProbes lists whose centroids are nearest the query are
+ * scanned. An item's approximate score is <query, centroid> plus one table
+ * lookup per subspace (inner products are linear, so one table of
+ * <query piece, codeword> serves every list). The numRerank best
+ * candidates are then scored exactly, and the best n are returned.
+ * Raising numProbes and numRerank raises recall, at the cost of latency.
+ *
+ */
+
+#ifndef MIPS_HH
+#define MIPS_HH
+
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <factormodel.hh>
+#include <topn.hh>
+
+using namespace arma;
+
+// The number of codewords per subspace (so codes fit in one byte).
+#define MIPS_NUM_CODEWORDS 256
+
+class MipsIndex
+{
+private:
+    const FactorModel &model;
+
+    // The dimension of the augmented item vectors, and that dimension
+    // rounded up to a whole number of subspaces of subspaceDim each.
+    int dim, paddedDim, subspaceDim, numSubspaces;
+
+    // One column per list, each paddedDim long (padding is zero).
+    fmat centroids;
+
+    // |centroid|^2 of each list.
+    std::vector<float> centroidNorms;
+
+    // The items (columns of the model's item factors; see
+    // FactorModel::itemIds()) of list l are listItems[listOffsets[l]] to
+    // listItems[listOffsets[l + 1] - 1], and the codes of the kth item
+    // (in list order) are codes[k * numSubspaces] onwards.
+    std::vector<size_t> listOffsets;
+    std::vector<int> listItems;
+    std::vector<uint8_t> codes;
+
+    // The codewords of each subspace: a subspaceDim x MIPS_NUM_CODEWORDS
+    // slice per subspace.
+    fcube codebooks;
+
+public:
+    /* Build an index over model's items (the model must be ready for
+     * queries, and must outlive the index). */
+    MipsIndex(const FactorModel &model, int numLists, int numSubspaces,
+              int numIterations = 10, unsigned int seed = 0);
+
+    /* The user's (approximately) n best items, best first, skipping the
+     * ones in rated (if given). */
+    std::vector<Recommendation> recommend(int user, size_t n, int numProbes,
+                                          size_t numRerank,
+                                          const RatedItems *rated = NULL)
+        const;
+
+    int numLists() const { return centroids.n_cols; }
+};
+
+#endif // MIPS_HH
@@ -0,0 +1,138 @@
+/**
+ * Compares the approximate MIPS index against exact top-N recommendation.
+ * A cached SVD++ model is loaded and indexed. A sample of users is then
+ * ranked exactly (with TopN) and with the index at several settings, and
+ * the recall@N and per-query latency of each setting are reported.
+ *
+ * Note: The main method does not expect any arguments in this case.
+ *
+ */
+
+#include <algorithm>
+#include <armadillo>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <netflix.hh>
+#include <mips.hh>
+#include <ratingstore.hh>
+#include <svdpp.hh>
+#include <topn.hh>
+
+using namespace std;
+using namespace std::chrono;
+using namespace arma;
+using namespace netflix; // challenge-related constants/functions.
+
+
+/* Constants */
+
+// The sets the cached model was trained on. Movies rated in them are never
+// recommended.
+const set<int> TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
+
+// These must match the cached model (see svdpp_test.cc).
+const int NUM_FACTORS = 200;
+const int NUM_ITERATIONS = 25;
+const string CHECKPOINT_FN = "data/svdpp_cached/svdpp.ckpt";
+
+// Index parameters: about sqrt(NUM_MOVIES) lists, and one byte per six
+// dimensions of the (202-dimensional) augmented item vectors.
+const int NUM_LISTS = 128;
+const int NUM_SUBSPACES = 34;
+
+// The number of movies to recommend to each user (the N in recall@N).
+const int NUM_RECOMMENDATIONS = 10;
+
+// The number of users to sample.
+const int NUM_QUERY_USERS = 2000;
+
+// The (numProbes, numRerank) settings to try, from fast to accurate.
+const int NUM_SETTINGS = 6;
+const int PROBES[NUM_SETTINGS] = {1, 2, 4, 8, 16, 32};
+const int RERANKS[NUM_SETTINGS] = {20, 40, 80, 150, 300, 600};
+
+
+int main(void)
+{
+    // The model is sized from the rating store's dimensions.
+    RatingStore ratings(RATINGS_STORE);
+
+    SVDPP predAlgo(ratings.numUsers(), ratings.numItems(),
+                   MEAN_RATING_TRAINING_SET, NUM_FACTORS, NUM_ITERATIONS,
+                   N_FN, CHECKPOINT_FN);
+
+    RatedItems rated(ratings.view(TRAIN_SETS), ratings.numUsers());
+
+    // Spread the sample over all users.
+    vector<int> users(NUM_QUERY_USERS);
+    for (int i = 0; i < NUM_QUERY_USERS; i++)
+    {
+        users[i] = (int) ((long) i * ratings.numUsers() / NUM_QUERY_USERS);
+    }
+
+    // Exact answers, one query at a time (for a fair latency comparison).
+    TopN topN(predAlgo, &rated);
+    vector<vector<Recommendation> > exact(NUM_QUERY_USERS);
+
+    time_point<system_clock> start = system_clock::now();
+    for (int i = 0; i < NUM_QUERY_USERS; i++)
+    {
+        exact[i] = topN.recommend(users[i], NUM_RECOMMENDATIONS);
+    }
+    duration<double, std::micro> elapsed = system_clock::now() - start;
+
+    cout << "Exact top-" << NUM_RECOMMENDATIONS << ": "
+         << elapsed.count() / NUM_QUERY_USERS << " us/query" << endl;
+
+    start = system_clock::now();
+    MipsIndex index(predAlgo, NUM_LISTS, NUM_SUBSPACES);
+    duration<float> secondsElapsed = system_clock::now() - start;
+
+    cout << "Built the index in " << secondsElapsed.count() << " seconds.\n"
+         << endl;
+
+    cout << setw(8) << "probes" << setw(8) << "rerank" << setw(12)
+         << "recall@" + to_string(NUM_RECOMMENDATIONS) << setw(12)
+         << "us/query" << endl;
+
+    for (int s = 0; s < NUM_SETTINGS; s++)
+    {
+        vector<vector<Recommendation> > approx(NUM_QUERY_USERS);
+
+        start = system_clock::now();
+        for (int i = 0; i < NUM_QUERY_USERS; i++)
+        {
+            approx[i] = index.recommend(users[i], NUM_RECOMMENDATIONS,
+                                        PROBES[s], RERANKS[s], &rated);
+        }
+        elapsed = system_clock::now() - start;
+
+        // The fraction of the exact top N that the index found.
+        long found = 0, total = 0;
+        for (int i = 0; i < NUM_QUERY_USERS; i++)
+        {
+            for (const Recommendation &want : exact[i])
+            {
+                for (const Recommendation &got : approx[i])
+                {
+                    if (got.item == want.item)
+                    {
+                        found++;
+                        break;
+                    }
+                }
+            }
+            total += exact[i].size();
+        }
+
+        cout << setw(8) << PROBES[s] << setw(8) << RERANKS[s] << setw(12)
+             << fixed << setprecision(4) << (double) found / total
+             << setw(12) << setprecision(1)
+             << elapsed.count() / NUM_QUERY_USERS << endl;
+    }
+}
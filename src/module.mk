@@ -1,3 +1,4 @@
 BINS += timesvdpp_test svdpp_test svd_test knn_test globals_test \
-	knn_on_globals rbm_new_test knn_on_timesvdpp rbm_test 
+	knn_on_globals rbm_new_test knn_on_timesvdpp rbm_test chain_test topn_test \
+	mips_bench predict_server benchmark kernel_bench
 # EXTS += interface.so
@@ -1,4 +1,8 @@
+#include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
 #ifndef NDEBUG
 #include <iostream>
 #endif
@@ -66,7 +70,7 @@ namespace netflix
         // Line count
         int lines = 0;
         // Count the number of lines in the data file
-        while ( std::getline(indexFile, line) != 0 ) ++lines;
+        while ( std::getline(indexFile, line) ) ++lines;
 
         // Clear the eofbit
         indexFile.clear();
@@ -124,4 +128,191 @@ namespace netflix
         return data;
     }
 
+
+    /**
+     * Loads the (user, item, date) triples of a qual-style text file (one
+     * space-separated triple per line) as an N x 3 matrix of ints. Column
+     * USER_ROW holds the user IDs, MOVIE_ROW the item IDs and DATE_ROW the
+     * dates, so each column can be handed straight to
+     * BaseAlgorithm::predictBatch().
+     *
+     * The text is only parsed once: the result is cached in Armadillo's
+     * binary format at qualPath + QUAL_INDEX_SUFFIX, and later calls load
+     * the cache unless the text file has been modified since.
+     *
+     * @param qualPath: The text file to index.
+     *
+     */
+    Mat<int> loadQualIndex(const std::string &qualPath)
+    {
+        const std::string indexPath = qualPath + QUAL_INDEX_SUFFIX;
+        Mat<int> index;
+
+        struct stat qualStat, indexStat;
+        bool haveQual = stat(qualPath.c_str(), &qualStat) == 0;
+        bool haveIndex = stat(indexPath.c_str(), &indexStat) == 0;
+
+        if (haveIndex && (!haveQual || indexStat.st_mtime >= qualStat.st_mtime)
+            && index.load(indexPath, arma_binary) && index.n_cols == 3)
+        {
+            return index;
+        }
+
+        std::ifstream qualFile(qualPath);
+
+        if (qualFile.fail())
+        {
+            throw std::runtime_error("Couldn't find qual file at " + qualPath);
+        }
+
+        std::vector<int> users, items, dates;
+        int user, item, date;
+
+        while (qualFile >> user >> item >> date)
+        {
+            users.push_back(user);
+            items.push_back(item);
+            dates.push_back(date);
+        }
+
+        if (!qualFile.eof())
+        {
+            throw std::runtime_error("The qual file at " + qualPath + " did "
+                                     "not contain three integers per line!");
+        }
+
+        index.set_size(users.size(), 3);
+        std::copy(users.begin(), users.end(), index.colptr(USER_ROW));
+        std::copy(items.begin(), items.end(), index.colptr(MOVIE_ROW));
+        std::copy(dates.begin(), dates.end(), index.colptr(DATE_ROW));
+
+        // A failure to cache just means we parse again next time.
+        index.save(indexPath, arma_binary);
+
+#ifndef NDEBUG
+        std::cout << "Indexed " << index.n_rows << " points of " << qualPath
+                  << " into " << indexPath << std::endl;
+#endif
+
+        return index;
+    }
+
+
+    /**
+     * Formats a prediction the way "stream << setprecision(sigFigs)" (i.e.
+     * printf's %.*g) would, without consulting the locale. Values in
+     * [1, 10) -- every bounded rating -- take a fast path that scales the
+     * value to an integer; anything else falls back to snprintf in the
+     * default "C" locale.
+     *
+     * @param prediction:   The value to format.
+     * @param sigFigs:      The number of significant figures (1 to 9).
+     * @param output:       A buffer with room for at least 32 characters.
+     *
+     * @return The number of characters written (no terminator is added).
+     *
+     */
+    int formatPrediction(float prediction, int sigFigs, char *output)
+    {
+        static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5,
+                                               1e6, 1e7, 1e8, 1e9};
+
+        if (prediction >= 1.0 && prediction < 10.0 && sigFigs >= 1
+            && sigFigs <= 9)
+        {
+            // Exact in double for sigFigs <= 9, so nearbyint's
+            // round-half-even matches printf on ties.
+            long long scaled = (long long)
+                std::nearbyint(prediction * POWERS_OF_TEN[sigFigs - 1]);
+
+            // Only fall through if rounding carried into a second digit.
+            if (scaled < (long long) POWERS_OF_TEN[sigFigs])
+            {
+                char digits[10];
+                for (int i = sigFigs - 1; i >= 0; i--)
+                {
+                    digits[i] = '0' + scaled % 10;
+                    scaled /= 10;
+                }
+
+                // %g drops trailing zeros, and the point if nothing is left.
+                int last = sigFigs - 1;
+                while (last > 0 && digits[last] == '0')
+                {
+                    last--;
+                }
+
+                int length = 0;
+                output[length++] = digits[0];
+                if (last > 0)
+                {
+                    output[length++] = '.';
+                    for (int i = 1; i <= last; i++)
+                    {
+                        output[length++] = digits[i];
+                    }
+                }
+
+                return length;
+            }
+        }
+
+        return snprintf(output, 32, "%.*g", sigFigs, prediction);
+    }
+
+
+    /**
+     * Writes predictions to a text file, one per line, formatted by
+     * formatPrediction(). Output is assembled in a large buffer and written
+     * in a few big writes, with no per-line flushing.
+     *
+     * @param outputPath:   The file to (over)write.
+     * @param predictions:  The n predictions to write.
+     * @param n:            The number of predictions.
+     * @param sigFigs:      Significant figures for each prediction.
+     *
+     */
+    void writePredictions(const std::string &outputPath,
+                          const float *predictions, size_t n, int sigFigs)
+    {
+        const size_t BUFFER_SIZE = 1 << 20;
+
+        FILE *outputFile = fopen(outputPath.c_str(), "w");
+
+        if (outputFile == NULL)
+        {
+            throw std::runtime_error("Couldn't open output file at " 
+                                     + outputPath);
+        }
+
+        std::vector<char> buffer(BUFFER_SIZE);
+        size_t used = 0;
+        bool failed = false;
+
+        for (size_t i = 0; i < n && !failed; i++)
+        {
+            // Leave room for one formatted value and its newline.
+            if (used + 64 > BUFFER_SIZE)
+            {
+                failed = fwrite(buffer.data(), 1, used, outputFile) != used;
+                used = 0;
+            }
+
+            used += formatPrediction(predictions[i], sigFigs,
+                                     buffer.data() + used);
+            buffer[used++] = '\n';
+        }
+
+        if (!failed && used > 0)
+        {
+            failed = fwrite(buffer.data(), 1, used, outputFile) != used;
+        }
+
+        if (fclose(outputFile) != 0 || failed)
+        {
+            throw std::runtime_error("Couldn't write predictions to "
+                                     + outputPath);
+        }
+    }
+
 }
@@ -32,7 +32,10 @@ namespace netflix
     // Represents an entry with no rating (or rather, an unknown rating).
     constexpr int NO_RATING = 0;
 
-    // The total number of users, movies, and dates in the dataset.
+    // The total number of users, movies, and dates in the Netflix dataset.
+    // Rating stores record the dimensions of whatever data they were built
+    // from (see RatingStore::numUsers()), which is what models should be
+    // sized by.
     constexpr int NUM_USERS = 458293;
     constexpr int NUM_MOVIES = 17770;
     constexpr int NUM_DATES = 2243;
@@ -97,24 +100,21 @@ namespace netflix
                                                    VALID_SET, PROBE_SET};
 
 
-    // These are the file names of where we're storing various subsets of
-    // the dataset in Armadillo's binary format (as fmats). We don't
-    // include "qual" among these subsets since qual should not be used for
-    // testing. The contents of these matrices should be self-explanatory.
-    // Run the helper code in "binarize_data.cc" to create them once.
-    const std::string BASE_BIN                  = "data/um/base.mat";
-    const std::string HIDDEN_BIN                = "data/um/hidden.mat";
-    const std::string VALID_BIN                 = "data/um/valid.mat";
-    const std::string PROBE_BIN                 = "data/um/probe.mat";
-    const std::string BASE_HIDDEN_BIN           = "data/um/base_"
-                                                  "hidden.mat";
-    const std::string BASE_HIDDEN_VALID_BIN     = "data/um/base_hidden_"
-                                                  "valid.mat";
-    const std::string ALL_TRAIN_BIN             = "data/um/base_hidden_valid_"
-                                                  "probe.mat";
-    const std::string MU_BASE_BIN               = "data/mu/base.mat";
-    const std::string MU_ALL_TRAIN_BIN          = "data/mu/base_hidden_"
-                                                  "valid_probe.mat";
+    // The master rating stores (see ratingstore.hh): every rating outside
+    // of qual, once, in (user, movie) and (movie, user) order, tagged with
+    // its set. Any of the subsets above is a view of these. Run the helper
+    // code in "binarize_data.cc" to create them once.
+    const std::string RATINGS_STORE             = "data/um/ratings.ckpt";
+    const std::string MU_RATINGS_STORE          = "data/mu/ratings.ckpt";
+
+    // The (user, movie) store split into shards of whole users, for
+    // training without loading every rating at once (see shardsource.hh).
+    // Run the helper code in "shard_ratings.cc" to create them.
+    const std::string RATING_SHARDS             = "data/um/shards/ratings";
+
+    // Where models append their training telemetry (see telemetry.hh),
+    // one JSON record per line.
+    const std::string TELEMETRY_FN = "data/telemetry.jsonl";
 
     // The number of columns in the data files (not including qual).
     constexpr int COLUMNS = 4;
@@ -129,11 +129,19 @@ namespace netflix
     // N).
     const std::string DELIMITER = " ";
     
+    // Suffix of the binary index cached next to a qual-style text file by
+    // loadQualIndex().
+    const std::string QUAL_INDEX_SUFFIX = ".idx.mat";
+
     /* Convenience functions */
     void splitIntoInts(const std::string &str, const std::string &delimiter,
                        std::vector<int> &output);
     fmat parseData(const std::string &indexPath, const std::string &dataPath, 
                    const std::set<int> &indices);
+    Mat<int> loadQualIndex(const std::string &qualPath);
+    int formatPrediction(float prediction, int sigFigs, char *output);
+    void writePredictions(const std::string &outputPath,
+                          const float *predictions, size_t n, int sigFigs);
     
     /**
      * Rounds a float to an int without truncating. Used to convert user
@@ -0,0 +1,713 @@
+/**
+ * A long-running prediction server. It loads one model (from its cache,
+ * where it has one) and then answers requests over a Unix domain socket,
+ * so that clients pay for loading the model once instead of on every run.
+ *
+ * Usage: predict_server <svd|svdpp|timesvdpp|globals|knn> [socket path]
+ *
+ * The protocol is line-based text. Each request is one line, and gets one
+ * line back:
+ *
+ *      P <user> <movie> <date>     ->  <predicted rating>
+ *      T <user> <n>                ->  <movie>:<score> ... (best first)
+ *      S                           ->  latency statistics
+ *
+ * Malformed requests, and requests in a batch that the model failed on,
+ * get "E <reason>". Top-N requests are only served for the factor models
+ * (svd and svdpp), and skip movies rated in the model's training set.
+ *
+ * Every connection is served by its own thread (up to MAX_CONNECTIONS at a
+ * time; clients past that get "E server busy" and are disconnected), but
+ * the models are only ever called from a single batching thread: requests
+ * from all connections are queued, and each time the batching thread is
+ * free it takes everything queued (sorted by user) as one batch. Batches
+ * therefore grow with the load, and a lone request isn't held back waiting
+ * for company. Clients that pipeline several lines per write get those
+ * lines batched together too.
+ *
+ */
+
+#include <algorithm>
+#include <armadillo>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <basealgorithm.hh>
+#include <factormodel.hh>
+#include <globals.hh>
+#include <histogram.hh>
+#include <knn.hh>
+#include <netflix.hh>
+#include <ratingstore.hh>
+#include <svd.hh>
+#include <svdpp.hh>
+#include <timesvdpp.hh>
+#include <topn.hh>
+
+using namespace std;
+using namespace std::chrono;
+using namespace arma;
+using namespace netflix; // challenge-related constants/functions.
+
+
+/* Constants */
+
+const string DEFAULT_SOCKET_PATH = "/tmp/netflix_predict.sock";
+
+// The largest request line accepted; longer ones close the connection.
+const size_t MAX_LINE_LENGTH = 4096;
+
+// The largest n a top-N request may ask for.
+const size_t MAX_RECOMMENDATIONS = 1000;
+
+// The most clients served at once. Each has a thread of its own.
+const int MAX_CONNECTIONS = 256;
+
+// These must match the cached models (see svd_test.cc, svdpp_test.cc and
+// timesvdpp_test.cc). The training sets are only read to find the movies
+// each user has rated, for top-N requests.
+const int SVD_NUM_FACTORS = 1000;
+const int SVD_NUM_ITERATIONS = 40;
+const set<int> SVD_TRAIN_SETS = ALL_TRAIN_IDX;
+const string SVD_CHECKPOINT_FN = "data/svd_cached/svd.ckpt";
+
+const int SVDPP_NUM_FACTORS = 200;
+const int SVDPP_NUM_ITERATIONS = 25;
+const set<int> SVDPP_TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
+const string SVDPP_CHECKPOINT_FN = "data/svdpp_cached/svdpp.ckpt";
+
+const int TIMESVDPP_NUM_FACTORS = 110;
+const int TIMESVDPP_NUM_ITERATIONS = 40;
+const int TIMESVDPP_NUM_TIME_BINS = 30;
+const bool TIMESVDPP_INCLUDE_USER_FAC_MAT_TIME = true;
+const string TIMESVDPP_CHECKPOINT_FN = "data/timesvdpp_cached/timesvdpp.ckpt";
+
+// Globals and KNN have no cache, so they're rebuilt at startup (KNN from
+// its saved P matrix). These match globals_test.cc and knn_test.cc.
+const int GLOBALS_LEVEL = 10;
+const set<int> GLOBALS_TRAIN_SETS = ALL_TRAIN_IDX;
+
+const int KNN_MIN_COMMON = 24;
+const int KNN_MAX_WEIGHT = 30;
+const set<int> KNN_TRAIN_SETS = ALL_TRAIN_IDX;
+const string KNN_P_FN = "data/knn_cached/knn-p.dta";
+
+
+/* One parsed request line, and (once answered) its reply. */
+struct Request
+{
+    // 'P' (predict), 'T' (top-N), 'S' (statistics) or 'E' (malformed, or
+    // failed).
+    char kind;
+
+    int user;
+    int item;
+    int date;
+    size_t n;
+
+    float rating;
+    vector<Recommendation> recommendations;
+
+    // The reply to 'S' and 'E' requests, which are answered directly
+    // (unless a batch fails, which turns its requests into 'E' ones).
+    string reply;
+
+    time_point<steady_clock> received;
+    bool done;
+};
+
+
+/*
+ * Queues requests from every connection and answers them in batches, from
+ * one thread (run()).
+ */
+class Batcher
+{
+private:
+    BaseAlgorithm &model;
+    const TopN *topN;
+
+    mutex queueMutex;
+    condition_variable requestsQueued;
+    condition_variable batchDone;
+    vector<Request *> queue;
+
+    void process(vector<Request *> &batch);
+    void fail(vector<Request *> &batch, const string &reason);
+
+public:
+    LatencyHistogram predictLatency;
+    LatencyHistogram topNLatency;
+    atomic<uint64_t> numBatches;
+    atomic<uint64_t> numBatched;
+
+    Batcher(BaseAlgorithm &model, const TopN *topN) :
+        model(model), topN(topN), numBatches(0), numBatched(0) {}
+
+    /* Queue requests, and wait until they've all been answered. */
+    void submit(const vector<Request *> &requests);
+
+    /* Answer queued requests forever. */
+    void run();
+
+    string statistics() const
+    {
+        uint64_t batches = numBatches.load();
+        double meanBatchSize =
+            batches == 0 ? 0.0 : (double) numBatched.load() / batches;
+
+        ostringstream line;
+        line << predictLatency.summary("predict") << " | "
+             << topNLatency.summary("topn") << " | batches count="
+             << batches << " mean_size=" << meanBatchSize;
+        return line.str();
+    }
+};
+
+
+void Batcher::submit(const vector<Request *> &requests)
+{
+    if (requests.empty())
+    {
+        return;
+    }
+
+    unique_lock<mutex> lock(queueMutex);
+    queue.insert(queue.end(), requests.begin(), requests.end());
+    requestsQueued.notify_one();
+
+    batchDone.wait(lock, [&requests]
+    {
+        for (const Request *request : requests)
+        {
+            if (!request->done)
+            {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+
+void Batcher::run()
+{
+    vector<Request *> batch;
+
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(queueMutex);
+            requestsQueued.wait(lock, [this] { return !queue.empty(); });
+            batch.swap(queue);
+        }
+
+        // A batch the model fails on is answered with errors, rather than
+        // leaving its clients waiting (and the server without a batcher).
+        try
+        {
+            process(batch);
+        }
+        catch (const exception &e)
+        {
+            fail(batch, e.what());
+        }
+        catch (...)
+        {
+            fail(batch, "unknown error");
+        }
+
+        {
+            lock_guard<mutex> lock(queueMutex);
+            for (Request *request : batch)
+            {
+                request->done = true;
+            }
+        }
+
+        batchDone.notify_all();
+        batch.clear();
+    }
+}
+
+
+/**
+ * Turns every request in a batch into an 'E' one, replying with the reason
+ * (on one line).
+ *
+ */
+void Batcher::fail(vector<Request *> &batch, const string &reason)
+{
+    string line = "E " + reason;
+    replace(line.begin(), line.end(), '\n', ' ');
+
+    for (Request *request : batch)
+    {
+        request->kind = 'E';
+        request->reply = line;
+        request->recommendations.clear();
+    }
+}
+
+
+/**
+ * Answers one batch: every prediction in a single predictBatch() call
+ * (sorted by user, so the model's per-user work is shared), and every
+ * top-N request in a single recommendBatch() call.
+ *
+ */
+void Batcher::process(vector<Request *> &batch)
+{
+    vector<Request *> predictions, topNs;
+    for (Request *request : batch)
+    {
+        (request->kind == 'P' ? predictions : topNs).push_back(request);
+    }
+
+    numBatches++;
+    numBatched += batch.size();
+
+    if (!predictions.empty())
+    {
+        stable_sort(predictions.begin(), predictions.end(),
+                    [](const Request *a, const Request *b)
+                    {
+                        return a->user < b->user;
+                    });
+
+        const size_t numPoints = predictions.size();
+        vector<int> users(numPoints), items(numPoints), dates(numPoints);
+        vector<float> ratings(numPoints);
+
+        for (size_t i = 0; i < numPoints; i++)
+        {
+            users[i] = predictions[i]->user;
+            items[i] = predictions[i]->item;
+            dates[i] = predictions[i]->date;
+        }
+
+        model.predictBatch(users.data(), items.data(), dates.data(),
+                           ratings.data(), numPoints, true);
+
+        time_point<steady_clock> now = steady_clock::now();
+        for (size_t i = 0; i < numPoints; i++)
+        {
+            predictions[i]->rating = ratings[i];
+            predictLatency.record(duration_cast<microseconds>(
+                now - predictions[i]->received).count());
+        }
+    }
+
+    if (!topNs.empty())
+    {
+        // One call with the largest n; smaller requests take a prefix.
+        size_t n = 0;
+        vector<int> users(topNs.size());
+        for (size_t i = 0; i < topNs.size(); i++)
+        {
+            users[i] = topNs[i]->user;
+            n = max(n, topNs[i]->n);
+        }
+
+        vector<Recommendation> output(topNs.size() * n);
+        topN->recommendBatch(users.data(), users.size(), n, output.data());
+
+        time_point<steady_clock> now = steady_clock::now();
+        for (size_t i = 0; i < topNs.size(); i++)
+        {
+            const Recommendation *best = output.data() + i * n;
+            for (size_t k = 0; k < topNs[i]->n && best[k].item != -1; k++)
+            {
+                topNs[i]->recommendations.push_back(best[k]);
+            }
+
+            topNLatency.record(duration_cast<microseconds>(
+                now - topNs[i]->received).count());
+        }
+    }
+}
+
+
+// The number of users, movies and dates in the rating store, which requests
+// are checked against. Set once in main(), before any client connects.
+static int numUsers, numItems, numDates;
+
+
+/**
+ * Parses one request line. Requests that the batcher can't answer come
+ * back as 'E' requests with the reason in reply.
+ *
+ */
+static Request parseRequest(const string &line, bool servesTopN)
+{
+    Request request;
+    request.kind = 'E';
+    request.user = request.item = request.date = 0;
+    request.n = 0;
+    request.rating = 0.0;
+    request.received = steady_clock::now();
+    request.done = false;
+
+    istringstream fields(line);
+    string command, extra;
+    fields >> command;
+
+    if (command == "P")
+    {
+        if (!(fields >> request.user >> request.item >> request.date)
+            || fields >> extra)
+        {
+            request.reply = "E usage: P <user> <movie> <date>";
+        }
+        else if (request.user < 0 || request.user >= numUsers
+                 || request.item < 0 || request.item >= numItems
+                 || request.date < 0 || request.date >= numDates)
+        {
+            request.reply = "E user, movie or date out of range";
+        }
+        else
+        {
+            request.kind = 'P';
+        }
+    }
+    else if (command == "T")
+    {
+        long n = 0;
+        if (!(fields >> request.user >> n) || fields >> extra)
+        {
+            request.reply = "E usage: T <user> <n>";
+        }
+        else if (!servesTopN)
+        {
+            request.reply = "E this model doesn't serve top-N requests";
+        }
+        else if (request.user < 0 || request.user >= numUsers || n < 1
+                 || n > (long) MAX_RECOMMENDATIONS)
+        {
+            request.reply = "E user or n out of range";
+        }
+        else
+        {
+            request.kind = 'T';
+            request.n = n;
+        }
+    }
+    else if (command == "S" && !(fields >> extra))
+    {
+        request.kind = 'S';
+    }
+    else
+    {
+        request.reply = "E unknown request";
+    }
+
+    return request;
+}
+
+
+/* Writes all of data to fd. Returns false if the client went away. */
+static bool writeAll(int fd, const string &data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t count = send(fd, data.data() + written,
+                             data.size() - written, MSG_NOSIGNAL);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        written += count;
+    }
+    return true;
+}
+
+
+// The number of clients being served (see MAX_CONNECTIONS).
+static atomic<int> numConnections(0);
+
+
+/**
+ * Serves one client until it disconnects. All the complete lines in each
+ * read are answered together (in order), so a client that pipelines its
+ * requests has them batched.
+ *
+ */
+static void serveConnection(int fd, Batcher &batcher, bool servesTopN)
+{
+    string buffer;
+    char chunk[65536];
+
+    while (true)
+    {
+        ssize_t count = read(fd, chunk, sizeof(chunk));
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            break;
+        }
+        buffer.append(chunk, count);
+
+        size_t end = buffer.rfind('\n');
+        if (end == string::npos)
+        {
+            if (buffer.size() > MAX_LINE_LENGTH)
+            {
+                break;
+            }
+            continue;
+        }
+
+        vector<Request> requests;
+        size_t start = 0;
+        while (start <= end)
+        {
+            size_t newline = buffer.find('\n', start);
+            string line = buffer.substr(start, newline - start);
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (!line.empty())
+            {
+                requests.push_back(parseRequest(line, servesTopN));
+            }
+            start = newline + 1;
+        }
+        buffer.erase(0, end + 1);
+
+        vector<Request *> batchable;
+        for (Request &request : requests)
+        {
+            if (request.kind == 'P' || request.kind == 'T')
+            {
+                batchable.push_back(&request);
+            }
+        }
+        batcher.submit(batchable);
+
+        ostringstream replies;
+        for (const Request &request : requests)
+        {
+            switch (request.kind)
+            {
+            case 'P':
+                replies << request.rating;
+                break;
+            case 'T':
+                for (size_t k = 0; k < request.recommendations.size(); k++)
+                {
+                    replies << (k == 0 ? "" : " ")
+                            << request.recommendations[k].item << ":"
+                            << request.recommendations[k].score;
+                }
+                break;
+            case 'S':
+                replies << batcher.statistics();
+                break;
+            default:
+                replies << request.reply;
+            }
+            replies << "\n";
+        }
+
+        if (!writeAll(fd, replies.str()))
+        {
+            break;
+        }
+    }
+
+    close(fd);
+    numConnections--;
+}
+
+
+static string socketPathToRemove;
+
+/* Removes the socket file on SIGINT/SIGTERM (unlink() is signal-safe). */
+static void removeSocketAndExit(int signal)
+{
+    unlink(socketPathToRemove.c_str());
+    _exit(128 + signal);
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        cerr << "Usage: " << argv[0]
+             << " <svd|svdpp|timesvdpp|globals|knn> [socket path]" << endl;
+        return 1;
+    }
+
+    const string modelName = argv[1];
+    const string socketPath = argc == 3 ? argv[2] : DEFAULT_SOCKET_PATH;
+
+    // Training sets (and the movies users have rated) come from here, and
+    // models are sized from its dimensions.
+    RatingStore ratings(RATINGS_STORE);
+    numUsers = ratings.numUsers();
+    numItems = ratings.numItems();
+    numDates = ratings.numDates();
+
+    unique_ptr<BaseAlgorithm> model;
+    unique_ptr<RatedItems> rated;
+    unique_ptr<TopN> topN;
+
+    cout << "Loading " << modelName << "..." << endl;
+    time_point<system_clock> start = system_clock::now();
+
+    if (modelName == "svd")
+    {
+        SVD *svd = new SVD(numUsers, numItems, MEAN_RATING_TRAINING_SET,
+                           SVD_NUM_FACTORS, SVD_NUM_ITERATIONS,
+                           SVD_CHECKPOINT_FN);
+        model.reset(svd);
+        rated.reset(new RatedItems(ratings.view(SVD_TRAIN_SETS), numUsers));
+        topN.reset(new TopN(*svd, rated.get()));
+    }
+    else if (modelName == "svdpp")
+    {
+        SVDPP *svdpp = new SVDPP(numUsers, numItems,
+                                 MEAN_RATING_TRAINING_SET, SVDPP_NUM_FACTORS,
+                                 SVDPP_NUM_ITERATIONS, N_FN,
+                                 SVDPP_CHECKPOINT_FN);
+        model.reset(svdpp);
+        rated.reset(new RatedItems(ratings.view(SVDPP_TRAIN_SETS),
+                                   numUsers));
+        topN.reset(new TopN(*svdpp, rated.get()));
+    }
+    else if (modelName == "timesvdpp")
+    {
+        model.reset(new TimeSVDPP(numUsers, numItems, numDates,
+                                  MEAN_RATING_TRAINING_SET,
+                                  TIMESVDPP_NUM_FACTORS,
+                                  TIMESVDPP_NUM_ITERATIONS,
+                                  TIMESVDPP_NUM_TIME_BINS,
+                                  TIMESVDPP_INCLUDE_USER_FAC_MAT_TIME,
+                                  N_FN, HAT_DEV_U_T_FN, F_U_T_FN,
+                                  TIMESVDPP_CHECKPOINT_FN));
+    }
+    else if (modelName == "globals")
+    {
+        fmat trainingSet = ratings.view(GLOBALS_TRAIN_SETS).matrix();
+
+        model.reset(new Globals(numUsers, numItems, GLOBALS_LEVEL,
+                                GLOBALS_TRAIN_SETS));
+        model->train(trainingSet);
+    }
+    else if (modelName == "knn")
+    {
+        model.reset(new KNN(numUsers, numItems, KNN_MIN_COMMON,
+                            KNN_MAX_WEIGHT, true, false, KNN_P_FN));
+        model->train(ratings.view(KNN_TRAIN_SETS));
+    }
+    else
+    {
+        cerr << "Unknown model \"" << modelName << "\"." << endl;
+        return 1;
+    }
+
+    duration<float> secondsElapsed = system_clock::now() - start;
+    cout << "Loaded in " << secondsElapsed.count() << " seconds." << endl;
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        cerr << "Socket path \"" << socketPath << "\" is too long." << endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        throw runtime_error(string("Couldn't create a socket: ")
+                            + strerror(errno));
+    }
+
+    // A stale socket file from an earlier run would make bind() fail.
+    unlink(socketPath.c_str());
+
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) < 0
+        || listen(listener, SOMAXCONN) < 0)
+    {
+        throw runtime_error("Couldn't listen on " + socketPath + ": "
+                            + strerror(errno));
+    }
+
+    socketPathToRemove = socketPath;
+    signal(SIGINT, removeSocketAndExit);
+    signal(SIGTERM, removeSocketAndExit);
+
+    Batcher batcher(*model, topN.get());
+    thread batchThread(&Batcher::run, &batcher);
+    batchThread.detach();
+
+    cout << "Serving " << modelName << " on " << socketPath << "." << endl;
+
+    while (true)
+    {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            throw runtime_error(string("accept() failed: ")
+                                + strerror(errno));
+        }
+
+        if (++numConnections > MAX_CONNECTIONS)
+        {
+            numConnections--;
+            writeAll(client, "E server busy\n");
+            close(client);
+            continue;
+        }
+
+        try
+        {
+            thread(serveConnection, client, ref(batcher),
+                   topN != NULL).detach();
+        }
+        catch (const system_error &)
+        {
+            // Out of threads: turn the client away like a busy server.
+            numConnections--;
+            writeAll(client, "E server busy\n");
+            close(client);
+        }
+    }
+}
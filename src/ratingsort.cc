@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <numeric>
+#include <omp.h>
+#include <stdexcept>
+#include <utility>
+#ifndef NDEBUG
+#include <iostream>
+#endif
+
+#include <ratingsort.hh>
+
+using namespace netflix; // challenge-related constants/functions.
+
+
+/**
+ * Returns the number of bits needed to hold every value up to maxValue.
+ */
+static int bitsFor(uint64_t maxValue)
+{
+    int bits = 0;
+    while (maxValue >> bits != 0)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+
+/**
+ * Sorts keys (keyBits wide) with a least significant digit radix sort,
+ * applying the same moves to perm. Each pass splits the input into one
+ * chunk per thread: every thread counts the digits in its chunk, the
+ * counts are turned into each (digit, thread) pair's first output slot,
+ * and every thread then scatters its chunk. A digit's elements from
+ * earlier chunks land before those from later ones, so each pass (and so
+ * the whole sort) is stable.
+ *
+ */
+static void radixSort(std::vector<uint64_t> &keys,
+                      std::vector<size_t> &perm, int keyBits)
+{
+    const size_t n = keys.size();
+    const size_t numBuckets = (size_t) 1 << RATINGSORT_RADIX_BITS;
+    const uint64_t mask = numBuckets - 1;
+
+    std::vector<uint64_t> keysOut(n);
+    std::vector<size_t> permOut(n);
+    std::vector<size_t> counts((size_t) omp_get_max_threads() * numBuckets);
+
+    for (int shift = 0; shift < keyBits; shift += RATINGSORT_RADIX_BITS)
+    {
+        #pragma omp parallel
+        {
+            const int numThreads = omp_get_num_threads();
+            const int thread = omp_get_thread_num();
+            const size_t first = n * thread / numThreads;
+            const size_t last = n * (thread + 1) / numThreads;
+            size_t *threadCounts = counts.data() + thread * numBuckets;
+
+            std::fill(threadCounts, threadCounts + numBuckets, 0);
+            for (size_t i = first; i < last; i++)
+            {
+                threadCounts[(keys[i] >> shift) & mask]++;
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                size_t offset = 0;
+                for (size_t digit = 0; digit < numBuckets; digit++)
+                {
+                    for (int t = 0; t < numThreads; t++)
+                    {
+                        size_t count = counts[t * numBuckets + digit];
+                        counts[t * numBuckets + digit] = offset;
+                        offset += count;
+                    }
+                }
+            }
+
+            for (size_t i = first; i < last; i++)
+            {
+                size_t slot = threadCounts[(keys[i] >> shift) & mask]++;
+                keysOut[slot] = keys[i];
+                permOut[slot] = perm[i];
+            }
+        }
+
+        keys.swap(keysOut);
+        perm.swap(permOut);
+    }
+}
+
+
+/**
+ * Computes the permutation that sorts a store's ratings into the given
+ * order (see RatingOrder). Ratings with equal sort fields keep their store
+ * order.
+ *
+ * @param store:    The ratings to sort.
+ * @param order:    The order to sort them into.
+ *
+ */
+std::vector<size_t> sortRatings(const RatingStore &store, RatingOrder order)
+{
+    const size_t n = store.size();
+    const float *ratings = store.data();
+
+    // The largest user, movie and date, to size the key's fields.
+    const int maxUser = std::max(store.numUsers() - 1, 0);
+    const int maxMovie = std::max(store.numItems() - 1, 0);
+    const int maxDate = std::max(store.numDates() - 1, 0);
+
+    // For USER_ACTIVITY, each user's rank by number of ratings (most
+    // first, ties broken by user ID).
+    std::vector<uint32_t> userRanks;
+    if (order == RatingOrder::USER_ACTIVITY)
+    {
+        std::vector<size_t> numRatings(maxUser + 1, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            numRatings[roundToInt(ratings[i * COLUMNS + USER_ROW])]++;
+        }
+
+        std::vector<uint32_t> users(maxUser + 1);
+        std::iota(users.begin(), users.end(), 0);
+        std::stable_sort(users.begin(), users.end(),
+                         [&numRatings](uint32_t a, uint32_t b)
+                         {
+                             return numRatings[a] > numRatings[b];
+                         });
+
+        userRanks.resize(maxUser + 1);
+        for (size_t rank = 0; rank < users.size(); rank++)
+        {
+            userRanks[users[rank]] = rank;
+        }
+    }
+
+    // The key is (major field << minorBits) | minor field.
+    int majorRow, minorRow, minorBits, keyBits;
+    switch (order)
+    {
+        case RatingOrder::USER_MOVIE:
+        case RatingOrder::USER_ACTIVITY:
+            majorRow = USER_ROW;
+            minorRow = MOVIE_ROW;
+            minorBits = bitsFor(maxMovie);
+            keyBits = bitsFor(maxUser) + minorBits;
+            break;
+        case RatingOrder::MOVIE_USER:
+            majorRow = MOVIE_ROW;
+            minorRow = USER_ROW;
+            minorBits = bitsFor(maxUser);
+            keyBits = bitsFor(maxMovie) + minorBits;
+            break;
+        case RatingOrder::USER_DATE:
+            majorRow = USER_ROW;
+            minorRow = DATE_ROW;
+            minorBits = bitsFor(maxDate);
+            keyBits = bitsFor(maxUser) + minorBits;
+            break;
+        default:
+            throw std::invalid_argument("Unknown rating order!");
+    }
+
+    std::vector<uint64_t> keys(n);
+    std::vector<size_t> perm(n);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++)
+    {
+        const float *rating = ratings + i * COLUMNS;
+        uint64_t major = roundToInt(rating[majorRow]);
+        if (!userRanks.empty())
+        {
+            major = userRanks[major];
+        }
+
+        keys[i] = (major << minorBits) | roundToInt(rating[minorRow]);
+        perm[i] = i;
+    }
+
+    radixSort(keys, perm, keyBits);
+
+#ifndef NDEBUG
+    std::cout << "Sorted " << n << " ratings on " << keyBits << "-bit keys."
+              << std::endl;
+#endif
+
+    return perm;
+}
+
+
+/**
+ * Writes a store's ratings, in a new order, as another store.
+ *
+ * @param store:    The store to copy.
+ * @param perm:     The new order (e.g. from sortRatings()).
+ * @param fileName: The store to (over)write.
+ *
+ */
+void writePermutedStore(const RatingStore &store,
+                        const std::vector<size_t> &perm,
+                        const std::string &fileName)
+{
+    const size_t n = store.size();
+
+    if (perm.size() != n)
+    {
+        throw std::invalid_argument("The permutation doesn't match the "
+                                    "store!");
+    }
+
+    const float *ratings = store.data();
+    const uint8_t *splits = store.splitTags();
+    std::vector<float> permutedRatings(n * COLUMNS);
+    std::vector<uint8_t> permutedSplits(n);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++)
+    {
+        std::copy(ratings + perm[i] * COLUMNS,
+                  ratings + perm[i] * COLUMNS + COLUMNS,
+                  permutedRatings.data() + i * COLUMNS);
+        permutedSplits[i] = splits[perm[i]];
+    }
+
+    // Keep the store's dims, which also cover qual.
+    const size_t dims[3] = {(size_t) store.numUsers(),
+                            (size_t) store.numItems(),
+                            (size_t) store.numDates()};
+    RatingStore::write(std::move(permutedRatings), std::move(permutedSplits),
+                       fileName, dims);
+}
+
+
+/**
+ * Writes a permutation (e.g. from sortRatings()) on its own, for callers
+ * that keep a single store and just want to visit it in another order.
+ *
+ * @param perm:     The permutation to write.
+ * @param fileName: The checkpoint to (over)write.
+ *
+ */
+void writePermutation(const std::vector<size_t> &perm,
+                      const std::string &fileName)
+{
+    std::vector<uint64_t> elems(perm.begin(), perm.end());
+    const size_t n = elems.size();
+
+    CheckpointWriter writer("permutation");
+    writer.add("permutation", std::move(elems), 1, n);
+    writer.write(fileName);
+}
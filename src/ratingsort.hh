@@ -0,0 +1,60 @@
+/*
+ * Reorders the ratings of a RatingStore. Several algorithms need their
+ * ratings in a particular order (e.g. SVD and SVD++ need them grouped by
+ * user, and Globals needs them grouped by movie as well), so rather than
+ * depending on a differently sorted copy of the raw text files, any order
+ * can be produced from a store directly.
+ *
+ * Each rating gets an integer key that packs its sort fields (e.g. user in
+ * the high bits and movie in the low bits, with each field only as wide as
+ * its largest value needs), and the keys are sorted with a parallel LSD
+ * radix sort. Every pass is stable, so ratings with equal keys keep their
+ * store order.
+ *
+ */
+
+#ifndef RATINGSORT_HH
+#define RATINGSORT_HH
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <ratingstore.hh>
+
+// The number of key bits sorted per radix sort pass.
+#define RATINGSORT_RADIX_BITS 11
+
+enum class RatingOrder
+{
+    // By user, then movie (the order train() expects).
+    USER_MOVIE,
+
+    // By movie, then user (the order of Globals' dataMU).
+    MOVIE_USER,
+
+    // By user, then date (ties keep store order).
+    USER_DATE,
+
+    // By user, with the users who rated the most first, then by movie.
+    // Heavy users' factors stay in cache across more of their ratings.
+    USER_ACTIVITY
+};
+
+/* The permutation that puts store's ratings in the given order: the ith
+ * rating in that order is column perm[i] of the store. */
+std::vector<size_t> sortRatings(const RatingStore &store,
+                                RatingOrder order);
+
+/* Write store's ratings (and their sets), permuted by perm, to a new
+ * store at fileName. */
+void writePermutedStore(const RatingStore &store,
+                        const std::vector<size_t> &perm,
+                        const std::string &fileName);
+
+/* Write perm to fileName, as a checkpoint with a single "permutation"
+ * section. */
+void writePermutation(const std::vector<size_t> &perm,
+                      const std::string &fileName);
+
+#endif // RATINGSORT_HH
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#ifndef NDEBUG
+#include <iostream>
+#endif
+
+#include <ratingstore.hh>
+
+using namespace netflix; // challenge-related constants/functions.
+
+// The name stores are written under (see Checkpoint::open()).
+static const std::string RATING_STORE_MODEL = "ratings";
+
+
+/**
+ * Counts the users, movies and dates of some ratings (one more than the
+ * largest ID of each), in one parallel pass.
+ *
+ * @param ratings:      The ratings, COLUMNS values per rating.
+ * @param numRatings:   The number of ratings.
+ * @param dims:         Where to write the three counts.
+ *
+ */
+static void countDims(const float *ratings, size_t numRatings,
+                      size_t dims[3])
+{
+    int maxUser = -1, maxMovie = -1, maxDate = -1;
+
+    #pragma omp parallel for reduction(max: maxUser, maxMovie, maxDate)
+    for (size_t i = 0; i < numRatings; i++)
+    {
+        const float *rating = ratings + i * COLUMNS;
+        maxUser = std::max(maxUser, roundToInt(rating[USER_ROW]));
+        maxMovie = std::max(maxMovie, roundToInt(rating[MOVIE_ROW]));
+        maxDate = std::max(maxDate, roundToInt(rating[DATE_ROW]));
+    }
+
+    dims[0] = maxUser + 1;
+    dims[1] = maxMovie + 1;
+    dims[2] = maxDate + 1;
+}
+
+
+/**
+ * Whether some dims fit in a store, i.e. every ID below them is exactly a
+ * float (see MAX_STORE_DIM).
+ *
+ */
+static bool dimsFit(const size_t dims[3])
+{
+    return dims[0] <= MAX_STORE_DIM && dims[1] <= MAX_STORE_DIM
+        && dims[2] <= MAX_STORE_DIM;
+}
+
+
+fmat RatingView::matrix() const
+{
+    if (columnRuns.size() == 1)
+    {
+        // Don't copy the ratings, and let Armadillo take its own copy if
+        // the matrix is ever resized.
+        return fmat(const_cast<float *>(ratings)
+                    + columnRuns[0].first * COLUMNS,
+                    COLUMNS, numRatings, false, false);
+    }
+
+    fmat data(COLUMNS, numRatings);
+
+    // Where each run starts in data.
+    std::vector<size_t> starts(columnRuns.size());
+    size_t next = 0;
+    for (size_t r = 0; r < columnRuns.size(); r++)
+    {
+        starts[r] = next;
+        next += columnRuns[r].second - columnRuns[r].first;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for (size_t r = 0; r < columnRuns.size(); r++)
+    {
+        const std::pair<size_t, size_t> &run = columnRuns[r];
+        memcpy(data.colptr(starts[r]), ratings + run.first * COLUMNS,
+               (run.second - run.first) * COLUMNS * sizeof(float));
+    }
+
+    return data;
+}
+
+
+/**
+ * Maps a rating store.
+ *
+ * @param fileName: The store to open (e.g. RATINGS_STORE).
+ * @param verify:   Whether to check the store's checksums. This reads the
+ *                  whole file once.
+ *
+ */
+RatingStore::RatingStore(const std::string &fileName, bool verify)
+{
+    checkpoint.open(fileName, RATING_STORE_MODEL, verify);
+
+    numRatings = checkpoint.section("splits").dims[0];
+    ratings = static_cast<const float *>(
+        checkpoint.data("ratings", CheckpointDType::F32,
+                        numRatings * COLUMNS));
+    splits = static_cast<const uint8_t *>(
+        checkpoint.data("splits", CheckpointDType::U8, numRatings));
+
+    if (checkpoint.hasSection("dims"))
+    {
+        const uint64_t *storedDims = static_cast<const uint64_t *>(
+            checkpoint.data("dims", CheckpointDType::U64, 3));
+        std::copy(storedDims, storedDims + 3, dims);
+    }
+    else
+    {
+        countDims(ratings, numRatings, dims);
+    }
+
+    if (!dimsFit(dims))
+    {
+        throw std::runtime_error("The store at " + fileName + " has more "
+                                 "than 2^24 users, movies or dates, whose "
+                                 "IDs don't fit in a float!");
+    }
+}
+
+
+/**
+ * Selects the ratings of some combination of sets. This makes one pass
+ * over the split tags, and doesn't touch the ratings themselves.
+ *
+ * @param splitSet: The sets to select (e.g. BASE_HIDDEN_IDX).
+ *
+ */
+RatingView RatingStore::view(const std::set<int> &splitSet) const
+{
+    // Whether each possible tag is selected.
+    bool selected[256] = {false};
+    for (int split : splitSet)
+    {
+        if (split < 0 || split > 255)
+        {
+            throw std::invalid_argument("Invalid set index " +
+                                        std::to_string(split));
+        }
+        selected[split] = true;
+    }
+
+    RatingView view;
+    view.ratings = ratings;
+
+    size_t col = 0;
+    while (col < numRatings)
+    {
+        while (col < numRatings && !selected[splits[col]])
+        {
+            col++;
+        }
+
+        size_t first = col;
+        while (col < numRatings && selected[splits[col]])
+        {
+            col++;
+        }
+
+        if (col > first)
+        {
+            view.columnRuns.push_back(std::make_pair(first, col));
+            view.numRatings += col - first;
+        }
+    }
+
+    return view;
+}
+
+
+/**
+ * Builds a rating store from a text data file (one "user movie date
+ * rating" line per rating) and its index file (the set of each line). The
+ * ratings keep the data file's order. Ratings in qual are left out.
+ *
+ * @param indexPath:    The index file (e.g. INDEX_PATH).
+ * @param dataPath:     The data file (e.g. DATA_PATH).
+ * @param fileName:     The store to (over)write.
+ *
+ */
+void RatingStore::build(const std::string &indexPath,
+                        const std::string &dataPath,
+                        const std::string &fileName)
+{
+    std::ifstream indexFile(indexPath);
+
+    if (indexFile.fail())
+    {
+        throw std::runtime_error("Couldn't find index file at " + indexPath);
+    }
+
+    std::ifstream dataFile(dataPath);
+
+    if (dataFile.fail())
+    {
+        throw std::runtime_error("Couldn't find data file at " + dataPath);
+    }
+
+    // Count the lines first, so the ratings are only allocated once.
+    size_t numLines = 0;
+    std::string line;
+    while (std::getline(indexFile, line))
+    {
+        numLines++;
+    }
+
+    indexFile.clear();
+    indexFile.seekg(0, indexFile.beg);
+
+    std::vector<float> ratings;
+    std::vector<uint8_t> splits;
+    ratings.reserve(numLines * COLUMNS);
+    splits.reserve(numLines);
+
+    int index, user, movie, date;
+    float rating;
+
+    // One more than the largest IDs in qual, which the store's dims must
+    // cover even though qual is left out.
+    size_t qualDims[3] = {0, 0, 0};
+
+    while (indexFile >> index)
+    {
+        if (!(dataFile >> user >> movie >> date >> rating))
+        {
+            throw std::runtime_error("The data file at " + dataPath +
+                                     " is shorter than its index!");
+        }
+
+        if (index == QUAL_SET)
+        {
+            qualDims[0] = std::max(qualDims[0], (size_t) user + 1);
+            qualDims[1] = std::max(qualDims[1], (size_t) movie + 1);
+            qualDims[2] = std::max(qualDims[2], (size_t) date + 1);
+            continue;
+        }
+
+        ratings.push_back((float) user);
+        ratings.push_back((float) movie);
+        ratings.push_back((float) date);
+        ratings.push_back(rating);
+        splits.push_back((uint8_t) index);
+
+#ifndef NDEBUG
+        if (splits.size() % 10000000 == 0)
+        {
+            std::cout << "Read " << splits.size() << " ratings." << std::endl;
+        }
+#endif
+    }
+
+    write(std::move(ratings), std::move(splits), fileName, qualDims);
+}
+
+
+/**
+ * Writes a rating store.
+ *
+ * @param ratings:  The ratings, COLUMNS values per rating (as in the
+ *                  columns of a ratings matrix).
+ * @param splits:   The set of each rating.
+ * @param fileName: The store to (over)write.
+ * @param minDims:  The least numbers of users, movies and dates to record
+ *                  (e.g. to cover qual, or the store a shard was cut
+ *                  from), or NULL to just count those of the ratings.
+ *
+ */
+void RatingStore::write(std::vector<float> &&ratings,
+                        std::vector<uint8_t> &&splits,
+                        const std::string &fileName,
+                        const size_t *minDims)
+{
+    const size_t numRatings = splits.size();
+
+    if (ratings.size() != numRatings * COLUMNS)
+    {
+        throw std::invalid_argument("A rating store needs one set per "
+                                    "rating!");
+    }
+
+    size_t dims[3];
+    countDims(ratings.data(), numRatings, dims);
+
+    if (minDims != NULL)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            dims[k] = std::max(dims[k], minDims[k]);
+        }
+    }
+
+    // An ID of 2^24 or more doesn't survive the trip through a float, but
+    // it's still rounded to one of 2^24 or more, so this catches it.
+    if (!dimsFit(dims))
+    {
+        throw std::invalid_argument("A rating store can't have more than "
+                                    "2^24 users, movies or dates!");
+    }
+
+    CheckpointWriter writer(RATING_STORE_MODEL);
+    writer.add("ratings", std::move(ratings), 2, COLUMNS, numRatings);
+    writer.add("splits", std::move(splits), 1, numRatings);
+    writer.add("dims", std::vector<uint64_t>(dims, dims + 3), 1, 3);
+    writer.write(fileName);
+}
+
+
+/**
+ * Loads a copy of the ratings of some combination of sets.
+ *
+ * @param splitSet:     The sets to load (e.g. PROBE_IDX).
+ * @param storePath:    The store to load them from.
+ *
+ */
+fmat loadRatings(const std::set<int> &splitSet, const std::string &storePath)
+{
+    RatingStore store(storePath);
+    RatingView view = store.view(splitSet);
+    fmat data = view.matrix();
+
+    // A single run is backed by the store, which is about to be unmapped.
+    if (view.runs().size() == 1)
+    {
+        return fmat(data.memptr(), data.n_rows, data.n_cols);
+    }
+
+    return data;
+}
@@ -0,0 +1,214 @@
+/*
+ * One master copy of every rating outside of qual, tagged with the set
+ * (BASE_SET, VALID_SET, HIDDEN_SET or PROBE_SET) each rating came from. It
+ * replaces the separate Armadillo binary we used to keep for every
+ * combination of sets, each of which duplicated most of the ratings.
+ *
+ * A store is a checkpoint (see checkpoint.hh) with three sections:
+ *
+ *      "ratings"   the 4 x N ratings matrix (rows USER_ROW to RATING_ROW),
+ *                  in the order of the text file it was built from
+ *      "splits"    the set of each rating, one byte per rating
+ *      "dims"      the number of users, movies and dates (one more than
+ *                  the largest ID of each, counting qual), as three uint64s
+ *
+ * Models should be sized from the dims rather than from the Netflix
+ * constants in netflix.hh, so the same code runs on other catalogs. The
+ * dims cover the IDs of qual too, even though its ratings aren't stored,
+ * so that a model sized from them can predict qual. Stores written before
+ * "dims" existed have them counted from their own ratings when they're
+ * opened, which misses any larger IDs in qual; rebuild them.
+ *
+ * IDs are stored as floats (as in every 4 x N ratings matrix), which only
+ * hold integers exactly up to 2^24, so a store can't have more than
+ * MAX_STORE_DIM users, movies or dates. Writing or opening a larger one
+ * throws, rather than letting IDs collide.
+ *
+ * Opening a store just maps it. A RatingView then picks out any
+ * combination of sets as a list of contiguous runs of columns, found with
+ * a single pass over the split tags. Models that train on a view (SVD,
+ * SVD++, Time-SVD++ and kNN; see BaseAlgorithm::train()) walk its runs
+ * with a RatingCursor, so nothing is copied whatever sets are picked.
+ * Only callers that ask for a matrix of their own get a copy, unless the
+ * view is a single run (e.g. every training set at once), which is handed
+ * out as a matrix backed by the store itself.
+ *
+ * Since the runs keep the store's order, a view of a store built from
+ * (user, movie) ordered data is still sorted by user, as train() expects.
+ *
+ */
+
+#ifndef RATINGSTORE_HH
+#define RATINGSTORE_HH
+
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <checkpoint.hh>
+#include <netflix.hh>
+
+using namespace arma;
+
+// The most users, movies or dates a rating store can have (see above).
+const size_t MAX_STORE_DIM = (size_t) 1 << 24;
+
+class RatingStore;
+
+/*
+ * The ratings of some combination of sets in a RatingStore. A view refers
+ * to the store's memory, so it must not outlive the store.
+ */
+class RatingView
+{
+private:
+    // The store's 4 x N ratings, column-major.
+    const float *ratings;
+
+    // [first, last) column ranges of the selected ratings, in order.
+    std::vector<std::pair<size_t, size_t> > columnRuns;
+    size_t numRatings;
+
+    friend class RatingStore;
+    friend class RatingCursor;
+
+public:
+    RatingView() : ratings(NULL), numRatings(0) {}
+
+    /* Every column of a 4 x N ratings matrix, which the view refers to
+     * (so it must not outlive the matrix). */
+    explicit RatingView(const fmat &data)
+        : ratings(data.memptr()), numRatings(data.n_cols)
+    {
+        if (data.n_rows != netflix::COLUMNS)
+        {
+            throw std::invalid_argument("Data array must have four rows!");
+        }
+
+        if (numRatings > 0)
+        {
+            columnRuns.push_back(std::make_pair((size_t) 0, numRatings));
+        }
+    }
+
+    /* The number of ratings selected. */
+    size_t size() const { return numRatings; }
+
+    const std::vector<std::pair<size_t, size_t> > &runs() const
+    {
+        return columnRuns;
+    }
+
+    /* Call f(column) with a pointer to the 4 values of each selected
+     * rating, in order. */
+    template <typename Function>
+    void forEach(Function f) const
+    {
+        for (const std::pair<size_t, size_t> &run : columnRuns)
+        {
+            for (size_t col = run.first; col < run.second; col++)
+            {
+                f(ratings + col * netflix::COLUMNS);
+            }
+        }
+    }
+
+    /* The selected ratings as a 4 x size() matrix. If they're a single
+     * run, the matrix is backed by the store (and must not outlive it);
+     * otherwise they're copied. */
+    fmat matrix() const;
+};
+
+
+/*
+ * Walks the ratings of a view in order, one column at a time, for loops
+ * that can't be written as a forEach() (e.g. a user at a time).
+ */
+class RatingCursor
+{
+private:
+    const float *ratings;
+    const std::pair<size_t, size_t> *run;
+    size_t col;
+
+public:
+    explicit RatingCursor(const RatingView &view)
+        : ratings(view.ratings), run(view.columnRuns.data()),
+          col(view.columnRuns.empty() ? 0 : run->first)
+    {
+    }
+
+    /* The 4 values of the next rating. There must be one left. */
+    const float *next()
+    {
+        if (col == run->second)
+        {
+            run++;
+            col = run->first;
+        }
+
+        return ratings + (col++) * netflix::COLUMNS;
+    }
+};
+
+
+class RatingStore
+{
+private:
+    Checkpoint checkpoint;
+    const float *ratings;
+    const uint8_t *splits;
+    size_t numRatings;
+
+    // One more than the largest user, movie and date ID.
+    size_t dims[3];
+
+public:
+    /* Map the store at fileName (checking its checksums if verify is
+     * set). */
+    RatingStore(const std::string &fileName, bool verify = false);
+
+    /* The number of ratings in the store. */
+    size_t size() const { return numRatings; }
+
+    /* The dimensions of the dataset (see "dims" above). These fit in an
+     * int (see MAX_STORE_DIM), as models index users and movies with
+     * ints. */
+    int numUsers() const { return (int) dims[0]; }
+    int numItems() const { return (int) dims[1]; }
+    int numDates() const { return (int) dims[2]; }
+
+    /* The 4 x size() ratings (column-major), and the set of each. */
+    const float *data() const { return ratings; }
+    const uint8_t *splitTags() const { return splits; }
+
+    /* The ratings whose set is in splitSet (e.g. netflix::ALL_TRAIN_IDX). */
+    RatingView view(const std::set<int> &splitSet) const;
+
+    /* Build a store from a data file and its index (e.g. DATA_PATH and
+     * INDEX_PATH), leaving out qual. */
+    static void build(const std::string &indexPath,
+                      const std::string &dataPath,
+                      const std::string &fileName);
+
+    /* Write a store holding the given ratings (4 per rating) and their
+     * sets. Its dims cover the ratings' IDs, and at least minDims (three
+     * counts, e.g. those of ratings left out of the store) if given. */
+    static void write(std::vector<float> &&ratings,
+                      std::vector<uint8_t> &&splits,
+                      const std::string &fileName,
+                      const size_t *minDims = NULL);
+};
+
+
+/* A copy of the ratings whose set is in splitSet, from the store at
+ * storePath. For callers that just want a matrix to keep. */
+fmat loadRatings(const std::set<int> &splitSet,
+                 const std::string &storePath = netflix::RATINGS_STORE);
+
+#endif // RATINGSTORE_HH
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <dirent.h>
 #include <fstream>
 #include <numeric>
@@ -20,7 +21,9 @@
 #define CACHE_EXT ".bin"
 #define DATA_DIR "data/rbm_cached/"
 #define INDICATOR_DATA_DIR DATA_DIR "users/"
-#define PMF_PATH DATA_DIR "rating_pmf" CACHE_EXT
+// The rating pmf's are indexed by rating - MIN_RATING. Caches from before
+// that (indexed by rating) have a different name, so they're never read.
+#define PMF_PATH DATA_DIR "rating_pmf_v2" CACHE_EXT
 
 // Calculate an index in a flat "2d" array
 #define GET2DINDEX(d1, i, j) (d1 * i + j)
@@ -33,25 +36,140 @@
 
 RBM::RBM (int users, int movies, int hidden, data_t rate, data_t momentum) : 
     users(users), movies(movies), hidden(hidden), rate(rate), 
-    momentum(momentum) {
-    // Allocate weight matrix
-    this->weights = new data_t*[hidden];
-    for ( int h = 0; h < hidden; ++h ) {
-        this->weights[h] = new data_t[movies * MAX_RATING];
-    }
+    momentum(momentum), stride(simd::paddedLength(hidden)), 
+    indicators(NULL), hiddenCache(HIDDEN_CACHE_SIZE, this->stride) {
+    // Allocate weight matrix (movie-major, one aligned row per softmax unit)
+    this->weights = 
+        simd::alignedAlloc<data_t>(movies * MAX_RATING * this->stride);
     // Allocate visible biases
     this->visibleBias = new data_t[movies * MAX_RATING]();
-    // Allocate hidden biases
-    this->hiddenBias = new data_t[hidden]();
+    // Allocate hidden biases (padded like a row of the weight matrix)
+    this->hiddenBias = simd::alignedAlloc<data_t>(this->stride);
 }
 
 RBM::~RBM () {
-    for ( int h = 0; h < hidden; ++h ) {
-        delete [] this->weights[h];
-    }
-    delete [] this->weights;
+    this->freeIndicators();
+    simd::alignedFree(this->weights);
     delete [] this->visibleBias;
-    delete [] this->hiddenBias;
+    simd::alignedFree(this->hiddenBias);
+}
+
+void RBM::freeIndicators () {
+    if ( this->indicators == NULL ) return;
+    for ( int i = 0; i < this->users; ++i ) {
+        delete this->indicators[i];
+    }
+    delete [] this->indicators;
+    this->indicators = NULL;
+}
+
+HiddenCache::HiddenCache (size_t capacity, size_t stride) :
+    capacity(capacity), stride(stride) {
+    this->pool = simd::alignedAlloc<data_t>(capacity * stride);
+}
+
+HiddenCache::~HiddenCache () {
+    simd::alignedFree(this->pool);
+}
+
+data_t *HiddenCache::find (int user) {
+    auto entry = this->entries.find(user);
+    if ( entry == this->entries.end() ) return NULL;
+    // Move this user to the front of the recency list
+    this->order.splice(this->order.begin(), this->order, entry->second);
+    return this->pool + entry->second->second * this->stride;
+}
+
+data_t *HiddenCache::insert (int user) {
+    size_t slot;
+    // Reuse the slot of the least recently used user if we're full
+    if ( this->order.size() >= this->capacity ) {
+        slot = this->order.back().second;
+        this->entries.erase(this->order.back().first);
+        this->order.pop_back();
+    } else {
+        slot = this->order.size();
+    }
+    this->order.emplace_front(user, slot);
+    this->entries[user] = this->order.begin();
+    return this->pool + slot * this->stride;
+}
+
+void HiddenCache::clear () {
+    this->order.clear();
+    this->entries.clear();
+}
+
+// Evaluate the softmax units of n movies in place. buffer holds MAX_RATING
+// consecutive inputs (weighted hidden contributions plus visible bias) per
+// movie, and is overwritten with P[v_q^k == 1 | h] (Eq. 10 of Salakhutdinov,
+// Mnih, & Hinton 2007), normalized over the ratings of each movie
+static inline void activateSoftmax (data_t *__restrict__ buffer, size_t n) {
+    const size_t units = n * MAX_RATING;
+    // Activate all units of all movies in one flat loop so that it vectorizes
+    for ( size_t i = 0; i < units; ++i ) {
+        buffer[i] = sigmoid<data_t>(buffer[i]);
+    }
+    // Normalize the activation probabilities of each movie
+    for ( size_t i = 0; i < units; i += MAX_RATING ) {
+        data_t total = (buffer[i] + buffer[i + 1]) +
+            ((buffer[i + 2] + buffer[i + 3]) + buffer[i + 4]);
+        if ( total > 0 ) {
+            const data_t scale = 1.0 / total;
+            for ( int r = 0; r < MAX_RATING; ++r ) {
+                buffer[i + r] *= scale;
+            }
+        }
+    }
+}
+
+// Compute the expected (one-indexed) rating of a movie from the activation
+// probabilities of its softmax units
+static inline data_t expectedRating (const data_t *probs) {
+    return (MIN_RATING * probs[0] + (MIN_RATING + 1) * probs[1]) +
+        ((MIN_RATING + 2) * probs[2] + (MIN_RATING + 3) * probs[3]) +
+        (MIN_RATING + 4) * probs[4];
+}
+
+// Update one row of the weight matrix with momentum. pos & neg hold the
+// (binary) hidden states that were sampled alongside this softmax unit from
+// the data and from the model respectively; only weights to hidden units
+// that were active in either phase are changed
+static inline void updateWeightRow (data_t *__restrict__ weight,
+                                    data_t *__restrict__ delta,
+                                    const data_t *__restrict__ pos,
+                                    const data_t *__restrict__ neg,
+                                    size_t n, data_t momentum, data_t rate) {
+    for ( size_t h = 0; h < n; ++h ) {
+        const data_t change = momentum * delta[h]
+            + rate * ((pos[h] - neg[h]) - (data_t) DECAY * weight[h]);
+        const bool active = (pos[h] + neg[h]) > 0;
+        // Written as selects rather than a branch so that it vectorizes
+        delta[h] = active ? change : delta[h];
+        weight[h] += active ? change : 0;
+    }
+}
+
+// Update the bias of one visible softmax unit with momentum
+static inline void updateVisibleBias (data_t &bias, data_t &delta,
+                                      data_t pos, data_t neg, 
+                                      data_t momentum, data_t rate) {
+    delta = momentum * delta + rate * (pos - neg);
+    bias += delta;
+}
+
+// Sample a (zero-indexed) rating from the activation probabilities of a
+// movie's softmax units
+template <typename Engine>
+static inline uint8_t sampleSoftmax (const data_t *probs, 
+                                     std::uniform_real_distribution<data_t> 
+                                     &uniform, Engine &engine) {
+    int sampledRating = 0;
+    data_t r = uniform(engine) - probs[0];
+    while ( r > 0 && sampledRating < MAX_RATING - 1 ) {
+        r -= probs[++sampledRating];
+    }
+    return (uint8_t) sampledRating;
 }
 
 // Helper function for building the path to a user's cached indicator matrix
@@ -99,7 +217,11 @@ static void loadIndicator (std::vector<struct rating_t> **indicators,
     // Get the source path of the cached indicator matrix for this user
     std::string cachePath = userCachePath(user);
     struct stat statBuffer;
-    stat(cachePath.c_str(), &statBuffer);
+    // Users without a cached indicator matrix have no ratings
+    if ( stat(cachePath.c_str(), &statBuffer) != 0 ) {
+        indicators[user] = new std::vector<struct rating_t>();
+        return;
+    }
     // Open this user's cached (sparse) indicator matrix
     std::ifstream indicatorCache(cachePath, ios::binary);
     // Calculate the number of (movie, rating) pairs for this user
@@ -145,10 +267,12 @@ void RBM::train (const Mat<data_t> &data) {
 #ifndef NDEBUG
     std::cout << "Initializing weight matrix" << std::endl;
 #endif
-    // Initialize weight matrix using our normal distribution
-    for ( int h = 0; h < hidden; ++h ) {
-        for ( int i = 0; i < this->movies * MAX_RATING; ++i ) {
-            this->weights[h][i] = normal(engine);
+    // Initialize weight matrix using our normal distribution (the padding
+    // at the end of each row stays zero)
+    for ( int i = 0; i < this->movies * MAX_RATING; ++i ) {
+        data_t *weight = this->weights + i * this->stride;
+        for ( int h = 0; h < this->hidden; ++h ) {
+            weight[h] = normal(engine);
         }
     }
 
@@ -165,20 +289,40 @@ void RBM::train (const Mat<data_t> &data) {
 #ifndef NDEBUG
     std::cout << "Initializing biases for the visible units" << std::endl;
 #endif
+    const size_t pmfBytes = this->movies * MAX_RATING * sizeof(data_t);
+    bool pmfCached = false;
     struct stat statBuffer;
-    // If a cached ranking pmf matrix does not exist
-    if ( stat(PMF_PATH, &statBuffer) != 0 ) {
+    // Only a cached rating pmf matrix of the right size that reads in full
+    // is used; anything else (e.g. one for a different store) is rebuilt
+    if ( stat(PMF_PATH, &statBuffer) == 0 
+         && (size_t) statBuffer.st_size == pmfBytes ) {
+#ifndef NDEBUG
+        std::cout << "Loading cached rating pmf's" << std::endl;
+#endif
+        // Open the binary file used to cache the rating pmf's
+        std::ifstream biasCache(PMF_PATH, ios::binary);
+        // Initialize biases of visible units
+        pmfCached = (bool) biasCache.read((char *) this->visibleBias, 
+                                          pmfBytes);
+        biasCache.close();
+    }
+    if ( !pmfCached ) {
 #ifndef NDEBUG
         std::cout << "Caching rating pmf's for all movies" 
                   << std::endl;
 #endif
+        // A failed read may have left part of a cache behind
+        std::fill(this->visibleBias, 
+                  this->visibleBias + this->movies * MAX_RATING, 0.0);
         int movie, rating;
         // For each column in the data matrix (rating entry)
         for ( unsigned i = 0; i < data.n_cols; ++i ) {
             movie = std::lround(data.at(MOVIE_ROW, i));
             rating = std::lround(data.at(RATING_ROW, i));
-            // Increment the count for that movie, rating pair
-            GET2D(this->visibleBias, MAX_RATING, movie, rating) += 1.0;
+            // Increment the count for that movie, rating pair (softmax units
+            // are zero-indexed)
+            GET2D(this->visibleBias, MAX_RATING, movie, 
+                  rating - MIN_RATING) += 1.0;
 
         }
         data_t total;
@@ -200,27 +344,19 @@ void RBM::train (const Mat<data_t> &data) {
         // Open the binary file used to cache the rating pmf's
         std::ofstream biasCache(PMF_PATH, ios::binary);
         // Cache the pmf matrix (initial biases of the visible units)
-        biasCache.write((char *) this->visibleBias, 
-                        this->movies * MAX_RATING * sizeof(data_t));
-        biasCache.close();
-    } else {
-#ifndef NDEBUG
-        std::cout << "Loading cached rating pmf's" << std::endl;
-#endif
-        // Open the binary file used to cache the rating pmf's
-        std::ifstream biasCache(PMF_PATH, ios::binary);
-        // Initialize biases of visible units
-        biasCache.read((char *) this->visibleBias,
-                       this->movies * MAX_RATING * sizeof(data_t));
+        biasCache.write((char *) this->visibleBias, pmfBytes);
         biasCache.close();
     }
 
     // Allocate an array for storing each user's sparse indicator matrix
     // This array is not contiguous in memory on purpose; we don't want
     // all users' (sparse) indicator matrices taking up cache space when we
-    // only need one at a time, and it makes indexing way easier
-    std::vector<struct rating_t> **const indicators = 
-        new std::vector<struct rating_t>*[this->users];
+    // only need one at a time, and it makes indexing way easier. The
+    // matrices are kept after training for prediction
+    this->freeIndicators();
+    this->hiddenCache.clear();
+    this->indicators = new std::vector<struct rating_t>*[this->users]();
+    std::vector<struct rating_t> **const indicators = this->indicators;
     // Vector for marking indicator matrices as found; all are initialized as
     // missing
     std::vector<bool> found(this->users, 0);
@@ -323,52 +459,41 @@ void RBM::train (const Mat<data_t> &data) {
 
     // Begin training procedure
 
+    const size_t stride = this->stride;
     // Activation probabilities for the hidden units
-    // data_t *const hiddenProbs = new data_t[this->hidden]();
+    data_t *const hiddenProbs = simd::alignedAlloc<data_t>(stride);
     // Store the state of the hidden units across contrastive divergence steps
-    uint8_t *const hiddenStatesBuffer = new uint8_t[this->hidden]();
+    data_t *const hiddenStatesBuffer = simd::alignedAlloc<data_t>(stride);
     // Hidden states sampled from the data
-    uint8_t *const posHiddenStates = new uint8_t[this->hidden]();
-    // Activation histogram for hidden units sampled from the data
-    uint8_t *const posHiddenAct = new uint8_t[this->hidden]();
+    data_t *const posHiddenStates = simd::alignedAlloc<data_t>(stride);
     // Hidden states sampled using contrastive divergence (approximation of
     // sampling from the model's distribution, which is intractable)
-    uint8_t *const negHiddenStates = new uint8_t[this->hidden]();
-    // Activation histogram using contrastive divergence
-    uint8_t *const negHiddenAct = new uint8_t[this->hidden]();
-
-    // Activation probabilities for the visible units
-    data_t *const visibleProbs = new data_t[this->movies * MAX_RATING]();
+    data_t *const negHiddenStates = simd::alignedAlloc<data_t>(stride);
+    // Hidden states that are never active; stands in for the phase that did
+    // not touch a softmax unit when its weights are updated
+    data_t *const inactiveStates = simd::alignedAlloc<data_t>(stride);
+
+    // Activation probabilities of the softmax units of the current user's
+    // rated movies, MAX_RATING consecutive units per rated movie. These only
+    // grow to fit the most prolific user seen so far
+    std::vector<data_t> visibleProbs;
     // Non-regularized activation probabilities for the visible units, used to
     // compute RMSE
-    data_t *const visibleProbsRMSE = new data_t[this->movies * MAX_RATING]();
-    // Activation histogram for visible units sampled from the data
-    uint8_t *const posVisibleAct = new uint8_t[this->movies * MAX_RATING]();
-    // Activation histogram for visible units sampled using contrastive
-    // divergence
-    uint8_t *const negVisibleAct = new uint8_t[this->movies * MAX_RATING]();
-    // Movie-id indexed array used as a buffer for storing the sampled states
-    // of the visible softmax units
-    uint8_t *const softmax = new uint8_t[this->movies]();
+    std::vector<data_t> visibleProbsRMSE;
 
     // Change in the visible unit biases
     data_t *const deltaVisibleBias = new data_t[this->movies * MAX_RATING]();
     // Change in the hidden unit biases
     data_t *const deltaHiddenBias = new data_t[this->hidden]();
-    // Change in the weight matrix
-    data_t **const deltaCD = new data_t*[this->hidden]();
-    // Contrastive divergence 
-    uint8_t **const posCD = new uint8_t*[this->hidden]();
-    uint8_t **const negCD = new uint8_t*[this->hidden]();
-    for ( int h = 0; h < this->hidden; ++h ) {
-        posCD[h] = new uint8_t[this->movies * MAX_RATING]();
-        negCD[h] = new uint8_t[this->movies * MAX_RATING]();
-        deltaCD[h] = new data_t[this->movies * MAX_RATING]();
-    }
+    // Change in the weight matrix (same layout as the weights)
+    data_t *const deltaCD = 
+        simd::alignedAlloc<data_t>(this->movies * MAX_RATING * stride);
 
+#if !defined(NDEBUG) || !defined(NTIME)
+    std::chrono::duration<double> seconds_elapsed;
+#endif
 #ifndef NDEBUG
     std::chrono::time_point<std::chrono::system_clock> begin, end;
-    std::chrono::duration<double> seconds_elapsed;
 #endif
 #ifndef NTIME
     std::chrono::time_point<std::chrono::system_clock> 
@@ -377,10 +502,6 @@ void RBM::train (const Mat<data_t> &data) {
 
     // Initialize uniform distribution once
     std::uniform_real_distribution<data_t> uniform(0.0, 1.0);
-    bool active;
-
-    data_t *__restrict__ weight, *__restrict__ delta;
-    uint8_t *__restrict__ pos, *__restrict__ neg;
     unsigned visInd;
 
     // TODO: add per-epoch RMSE computation
@@ -390,7 +511,9 @@ void RBM::train (const Mat<data_t> &data) {
 #endif
     // For the specified number of epochs (should be while RMSE is decreasing)
     for ( int epoch = 0; epoch < EPOCHS; ++epoch ) {
+#ifndef NDEBUG
         begin = std::chrono::system_clock::now();
+#endif
         // Total RMSE for this epoch
         double epochRMSE = 0.0;
 
@@ -401,83 +524,54 @@ void RBM::train (const Mat<data_t> &data) {
 #endif
             // This user's sparse indicator matrix
             std::vector<struct rating_t> *const indicator = indicators[user];
+            const size_t nratings = indicator->size();
+            if ( visibleProbs.size() < nratings * MAX_RATING ) {
+                visibleProbs.resize(nratings * MAX_RATING);
+                visibleProbsRMSE.resize(nratings * MAX_RATING);
+            }
 
             // Run a training iteration until we have to sample the visible
             // units, i.e., sample the hidden units given the data
 
-            // For all (movie, rating) pairs (active visible units)
+            // Accumulate the weights of all set visible units (sampled from
+            // the data) into the inputs of the hidden units
+            memcpy(hiddenProbs, this->hiddenBias, stride * sizeof(data_t));
             for ( std::vector<struct rating_t>::const_iterator it = 
                   indicator->cbegin(); it != indicator->cend(); ++it ) {
-                // Add bias contribution of this set visible unit (sample its
-                // state from the data)
-                GET2D(posVisibleAct, MAX_RATING, it->movie, it->score) += 1;
+                simd::add(this->weightRow(it->movie, it->score - MIN_RATING),
+                          hiddenProbs, stride);
             }
             // For each hidden unit
             for ( int h = 0; h < this->hidden; ++h ) {
-                weight = this->weights[h];
-                data_t prob = 0;
-                // Calculate the sum of the elements of the Schur product of
-                // this user's indicator matrix & the hth slice of the weight
-                // cube
-                for ( std::vector<struct rating_t>::const_iterator it =
-                      indicator->cbegin(); it != indicator->cend(); ++it ) {
-                    // Accumulate the contribution of this set visible unit
-                    prob += GET2D(weight, MAX_RATING, it->movie, it->score);
-                }
                 // Calculate P[h_j = 1 | V] (Eq. 9 of Salakhutdinov, Mnih,
                 // & Hinton 2007)
-                prob = sigmoid<data_t>(prob + this->hiddenBias[h]);
-                // Sample the state of this hidden unit
-                active = prob > uniform(engine);
-                // Record the activation probability & sampled state of this
-                // unit for training purposes (sample from data)
-                posHiddenStates[h] = hiddenStatesBuffer[h] = (uint8_t) active;
-                posHiddenAct[h] = (uint8_t) active;
-                // Calculate non-regularized probabilities for RMSE
-                // reporting
-                for ( std::vector<struct rating_t>::const_iterator it =
-                      indicator->cbegin(); it != indicator->cend(); ++it ) {
-                    visInd = GET2DINDEX(MAX_RATING, it->movie, 0);
-                    // For each softmax unit
-                    for ( int r = 0; r < MAX_RATING; ++r ) {
-                        // Calculate non-regularized activation probability
-                        visibleProbsRMSE[visInd + r] += 
-                            prob * weight[visInd + r];
-                    }
-                }
+                hiddenProbs[h] = sigmoid<data_t>(hiddenProbs[h]);
+                // Sample the state of this hidden unit, and record it for
+                // training purposes (sample from data)
+                posHiddenStates[h] = hiddenStatesBuffer[h] = 
+                    (data_t) (hiddenProbs[h] > uniform(engine));
             }
 
-            // For each rated movie
+            // Calculate non-regularized probabilities for RMSE reporting
+            data_t *visible = visibleProbsRMSE.data();
             for ( std::vector<struct rating_t>::const_iterator it =
                   indicator->cbegin(); it != indicator->cend(); ++it ) {
                 visInd = GET2DINDEX(MAX_RATING, it->movie, 0);
                 // For each softmax unit
                 for ( int r = 0; r < MAX_RATING; ++r ) {
-                    // Calculate P[v_q^k == 1 | h] (Eq. 10 of
-                    // Salakhutdinov, Mnih, & Hinton 2007)
-                    visibleProbsRMSE[visInd + r] = 
-                        sigmoid<data_t>(visibleProbsRMSE[visInd + r] 
-                                        + this->visibleBias[visInd + r]);
-                }
-                // Normalize the activation probabilities
-                data_t total = 
-                    (visibleProbsRMSE[visInd] + visibleProbsRMSE[visInd + 1]) +
-                    ((visibleProbsRMSE[visInd + 2] 
-                      + visibleProbsRMSE[visInd + 3])
-                     + visibleProbsRMSE[visInd + 4]);
-                if ( total > 0 ) {
-                    for ( int r = 1; r < MAX_RATING; ++r ) {
-                        visibleProbsRMSE[visInd + r] *= 1.0 / total;
-                    }
+                    *visible++ = simd::dot(hiddenProbs, 
+                                           this->weightRow(it->movie, r),
+                                           stride)
+                        + this->visibleBias[visInd + r];
                 }
-                // Compute expected value for the corresponding softmax unit
-                data_t expectation = 
-                    (visibleProbsRMSE[visInd + 1] 
-                     + 2.0 * visibleProbsRMSE[visInd + 2]) +
-                    (3.0 * visibleProbsRMSE[visInd + 3] 
-                     + 4.0 * visibleProbsRMSE[visInd + 4]);
+            }
+            activateSoftmax(visibleProbsRMSE.data(), nratings);
+            visible = visibleProbsRMSE.data();
+            for ( std::vector<struct rating_t>::const_iterator it =
+                  indicator->cbegin(); it != indicator->cend(); 
+                  ++it, visible += MAX_RATING ) {
                 // Compute mean squared error contributed by the expectation
-                data_t mse = pow(it->score - expectation, 2.0);
+                data_t mse = pow(it->score - expectedRating(visible), 2.0);
                 mse *= 1.0 / (data_t) data.n_cols;
                 // Accumulate contribution to per-epoch RMSE
                 epochRMSE += (double) mse;
@@ -489,105 +583,53 @@ void RBM::train (const Mat<data_t> &data) {
             for ( int k = CD_STEPS; k > 0; --k ) {
                 const bool lastStep = k <= 1;
                 
-                // Begin reconstruction
-
-                // For each hidden unit
-                for ( int h = 0; h < this->hidden; ++h ) {
-                    // If it is not active, skip it
-                    if ( ! hiddenStatesBuffer[h] ) continue;
-                    // For all (movie, rating) pairs
-                    for ( std::vector<struct rating_t>::const_iterator it = 
-                          indicator->cbegin(); it != indicator->cend(); 
-                          ++it ) {
-                        // Accumulate contributions from this set hidden
-                        // unit
-                        visInd = GET2DINDEX(MAX_RATING, it->movie, 0);
-                        // For each softmax unit
-                        for ( int r = 0; r < MAX_RATING; ++r ) {
-                            // Accumulate contribution to softmax unit
-                            visibleProbs[visInd + r] += weight[visInd + r];
-                        }
-                    }
-                }
-                // For all (movie, rating) pairs
-                for ( std::vector<struct rating_t>::iterator it = 
-                      indicator->begin(); it != indicator->end(); ++it ) {
+                // Begin reconstruction; the inputs of each softmax unit are
+                // the dot product of its weights & the hidden states
+                visible = visibleProbs.data();
+                for ( std::vector<struct rating_t>::const_iterator it = 
+                      indicator->cbegin(); it != indicator->cend(); ++it ) {
                     visInd = GET2DINDEX(MAX_RATING, it->movie, 0);
                     // For each softmax unit
                     for ( int r = 0; r < MAX_RATING; ++r ) {
-                        // Calculate P[v_q^k == 1 | h] (Eq. 10 of
-                        // Salakhutdinov, Mnih, & Hinton 2007)
-                        visibleProbs[visInd + r] = 
-                            sigmoid<data_t>(visibleProbs[visInd + r] 
-                                            + this->visibleBias[visInd + r]);
+                        *visible++ = simd::dot(hiddenStatesBuffer,
+                                               this->weightRow(it->movie, r),
+                                               stride)
+                            + this->visibleBias[visInd + r];
                     }
-                    // Normalize the activation probabilities
-                    data_t total = 
-                        (visibleProbs[visInd] + visibleProbs[visInd + 1]) +
-                        ((visibleProbs[visInd + 2] + visibleProbs[visInd + 3])
-                         + visibleProbs[visInd + 4]);
-                    for ( int r = 0; r < MAX_RATING; ++r ) {
-                        visibleProbs[visInd + r] *= 1.0 / total;
-                    }
-                    // Sample the state of this visible softmax unit (sample
-                    // from approximation of model)
-                    int8_t sampledRating = -1;
-                    data_t r = uniform(engine);
-                    do {
-                        r -= visibleProbs[visInd + ++sampledRating];
-                    } while ( r > 0 );
+                }
+                activateSoftmax(visibleProbs.data(), nratings);
+
+                // Sample the states of the visible softmax units (sample
+                // from approximation of model), and accumulate their weights
+                // into the inputs of the hidden units
+                memcpy(negHiddenStates, this->hiddenBias, 
+                       stride * sizeof(data_t));
+                visible = visibleProbs.data();
+                for ( std::vector<struct rating_t>::iterator it = 
+                      indicator->begin(); it != indicator->end(); 
+                      ++it, visible += MAX_RATING ) {
                     // Record the (zero-indexed) sampled rating
-                    it->softmax = (uint8_t) sampledRating;
+                    it->softmax = sampleSoftmax(visible, uniform, engine);
+                    simd::add(this->weightRow(it->movie, it->softmax),
+                              negHiddenStates, stride);
                 }
 
                 // Sample the states of the hidden units given the states of
                 // visible units sampled from the approximation of the model
-
-                // For each hidden unit
                 for ( int h = 0; h < this->hidden; ++h ) {
-                    weight = this->weights[h];
-                    data_t prob = 0;
-                    // For all (movie, rating) pairs
-                    for ( std::vector<struct rating_t>::const_iterator it = 
-                          indicator->cbegin(); it != indicator->cend(); 
-                          ++it ) {
-                        // Accumulate contribution of the sampled visible unit 
-                        prob += GET2D(weight, MAX_RATING,
-                                      it->movie, it->softmax);
-                    }
                     // Calculate P[h_j = 1 | V] (Eq. 9 of Salakhutdinov, Mnih,
-                    // & Hinton 2007) from the sampled data
-                    prob = sigmoid<data_t>(prob + this->hiddenBias[h]);
-                    // Sample the state of this hidden unit
-                    active = prob > uniform(engine);
-                    // Record the sampled state of this unit for training
-                    // purposes (sample from approximation of model)
-                    negHiddenStates[h] = (uint8_t) active;
-                }
-                // Reset sampled visible unit activation probabilities
-                memset(visibleProbs, 0, this->movies * MAX_RATING);
-                // If this is the last CD step
-                if ( lastStep ) {
-                    // For each hidden unit
-                    for ( int h = 0; h < this->hidden; ++h ) {
-                        // Train on this data
-                        negHiddenAct[h] += negHiddenStates[h];
-                    }
-                    // For all (movie, rating) pairs 
-                    for ( std::vector<struct rating_t>::const_iterator it =
-                          indicator->cbegin(); it != indicator->cend(); 
-                          ++it ) {
-                        // Train on the sampled data
-                        GET2D(negVisibleAct, MAX_RATING, 
-                              it->movie, it->softmax) += 1;
-                    }
-                    continue;
+                    // & Hinton 2007) from the sampled data, then sample the
+                    // state of this hidden unit
+                    negHiddenStates[h] = (data_t) 
+                        (sigmoid<data_t>(negHiddenStates[h]) > 
+                         uniform(engine));
                 }
+                // If this is the last CD step, train on this data
+                if ( lastStep ) continue;
                 // Load the sampled states of the hidden unit into the
                 // buffer, for the next contrastive divergence step
-                for ( int h = 0; h < this->hidden; ++h ) {
-                    hiddenStatesBuffer[h] = negHiddenStates[h];
-                }
+                memcpy(hiddenStatesBuffer, negHiddenStates, 
+                       stride * sizeof(data_t));
             } // CD-k iterations
 #ifndef NTIME
             section_end = std::chrono::system_clock::now();
@@ -596,85 +638,34 @@ void RBM::train (const Mat<data_t> &data) {
                       << " seconds for user " << user + 1 << std::endl;
             section_begin = std::chrono::system_clock::now();
 #endif
-            // Accumulate changes in the weights
-
-            // For each hidden unit
-            for ( int h = 0; h < this->hidden; ++h ) {
-                neg = negCD[h];
-                // For all (movie, rating) pairs
-                for ( std::vector<struct rating_t>::const_iterator it = 
-                      indicator->cbegin(); it != indicator->cend(); ++it ) {
-                    // Accumulate contributions from Gibbs sampling
-                    GET2D(neg, MAX_RATING, it->movie, it->softmax)
-                        += negHiddenStates[h];
-                }
-            }
-            // For each hidden unit
-            for ( int h = 0; h < this->hidden; ++h ) {
-                // Skip units not activated when sampled given the data
-                // distribution
-                if ( ! posHiddenStates[h] ) continue;
-                pos = posCD[h];
-                // For all (movie, rating) pairs
-                for ( std::vector<struct rating_t>::const_iterator it = 
-                      indicator->cbegin(); it != indicator->cend(); ++it ) {
-                    // Accumulate contributions the data distribution
-                    GET2D(pos, MAX_RATING, it->movie, it->score) += 1;
-                }
-            }
-
-            // Update weights
-
-            // For each hidden unit
-            for ( int h = 0; h < this->hidden; ++h ) {
-                pos = posCD[h];
-                neg = negCD[h];
-                delta = deltaCD[h];
-                weight = this->weights[h];
-                // For all (movie, rating) pairs
-                for ( std::vector<struct rating_t>::const_iterator it = 
-                      indicator->cbegin(); it != indicator->cend(); ++it ) {
-                    visInd = GET2DINDEX(MAX_RATING, it->movie, 0);
-                    // For ecah softmax unit
-                    for ( int r = 0; r < MAX_RATING; ++r ) {
-                        // If it was ever activated
-                        if ( (pos[visInd + r] | neg[visInd + r]) != 0 ) {
-                            // Calculate the change in this weight
-                            delta[visInd + r] = 
-                                this->momentum * delta[visInd + r]
-                                + this->rate * 
-                                    ((data_t)(pos[visInd + r] 
-                                              - neg[visInd + r])
-                                     - DECAY * weight[visInd + r]);
-                            // Update the weight matrix
-                            weight[visInd + r] += delta[visInd + r];
-                        }
-                    }
-                }
-            }
-
-            // Update visible biases
-
-            // For all (movie, rating) pairs
+            // Update weights & visible biases. Only the softmax units that
+            // were set in the data (score) or sampled from the model (softmax)
+            // have a nonzero gradient
             for ( std::vector<struct rating_t>::const_iterator it = 
                   indicator->cbegin(); it != indicator->cend(); ++it ) {
+                const unsigned score = it->score - MIN_RATING;
+                const unsigned sampled = it->softmax;
                 visInd = GET2DINDEX(MAX_RATING, it->movie, 0);
-                // For each softmax unit
-                for ( int r = 0; r < MAX_RATING; ++r ) {
-                    // If it was ever activated
-                    if ( (posVisibleAct[visInd + r]
-                          | negVisibleAct[visInd + r]) != 0 ) {
-                        // Calculate the change in this bias
-                        deltaVisibleBias[visInd + r] = 
-                            this->momentum * deltaVisibleBias[visInd + r]
-                            + this->rate
-                                * (data_t)(posVisibleAct[visInd + r] 
-                                           - negVisibleAct[visInd + r]);
-                        // Update the bias of this unit
-                        this->visibleBias[visInd + r] +=
-                            deltaVisibleBias[visInd + r];
-                    }
-                }
+                // The unit set in the data saw the positive hidden states,
+                // and the sampled unit saw the negative ones
+                updateWeightRow(this->weightRow(it->movie, score),
+                                deltaCD + (visInd + score) * stride,
+                                posHiddenStates, 
+                                sampled == score ? negHiddenStates 
+                                                 : inactiveStates,
+                                stride, this->momentum, this->rate);
+                updateVisibleBias(this->visibleBias[visInd + score],
+                                  deltaVisibleBias[visInd + score], 1.0,
+                                  sampled == score ? 1.0 : 0.0,
+                                  this->momentum, this->rate);
+                if ( sampled == score ) continue;
+                updateWeightRow(this->weightRow(it->movie, sampled),
+                                deltaCD + (visInd + sampled) * stride,
+                                inactiveStates, negHiddenStates,
+                                stride, this->momentum, this->rate);
+                updateVisibleBias(this->visibleBias[visInd + sampled],
+                                  deltaVisibleBias[visInd + sampled], 0.0, 
+                                  1.0, this->momentum, this->rate);
             }
 
             // Update hidden biases
@@ -682,218 +673,134 @@ void RBM::train (const Mat<data_t> &data) {
             // For each hidden unit
             for ( int h = 0; h < this->hidden; ++h ) {
                 // Ignore hidden unit biases for units that were never active
-                if ( (posHiddenAct[h] | negHiddenAct[h]) == 0 ) continue;
+                if ( posHiddenStates[h] + negHiddenStates[h] == 0 ) continue;
                 // Calculate the change in bias
                 deltaHiddenBias[h] = this->momentum * deltaHiddenBias[h]
-                    + this->rate * (data_t)(posHiddenAct[h] - negHiddenAct[h]);
+                    + this->rate * (posHiddenStates[h] - negHiddenStates[h]);
                 // Update the bias for this hidden unit
                 this->hiddenBias[h] += deltaHiddenBias[h];
             }
 #ifndef NTIME
-            section_end = std::chrono::system_clock::now();
-            seconds_elapsed = section_end - section_begin;
+            user_end = std::chrono::system_clock::now();
+            seconds_elapsed = user_end - section_begin;
             std::cout << "weight & bias updates completed in "
                       << seconds_elapsed.count() << " seconds for user " 
                       << user + 1 << std::endl;
-            section_begin = std::chrono::system_clock::now();
-#endif
-
-            // TODO: is there a way to avoid zeroing all these arrays?
-            //       is reallocating faster? can I bit pack an over-allocated
-            //       array?
-
-            memset(negHiddenAct, 0, this->hidden);
-            memset(visibleProbsRMSE, 0, this->movies * MAX_RATING);
-            memset(posVisibleAct, 0, this->movies * MAX_RATING);
-            memset(negVisibleAct, 0, this->movies * MAX_RATING);
-            for ( int h = 0; h < this->hidden; ++h ) {
-                memset(posCD[h], 0, this->movies * MAX_RATING);
-                memset(negCD[h], 0, this->movies * MAX_RATING);
-            } 
-#ifndef NTIME
-            user_end = std::chrono::system_clock::now();
-            seconds_elapsed = user_end - section_begin;
-            std::cout << "Zeroed loop arrays in " << seconds_elapsed.count()
-                      << " seconds for user " << user + 1 << std::endl;
             seconds_elapsed = user_end - user_begin;
             std::cout << "Processed user " << user + 1 << " of epoch "
                       << epoch << " in " << seconds_elapsed.count()
                       << " seconds" << std::endl;
 #endif
         } // For all users
-    end = std::chrono::system_clock::now();
-    seconds_elapsed = end - begin;
-    cout << "Finished epoch " << epoch << " of RBM training in " 
-         << seconds_elapsed.count() << " seconds.  RMSE: " << sqrt(epochRMSE) 
-         << std::endl;
+#ifndef NDEBUG
+        end = std::chrono::system_clock::now();
+        seconds_elapsed = end - begin;
+        std::cout << "Finished epoch " << epoch << " of RBM training in " 
+                  << seconds_elapsed.count() << " seconds.  RMSE: " 
+                  << sqrt(epochRMSE) << std::endl;
+#endif
     } // Epochs
 
-    // delete [] hiddenProbs;
-    delete [] hiddenStatesBuffer;
-    delete [] posHiddenStates;
-    delete [] posHiddenAct;
-    delete [] negHiddenStates;
-    delete [] negHiddenAct;
-
-    delete [] visibleProbs;
-    delete [] visibleProbsRMSE;
-    delete [] posVisibleAct;
-    delete [] negVisibleAct;
-    delete [] softmax;
+    simd::alignedFree(hiddenProbs);
+    simd::alignedFree(hiddenStatesBuffer);
+    simd::alignedFree(posHiddenStates);
+    simd::alignedFree(negHiddenStates);
+    simd::alignedFree(inactiveStates);
 
     delete [] deltaVisibleBias;
     delete [] deltaHiddenBias;
+    simd::alignedFree(deltaCD);
+}
 
-    for ( int h = 0; h < this->hidden; ++h ) {
-        delete [] posCD[h];
-        delete [] negCD[h];
-        delete [] deltaCD[h];
+// void RBM::save(const std::string &cachePath) {
+
+// }
+
+const std::vector<struct rating_t> &RBM::userIndicator (int user) {
+    // Predicting without having trained in this process; fall back to the
+    // indicator matrices cached on disk, loading each one once
+    if ( this->indicators == NULL ) {
+        this->indicators = new std::vector<struct rating_t>*[this->users]();
     }
-    delete [] deltaCD;
-    delete [] posCD;
-    delete [] negCD;
+    if ( this->indicators[user] == NULL ) {
+        loadIndicator(this->indicators, user);
+    }
+    return *this->indicators[user];
+}
 
-    for ( int i = 0; i < this->users; ++i ) {
-        delete indicators[i];
+const data_t *RBM::userHiddenProbs (int user) {
+    data_t *hiddenProbs = this->hiddenCache.find(user);
+    if ( hiddenProbs != NULL ) return hiddenProbs;
+
+    hiddenProbs = this->hiddenCache.insert(user);
+    const std::vector<struct rating_t> &indicator = this->userIndicator(user);
+    // Compute the hidden activation probabilities given the data
+    memcpy(hiddenProbs, this->hiddenBias, this->stride * sizeof(data_t));
+    for ( std::vector<struct rating_t>::const_iterator it = 
+          indicator.cbegin(); it != indicator.cend(); ++it ) {
+        // Accumulate the contribution of this set visible unit
+        simd::add(this->weightRow(it->movie, it->score - MIN_RATING),
+                  hiddenProbs, this->stride);
     }
-    delete [] indicators;
+    for ( int h = 0; h < this->hidden; ++h ) {
+        // Calculate P[h_j = 1 | V] (Eq. 9 of Salakhutdinov, Mnih,
+        // & Hinton 2007)
+        hiddenProbs[h] = sigmoid<data_t>(hiddenProbs[h]);
+    }
+
+    return hiddenProbs;
 }
 
-// void RBM::save(const std::string &cachePath) {
+float RBM::predict (int user, int item, int date, bool bound) {
+    const data_t *hiddenProbs = this->userHiddenProbs(user);
+    const unsigned visInd = GET2DINDEX(MAX_RATING, item, 0);
+    // Reconstruct only the softmax units of the requested movie
+    data_t visibleProbs[MAX_RATING];
+    for ( int r = 0; r < MAX_RATING; ++r ) {
+        visibleProbs[r] = simd::dot(hiddenProbs, this->weightRow(item, r),
+                                    this->stride)
+            + this->visibleBias[visInd + r];
+    }
+    activateSoftmax(visibleProbs, 1);
+    float prediction = expectedRating(visibleProbs);
+    if ( bound ) {
+        prediction = std::max<float>(MIN_RATING, 
+                                     std::min<float>(MAX_RATING, prediction));
+    }
+    return prediction;
+}
 
-// }
+void RBM::predictBatch (const int *users, const int *items, const int *dates,
+                        float *output, size_t n, bool bound) {
+    checkIds(users, items, dates, n);
+    for ( size_t i = 0; i < n; ++i ) {
+        output[i] = this->predict(users[i], items[i], dates[i], bound);
+    }
+}
 
 fmat RBM::predict (const fmat &targets) {
-    // Activation probabilities for hidden units
-    data_t *hiddenProbs = new data_t[this->hidden]();
-    // Activation probabilities for visible units
-    data_t *visibleProbs = new data_t[MAX_RATING * this->movies]();
     // Output matrix (for storing predictions)
     fmat output(3, targets.n_cols);
-    // Column index in the matrix of targets, and outputs, respectively
-    unsigned col = 0, outputCol = 0, visInd;
-    data_t datum;
-    data_t *__restrict__ weight;
 #ifndef NTIME
     std::chrono::time_point<std::chrono::system_clock> begin, end;
     std::chrono::duration<double> seconds_elapsed;
+    begin = std::chrono::system_clock::now();
 #endif
 
-    while ( col < targets.n_cols ) {
-#ifndef NTIME
-        begin = std::chrono::system_clock::now();
-#endif
+    for ( unsigned col = 0; col < targets.n_cols; ++col ) {
         int user = std::lround(targets.at(USER_ROW, col));
-        // Get the source path of the cached indicator matrix for this user
-        std::string cachePath = userCachePath(user);
-        struct stat statBuffer;
-        stat(cachePath.c_str(), &statBuffer);
-        // Open this user's cached (sparse) indicator matrix
-        std::ifstream indicatorCache(cachePath, ios::binary);
-        // Calculate the number of (movie, rating) pairs for this user
-        int nratings = statBuffer.st_size / sizeof(struct rating_t);
-        // Allocate a vector to store all of the (movie, rating) pairs
-        std::vector<struct rating_t> indicator(nratings);
-        // Load this user's cached (sparse) indicator matrix
-        indicatorCache.read((char *) indicator.data(),
-                            nratings * sizeof(struct rating_t));
-        indicatorCache.close();    
-
-        // Sample the hidden units given the data
-
-        // For each hidden unit
-        for ( int h = 0; h < this->hidden; ++h ) {
-            weight = this->weights[h];
-            hiddenProbs[h] = 0;
-            // Calculate the sum of the elements of the Schur product of
-            // this user's indicator matrix & the hth slice of the weight
-            // cube
-            for ( std::vector<struct rating_t>::const_iterator it = 
-                  indicator.cbegin(); it != indicator.cend(); ++it ) {
-                // Accumulate the contribution of this set visible unit
-                hiddenProbs[h] += GET2D(weight, MAX_RATING,
-                                        it->movie, it->score);
-            }
-            // Calculate P[h_j = 1 | V] (Eq. 9 of Salakhutdinov, Mnih,
-            // & Hinton 2007)
-            hiddenProbs[h] =
-                sigmoid<data_t>(hiddenProbs[h] + this->hiddenBias[h]);
-        }
-
-        // Reconstruct visible units
-
-        // Vector for storing the indices of movies whose ratings we need to
-        // predict (that do not exist in the data)
-        std::vector<int> targetMovies;
-        // Extract all movie indices from the input matrix (assumes input is
-        // sorted by user id) for this user
-        while ( col < targets.n_cols && targets.at(USER_ROW, col) == user ) {
-            targetMovies.push_back(std::lround(targets.at(MOVIE_ROW, col++)));
-        }
-
-        // Compute activation probabilities of the visible units
-
-        // For each hidden unit
-        for ( int h = 0; h < this->hidden; ++h ) {
-            datum = hiddenProbs[h];
-            weight = this->weights[h];
-            // For all movies we need ratings for
-            for ( std::vector<int>::const_iterator it = 
-                  targetMovies.begin(); it != targetMovies.end(); ++it ) {
-                visInd = GET2DINDEX(MAX_RATING, *it, 0);
-                // For ecah softmax unit
-                for ( int r = 0; r < MAX_RATING; ++r ) {
-                    // Accumulate contribution to this softmax unit
-                    visibleProbs[visInd + r] += datum * weight[visInd + r];
-                }
-            }
-        }
-        // For all movies we need ratings for
-        for ( std::vector<int>::const_iterator it = targetMovies.cbegin();
-              it != targetMovies.cend(); ++it ) {
-            visInd = GET2DINDEX(MAX_RATING, *it, 0);
-            // For each softmax unit
-            for ( int r = 0; r < MAX_RATING; ++r ) {
-                // Calculate P[v_q^k == 1 | h] (Eq. 10 of Salakhutdinov,
-                // Mnih, & Hinton 2007)
-                visibleProbs[visInd + r] = 
-                    sigmoid<data_t>(visibleProbs[visInd + r] 
-                                    + this->visibleBias[visInd + r]);
-            }
-            // Normalize the activation probabilities
-            data_t total = 
-                (visibleProbs[visInd] + visibleProbs[visInd + 1]) +
-                ((visibleProbs[visInd + 2] + visibleProbs[visInd + 3])
-                 + visibleProbs[visInd + 4]);
-            if ( total > 0 ) {
-                for ( int r = 0; r < MAX_RATING; ++r ) {
-                    visibleProbs[visInd + r] *= 1.0 / total;
-                }
-            }
-        }
-
-        // Compute the expected value (rating) for target visible units
-        for ( std::vector<int>::const_iterator it = targetMovies.cbegin();
-              it != targetMovies.cend(); ++it ) {
-            visInd = GET2DINDEX(MAX_RATING, *it, 1);
-            data_t r = visibleProbs[visInd] 
-                + 2.0 * visibleProbs[visInd + 1]
-                + 3.0 * visibleProbs[visInd + 2] 
-                + 4.0 * visibleProbs[visInd + 3];
-            // Store this rating in the output matrix
-            output.at(0, outputCol) = user;
-            output.at(1, outputCol) = *it;
-            output.at(2, outputCol++) = r;
-        }
-
-        memset(visibleProbs, 0, this->movies * MAX_RATING * sizeof(data_t));
+        int movie = std::lround(targets.at(MOVIE_ROW, col));
+        // Store this rating in the output matrix
+        output.at(0, col) = user;
+        output.at(1, col) = movie;
+        output.at(2, col) = this->predict(user, movie, 0, false);
+    }
 #ifndef NTIME
-        end = std::chrono::system_clock::now();
-        seconds_elapsed = end - begin;
-        std::cout << "Generated predictions for user " << user + 1 << " in "
-                  << seconds_elapsed.count() << " seconds" << std::endl;
+    end = std::chrono::system_clock::now();
+    seconds_elapsed = end - begin;
+    std::cout << "Generated " << targets.n_cols << " predictions in "
+              << seconds_elapsed.count() << " seconds" << std::endl;
 #endif
-    }
 
     return output;
 }
@@ -4,14 +4,21 @@
 #include <armadillo>
 #include <cmath>
 #include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <basealgorithm.hh>
 #include <netflix.hh>
+#include <simd.hh>
 
 #define HIDDEN 32
 #define EPSILON 0.001
 #define MOMENTUM 0.9
 #define DELTA 0.00002
+// Number of users whose hidden activations are kept for prediction
+#define HIDDEN_CACHE_SIZE 4096
 
 using namespace arma;
 using namespace netflix;
@@ -62,6 +69,42 @@ inline T sigmoid(const T &x) {
     return 1.0 / (1.0 + exp(-1.0 * x));
 }
 
+// Bounded cache of the hidden unit activation probabilities of recently seen
+// users; the least recently used user is evicted when it is full
+class HiddenCache {
+private:
+    // Maximum number of cached users
+    size_t capacity;
+
+    // Length of each cached vector of probabilities
+    size_t stride;
+
+    // capacity x stride probabilities; each user owns one slot (row)
+    data_t *pool;
+
+    // (user, slot) pairs, most recently used first
+    std::list<std::pair<int, size_t>> order;
+
+    // Position of each cached user in order
+    std::unordered_map<int, std::list<std::pair<int, size_t>>::iterator>
+        entries;
+
+public:
+    HiddenCache(size_t capacity, size_t stride);
+    ~HiddenCache();
+
+    // Get the cached probabilities of a user (marking them as most recently
+    // used), or NULL if they are not cached
+    data_t *find(int user);
+
+    // Get a slot to store the probabilities of a user in, evicting the least
+    // recently used user if the cache is full
+    data_t *insert(int user);
+
+    // Forget all users (e.g. after the weights change)
+    void clear();
+};
+
 class RBM : public BaseAlgorithm {
 private:
 
@@ -82,8 +125,15 @@ private:
     // Momentum
     data_t momentum;
 
-    // Weights between the hidden & visible units (W)
-    data_t **weights;
+    // Distance (in elements) between consecutive rows of the weight matrix;
+    // the number of hidden units padded to a whole cache line
+    size_t stride;
+
+    // Weights between the hidden & visible units (W), stored movie-major as
+    // a flat movies x MAX_RATING x stride array. The row for softmax unit r
+    // of a movie holds that unit's weights to every hidden unit, so the
+    // passes over a user's rated movies read contiguous, aligned rows
+    data_t *weights;
 
     // Shared biases of visible units
     data_t *visibleBias;
@@ -91,6 +141,38 @@ private:
     // Shared biases of the hidden units
     data_t *hiddenBias;
 
+    // Each user's sparse indicator matrix ((movie, rating) pairs), indexed by
+    // user; kept after training so that predictions never touch the disk.
+    // Entries are NULL until loaded
+    std::vector<struct rating_t> **indicators;
+
+    // Hidden activation probabilities of recently predicted users
+    HiddenCache hiddenCache;
+
+    // Get the row of weights between softmax unit r (zero-indexed) of a
+    // movie and all of the hidden units
+    inline data_t *weightRow(unsigned movie, unsigned r) const {
+        return this->weights + (movie * MAX_RATING + r) * this->stride;
+    }
+
+    // Get a user's sparse indicator matrix, loading it from the cache
+    // directory if it is not in memory
+    const std::vector<struct rating_t> &userIndicator(int user);
+
+    // Get the hidden unit activation probabilities of a user given their
+    // ratings, computing them if they are not cached
+    const data_t *userHiddenProbs(int user);
+
+    // Release all in-memory indicator matrices
+    void freeIndicators();
+
+protected:
+    void idBounds(int &users, int &items, int &dates) const {
+        users = this->users;
+        items = this->movies;
+        dates = INT_MAX;
+    }
+
 public:
     RBM(int users, int movies, int hidden, data_t rate, data_t momentum);
     ~RBM();
@@ -100,7 +182,11 @@ public:
     Mat<data_t> predict (const Mat<data_t> &targets);
     Mat<data_t> predict (const std::string &targetPath);
 
-    float predict(int user, int item, int date, bool bound) { return 0.0; };
+    float predict(int user, int item, int date, bool bound);
+
+    // Runs serially: predict() shares the hidden activation cache
+    void predictBatch(const int *users, const int *items, const int *dates,
+                      float *output, size_t n, bool bound);
 };
 
 #endif // __RBM_HH__
\ No newline at end of file
@@ -1,18 +1,24 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
 #include <rbm_new.hh>
+#include <telemetry.hh>
 
 RBM_New::RBM_New(int numUsers, int numItems, float globalAverage,
-    int maxRating, int numFactors, float learningRate, int numIters) :
+    int maxRating, int numFactors, float learningRate, int numIters,
+    uint64_t seed) :
+    rbm_seed(seed),
     numUsers(numUsers), numItems(numItems), globalAverage(globalAverage),
     maxRating(maxRating), numFactors(numFactors), learningRate(learningRate),
     userStartIndex(numUsers), numItemsTrainingSet(numUsers), numIters(numIters),
     numUsersTrainingSet(numItems)
 {
-    W = randu<cube>(maxRating, numFactors, numUsers) / 8.0;
-    BV = randu<mat>(maxRating, numUsers) / 8.0;
+    W = randu<cube>(maxRating, numFactors, numItems) / 8.0;
+    BV = randu<mat>(maxRating, numItems) / 8.0;
     BH = randu<vec>(numFactors) / 8.0;
     // BH = randu<mat>(maxRating, numFactors) / 8.0;
     CD_K = 1;
-    userStartIndex.zeros();
     numItemsTrainingSet.zeros();
     numUsersTrainingSet.zeros();
 
@@ -23,6 +29,16 @@ RBM_New::RBM_New(int numUsers, int numItems, float globalAverage,
     rbm_scaling      = 1.0;
     rbm_mult_step_dec= 0.999;
     D = 100;
+    rbm_stride = simd::paddedLength(D);
+    rbm_user_size = 3 * rbm_stride;
+    rbm_movie_size = simd::paddedLength(rbm_bins) + rbm_bins * rbm_stride;
+    user_latent = NULL;
+    movie_latent = NULL;
+    if (rbm_bins > RBM_MAX_BINS)
+    {
+        throw std::logic_error("RBM_New supports at most " +
+                          std::to_string(RBM_MAX_BINS) + " rating bins");
+    }
     /* end of new stuff */
 }
 
@@ -37,7 +53,7 @@ void RBM_New::populateNumItemsTrainingSet()
 {
     cout << "Begin populating numItems..." << endl;
     int userId = -1;
-    for(unsigned int i = 0; i < dataUM.n_cols; i++)
+    for(uword i = 0; i < dataUM.n_cols; i++)
     {
         // Based on the user that this rating was by, increment the
         // appropriate element of numItemsTrainingSet.
@@ -53,39 +69,32 @@ void RBM_New::populateNumItemsTrainingSet()
 }
 
 
-float RBM_New::predict(int user, int movie, int date, bool bound)
+void RBM_New::computeHidden(int user, vec &Hu)
 {
-    // predicting stage
-    int startIdx = userStartIndex[user];
-    int user_size = numItemsTrainingSet[user];
-    float predictedRating;
-    if (user_size == 0)
-        return globalAverage;
-
-    vec Hu = zeros<vec>(numFactors);
-    vec Vum(maxRating);
-    ivec scores = linspace<ivec>(1, 5, 5);
+    size_t startIdx = userStartIndex[user];
+    size_t user_size = numItemsTrainingSet[user];
 
     Hu = BH;
 
-    for (int f = 0; f < numFactors; f++)
+    for (size_t u = startIdx; u < startIdx + user_size; u++)
     {
-        for (int u = startIdx; u < startIdx + user_size; u++)
+        int movieId = roundToInt(dataUM(MOVIE_ROW, u));
+        int rating = roundToInt(dataUM(RATING_ROW, u));
+        unsigned int k = rating - 1;
+        for (int f = 0; f < numFactors; f++)
         {
-            int movieId = roundToInt(dataUM(MOVIE_ROW, u));
-            int rating = roundToInt(dataUM(RATING_ROW, u));
-            unsigned int k = rating - 1;
-            float w = W(k, f, movieId);
-            Hu(f) += w;
+            Hu(f) += W(k, f, movieId);
         }
     }
 
     Hu = 1.0 / (1 + exp(-Hu));
-    date = date;
-    bound = bound;
+}
+
+
+float RBM_New::predictFromHidden(const vec &Hu, int movie, bool bound)
+{
     // Negative phase to predict score
-    Vum = normalise( exp(BV.col(movie) + W.slice(movie) * Hu), 1);
-    predictedRating = dot(Vum, scores);
+    float predictedRating = rbm_expected_rating(BV, W, Hu, movie);
     if (bound)
     {
         if (predictedRating > 5)
@@ -97,10 +106,48 @@ float RBM_New::predict(int user, int movie, int date, bool bound)
 }
 
 
+float RBM_New::predict(int user, int movie, int date, bool bound)
+{
+    // predicting stage
+    if (numItemsTrainingSet[user] == 0)
+        return globalAverage;
+
+    date = date;
+    vec Hu(numFactors);
+    computeHidden(user, Hu);
+    return predictFromHidden(Hu, movie, bound);
+}
+
+
+/* Batch kernel: the hidden activations are computed once per run of a user. */
+void RBM_New::predictRange(const int *users, const int *items,
+    const int * /* dates */, float *output, size_t n, bool bound)
+{
+    vec Hu(numFactors);
+    int currUser = -1;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int user = users[i];
+        if (numItemsTrainingSet[user] == 0)
+        {
+            output[i] = globalAverage;
+            continue;
+        }
+        if (user != currUser)
+        {
+            currUser = user;
+            computeHidden(user, Hu);
+        }
+        output[i] = predictFromHidden(Hu, items[i], bound);
+    }
+}
+
+
 void RBM_New::singleUser(int user_id, int CD_K)
 {
     int size = numItemsTrainingSet[user_id];
-    int startIdx = userStartIndex[user_id];
+    size_t startIdx = userStartIndex[user_id];
 
     // Initialization
     mat V0 = zeros<mat>(maxRating, size);
@@ -170,33 +217,96 @@ void RBM_New::singleUser(int user_id, int CD_K)
 }
 
 
+unsigned int RBM_New::cdStepsForIteration(int iter_num)
+{
+    // Run longer Gibbs chains as training progresses.
+    if (iter_num < 15)
+        return 1;
+    else if (iter_num < 25)
+        return 3;
+    else if (iter_num < 35)
+        return 5;
+    else
+        return 9;
+}
+
+
+float RBM_New::computeRMSE(const fmat &testSet)
+{
+    // The hidden activations of a user only depend on the user's training
+    // ratings, so compute them once per run of the (user-sorted) test set.
+    vec Hu(numFactors);
+    int lastUser = -1;
+    double sse = 0.0;
+
+    for (uword i = 0; i < testSet.n_cols; i++)
+    {
+        int user = roundToInt(testSet(USER_ROW, i));
+        int item = roundToInt(testSet(MOVIE_ROW, i));
+        float prediction = globalAverage;
+
+        if (numItemsTrainingSet[user] > 0)
+        {
+            if (user != lastUser)
+            {
+                computeHidden(user, Hu);
+                lastUser = user;
+            }
+            prediction = predictFromHidden(Hu, item, true);
+        }
+
+        sse += pow(testSet(RATING_ROW, i) - prediction, 2.0);
+    }
+
+    return sqrt(sse / testSet.n_cols);
+}
+
+
 void RBM_New::train(const fmat &data)
 {
     dataUM = data;
     populateNumItemsTrainingSet();
 
+    // Every user with at least one training rating is visited exactly
+    // once per epoch, in an order that is reshuffled each epoch.
+    std::vector<int> users;
+    for (int u = 0; u < numUsers; u++)
+    {
+        if (numItemsTrainingSet[u] > 0)
+            users.push_back(u);
+    }
+    std::mt19937_64 engine(rbm_seed);
+
     // Training stage
     for (int iter_num = 0; iter_num < numIters; iter_num++)
     {
+        telemetry::Epoch record("RBM_New", iter_num + 1);
+        record.learningRate("learning_rate", learningRate);
+
         // Customize CD_K based on the number of iteration
-        if (iter_num < 15)
-            CD_K = 1;
-        else if (iter_num < 25)
-            CD_K = 3;
-        else if (iter_num < 35)
-            CD_K = 5;
-        else
-            CD_K = 9;
-
-        cout << "\n== Iteration " << iter_num << " ==" << endl;
-
-        for (unsigned int i = 0; i < dataUM.n_cols; i++)
+        CD_K = cdStepsForIteration(iter_num);
+
+        cout << "\n== Iteration " << iter_num << " (CD_K = " << CD_K
+             << ") ==" << endl;
+
+        std::shuffle(users.begin(), users.end(), engine);
+        for (unsigned int i = 0; i < users.size(); i++)
         {
-            int user_id = roundToInt(dataUM(USER_ROW, i));
-            singleUser(user_id, CD_K);
+            singleUser(users[i], CD_K);
             if (i % 100000 == 0)
-                cout << "Processed data: " << i << endl;
+                cout << "Processed users: " << i << endl;
         }
+        record.ratings.add(dataUM.n_cols);
+
+        // The probe set is loaded once, and scored when it's due (if the
+        // rating store is there).
+        if (record.probeDue() && telemetry::probeSet().n_cols > 0)
+        {
+            record.phase("probe");
+            record.setProbeRMSE(computeRMSE(telemetry::probeSet()));
+        }
+
+        record.finish();
     }
     cout << "\nFinished training!" << endl;
     cout << "Training data size: " << dataUM.n_cols << endl;
@@ -206,44 +316,25 @@ void RBM_New::train(const fmat &data)
 
 void RBM_New::setRand2(int movieId, float c)
 {
-    for(unsigned int i = 0; i < movie_data[movieId].w.size(); i++)
-        movie_data[movieId].w[i] = ((drand48() - 0.5) * c);
-}
-
-
-float RBM_New::newer_dot(vec a, int as, vec b, int bs)
-{
-    float ret = 0;
-    for(int i = 0; i < D; i++)
-        ret += (double)a[as + i] * (double)b[bs + i];
-    //std::cout << ret << std::endl;
-    return ret;
+    // Movies draw from streams that no user sweep uses, so initialization
+    // is reproducible for a given seed.
+    rbm_rng rng(rbm_seed, rbm_rng::initStream(movieId));
+    // Only the first D weights of each bin are used; the padding stays zero
+    for(int r = 0; r < rbm_bins; r++)
+        for(int k = 0; k < D; k++)
+            movie_data[movieId].w[r * rbm_stride + k] =
+                ((rng.uniform() - 0.5) * c);
 }
 
 
 float RBM_New::rbm_predict(const rbm_user &usr, 
     const rbm_movie &mov, const float rating, float &prediction)
 {
-    float ret = 0;
-    float nn = 0;
     //if (mov.bi.size() == 0) return globalAverage;
 
-    for(int r = 0; r < rbm_bins; ++r)
-    {               
-        float zz = exp(mov.bi[r] + newer_dot(usr.h, 0, mov.w, r * D));
-        //cout << zz << endl;
-        /*if (std::isinf(zz))
-        {
-            std::cout << " mov.bi[r] " << mov.bi[r] << " dot: " << newer_dot(usr.h, 0, mov.w, r * D) << std::endl;
-        }*/
-        ret += zz * (float)(r);
-        //assert(!std::isnan(ret));
-        nn += zz;
-    }
-    //std::cout << nn << std::endl;
+    float ret = rbm_expected_bin(usr.h, mov.bi, mov.w, rbm_bins, rbm_stride,
+                                 D);
     //assert(!std::isnan(ret));
-    //assert(std::fabs(nn) > 1e-32);
-    ret /= nn;
     if(ret < MIN_RATING) ret = MIN_RATING;
     else if(ret > maxRating) ret = maxRating;
     //std::cout << nn << " " << ret << " " << (ret != ret) << std:: endl;
@@ -256,43 +347,43 @@ float RBM_New::rbm_predict(const rbm_user &usr,
 
 void RBM_New::rbm_init()
 {
-    srand48(time(NULL));
-    //latent_factors_inmem.resize(numUsers + numItems);
     user_data.resize(numUsers);
     movie_data.resize(numItems);
-/*
-#pragma omp parallel for
-  for(int i = 0; i < (int)numItems; ++i)
-  {
-    vertex_data & movie = latent_factors_inmem[numUsers + i];
-    movie.pvec = zeros(rbm_bins + D * rbm_bins);
-    movie.bias = 0;
-  }
-*/
+
+    // (Re)allocate the flat parameter arrays; alignedAlloc zeroes them.
+    simd::alignedFree(user_latent);
+    simd::alignedFree(movie_latent);
+    user_latent = simd::alignedAlloc<float>((size_t)numUsers * rbm_user_size);
+    movie_latent =
+        simd::alignedAlloc<float>((size_t)numItems * rbm_movie_size);
+
 #pragma omp parallel for
   for(int i = 0; i < (int)numItems; ++i)
   {
-    movie_data[i] = rbm_movie(rbm_bins, D);
+    movie_data[i] = rbm_movie(movie_latent + (size_t)i * rbm_movie_size,
+                              simd::paddedLength(rbm_bins));
   }
   for (int i = 0; i < (int)numUsers; ++i)
   {
-    user_data[i] = rbm_user(D);
+    user_data[i] = rbm_user(user_latent + (size_t)i * rbm_user_size,
+                            rbm_stride);
   }
 }
 
 float RBM_New::predict1(const rbm_user & usr, 
     const rbm_movie & mov, 
     const float rating, 
-    float & prediction){
+    float & prediction,
+    rbm_rng & rng){
 
-    vec zz = zeros(rbm_bins);
+    float zz[RBM_MAX_BINS];
     float szz = 0;
     for(int r = 0; r < rbm_bins; ++r)
     {
-        zz[r] = exp(mov.bi[r] + newer_dot(usr.h0, 0, mov.w, r * D));
+        zz[r] = exp(mov.bi[r] + simd::dot(usr.h0, mov.w + r * rbm_stride, D));
         szz += zz[r];
     }
-    float rd = drand48() * szz;
+    float rd = rng.uniform() * szz;
     szz = 0;
     int ret = 0;
     for(int r = 0; r < rbm_bins; ++r)
@@ -322,7 +413,7 @@ void RBM_New::update(int currIter)
         // Go over users.
         for(int u = 0; u < numUsers; u++)
         {
-            int startIdx = userStartIndex[u];
+            size_t startIdx = userStartIndex[u];
             int userId = roundToInt(dataUM(USER_ROW, startIdx));
             cout << userId << " " << u << " " << numItemsTrainingSet[u] << endl;
             assert(userId == u || (numItemsTrainingSet[u] == 0));
@@ -376,39 +467,66 @@ void RBM_New::update(int currIter)
         }
         return; //done with initialization
     }
+    // The number of weights per movie, and across all movies.
+    const size_t movieWeights = (size_t)rbm_bins * rbm_stride;
+    const size_t numWeights = (size_t)numItems * movieWeights;
+    const int numThreads = omp_get_max_threads();
+
+    // Per-thread gradient buffers. Hidden states are binary, so the
+    // gradient of a weight over the sweep is an integer (sum of h0 over the
+    // ratings that set its bin, minus sum of h1 over the ratings that
+    // sampled it). Integer sums are associative, so the reduction below is
+    // bit-identical for any number of threads. occurrences counts how many
+    // times each (movie, bin) row was touched, for the weight decay. The
+    // buffers are zeroed when allocated, and the reduction clears the rows
+    // it reads, so they're only allocated once per model.
+    while ((int)gradients.size() < numThreads)
+    {
+        gradients.push_back(simd::alignedAlloc<int32_t>(numWeights));
+        occurrences.push_back(
+            simd::alignedAlloc<int32_t>((size_t)numItems * rbm_bins));
+    }
+
+    // Each thread counts the ratings it sweeps into its own slot.
+    telemetry::Epoch record("RBM_New", currIter - 1);
+    record.learningRate("alpha", rbm_alpha);
+
+#pragma omp parallel num_threads(numThreads)
+  {
+    const int thread = omp_get_thread_num();
+    int32_t * grad = gradients[thread];
+    int32_t * occ = occurrences[thread];
+    // Sampled rating bins of the current user; only grows, so the sweep
+    // does not allocate once it has seen the most prolific user.
+    std::vector<int> v1;
+
     // go over all user nodes
+#pragma omp for schedule(dynamic, 256)
     for(int u = 0; u < numUsers; u++)
     {
-        user_data[u].h.zeros();
-        user_data[u].h0.zeros();
-        user_data[u].h1.zeros();
-        //std::cout << user_data[u].h[0] << " " << user_data[u].h[0] << " " << user_data[u].h[0] << " ";
-      if (u % 100000 == 0) std::cout << "At user: " << u << std::endl;
-      int startIdx = userStartIndex[u];
+      // Each user draws from its own stream, so the samples do not depend
+      // on which thread processes the user.
+      rbm_rng rng(rbm_seed, rbm_rng::sweepStream(currIter, u));
+      // h, h0 and h1 are contiguous
+      memset(user_data[u].h, 0, rbm_user_size * sizeof(float));
+      size_t startIdx = userStartIndex[u];
       int movieRated = numItemsTrainingSet[u];
-      vec v1 = zeros(movieRated); 
+      v1.resize(movieRated);
+      record.ratings.add(movieRated);
       //go over all ratings
       for(int e = 0; e < movieRated; e++)
       {
-        //std::cout << user_data[u].h[0] << " " << user_data[u].h[0] << " " << user_data[u].h[0] << " " << std::endl;
-      
         float observation = dataUM(RATING_ROW, startIdx + e);
         int movieId = roundToInt(dataUM(MOVIE_ROW, startIdx + e));     
         int r = (int)(observation / rbm_scaling);
         assert(r < rbm_bins);  
-        for(int k = 0; k < D; k++)
-        {
-            //std::cout << user_data[u].h[k] << " ";
-          user_data[u].h[k] += movie_data[movieId].w[D * r + k];
-          //std::cout << user_data[u].h[k] << std::endl;
-          assert(!std::isnan(user_data[u].h[k]));
-        }
+        simd::add(movie_data[movieId].w + r * rbm_stride, user_data[u].h, D);
       }
 
       for(int k=0; k < D; k++)
       {
         user_data[u].h[k] = sigmoid(user_data[u].h[k]);
-        if (drand48() < user_data[u].h[k]) 
+        if (rng.uniform() < user_data[u].h[k]) 
           user_data[u].h0[k] = 1;
         else user_data[u].h0[k] = 0;
       }
@@ -420,7 +538,8 @@ void RBM_New::update(int currIter)
         float observation = dataUM(RATING_ROW, startIdx + e);
         int movieId = roundToInt(dataUM(MOVIE_ROW, startIdx + e));     
 
-        predict1(user_data[u], movie_data[movieId], observation, prediction);    
+        predict1(user_data[u], movie_data[movieId], observation, prediction,
+                 rng);
         int vi = (int)(prediction / rbm_scaling);
         v1[i] = vi;
         i++;
@@ -429,45 +548,87 @@ void RBM_New::update(int currIter)
       i = 0;
       for(int e=0; e < movieRated; e++) {
         int movieId = roundToInt(dataUM(MOVIE_ROW, startIdx + e));     
-        int r = (int)v1[i];
-        for (int k=0; k< D;k++)
-        {
-          user_data[u].h1[k] += movie_data[movieId].w[r * D + k];
-        }
+        int r = v1[i];
+        simd::add(movie_data[movieId].w + r * rbm_stride, user_data[u].h1, D);
         i++;
       }
 
       for (int k=0; k < D; k++){
         user_data[u].h1[k] = sigmoid(user_data[u].h1[k]);
-        if (drand48() < user_data[u].h1[k]) 
+        if (rng.uniform() < user_data[u].h1[k]) 
           user_data[u].h1[k] = 1;
         else user_data[u].h1[k] = 0;
       }
 
+      // Accumulate the positive (data) and negative (sampled) statistics
+      // into this thread's gradient buffer.
       i = 0;
       for(int e=0; e < movieRated; e++)
       {
         int movieId = roundToInt(dataUM(MOVIE_ROW, startIdx + e));
         float observation = dataUM(RATING_ROW, startIdx + e);
-        float prediction;
-        rbm_predict(user_data[u], movie_data[movieId], observation, prediction);
-        //float pui = prediction / rbm_scaling;
         float rui = observation / rbm_scaling;
-        //rmse_vec[omp_get_thread_num()] += (pui - rui) * (pui - rui);
-        //nn += 1.0;
         int vi0 = (int)(rui);
-        int vi1 = (int)v1[i];
+        int vi1 = v1[i];
+        int32_t * g0 = grad + movieId * movieWeights + vi0 * rbm_stride;
+        int32_t * g1 = grad + movieId * movieWeights + vi1 * rbm_stride;
         for (int k = 0; k < D; k++)
         {
-          movie_data[movieId].w[D*vi0+k] += rbm_alpha * (user_data[u].h0[k] - rbm_beta * movie_data[movieId].w[vi0*D+k]);
-          assert(!std::isnan(movie_data[movieId].w[D*vi0+k]));
-          movie_data[movieId].w[D*vi1+k] -= rbm_alpha * (user_data[u].h1[k] + rbm_beta * movie_data[movieId].w[vi1*D+k]);
-          assert(!std::isnan(movie_data[movieId].w[D*vi1+k]));
+          g0[k] += (int32_t)user_data[u].h0[k];
+          g1[k] -= (int32_t)user_data[u].h1[k];
         }
+        occ[movieId * rbm_bins + vi0]++;
+        occ[movieId * rbm_bins + vi1]++;
         i++; 
       }
     }
+
+    // Reduce the per-thread buffers and apply the sweep's update. Applying
+    // the decay term n times is w * (1 - alpha * beta)^n; the data terms
+    // were summed exactly above. Only the threads that touched a row are
+    // read, and their rows are cleared for the next sweep.
+    const double decay = 1.0 - rbm_alpha * rbm_beta;
+    std::vector<int> touched;
+#pragma omp for schedule(static)
+    for (int m = 0; m < numItems; m++)
+    {
+      for (int r = 0; r < rbm_bins; r++)
+      {
+        const size_t row = (size_t)m * rbm_bins + r;
+        int32_t n = 0;
+        touched.clear();
+        for (int t = 0; t < numThreads; t++)
+          if (occurrences[t][row] != 0)
+          {
+            n += occurrences[t][row];
+            touched.push_back(t);
+          }
+        if (n == 0) continue;
+
+        const float shrink = pow(decay, n);
+        const size_t offset = m * movieWeights + r * rbm_stride;
+        float * w = movie_data[m].w + r * rbm_stride;
+        for (int k = 0; k < D; k++)
+        {
+          int32_t g = 0;
+          for (int t : touched)
+            g += gradients[t][offset + k];
+          w[k] = w[k] * shrink + rbm_alpha * g;
+          assert(!std::isnan(w[k]));
+        }
+
+        for (int t : touched)
+        {
+          memset(gradients[t] + offset, 0, D * sizeof(int32_t));
+          occurrences[t][row] = 0;
+        }
+      }
+    }
+  }
+
     rbm_alpha *= rbm_mult_step_dec;
+
+    record.finish();
 }
 
 
@@ -495,5 +656,11 @@ void RBM_New::new_train(const fmat &data)
 
 RBM_New::~RBM_New()
 {
-    // Nothing to destroy here.
+    simd::alignedFree(user_latent);
+    simd::alignedFree(movie_latent);
+    for (size_t t = 0; t < gradients.size(); t++)
+    {
+        simd::alignedFree(gradients[t]);
+        simd::alignedFree(occurrences[t]);
+    }
 }
@@ -6,99 +6,139 @@
 #include <armadillo>
 #include <iostream>
 #include <assert.h>
+#include <cstdint>
 #include <omp.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <simd.hh>
 
 using namespace arma;
 using namespace netflix;
 
 /*
+ * A user's hidden units; views into RBM_New's flat user array, which stores
+ * all three of them back to back for every user.
+ *
  * h = pvec = D * float
- * h0 = weight = D * float
- * h1 = weight+D = D * float
+ * h0 = h + stride = D * float
+ * h1 = h0 + stride = D * float
  */
 struct rbm_user
 {
-  vec h;
-  vec h0;
-  vec h1;
-  rbm_user()
+  float * h;
+  float * h0;
+  float * h1;
+  rbm_user() : h(NULL), h0(NULL), h1(NULL)
   {
 
   }
-  rbm_user(int D)
-  {
-    h.resize(D);
-    h0.resize(D);
-    h1.resize(D);
-    h.zeros();
-    h0.zeros();
-    h1.zeros();
-  }
-  /*
-    h = (float*)malloc(D * sizeof(float));
-    h0 = (float*)malloc(D * sizeof(float));
-    h1 = (float*)malloc(D * sizeof(float));
-  }
-  rbm_user(const vertex_data & vdata)
-  {
-    h = (float*)&vdata.pvec[0];
-    h0 = h + 100;
-    h1 = h0 + 100;
-  }
-
-  rbm_user & operator=(vertex_data & data)
+  rbm_user(float * pvec, int stride)
   {
-    h = (float*)&data.pvec[0];
-    h0 = h + 100;
-    h1 = h0 + 100;
-    return * this;
+    h = pvec;
+    h0 = h + stride;
+    h1 = h0 + stride;
   }
-  */
 };
 
 
 /**
+ * A movie's visible biases and weights; views into RBM_New's flat movie
+ * array. The weights of rating bin r start at w + r * stride.
+ *
  * bi = rbm_bins * float 
- *  w = weight = rbm_bins * D * float
+ *  w = weight = rbm_bins * stride * float
  */
 struct rbm_movie{
-  vec bi;
-  vec w;
-  rbm_movie()
+  float * bi;
+  float * w;
+  rbm_movie() : bi(NULL), w(NULL)
   {
 
   }
-  rbm_movie(int bins, int D)
+  rbm_movie(float * pvec, int binsStride)
   {
-    bi.resize(bins);
-    w.resize(D * bins);
-    bi.zeros();
-    w.zeros();
-    /*
-    for (unsigned i = 0; i < bi.size(); i++)
-        bi[i] = 0;
-    for(unsigned int i = 0; i < w.size(); i++)
-        w[i] = 0;
-    */
+    bi = pvec;
+    w = bi + binsStride;
   }
-  /*
-  float * bi;
-  float * w;
+};
 
+/*
+ * Counter-based random number stream. Every draw is a hash of (seed, stream,
+ * counter), so any number of streams can be sampled concurrently without
+ * shared state, and the values drawn do not depend on which thread draws
+ * them. The hash is the SplitMix64 finalizer.
+ */
+struct rbm_rng
+{
+  uint64_t key;
+  uint64_t counter;
+  rbm_rng(uint64_t seed, uint64_t stream) :
+    key(mix(seed ^ mix(stream + 0x9E3779B97F4A7C15ULL))), counter(0)
+  {
 
-  rbm_movie(const vertex_data& vdata){
-    bi = (float*)&vdata.pvec[0];
-    w = bi + 6;
   }
-
-  rbm_movie & operator=(vertex_data & data){
-    bi = (float*)&data.pvec[0];
-    w = bi + 6;
-    return * this;
+  // Streams are numbered in disjoint ranges, one for each use, so no two
+  // uses ever draw the same values: initialization draws from one stream
+  // per movie, and each training sweep from one per user (the top bit sets
+  // the two ranges apart).
+  static inline uint64_t initStream(int movie)
+  {
+    return (uint64_t)(uint32_t)movie;
+  }
+  static inline uint64_t sweepStream(int iter, int user)
+  {
+    return (1ULL << 63) | ((uint64_t)(uint32_t)iter << 32) | (uint32_t)user;
+  }
+  static inline uint64_t mix(uint64_t z)
+  {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  // Uniform double in [0, 1)
+  inline double uniform()
+  {
+    counter++;
+    return (mix(key + counter * 0x9E3779B97F4A7C15ULL) >> 11) *
+      (1.0 / 9007199254740992.0);
   }
-  */
 };
 
+/*
+ * The expected rating of a movie's softmax units given the hidden unit
+ * probabilities Hu, from RBM_New's Armadillo parameters (see
+ * RBM_New::predictFromHidden()).
+ */
+inline float rbm_expected_rating(const mat &BV, const cube &W, const vec &Hu,
+  int movie)
+{
+  ivec scores = linspace<ivec>(1, 5, 5);
+  vec Vum = normalise(exp(BV.col(movie) + W.slice(movie) * Hu), 1);
+  return dot(Vum, scores);
+}
+
+/*
+ * The expected (zero-based) rating bin of a movie's softmax units given
+ * the hidden unit probabilities h. Bin r has visible bias bi[r] and its
+ * weights start at w + r * stride, of which the first D are used (see
+ * RBM_New::rbm_predict()).
+ */
+inline float rbm_expected_bin(const float * h, const float * bi,
+  const float * w, int bins, int stride, int D)
+{
+  float ret = 0;
+  float nn = 0;
+  for(int r = 0; r < bins; ++r)
+  {
+    float zz = exp(bi[r] + simd::dot(h, w + r * stride, D));
+    ret += zz * (float)(r);
+    nn += zz;
+  }
+  return ret / nn;
+}
+
 class RBM_New : public BaseAlgorithm
 {
     private:
@@ -112,19 +152,24 @@ class RBM_New : public BaseAlgorithm
         float globalAverage;
         float learningRate;
 
-        // numUsers * numFactors * maxRating
+        // numItems * numFactors * maxRating
         cube W;
-        // maxRating * numUsers
+        // maxRating * numItems
         mat BV;
         // numFactors
         vec BH;
 
         fcolvec numItemsTrainingSet;
-        fcolvec userStartIndex;
+        // The column of dataUM where each user's ratings start.
+        std::vector<size_t> userStartIndex;
 
         float sigma(float num);
         void populateNumItemsTrainingSet();
         void singleUser(int user_id, int CD_K);
+        unsigned int cdStepsForIteration(int iter_num);
+        void computeHidden(int user, vec &Hu);
+        float predictFromHidden(const vec &Hu, int movie, bool bound);
+        float computeRMSE(const fmat &testSet);
 
         /* New stuff here! */
         fcolvec numUsersTrainingSet;
@@ -134,27 +179,60 @@ class RBM_New : public BaseAlgorithm
         double rbm_scaling;
         double rbm_mult_step_dec;
         int D;
-        //std::vector<vertex_data> latent_factors_inmem;
+        // D padded to a whole cache line; the distance between consecutive
+        // hidden vectors (of a user) or weight vectors (of a movie)
+        int rbm_stride;
+        // The number of floats stored per user and per movie in the flat
+        // arrays below
+        int rbm_user_size;
+        int rbm_movie_size;
+        // Largest number of rating bins supported by the stack buffers used
+        // in sampling
+        static constexpr int RBM_MAX_BINS = 16;
+        // h/h0/h1 of all users and bi/w of all movies, each in one aligned
+        // allocation; user_data and movie_data hold views into these
+        float * user_latent;
+        float * movie_latent;
         std::vector<rbm_user> user_data;
         std::vector<rbm_movie> movie_data;
 
+        // Seed of all random streams used in initialization and training
+        uint64_t rbm_seed;
+
+        // Per-thread gradient and occurrence buffers of update(), allocated
+        // on first use and kept across sweeps; update() leaves them zeroed
+        std::vector<int32_t *> gradients;
+        std::vector<int32_t *> occurrences;
+
         void setRand2(int movieId, float c);
-        float newer_dot(vec a, int as, vec b, int bs);
 
         float rbm_predict(const rbm_user &usr, const rbm_movie &mov, 
             const float rating, float & prediction);
         float predict1(const rbm_user & usr, 
             const rbm_movie & mov, 
             const float rating, 
-            float & prediction);
+            float & prediction,
+            rbm_rng & rng);
         inline float sigmoid(float x);
         void rbm_init();
         /* End of new stuff */
 
+    protected:
+        void idBounds(int &users, int &items, int &dates) const
+        {
+            users = numUsers;
+            items = numItems;
+            dates = INT_MAX;
+        }
+
+        void predictRange(const int *users, const int *items,
+                          const int *dates, float *output, size_t n,
+                          bool bound);
+
     public:
         RBM_New(int numUsers, int numItems, float globalAverage,
             int maxRating, int numFactors, float learningRate,
-            int numIters);
+            int numIters, uint64_t seed = 0);
         void train(const fmat &data);
         float predict(int user, int item, int date, bool bound);
         float new_predict(int user, int movie, float rating);
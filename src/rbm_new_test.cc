@@ -16,16 +16,15 @@
 #include <vector>
 
 #include <netflix.hh>
+#include <ratingstore.hh>
 #include <rbm_new.hh>
 
 using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
-// The Armadillo binary file to use for training.
-// Make sure that both UM and MU data are using the same
-// "type" of training resource (eg. probe, hidden, base, etc.)
-const string TRAIN_UM = BASE_BIN;
+// The sets to train on (views of the rating store).
+const set<int> TRAIN_SETS = BASE_IDX;
 
 const int NUM_FACTORS = 100;
 
@@ -47,22 +46,20 @@ fcolvec temp;
 void testOnDataFile(RBM_New &predAlgo, const string &testFileName,
                     const string &outputFileName);
 
-// Helper function that carries out "predAlgo" on the test file specified
-// by testFileName (most likely the "probe" dataset), and calculates the
-// RMSE based on those results. Note that testFileName must refer to an
-// Armadillo binary in this case.
-float computeRMSE(RBM_New &predAlgo, const string &testFileName);
+// Helper function that carries out "predAlgo" on testSet (most likely the
+// "probe" dataset), and calculates the RMSE based on those results.
+float computeRMSE(RBM_New &predAlgo, const fmat &testSet);
 
 
 int main(void)
 {
-    // Load from binary.
-    fmat trainingSetUM;
-    trainingSetUM.load(TRAIN_UM, arma_binary);
-    cout << "Loaded training data from " << TRAIN_UM << "."
-        << endl;
+    // Map the rating store, and view the training sets in it.
+    RatingStore ratings(RATINGS_STORE);
+    fmat trainingSetUM = ratings.view(TRAIN_SETS).matrix();
+    cout << "Loaded " << trainingSetUM.n_cols << " training ratings from "
+        << RATINGS_STORE << "." << endl;
         cout << trainingSetUM.n_cols << endl;
-    RBM_New predAlgo(NUM_USERS, NUM_MOVIES,
+    RBM_New predAlgo(ratings.numUsers(), ratings.numItems(),
         MEAN_RATING_TRAINING_SET, MAX_RATING, NUM_FACTORS,
         LEARNING_RATE, NUM_ITERS);
     //predAlgo.train(trainingSetUM);
@@ -73,7 +70,7 @@ int main(void)
         std::cout << "At iteration " << j << std::endl;
         predAlgo.update(j);
             // Get probe RMSE.
-        float probeRMSE = computeRMSE(predAlgo, PROBE_BIN);
+        float probeRMSE = computeRMSE(predAlgo, loadRatings(PROBE_IDX));
         // Go through qual.dta to produce a prediction file.
         //testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
         cout << "\nProbe RMSE: " << probeRMSE << endl;
@@ -84,24 +81,11 @@ int main(void)
 
 /**
  * Compute the RMSE of a given prediction algorithm on a certain set of
- * data. Note that testFileName must refer to an **Armadillo binary** in
- * this case. This binary must represent a 4 x N matrix, where N is the
- * number of test points.
+ * data: a 4 x N matrix, where N is the number of test points.
  *
  */
-float computeRMSE(RBM_New &predAlgo, const string &testFileName)
+float computeRMSE(RBM_New &predAlgo, const fmat &testSet)
 {
-    // Load from binary.
-    fmat testSet;
-    testSet.load(testFileName, arma_binary);
-
-    // The test set should have four rows.
-    if (testSet.n_rows != 4)
-    {
-        throw invalid_argument("File " + testFileName + " did not have " +
-                               "four rows!");
-    }
-
     // The number we divide by in computing the RMSE.
     int nMinusOne = testSet.n_cols - 1;
     temp.resize(testSet.n_cols);
@@ -10,6 +10,7 @@
 #include <iostream>
 #endif
 
+#include <ratingstore.hh>
 #include <rbm.hh>
 
 // The indices of the dataset to use for training.
@@ -106,14 +107,14 @@ double computeRMSE(const Mat<data_t> &data, const Mat<data_t> &predictions) {
 
 int main() {
     std::cout << "Intializing RBM" << std::endl;
-    RBM rbm(NUM_USERS, NUM_MOVIES, HIDDEN, EPSILON, MOMENTUM);
+    RatingStore ratings(RATINGS_STORE);
+    RBM rbm(ratings.numUsers(), ratings.numItems(), HIDDEN, EPSILON,
+            MOMENTUM);
     std::cout << "Training RBM" << std::endl;
-    fmat data;
-    data.load(BASE_BIN);
+    fmat data = loadRatings(BASE_IDX);
     rbm.train(data);
     std::cout << "Generating predictions on probe set" << std::endl;
-    Mat<data_t> probe;
-    probe.load(PROBE_BIN);
+    Mat<data_t> probe = loadRatings(PROBE_IDX);
     Mat<data_t> predictions = rbm.predict(probe);
     predictions.save(OUTPUT_FN);
     double rmse = computeRMSE(probe, predictions);
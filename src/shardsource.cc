@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <stdexcept>
+#ifndef NDEBUG
+#include <iostream>
+#endif
+
+#include <netflix.hh>
+#include <checkpoint.hh>
+#include <shardsource.hh>
+
+using namespace netflix; // challenge-related constants/functions.
+
+// The name manifests are written under (see Checkpoint::open()).
+static const std::string SHARD_MANIFEST_MODEL = "shards";
+
+
+/**
+ * Opens a shard manifest written by write().
+ *
+ * @param manifestPath: The manifest to open (e.g. RATING_SHARDS).
+ * @param splitSet:     The sets to train on (e.g. ALL_TRAIN_IDX).
+ *
+ */
+ShardSource::ShardSource(const std::string &manifestPath,
+                         const std::set<int> &splitSet) :
+    manifestPath(manifestPath), splitSet(splitSet)
+{
+    Checkpoint manifest;
+    manifest.open(manifestPath, SHARD_MANIFEST_MODEL);
+
+    size_t numBounds = manifest.section("userBounds").dims[0];
+    const uint64_t *bounds = static_cast<const uint64_t *>(
+        manifest.data("userBounds", CheckpointDType::U64, numBounds));
+
+    if (numBounds < 2)
+    {
+        throw std::runtime_error("The manifest at " + manifestPath +
+                                 " has no shards!");
+    }
+
+    for (size_t i = 0; i < numBounds; i++)
+    {
+        if (bounds[i] > INT_MAX || (i > 0 && bounds[i] < bounds[i - 1]))
+        {
+            throw std::runtime_error("The manifest at " + manifestPath +
+                                     " has invalid user ranges!");
+        }
+    }
+
+    userBounds.assign(bounds, bounds + numBounds);
+    rewind();
+}
+
+
+/**
+ * Starts reading a shard's ratings on a background thread.
+ *
+ * @param shard:    The shard to read.
+ *
+ */
+void ShardSource::prefetch(size_t shard)
+{
+    const std::string storePath = manifestPath + "." + std::to_string(shard);
+    const std::set<int> sets = splitSet;
+
+    // Replacing the future waits for any read that's still going.
+    pendingShard = shard;
+    pending = std::async(std::launch::async, [storePath, sets]()
+                         {
+                             return loadRatings(sets, storePath);
+                         });
+}
+
+
+/**
+ * Starts a new pass over the shards. Right after the end of a pass, the
+ * first shard has usually been read already.
+ *
+ */
+void ShardSource::rewind()
+{
+    nextShard = 0;
+    waitSeconds = 0.0;
+
+    if (!pending.valid() || pendingShard != 0)
+    {
+        prefetch(0);
+    }
+}
+
+
+/**
+ * Hands out the next shard of this pass, and starts reading the one after
+ * it. The shard's previous ratings are freed first (even at the end of the
+ * pass), so at most two shards are in memory.
+ *
+ * @param shard:    Where to put the shard.
+ *
+ * @return Whether there was a shard left in this pass.
+ *
+ */
+bool ShardSource::next(RatingShard &shard)
+{
+    shard.ratings.reset();
+
+    if (nextShard == numShards())
+    {
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    shard.ratings = pending.get();
+    std::chrono::duration<double> waited =
+        std::chrono::steady_clock::now() - start;
+    waitSeconds += waited.count();
+
+    shard.firstUser = userBounds[nextShard];
+    shard.endUser = userBounds[nextShard + 1];
+
+    const fmat &ratings = shard.ratings;
+    if (ratings.n_cols > 0
+        && (roundToInt(ratings(USER_ROW, 0)) < shard.firstUser
+            || roundToInt(ratings(USER_ROW, ratings.n_cols - 1))
+               >= shard.endUser))
+    {
+        throw std::runtime_error("Shard " + std::to_string(nextShard) +
+                                 " of " + manifestPath + " has users "
+                                 "outside of its range!");
+    }
+
+    nextShard++;
+    prefetch(nextShard % numShards());
+
+    return true;
+}
+
+
+/**
+ * Splits a store into shards of whole users, and writes them along with
+ * their manifest (see the top of shardsource.hh). Shards end at the first
+ * user boundary after an even split of the ratings, so they can come out a
+ * little uneven, and fewer than numShards if some users have more than a
+ * shard's worth of ratings.
+ *
+ * @param store:        The ratings to split, sorted by user.
+ * @param numShards:    The number of shards to aim for.
+ * @param manifestPath: The manifest to (over)write.
+ *
+ */
+void ShardSource::write(const RatingStore &store, int numShards,
+                        const std::string &manifestPath)
+{
+    if (numShards < 1)
+    {
+        throw std::invalid_argument("There must be at least one shard!");
+    }
+
+    const size_t n = store.size();
+    const float *ratings = store.data();
+    const uint8_t *splits = store.splitTags();
+
+    auto userOf = [ratings](size_t col)
+    {
+        return roundToInt(ratings[col * COLUMNS + USER_ROW]);
+    };
+
+    for (size_t col = 1; col < n; col++)
+    {
+        if (userOf(col) < userOf(col - 1))
+        {
+            throw std::invalid_argument("Only stores sorted by user can be "
+                                        "sharded!");
+        }
+    }
+
+    // The first column of each shard, and one past the last column.
+    std::vector<size_t> colBounds(1, 0);
+    for (int i = 1; i < numShards; i++)
+    {
+        size_t col = n * i / numShards;
+        while (col > 0 && col < n && userOf(col) == userOf(col - 1))
+        {
+            col++;
+        }
+
+        if (col > colBounds.back() && col < n)
+        {
+            colBounds.push_back(col);
+        }
+    }
+    colBounds.push_back(n);
+
+    // Every user belongs to some shard, even without ratings.
+    std::vector<uint64_t> userBounds(1, 0);
+    for (size_t i = 1; i + 1 < colBounds.size(); i++)
+    {
+        userBounds.push_back(userOf(colBounds[i]));
+    }
+    userBounds.push_back(store.numUsers());
+
+    // Every shard has the dims of the whole store, so models can be sized
+    // from any of them.
+    const size_t dims[3] = {(size_t) store.numUsers(),
+                            (size_t) store.numItems(),
+                            (size_t) store.numDates()};
+
+    for (size_t i = 0; i + 1 < colBounds.size(); i++)
+    {
+        const size_t first = colBounds[i], last = colBounds[i + 1];
+
+        RatingStore::write(
+            std::vector<float>(ratings + first * COLUMNS,
+                               ratings + last * COLUMNS),
+            std::vector<uint8_t>(splits + first, splits + last),
+            manifestPath + "." + std::to_string(i), dims);
+
+#ifndef NDEBUG
+        std::cout << "Wrote shard " << i << " (users " << userBounds[i]
+                  << " to " << userBounds[i + 1] << ", " << last - first
+                  << " ratings)." << std::endl;
+#endif
+    }
+
+    const size_t numBounds = userBounds.size();
+    CheckpointWriter writer(SHARD_MANIFEST_MODEL);
+    writer.add("userBounds", std::move(userBounds), 1, numBounds);
+    writer.write(manifestPath);
+}
@@ -0,0 +1,91 @@
+/*
+ * Training data that's read from disk a piece at a time, for models whose
+ * parameters fit in memory but whose ratings don't. The ratings are split
+ * into shards: rating stores (see ratingstore.hh) that each hold every
+ * rating of a contiguous range of users, sorted by user like any other
+ * store. A manifest (a checkpoint with a single "userBounds" section)
+ * records the ranges; shard i holds users [userBounds[i], userBounds[i + 1])
+ * and lives next to the manifest, at "<manifest>.<i>".
+ *
+ * A ShardSource hands the shards out in order. While the caller trains on
+ * one shard, the next is read on a background thread, so reading overlaps
+ * with training and at most two shards are in memory at once. After the
+ * last shard, the first one is read again for the next pass.
+ *
+ */
+
+#ifndef SHARDSOURCE_HH
+#define SHARDSOURCE_HH
+
+#include <armadillo>
+#include <cstddef>
+#include <future>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <ratingstore.hh>
+
+using namespace arma;
+
+/*
+ * The ratings of one shard, and the users it covers. Users in the range
+ * with no ratings in the chosen sets still belong to the shard.
+ */
+struct RatingShard
+{
+    fmat ratings;
+    int firstUser = 0;
+    int endUser = 0;
+};
+
+
+class ShardSource
+{
+private:
+    std::string manifestPath;
+    std::set<int> splitSet;
+
+    // Shard i covers users [userBounds[i], userBounds[i + 1]).
+    std::vector<int> userBounds;
+
+    // The shard next() hands out next, and the shard being read in the
+    // background (the one after it, or the first after the last).
+    size_t nextShard = 0;
+    size_t pendingShard = 0;
+    std::future<fmat> pending;
+
+    // The time next() has spent waiting for reads since rewind().
+    double waitSeconds = 0.0;
+
+    void prefetch(size_t shard);
+
+public:
+    /* Open the manifest at manifestPath, and start reading the first
+     * shard's ratings in the given sets (e.g. netflix::ALL_TRAIN_IDX). */
+    ShardSource(const std::string &manifestPath,
+                const std::set<int> &splitSet);
+
+    size_t numShards() const { return userBounds.size() - 1; }
+
+    /* One past the last user in any shard. */
+    int numUsers() const { return userBounds.back(); }
+
+    /* Start a new pass over the shards. */
+    void rewind();
+
+    /* Replace shard with the next shard of this pass, or free it and
+     * return false if the pass is over. */
+    bool next(RatingShard &shard);
+
+    /* The time spent waiting for shards to be read since rewind(). If this
+     * is a large part of a pass, training is bound by the disk. */
+    double secondsWaited() const { return waitSeconds; }
+
+    /* Split a store (sorted by user) into numShards shards of about the
+     * same number of ratings, and write them with their manifest. */
+    static void write(const RatingStore &store, int numShards,
+                      const std::string &manifestPath);
+};
+
+#endif // SHARDSOURCE_HH
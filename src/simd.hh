@@ -0,0 +1,263 @@
+/**
+ * Small dense vector kernels shared by the hot loops of our models. These
+ * operate on raw float spans (pointer + length) so that callers never have
+ * to build temporary Armadillo objects in their inner loops.
+ *
+ * The kernels are written with AVX/FMA intrinsics when the compiler targets
+ * them (our config.mk builds with -march=core-avx2) and fall back to plain
+ * loops otherwise. Every kernel finishes the elements left over from its
+ * vector loop with a scalar tail, so it takes any span, including unpadded
+ * ones such as Armadillo columns. Buffers obtained from simd::alignedAlloc()
+ * are aligned to a cache line, and spans padded with simd::paddedLength()
+ * (and zero-filled) can be passed at their padded length so that the tail
+ * never runs.
+ *
+ */
+
+#ifndef SIMD_HH
+#define SIMD_HH
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace simd
+{
+    // Alignment (in bytes) of buffers handed out by alignedAlloc(); one
+    // cache line.
+    constexpr size_t ALIGNMENT = 64;
+
+    // The number of floats in one aligned block.
+    constexpr size_t BLOCK = ALIGNMENT / sizeof(float);
+
+    /**
+     * Returns n rounded up to a whole number of aligned blocks. Rows of a
+     * matrix whose stride is a padded length all start on a cache line.
+     *
+     */
+    inline size_t paddedLength(size_t n)
+    {
+        return (n + BLOCK - 1) / BLOCK * BLOCK;
+    }
+
+    /**
+     * Allocates a zero-initialized, cache line aligned array of n elements.
+     * Memory obtained here must be released with alignedFree().
+     *
+     * @param n: The number of elements to allocate.
+     *
+     */
+    template <typename T>
+    T *alignedAlloc(size_t n)
+    {
+        void *ptr = NULL;
+        size_t bytes = (n == 0 ? 1 : n) * sizeof(T);
+
+        if (posix_memalign(&ptr, ALIGNMENT, bytes) != 0)
+        {
+            throw std::bad_alloc();
+        }
+
+        memset(ptr, 0, bytes);
+        return static_cast<T *>(ptr);
+    }
+
+    inline void alignedFree(void *ptr)
+    {
+        free(ptr);
+    }
+
+    /**
+     * Returns sum_i a[i] * b[i] over the first n elements.
+     *
+     */
+    inline float dot(const float *__restrict__ a, const float *__restrict__ b,
+                     size_t n)
+    {
+        size_t i = 0;
+        float sum = 0.0;
+
+#ifdef __AVX__
+        // Four independent accumulators hide the latency of the FMA unit.
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+
+        for (; i + 32 <= n; i += 32)
+        {
+#ifdef __FMA__
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),
+                                   _mm256_loadu_ps(b + i), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),
+                                   _mm256_loadu_ps(b + i + 8), acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16),
+                                   _mm256_loadu_ps(b + i + 16), acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24),
+                                   _mm256_loadu_ps(b + i + 24), acc3);
+#else
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                 _mm256_loadu_ps(b + i)));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(
+                                 _mm256_loadu_ps(a + i + 8),
+                                 _mm256_loadu_ps(b + i + 8)));
+            acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(
+                                 _mm256_loadu_ps(a + i + 16),
+                                 _mm256_loadu_ps(b + i + 16)));
+            acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(
+                                 _mm256_loadu_ps(a + i + 24),
+                                 _mm256_loadu_ps(b + i + 24)));
+#endif
+        }
+
+        for (; i + 8 <= n; i += 8)
+        {
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                 _mm256_loadu_ps(b + i)));
+        }
+
+        // Horizontal sum of the accumulators.
+        __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1),
+                                   _mm256_add_ps(acc2, acc3));
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc),
+                                 _mm256_extractf128_ps(acc, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        sum = _mm_cvtss_f32(half);
+#endif
+
+        for (; i < n; i++)
+        {
+            sum += a[i] * b[i];
+        }
+
+        return sum;
+    }
+
+    /**
+     * Returns (a0 + a1 + a2)^T (b0 + beta * b1 + b2) over the first n
+     * elements, in one pass and without materializing either sum. This is
+     * the shape of Time-SVD++'s factor term, whose item and user vectors
+     * are each the sum of three components.
+     *
+     */
+    inline float dotOfSums(const float *__restrict__ a0,
+                           const float *__restrict__ a1,
+                           const float *__restrict__ a2,
+                           const float *__restrict__ b0, float beta,
+                           const float *__restrict__ b1,
+                           const float *__restrict__ b2, size_t n)
+    {
+        size_t i = 0;
+        float sum = 0.0;
+
+#ifdef __AVX__
+        const __m256 betaVec = _mm256_set1_ps(beta);
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256 aLo = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(a0 + i),
+                _mm256_loadu_ps(a1 + i)), _mm256_loadu_ps(a2 + i));
+            __m256 aHi = _mm256_add_ps(_mm256_add_ps(
+                _mm256_loadu_ps(a0 + i + 8), _mm256_loadu_ps(a1 + i + 8)),
+                _mm256_loadu_ps(a2 + i + 8));
+#ifdef __FMA__
+            __m256 bLo = _mm256_add_ps(_mm256_fmadd_ps(betaVec,
+                _mm256_loadu_ps(b1 + i), _mm256_loadu_ps(b0 + i)),
+                _mm256_loadu_ps(b2 + i));
+            __m256 bHi = _mm256_add_ps(_mm256_fmadd_ps(betaVec,
+                _mm256_loadu_ps(b1 + i + 8), _mm256_loadu_ps(b0 + i + 8)),
+                _mm256_loadu_ps(b2 + i + 8));
+            acc0 = _mm256_fmadd_ps(aLo, bLo, acc0);
+            acc1 = _mm256_fmadd_ps(aHi, bHi, acc1);
+#else
+            __m256 bLo = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(b0 + i),
+                _mm256_mul_ps(betaVec, _mm256_loadu_ps(b1 + i))),
+                _mm256_loadu_ps(b2 + i));
+            __m256 bHi = _mm256_add_ps(_mm256_add_ps(
+                _mm256_loadu_ps(b0 + i + 8),
+                _mm256_mul_ps(betaVec, _mm256_loadu_ps(b1 + i + 8))),
+                _mm256_loadu_ps(b2 + i + 8));
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(aLo, bLo));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(aHi, bHi));
+#endif
+        }
+
+        __m256 acc = _mm256_add_ps(acc0, acc1);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc),
+                                 _mm256_extractf128_ps(acc, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        sum = _mm_cvtss_f32(half);
+#endif
+
+        for (; i < n; i++)
+        {
+            sum += (a0[i] + a1[i] + a2[i]) * (b0[i] + beta * b1[i] + b2[i]);
+        }
+
+        return sum;
+    }
+
+    /**
+     * Computes y += alpha * x over the first n elements.
+     *
+     */
+    inline void axpy(float alpha, const float *__restrict__ x,
+                     float *__restrict__ y, size_t n)
+    {
+        size_t i = 0;
+
+#ifdef __AVX__
+        const __m256 alphaVec = _mm256_set1_ps(alpha);
+
+        for (; i + 8 <= n; i += 8)
+        {
+#ifdef __FMA__
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(alphaVec,
+                             _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+#else
+            _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i),
+                             _mm256_mul_ps(alphaVec, _mm256_loadu_ps(x + i))));
+#endif
+        }
+#endif
+
+        for (; i < n; i++)
+        {
+            y[i] += alpha * x[i];
+        }
+    }
+
+    /**
+     * Computes y += x over the first n elements.
+     *
+     */
+    inline void add(const float *__restrict__ x, float *__restrict__ y,
+                    size_t n)
+    {
+        size_t i = 0;
+
+#ifdef __AVX__
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i),
+                                                  _mm256_loadu_ps(x + i)));
+        }
+#endif
+
+        for (; i < n; i++)
+        {
+            y[i] += x[i];
+        }
+    }
+}
+
+#endif // SIMD_HH
@@ -1,11 +1,11 @@
 #ifndef NDEBUG
-#include <chrono>
 #include <iostream>
-
-using namespace std::chrono;
 #endif
 
+#include <ratingstore.hh>
 #include <svd.hh>
+#include <telemetry.hh>
+#include <validation.hh>
 
 
 /** 
@@ -40,8 +40,8 @@ SVD::SVD(int numUsers, int numItems, float meanRating, int numFactors,
 
 /**
  * This constructor uses cached data to initialize the internals of the
- * SVD object. It is assumed that all of the cached data is stored in
- * Armadillo's machine-dependent binary format.
+ * SVD object. The cached data is a checkpoint written by saveCheckpoint(),
+ * which is mapped rather than read, so this returns almost immediately.
  *
  * Note: This constructor should be used for blending, not the other one!
  *
@@ -55,30 +55,22 @@ SVD::SVD(int numUsers, int numItems, float meanRating, int numFactors,
  *                                  SVD.
  * @param numIterations:            The number of iterations to use for
  *                                  SVD.
- * @param fileNameBUser:            Name of file containing data for bUser,
- *                                  in Armadillo's machine-dependent binary
- *                                  format.
- * @param fileNameBItem:            Same as above, but for bItem.
- * @param fileNameUserFacMat:       Same as above, but for userFacMat.
- * @param fileNameItemFacMat:       Same as above, but for itemFacMat.
+ * @param fileNameCheckpoint:       Name of the checkpoint file holding
+ *                                  bUser, bItem, userFacMat and itemFacMat.
+ *                                  Their shapes must match the arguments
+ *                                  above.
  *
  */
 SVD::SVD(int numUsers, int numItems, float meanRating, int numFactors,
-         int numIterations,
-         const string &fileNameBUser, const string &fileNameBItem,
-         const string &fileNameUserFacMat,
-         const string &fileNameItemFacMat) :
+         int numIterations, const string &fileNameCheckpoint) :
     numUsers(numUsers), numItems(numItems), meanRating(meanRating),
-    numFactors(numFactors), numIterations(numIterations), bUser(numUsers),
-    bItem(numItems), userFacMat(numFactors, numUsers),
-    itemFacMat(numFactors, numItems), numItemsTrainingSet(numUsers)
+    numFactors(numFactors), numIterations(numIterations),
+    numItemsTrainingSet(numUsers)
 {
-    // Initialize bUser, bItem, userFacMat, and itemFacMat by reading from
-    // their binary files.
-    bUser.load(fileNameBUser, arma_binary);
-    bItem.load(fileNameBItem, arma_binary);
-    userFacMat.load(fileNameUserFacMat, arma_binary);
-    itemFacMat.load(fileNameItemFacMat, arma_binary);
+    // Point bUser, bItem, userFacMat, and itemFacMat at their sections of
+    // the checkpoint.
+    checkpoint.open(fileNameCheckpoint, "SVD");
+    loadCheckpointSections();
      
     trained = true;
     usingCachedData = true;
@@ -98,16 +90,14 @@ SVD::SVD(int numUsers, int numItems, float meanRating, int numFactors,
  *              train() for more details.
  *
  */
-void SVD::populateNumItemsTrainingSet(const fmat &data)
+void SVD::populateNumItemsTrainingSet(const RatingView &data)
 {
-    for(unsigned int i = 0; i < data.n_cols; i++)
-    {
-        // Based on the user that this rating was by, increment the
-        // appropriate element of numItemsTrainingSet.
-        int user = roundToInt(data(USER_ROW, i));
-        
-        numItemsTrainingSet(user) ++;
-    }
+    data.forEach([this](const float *rating)
+            {
+                // Based on the user that this rating was by, increment the
+                // appropriate element of numItemsTrainingSet.
+                numItemsTrainingSet(roundToInt(rating[USER_ROW]))++;
+            });
 }
 
 
@@ -171,6 +161,13 @@ void SVD::initInternalData()
     // now, since this will be set up while training.
     bUser.zeros();
     bItem.zeros();
+
+    // Start over with the initial step sizes.
+    SVD_GAMMA_B_I = SVD_GAMMA_B_I_INIT;
+    SVD_GAMMA_B_U = SVD_GAMMA_B_U_INIT;
+    SVD_GAMMA_Q_I = SVD_GAMMA_Q_I_INIT;
+    SVD_GAMMA_P_U = SVD_GAMMA_P_U_INIT;
+    iterationsDone = 0;
 }
 
 
@@ -181,33 +178,16 @@ void SVD::initInternalData()
  * @param data:                     This is the training data to use for
  *                                  our algorithm. See train() for more
  *                                  details.
- * @param fileNameBUser:            Name of file where we'll save bUser (in
- *                                  Armadillo's machine-dependent binary
- *                                  format).
- * @param fileNameBItem:            Same as above, but for bItem.
- * @param fileNameUserFacMat:       Same as above, but for userFacMat.
- * @param fileNameItemFacMat:       Same as above, but for itemFacMat.
+ * @param fileNameCheckpoint:       Name of the checkpoint file to save to.
+ *                                  See saveCheckpoint().
  * 
  */
-void SVD::trainAndCache(const fmat &data, const string &fileNameBUser,
-                        const string &fileNameBItem,
-                        const string &fileNameUserFacMat,
-                        const string &fileNameItemFacMat)
+void SVD::trainAndCache(const RatingView &data,
+                        const string &fileNameCheckpoint)
 {
     // Train the SVD algorithm, then save internal data to file.
     train(data);
-    
-    bUser.save(fileNameBUser, arma_binary);
-    bItem.save(fileNameBItem, arma_binary);
-    userFacMat.save(fileNameUserFacMat, arma_binary);
-    itemFacMat.save(fileNameItemFacMat, arma_binary);
-    
-#ifndef NDEBUG
-    cout << "Saved bUser to " << fileNameBUser << endl;
-    cout << "Saved bItem to " << fileNameBItem << endl;
-    cout << "Saved userFacMat to " << fileNameUserFacMat << endl;
-    cout << "Saved itemFacMat to " << fileNameItemFacMat << endl;
-#endif
+    saveCheckpoint(fileNameCheckpoint);
 }
 
 
@@ -224,16 +204,189 @@ void SVD::trainAndCache(const fmat &data, const string &fileNameBUser,
  *
  */
 void SVD::trainAndCache(const string &fileNameData,
-                        const string &fileNameBUser,
-                        const string &fileNameBItem,
-                        const string &fileNameUserFacMat,
-                        const string &fileNameItemFacMat)
+                        const string &fileNameCheckpoint)
 {
     fmat data;
     
     data.load(fileNameData, arma_binary);
-    trainAndCache(data, fileNameBUser, fileNameBItem, fileNameUserFacMat,
-                  fileNameItemFacMat);
+    trainAndCache(RatingView(data), fileNameCheckpoint);
+}
+
+
+/**
+ * Saves bUser, bItem, userFacMat and itemFacMat to a single checkpoint
+ * file, which the caching constructor can load. The step sizes and the
+ * number of iterations done are saved too, so training can be resumed from
+ * the checkpoint (see resumeTraining()).
+ *
+ * @param fileNameCheckpoint:   Name of the checkpoint file to (over)write.
+ *
+ */
+void SVD::saveCheckpoint(const string &fileNameCheckpoint) const
+{
+    CheckpointWriter writer("SVD");
+    addCheckpointSections(writer);
+    writer.write(fileNameCheckpoint);
+
+#ifndef NDEBUG
+    cout << "Saved SVD checkpoint to " << fileNameCheckpoint << endl;
+#endif
+}
+
+
+/**
+ * Adds this model's parameters and training state to a checkpoint.
+ */
+void SVD::addCheckpointSections(CheckpointWriter &writer) const
+{
+    writer.add("bUser", bUser);
+    writer.add("bItem", bItem);
+    writer.add("userFacMat", userFacMat);
+    writer.add("itemFacMat", itemFacMat);
+    itemMap.addTo(writer, "itemIds");
+
+    std::vector<float> gammas = {SVD_GAMMA_B_I, SVD_GAMMA_B_U, SVD_GAMMA_Q_I,
+                                 SVD_GAMMA_P_U};
+    writer.add("training.gammas", std::move(gammas), 1, 4);
+    writer.add("training.iterations",
+               std::vector<uint64_t>(1, iterationsDone), 1, 1);
+}
+
+
+/**
+ * Points this model's parameters at their sections of the open checkpoint,
+ * and restores its training state.
+ */
+void SVD::loadCheckpointSections()
+{
+    bUser = checkpoint.column("bUser", numUsers);
+    bItem = checkpoint.column("bItem", numItems);
+    userFacMat = checkpoint.matrix("userFacMat", numFactors, numUsers);
+    itemFacMat = checkpoint.matrix("itemFacMat", numFactors, numItems);
+    itemMap = IdMap::load(checkpoint, "itemIds", numItems);
+
+    const float *gammas = static_cast<const float *>(
+        checkpoint.data("training.gammas", CheckpointDType::F32, 4));
+    SVD_GAMMA_B_I = gammas[0];
+    SVD_GAMMA_B_U = gammas[1];
+    SVD_GAMMA_Q_I = gammas[2];
+    SVD_GAMMA_P_U = gammas[3];
+
+    iterationsDone = *static_cast<const uint64_t *>(
+        checkpoint.data("training.iterations", CheckpointDType::U64, 1));
+}
+
+
+/**
+ * Makes training save a snapshot of its progress every "interval"
+ * iterations. Snapshots are written on a background thread while the next
+ * iteration runs, and can be passed to resumeTraining().
+ *
+ * @param fileNameCheckpoint:   Name of the checkpoint file to keep
+ *                              overwriting with the latest snapshot.
+ * @param interval:             The number of iterations between snapshots,
+ *                              or 0 to stop saving them.
+ *
+ */
+void SVD::setIterationCheckpoints(const string &fileNameCheckpoint,
+                                  int interval)
+{
+    if (interval < 0)
+    {
+        throw invalid_argument("The checkpoint interval can't be negative!");
+    }
+
+    fileNameIterCheckpoint = fileNameCheckpoint;
+    iterCheckpointInterval = interval;
+}
+
+
+/**
+ * Makes training stop once the probe RMSE hasn't improved for "patience"
+ * evaluated iterations, and leave the model at its best iteration. Since
+ * the probe set is scored while the next iteration trains, this runs one
+ * iteration past the stopping point. The parameters of each scored
+ * iteration are written out in the background while it's scored, and the
+ * best iteration's are kept in a checkpoint, which the model is reloaded
+ * from if training has moved past it.
+ *
+ * @param patience:             The number of scored iterations without an
+ *                              improvement to stop after, or 0 to never
+ *                              stop early.
+ * @param fileNameCheckpoint:   Name of the checkpoint file to keep the
+ *                              best iteration in (the one being scored
+ *                              is written next to it, with ".pending"
+ *                              appended).
+ *
+ */
+void SVD::setEarlyStopping(int patience, const string &fileNameCheckpoint)
+{
+    if (patience < 0)
+    {
+        throw invalid_argument("The early stopping patience can't be "
+                               "negative!");
+    }
+
+    earlyStoppingPatience = patience;
+    fileNameBestCheckpoint = fileNameCheckpoint;
+}
+
+
+/**
+ * Continues training from a checkpoint written by saveCheckpoint() or by a
+ * snapshot (see setIterationCheckpoints()). The parameters and step sizes
+ * are restored exactly, so the result is bit-for-bit the same as if
+ * training had never been interrupted.
+ *
+ * @param data:                 The training data the checkpoint was made
+ *                              with. See train() for more details.
+ * @param fileNameCheckpoint:   Name of the checkpoint file to resume from.
+ *
+ */
+void SVD::resumeTraining(const RatingView &data,
+                         const string &fileNameCheckpoint)
+{
+    if (usingCachedData)
+    {
+        throw logic_error("This algorithm shouldn't be trained if you're "
+                          "using cached data!");
+    }
+
+    checkpoint.open(fileNameCheckpoint, "SVD");
+    loadCheckpointSections();
+
+    if (iterationsDone > numIterations)
+    {
+        throw invalid_argument("The checkpoint at " + fileNameCheckpoint +
+                               " is past the last iteration!");
+    }
+
+#ifndef NDEBUG
+    cout << "Resuming SVD after iteration " << iterationsDone << endl;
+#endif
+
+    numItemsTrainingSet.zeros();
+    populateNumItemsTrainingSet(data);
+    trainIterations([this, &data]() -> size_t
+            {
+                trainUsers(data, NULL, 0, numUsers);
+                return data.size();
+            });
+}
+
+
+/**
+ * Makes train() renumber items by descending number of ratings, so the
+ * most rated items' factors sit next to each other (see idmap.hh). The
+ * numbering is saved with the model, and item IDs passed in or handed out
+ * are always the original ones.
+ *
+ * @param enabled:  Whether to renumber items on the next train().
+ *
+ */
+void SVD::setItemRenumbering(bool enabled)
+{
+    renumberItems = enabled;
 }
 
 
@@ -257,6 +410,40 @@ void SVD::trainAndCache(const string &fileNameData,
  */
 
 void SVD::train(const fmat &data)
+{
+    train(RatingView(data), NULL);
+}
+
+
+/**
+ * Trains on a view of a rating store (see train(const fmat &)), walking
+ * its runs rather than copying them into a matrix.
+ *
+ */
+void SVD::train(const RatingView &view)
+{
+    train(view, NULL);
+}
+
+
+/**
+ * Trains on data's users and items with ratings taken from a separate
+ * column (e.g. the residuals of an earlier model), so that no copy of the
+ * training matrix is made.
+ *
+ */
+void SVD::trainWithRatings(const RatingView &data, const float *ratings)
+{
+    train(data, ratings);
+}
+
+
+/**
+ * Does the work of train(), taking the i-th rating of data from ratings[i]
+ * (or from data itself if ratings is NULL).
+ *
+ */
+void SVD::train(const RatingView &data, const float *ratings)
 {
     // The predicted rating given by SVD++ for user u and item i is:
     //
@@ -279,12 +466,6 @@ void SVD::train(const fmat &data)
     // This minimization is accomplished via stochastic gradient descent on
     // the free parameters of b_u, b_i, q_i, and p_u.
     
-    // Check that the data does in fact have four rows!
-    if (data.n_rows != 4)
-    {
-        throw invalid_argument("Data array must have four rows!");
-    }
-
     // If we're using cached data, we shouldn't be calling this method!
     if (usingCachedData)
     {
@@ -303,100 +484,201 @@ void SVD::train(const fmat &data)
 #endif
     }
     
+    // Number the items for this training set, most rated first, if we've
+    // been asked to (see setItemRenumbering()).
+    itemMap = renumberItems ? IdMap::byFrequency(data, MOVIE_ROW, numItems)
+                            : IdMap();
+
     // We want to find the number of items rated by each user in the
     // training set, since this will help us go through our training data
     // in a more organized fashion.
     populateNumItemsTrainingSet(data);
-    
-#ifndef NDEBUG
-    time_point<system_clock> start, end;
-    duration<float, ratio<60>> minutes_elapsed; 
-#endif
-    
-    // Iterate for the specified number of iterations.
-    for(int iterCount = 0; iterCount < numIterations; iterCount++)
+
+    trainIterations([this, &data, ratings]() -> size_t
+            {
+                trainUsers(data, ratings, 0, numUsers);
+                return data.size();
+            });
+}
+
+
+/**
+ * Trains on ratings streamed from disk a shard at a time (see
+ * shardsource.hh) instead of a matrix held in memory, so only the
+ * parameters and two shards are ever resident. Shards are visited in user
+ * order, so the result is the same as train() on all of their ratings.
+ *
+ * @param shards:   The shards to train on. Every user in them must be
+ *                  below numUsers.
+ *
+ */
+void SVD::trainStreaming(ShardSource &shards)
+{
+    if (usingCachedData)
     {
+        throw logic_error("This algorithm shouldn't be trained if you're "
+                          "using cached data!");
+    }
+
+    if (shards.numUsers() > numUsers)
+    {
+        throw invalid_argument("The shards have more users than the "
+                               "model!");
+    }
+
+    if (trained)
+    {
+        initInternalData();
+
 #ifndef NDEBUG
-        start = system_clock::now();
+        cout << "Cleared old internal data" << endl;
 #endif
-        
-        // The rating number that we're looking at right now (i.e. the
-        // column in our training set).
-        unsigned int ratingNum = 0;
-        
-        // Iterate through all users in the training data. We're assuming
-        // that the data is sorted (column-wise) by user ID!
-        for (unsigned int user = 0; user < (unsigned int) numUsers;
-             user ++)
+    }
+
+    // Count each user's ratings (and each item's, to renumber them) with
+    // one pass over the shards before training.
+    vector<size_t> itemCounts(renumberItems ? numItems : 0, 0);
+    RatingShard shard;
+
+    shards.rewind();
+    while (shards.next(shard))
+    {
+        const RatingView view(shard.ratings);
+        populateNumItemsTrainingSet(view);
+
+        if (renumberItems)
         {
-            // Find the number of items rated by this user in the training
-            // set, so we know how many entries to parse.
-            int numItemsUserTrainSet = numItemsTrainingSet[user];
-            
-            // Increment ratingNum as we iterate over items rated by the
-            // user.
-            for(int itemNum = 0; itemNum < numItemsUserTrainSet; itemNum++,
-                                                                 ratingNum++)
-            {
-                int item = roundToInt(data(MOVIE_ROW, ratingNum));
-                float actualRating = data(RATING_ROW, ratingNum);
-                
-                // Get the predicted rating for this user and item, using the
-                // aforementioned formula for rHat_{ui}.
-                float predictedRating = meanRating + bUser(user) + bItem(item);
-                
-                // Compute the factorized term (i.e. q_i^T * p_u).
-                fcolvec userFactorTerm(userFacMat.col(user));
-                fcolvec qi(itemFacMat.col(item));
-                predictedRating += dot(qi, userFactorTerm);
-                
-                // Apply gradient descent on all of the free parameters in
-                // our algorithm. This just involves subtracting off the
-                // gradient of the error metric (which we're trying to
-                // minimize) with respect to each free parameter. Note
-                // that factors of 2 have been absorbed into the "gamma"
-                // step sizes.
-                
-                // The error in our prediction for this user and item.
-                float eUI = actualRating - predictedRating;
-
-                // b_u <- b_u + gamma_b_u * (e_{ui} - SVD_LAM_B_U * b_u)
-                bUser(user) += SVD_GAMMA_B_U * (eUI - SVD_LAM_B_U *
-                                                bUser(user));
-                
-                // b_i <- b_i + gamma_b_i * (e_{ui} - SVD_LAM_B_I * b_i)
-                bItem(item) += SVD_GAMMA_B_I * (eUI - SVD_LAM_B_I *
-                                                bItem(item));
-
-                // q_i <- q_i + gamma_2 * (e_{ui} * p_u
-                //                         - SVD_LAM_Q_I * q_i)
-                itemFacMat.col(item) += SVD_GAMMA_Q_I * (eUI * 
-                        userFactorTerm - SVD_LAM_Q_I * qi);
-                
-                // p_u <- p_u + gamma_2 * (e_{ui} * q_i - SVD_LAM_P_U * 
-                //                                        p_u)
-                userFacMat.col(user) += SVD_GAMMA_P_U * (eUI * qi - 
-                        SVD_LAM_P_U * userFactorTerm);
-            }
-            
+            IdMap::countIds(view, MOVIE_ROW, itemCounts);
         }
-        
+    }
+
+    itemMap = renumberItems ? IdMap::fromCounts(itemCounts) : IdMap();
+
+    auto epoch = [this, &shards]() -> size_t
+    {
+        RatingShard shard;
+        size_t numRatings = 0;
+
+        shards.rewind();
+        while (shards.next(shard))
+        {
+            trainUsers(RatingView(shard.ratings), NULL, shard.firstUser,
+                       shard.endUser);
+            numRatings += shard.ratings.n_cols;
+        }
+
+#ifndef NDEBUG
+        cout << "Waited " << shards.secondsWaited() << " seconds for "
+             << "shards to be read" << endl;
+#endif
+
+        return numRatings;
+    };
+
+    trainIterations(epoch);
+}
+
+
+/**
+ * Runs the remaining iterations of stochastic gradient descent (from
+ * iterationsDone up to numIterations), saving snapshots along the way if
+ * requested, and scoring the probe set in the background. Training stops
+ * early, at its best epoch, if asked to (see setEarlyStopping()). See
+ * train() for the details.
+ *
+ * @param epoch:    Makes one pass over every user's training ratings (by
+ *                  calling trainUsers() on all of them, in order), and
+ *                  returns the number of ratings it trained on.
+ *
+ */
+void SVD::trainIterations(const function<size_t()> &epoch)
+{
+    ProbeValidator validator("SVD");
+    validator.setPatience(earlyStoppingPatience);
+    if (earlyStoppingPatience > 0)
+    {
+        validator.keepBest(fileNameBestCheckpoint);
+    }
+
+    // Iterate for the specified number of iterations.
+    for(int iterCount = iterationsDone; iterCount < numIterations;
+        iterCount++)
+    {
+        telemetry::Epoch record("SVD", iterCount + 1);
+        record.learningRate("gamma_b_u", SVD_GAMMA_B_U);
+        record.learningRate("gamma_b_i", SVD_GAMMA_B_I);
+        record.learningRate("gamma_q_i", SVD_GAMMA_Q_I);
+        record.learningRate("gamma_p_u", SVD_GAMMA_P_U);
+
+        // One pass over the training data.
+        record.ratings.add(epoch());
+
         // At the end of each iteration, decrease the gammas by the
         // constant factor declared in the header file.
         SVD_GAMMA_B_U *= SVD_GAMMA_MULT_PER_ITER;
         SVD_GAMMA_B_I *= SVD_GAMMA_MULT_PER_ITER;
         SVD_GAMMA_Q_I *= SVD_GAMMA_MULT_PER_ITER;
         SVD_GAMMA_P_U *= SVD_GAMMA_MULT_PER_ITER; 
-        
-        
-#ifndef NDEBUG
-        end = system_clock::now();
-        minutes_elapsed = end - start;
-        cout << "\nFinished iteration " << (iterCount + 1) << " of SVD "
-             << "in " << minutes_elapsed.count() << " minutes" << endl;
+        iterationsDone = iterCount + 1;
+
+        // Snapshot our progress if it's time to. Only the copy of the
+        // parameters holds up training; they're written in the background.
+        if (iterCheckpointInterval > 0
+            && iterationsDone % iterCheckpointInterval == 0
+            && iterationsDone < numIterations)
+        {
+            record.phase("snapshot");
+            CheckpointWriter writer("SVD");
+            addCheckpointSections(writer);
+            iterCheckpointWriter.write(std::move(writer),
+                                       fileNameIterCheckpoint);
+        }
+
+        // Hand the probe set's share of the parameters to the validator,
+        // which scores it while the next epoch trains.
+        if (record.probeDue() && validator.enabled())
+        {
+            record.phase("probe");
+            std::unique_ptr<ProbeSnapshot> snapshot(
+                new FactorSnapshot(*this, ProbeSet::resident()));
+
+            if (earlyStoppingPatience > 0)
+            {
+                CheckpointWriter writer("SVD");
+                addCheckpointSections(writer);
+                validator.submit(iterationsDone, std::move(snapshot),
+                                 &writer);
+            }
+            else
+            {
+                validator.submit(iterationsDone, std::move(snapshot));
+            }
+        }
+
+        record.finish();
+
+        if (validator.shouldStop())
+        {
+            break;
+        }
+    }
+
+    // Make sure the last snapshot made it to disk, and the last probe
+    // RMSE is in.
+    iterCheckpointWriter.wait();
+    validator.wait();
 
-        float probeRMSE = computeRMSE(PROBE_BIN);
-        cout << "Probe RMSE: " << probeRMSE << endl;
+    // Roll back to the best epoch if early stopping is on and we've gone
+    // past it.
+    if (earlyStoppingPatience > 0 && validator.bestEpoch() > 0
+        && validator.bestEpoch() != iterationsDone)
+    {
+        checkpoint.open(fileNameBestCheckpoint, "SVD");
+        loadCheckpointSections();
+
+#ifndef NDEBUG
+        cout << "Rolled SVD back to iteration " << iterationsDone
+             << " (probe RMSE " << validator.bestRMSE() << ")" << endl;
 #endif
     }
 
@@ -409,51 +691,85 @@ void SVD::train(const fmat &data)
 
 
 /**
+ * Carries out one pass of stochastic gradient descent over the ratings of
+ * the users in [firstUser, endUser). See train() for the details.
  *
- * TODO: remove this later!
- *
- * Compute the RMSE of this algorithm on a certain set of data. Note that
- * testFileName must refer to an **Armadillo binary** in this case. This
- * binary must represent a 4 x N matrix, where N is the number of test
- * points.
+ * @param data:         The ratings of exactly those users, sorted by user.
+ * @param ratings:      The i-th rating of data is ratings[i] (e.g. a
+ *                      residual), or its own if ratings is NULL.
+ * @param firstUser:    The first user to train on.
+ * @param endUser:      One past the last user to train on.
  *
  */
-float SVD::computeRMSE(const string &testFileName)
+void SVD::trainUsers(const RatingView &data, const float *ratings,
+                     int firstUser, int endUser)
 {
-    // Load from binary.
-    fmat testSet;
-    testSet.load(testFileName, arma_binary);
-
-    // The test set should have four rows.
-    if (testSet.n_rows != 4)
-    {
-        throw invalid_argument("File " + testFileName + " did not "
-                               + "have four rows!");
-    }
-
-    // The number we divide by in computing the RMSE.
-    int nMinusOne = testSet.n_cols - 1;
-
-    // Accumulator for RMSE (take square root at the end)
-    float rmse = 0.0;
+    RatingCursor cursor(data);
 
-    for (unsigned int i = 0; i < testSet.n_cols; i ++)
+    // The rating number that we're looking at right now (i.e. the
+    // column in our training set).
+    size_t ratingNum = 0;
+    
+    // Iterate through the users in the range. We're assuming that the data
+    // is sorted (column-wise) by user ID!
+    for (int user = firstUser; user < endUser; user++)
     {
-        int user = roundToInt(testSet(USER_ROW, i));
-        int item = roundToInt(testSet(MOVIE_ROW, i));
-        int date = roundToInt(testSet(DATE_ROW, i));
-        float actualRating = testSet(RATING_ROW, i);
+        // Find the number of items rated by this user in the training
+        // set, so we know how many entries to parse.
+        int numItemsUserTrainSet = numItemsTrainingSet[user];
         
-        float prediction = predict(user, item, date, true);
+        // Increment ratingNum as we iterate over items rated by the
+        // user.
+        for(int itemNum = 0; itemNum < numItemsUserTrainSet; itemNum++,
+                                                             ratingNum++)
+        {
+            const float *rating = cursor.next();
+            int item = itemMap.internal(roundToInt(rating[MOVIE_ROW]));
+            float actualRating = ratings != NULL ? ratings[ratingNum]
+                                                 : rating[RATING_ROW];
+            
+            // Get the predicted rating for this user and item, using the
+            // aforementioned formula for rHat_{ui}.
+            float predictedRating = meanRating + bUser(user) + bItem(item);
+            
+            // Compute the factorized term (i.e. q_i^T * p_u).
+            fcolvec userFactorTerm(userFacMat.col(user));
+            fcolvec qi(itemFacMat.col(item));
+            predictedRating += dot(qi, userFactorTerm);
+            
+            // Apply gradient descent on all of the free parameters in
+            // our algorithm. This just involves subtracting off the
+            // gradient of the error metric (which we're trying to
+            // minimize) with respect to each free parameter. Note
+            // that factors of 2 have been absorbed into the "gamma"
+            // step sizes.
+            
+            // The error in our prediction for this user and item.
+            float eUI = actualRating - predictedRating;
+
+            // b_u <- b_u + gamma_b_u * (e_{ui} - SVD_LAM_B_U * b_u)
+            bUser(user) += SVD_GAMMA_B_U * (eUI - SVD_LAM_B_U *
+                                            bUser(user));
+            
+            // b_i <- b_i + gamma_b_i * (e_{ui} - SVD_LAM_B_I * b_i)
+            bItem(item) += SVD_GAMMA_B_I * (eUI - SVD_LAM_B_I *
+                                            bItem(item));
+
+            // q_i <- q_i + gamma_2 * (e_{ui} * p_u
+            //                         - SVD_LAM_Q_I * q_i)
+            itemFacMat.col(item) += SVD_GAMMA_Q_I * (eUI * 
+                    userFactorTerm - SVD_LAM_Q_I * qi);
+            
+            // p_u <- p_u + gamma_2 * (e_{ui} * q_i - SVD_LAM_P_U * 
+            //                                        p_u)
+            userFacMat.col(user) += SVD_GAMMA_P_U * (eUI * qi - 
+                    SVD_LAM_P_U * userFactorTerm);
+        }
         
-        rmse += pow(actualRating - prediction, 2.0)/nMinusOne;
     }
-
-    return sqrt(rmse);
 }
 
 
-
 /** 
  * This function predicts a rating for a given user and item. If the SVD
  * has not been trained yet, a logic_error is thrown.
@@ -486,6 +802,7 @@ float SVD::predict(int user, int item, int date, bool bound)
     //
     // Where we use the same naming convention as in the Koren paper.
     
+    item = itemMap.internal(item);
     float predictedRating = meanRating + bUser(user) + bItem(item);
 
     // Compute the factorized term (i.e. q_i^T * p_u).
@@ -511,6 +828,94 @@ float SVD::predict(int user, int item, int date, bool bound)
 }
 
 
+/**
+ * Predicts one chunk of a batch (see BaseAlgorithm::predictBatch). Points
+ * are expected to be grouped by user, so p_u and b_u are only looked up
+ * when the user changes, and each prediction is a single dot product on
+ * the raw factor columns.
+ *
+ */
+void SVD::predictRange(const int *users, const int *items,
+                       const int * /* dates */, float *output, size_t n,
+                       bool bound)
+{
+    const float *userFactors = NULL;
+    float userTerm = 0.0;
+    int currUser = -1;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (users[i] != currUser)
+        {
+            currUser = users[i];
+            userFactors = userFacMat.colptr(currUser);
+            userTerm = meanRating + bUser(currUser);
+        }
+
+        int item = itemMap.internal(items[i]);
+        float predictedRating = userTerm + bItem(item) +
+            simd::dot(itemFacMat.colptr(item), userFactors, numFactors);
+
+        if (bound)
+        {
+            predictedRating = std::min(std::max(predictedRating,
+                (float) MIN_RATING), (float) MAX_RATING);
+        }
+
+        output[i] = predictedRating;
+    }
+}
+
+
+/**
+ * FactorModel: queries are ready once the model has been trained (or
+ * loaded from a checkpoint).
+ */
+bool SVD::readyForQueries() const
+{
+    return trained;
+}
+
+
+/**
+ * FactorModel: the item factors q_i, in internal item order.
+ */
+const fmat &SVD::itemFactors() const
+{
+    return itemFacMat;
+}
+
+
+/**
+ * FactorModel: the item biases b_i.
+ */
+const fcolvec &SVD::itemBiases() const
+{
+    return bItem;
+}
+
+
+/**
+ * FactorModel: how items map to columns of itemFactors().
+ */
+const IdMap &SVD::itemIds() const
+{
+    return itemMap;
+}
+
+
+/**
+ * FactorModel: writes the user's effective factor vector (p_u) to
+ * factors, and returns mu + b_u.
+ */
+float SVD::userQuery(int user, float *factors) const
+{
+    std::copy(userFacMat.colptr(user), userFacMat.colptr(user) + numFactors,
+              factors);
+    return meanRating + bUser(user);
+}
+
+
 SVD::~SVD()
 {
     // No dynamically allocated resources to free at the moment.
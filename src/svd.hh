@@ -22,12 +22,17 @@
 
 #include <netflix.hh>
 #include <basealgorithm.hh>
+#include <checkpoint.hh>
+#include <factormodel.hh>
+#include <idmap.hh>
+#include <shardsource.hh>
+#include <simd.hh>
 
 using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
-class SVD : public BaseAlgorithm
+class SVD : public BaseAlgorithm, public FactorModel
 {
 private:
     // Regularization constants for each internal variable. See the train()
@@ -44,10 +49,17 @@ private:
     // method for more on which parameters these apply to. These came from
     // a combination of the Koren paper, the abovementioned forum link, and
     // other tweaks.
-    float SVD_GAMMA_B_I = 0.007;
-    float SVD_GAMMA_B_U = 0.007;
-    float SVD_GAMMA_Q_I = 0.007;
-    float SVD_GAMMA_P_U = 0.007;
+    static constexpr float SVD_GAMMA_B_I_INIT = 0.007;
+    static constexpr float SVD_GAMMA_B_U_INIT = 0.007;
+    static constexpr float SVD_GAMMA_Q_I_INIT = 0.007;
+    static constexpr float SVD_GAMMA_P_U_INIT = 0.007;
+
+    // The current step sizes. These start out at the values above, and
+    // decay after every iteration.
+    float SVD_GAMMA_B_I = SVD_GAMMA_B_I_INIT;
+    float SVD_GAMMA_B_U = SVD_GAMMA_B_U_INIT;
+    float SVD_GAMMA_Q_I = SVD_GAMMA_Q_I_INIT;
+    float SVD_GAMMA_P_U = SVD_GAMMA_P_U_INIT;
     
     // The fraction by which the step sizes will be multiplied on each
     // iteration (as recommended in the Koren paper).
@@ -65,6 +77,10 @@ private:
     // The mean rating assigned to all items in the dataset. This is "mu"
     // in the Koren paper.
     const float meanRating;
+
+    // The checkpoint that the matrices below are mapped from, when using
+    // cached data. It must outlive them, so it is declared first.
+    Checkpoint checkpoint;
     
     // The bias for each user. Referred to as "b_u" in the Koren paper. The
     // uth element in this is the bias for user u.
@@ -88,42 +104,94 @@ private:
     // convention of the Koren paper.
     fmat itemFacMat;
 
+    // Whether train() renumbers items by popularity, and the numbering in
+    // use (see idmap.hh). bItem and itemFacMat are indexed by internal
+    // IDs; every other item ID is an original one.
+    bool renumberItems = false;
+    IdMap itemMap;
+
     // Whether the algorithm has been trained yet or not.
     bool trained = false;
 
     // Whether we're using cached data or not.
     bool usingCachedData = false;
 
+    // The number of training iterations completed so far.
+    int iterationsDone = 0;
+
+    // Where, and every how many iterations, training saves a snapshot of
+    // its progress. An interval of 0 means no snapshots are saved.
+    string fileNameIterCheckpoint;
+    int iterCheckpointInterval = 0;
+    BackgroundCheckpointWriter iterCheckpointWriter;
+
+    // After how many probe scores without an improvement training stops (0
+    // never stops early), and the checkpoint file it rolls back through.
+    int earlyStoppingPatience = 0;
+    string fileNameBestCheckpoint;
+
     void initInternalData();
-    void populateNumItemsTrainingSet(const fmat &data);
-    float computeRMSE(const string &testFileName);
+    void populateNumItemsTrainingSet(const RatingView &data);
+    void train(const RatingView &data, const float *ratings);
+    void trainIterations(const function<size_t()> &epoch);
+    void trainUsers(const RatingView &data, const float *ratings,
+                    int firstUser, int endUser);
+    void addCheckpointSections(CheckpointWriter &writer) const;
+    void loadCheckpointSections();
+
+protected:
+    void idBounds(int &users, int &items, int &dates) const
+    {
+        users = numUsers;
+        items = numItems;
+        dates = INT_MAX;
+    }
+
+    void predictRange(const int *users, const int *items, const int *dates,
+                      float *output, size_t n, bool bound);
 
 public:
     SVD(int numUsers, int numItems, float meanRating, int numFactors,
         int numIterations);
 
     SVD(int numUsers, int numItems, float meanRating, int numFactors,
-        int numIterations,
-        const string &fileNameBUser, const string &fileNameBItem,
-        const string &fileNameUserFacMat,
-        const string &fileNameItemFacMat);
+        int numIterations, const string &fileNameCheckpoint);
      
     ~SVD();
     
     void train(const fmat &data);
 
-    void trainAndCache(const fmat &data, const string &fileNameBUser,
-                       const string &fileNameBItem,
-                       const string &fileNameUserFacMat,
-                       const string &fileNameItemFacMat);
+    void train(const RatingView &view);
+
+    void trainWithRatings(const RatingView &data, const float *ratings);
+
+    void trainStreaming(ShardSource &shards);
+
+    void trainAndCache(const RatingView &data,
+                       const string &fileNameCheckpoint);
     
     void trainAndCache(const string &fileNameData,
-                       const string &fileNameBUser,
-                       const string &fileNameBItem,
-                       const string &fileNameUserFacMat,
-                       const string &fileNameItemFacMat);
+                       const string &fileNameCheckpoint);
+
+    void saveCheckpoint(const string &fileNameCheckpoint) const;
+
+    void setIterationCheckpoints(const string &fileNameCheckpoint,
+                                 int interval);
+
+    void setEarlyStopping(int patience, const string &fileNameCheckpoint);
+
+    void resumeTraining(const RatingView &data,
+                        const string &fileNameCheckpoint);
+
+    void setItemRenumbering(bool enabled);
     
     float predict(int user, int item, int date, bool bound);
+
+    bool readyForQueries() const;
+    const fmat &itemFactors() const;
+    const fcolvec &itemBiases() const;
+    const IdMap &itemIds() const;
+    float userQuery(int user, float *factors) const;
 };
 
 #endif // SVD_HH
@@ -17,6 +17,8 @@
 #include <vector>
 
 #include <netflix.hh>
+#include <ratingstore.hh>
+#include <shardsource.hh>
 #include <svd.hh>
 
 using namespace std;
@@ -26,9 +28,9 @@ using namespace netflix; // challenge-related constants/functions.
 
 /* Constants */
 
-// The Armadillo binary file to use for training.
-// const string SVD_TRAIN_FILE = BASE_HIDDEN_VALID_BIN;
-const string SVD_TRAIN_FILE = ALL_TRAIN_BIN;
+// The sets to train on (views of the rating store).
+// const set<int> SVD_TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
+const set<int> SVD_TRAIN_SETS = ALL_TRAIN_IDX;
 
 // The number of factors to use for SVD.
 const int NUM_FACTORS = 1000;
@@ -45,15 +47,21 @@ const int RATING_SIG_FIGS = 4;
 // Whether the data will be cached after training.
 const bool WILL_CACHE_DATA = true;
 
+// Whether to renumber movies by popularity before training (see idmap.hh).
+// The numbering is cached with the model.
+const bool RENUMBER_ITEMS = true;
+
+// Whether to train on the training sets a shard at a time, from the shards
+// at RATING_SHARDS (see shardsource.hh), rather than on all of them at
+// once. Run shard_ratings to create the shards first.
+const bool STREAM_SHARDS = false;
+
 // Whether we're using cached data **instead of** training.
 const bool USING_CACHED_DATA = false;
 
-// The locations of the files we'll use for caching (and read from if we're
-// using cached data). These must be in Armadillo binary format!
-const string B_USER_FN =            "data/svd_cached/b_user.mat";
-const string B_ITEM_FN =            "data/svd_cached/b_item.mat";
-const string USER_FAC_MAT_FN =      "data/svd_cached/user_fac.mat";
-const string ITEM_FAC_MAT_FN =      "data/svd_cached/item_fac.mat";
+// The checkpoint we'll cache the trained model in (and read from if we're
+// using cached data).
+const string CHECKPOINT_FN = "data/svd_cached/svd.ckpt";
 
 
 // Helper function that carries out "predAlgo" on the test file specified
@@ -76,47 +84,66 @@ int main(void)
                           "data\" flag if you're using cached data!");
     }
     
+    // Map the rating store. Models are sized from its dimensions.
+    RatingStore ratings(RATINGS_STORE);
+
     // If we've cached the matrices produced by SVD, use those to skip the
     // training step.
     if (USING_CACHED_DATA)
     {
-        // Construct an SVD object and pass in the cached data file
-        // names.
-        SVD predAlgo(NUM_USERS, NUM_MOVIES, MEAN_RATING_TRAINING_SET,
-                     NUM_FACTORS, NUM_ITERATIONS,
-                     B_USER_FN, B_ITEM_FN, USER_FAC_MAT_FN,
-                     ITEM_FAC_MAT_FN);
+        // Construct an SVD object and pass in the cached checkpoint.
+        SVD predAlgo(ratings.numUsers(), ratings.numItems(),
+                     MEAN_RATING_TRAINING_SET, NUM_FACTORS, NUM_ITERATIONS,
+                     CHECKPOINT_FN);
         
         // Go through qual.dta and produce a prediction file.
         testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
     }
     else // If not using cached data, we need to train.
     {
-        // Load from binary.
-        fmat trainingSet;
-        trainingSet.load(SVD_TRAIN_FILE, arma_binary);
-        
-        SVD predAlgo(NUM_USERS, NUM_MOVIES, MEAN_RATING_TRAINING_SET,
-                     NUM_FACTORS, NUM_ITERATIONS);
-        
-        // Check if we want to cache.
-        if (WILL_CACHE_DATA)
+        SVD predAlgo(ratings.numUsers(), ratings.numItems(),
+                     MEAN_RATING_TRAINING_SET, NUM_FACTORS, NUM_ITERATIONS);
+        predAlgo.setItemRenumbering(RENUMBER_ITEMS);
+
+        if (STREAM_SHARDS)
         {
-            // If so, train and then cache the results after training.
-            cout << "\nTraining SVD. The resulting matrices WILL be "
-                    "cached." << endl;
-            
-            predAlgo.trainAndCache(trainingSet, B_USER_FN, B_ITEM_FN,
-                                   USER_FAC_MAT_FN, ITEM_FAC_MAT_FN);
+            // Read the training set a shard at a time (see shardsource.hh)
+            // instead of holding all of it in memory.
+            cout << "\nTraining SVD on the shards at " << RATING_SHARDS
+                 << "." << endl;
+
+            ShardSource shards(RATING_SHARDS, SVD_TRAIN_SETS);
+            predAlgo.trainStreaming(shards);
+
+            if (WILL_CACHE_DATA)
+            {
+                predAlgo.saveCheckpoint(CHECKPOINT_FN);
+            }
         }
         else
         {
-            // If not, just train.
-            cout << "\nTraining SVD. The resulting matrices WON'T be "
-                    "cached." << endl;
-            predAlgo.train(trainingSet);
-        }        
-        
+            // The training set is a view of the rating store (and isn't
+            // copied if it's all of the training data).
+            RatingView trainingSet = ratings.view(SVD_TRAIN_SETS);
+
+            // Check if we want to cache.
+            if (WILL_CACHE_DATA)
+            {
+                // If so, train and then cache the results after training.
+                cout << "\nTraining SVD. The resulting matrices WILL be "
+                        "cached." << endl;
+            
+                predAlgo.trainAndCache(trainingSet, CHECKPOINT_FN);
+            }
+            else
+            {
+                // If not, just train.
+                cout << "\nTraining SVD. The resulting matrices WON'T be "
+                        "cached." << endl;
+                predAlgo.train(trainingSet);
+            }
+        }
+
         // Go through qual.dta to produce a prediction file.
         testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
     }
@@ -132,52 +159,21 @@ int main(void)
 void testOnDataFile(SVD &predAlgo, const string &testFileName,
                     const string &outputFileName)
 {
-    ifstream qualDataFile(testFileName);
-    ofstream outputFile(outputFileName); 
-    
-    if (qualDataFile.fail())
-    {
-        throw runtime_error("Couldn't find test file at " + testFileName);
-    }
-
-    if (outputFile.fail())
-    {
-        throw runtime_error("Couldn't open output file at " 
-                            + outputFileName);
-    }
-
-    string qualDataLine;
-    
     cout << "\nTesting on data in " << testFileName << "..." << endl;
 
-    while (getline(qualDataFile, qualDataLine))
-    {
-        // Read the line and split it.
-        vector<int> thisLineVec;
-        splitIntoInts(qualDataLine, DELIMITER,
-                      thisLineVec);
+    // Load the (cached) binary index of the test file and predict it in
+    // one batch.
+    Mat<int> testIndex = loadQualIndex(testFileName);
+    vector<float> predictions(testIndex.n_rows);
+    predAlgo.predictBatch(testIndex.colptr(USER_ROW),
+                          testIndex.colptr(MOVIE_ROW),
+                          testIndex.colptr(DATE_ROW),
+                          predictions.data(), testIndex.n_rows, true);
+
+    // Output the predictions to file.
+    writePredictions(outputFileName, predictions.data(), predictions.size(),
+                     RATING_SIG_FIGS);
 
-        if (thisLineVec.size() != 3)
-        {
-            throw logic_error("The line \"" + qualDataLine + "\" did not "
-                              "contain three delimiter-separated "
-                              "entries!");
-        }
-        
-        // The first entry is the user ID, the second entry is the item ID,
-        // and the third entry is the date. All of these should be
-        // zero-indexed!
-        int user = thisLineVec[0];
-        int item = thisLineVec[1];
-        int date = thisLineVec[2];
-        
-        // Output the prediction to file.
-        float prediction = predAlgo.predict(user, item, date, true);
-        outputFile << setprecision(RATING_SIG_FIGS) << prediction << endl;
-    }
-    
-    outputFile.close();
-    
     cout << "\nOutputted predictions on " << testFileName << " to the " 
         "output file " << outputFileName << endl;
 }
@@ -1,11 +1,11 @@
 #ifndef NDEBUG
-#include <chrono>
 #include <iostream>
-
-using namespace std::chrono;
 #endif
 
+#include <ratingstore.hh>
 #include <svdpp.hh>
+#include <telemetry.hh>
+#include <validation.hh>
 
 
 /** 
@@ -48,8 +48,8 @@ SVDPP::SVDPP(int numUsers, int numItems, float meanRating, int numFactors,
 
 /**
  * This constructor uses cached data to initialize the internals of the
- * SVDPP object. It is assumed that all of the cached data (except the file
- * containing N) is stored in Armadillo's machine-dependent binary format.
+ * SVDPP object. Apart from N, the cached data is a checkpoint written by
+ * saveCheckpoint(), which is mapped rather than read.
  *
  * Note: This constructor should be used for blending, not the other one!
  *
@@ -67,39 +67,27 @@ SVDPP::SVDPP(int numUsers, int numItems, float meanRating, int numFactors,
  *                                  information needed to populate the N
  *                                  mapping. This should be a plain text
  *                                  .dta file (or equivalent).
- * @param fileNameBUser:            Name of file containing data for bUser,
- *                                  in Armadillo's machine-dependent binary
- *                                  format.
- * @param fileNameBItem:            Same as above, but for bItem.
- * @param fileNameUserFacMat:       Same as above, but for userFacMat.
- * @param fileNameItemFacMat:       Same as above, but for itemFacMat.
- * @param fileNameYMat:             Same as above, but for yMat.
- * @param fileNameSumMovieWeights:  Same as above, but for sumMovieWeights.
+ * @param fileNameCheckpoint:       Name of the checkpoint file holding
+ *                                  bUser, bItem, userFacMat, itemFacMat,
+ *                                  yMat and sumMovieWeights. Their shapes
+ *                                  must match the arguments above.
  *
  */
 SVDPP::SVDPP(int numUsers, int numItems, float meanRating, int numFactors,
              int numIterations, const string &fileNameN,
-             const string &fileNameBUser, const string &fileNameBItem,
-             const string &fileNameUserFacMat,
-             const string &fileNameItemFacMat, const string &fileNameYMat,
-             const string &fileNameSumMovieWeights) :
+             const string &fileNameCheckpoint) :
     numUsers(numUsers), numItems(numItems), meanRating(meanRating),
-    numFactors(numFactors), numIterations(numIterations), bUser(numUsers),
-    bItem(numItems), userFacMat(numFactors, numUsers),
-    itemFacMat(numFactors, numItems), yMat(numFactors, numItems),
-    numItemsTrainingSet(numUsers), sumMovieWeights(numFactors, numUsers)
+    numFactors(numFactors), numIterations(numIterations),
+    numItemsTrainingSet(numUsers)
 {
     // Populate N by reading from fileNameN.
     populateN(fileNameN);
 
-    // Initialize bUser, bItem, userFacMat, itemFacMat, yMat, and
-    // sumMovieWeights by reading from their binary files.
-    bUser.load(fileNameBUser, arma_binary);
-    bItem.load(fileNameBItem, arma_binary);
-    userFacMat.load(fileNameUserFacMat, arma_binary);
-    itemFacMat.load(fileNameItemFacMat, arma_binary);
-    yMat.load(fileNameYMat, arma_binary);
-    sumMovieWeights.load(fileNameSumMovieWeights, arma_binary);
+    // Point bUser, bItem, userFacMat, itemFacMat, yMat, and
+    // sumMovieWeights at their sections of the checkpoint.
+    checkpoint.open(fileNameCheckpoint, "SVDPP");
+    loadCheckpointSections();
+    freeze();
     
     trained = true;
     usingCachedData = true;
@@ -169,16 +157,14 @@ void SVDPP::populateN(const string &fileNameN)
  *              train() for more details.
  *
  */
-void SVDPP::populateNumItemsTrainingSet(const fmat &data)
+void SVDPP::populateNumItemsTrainingSet(const RatingView &data)
 {
-    for(unsigned int i = 0; i < data.n_cols; i++)
-    {
-        // Based on the user that this rating was by, increment the
-        // appropriate element of numItemsTrainingSet.
-        int user = roundToInt(data(USER_ROW, i));
-        
-        numItemsTrainingSet(user) ++;
-    }
+    data.forEach([this](const float *rating)
+            {
+                // Based on the user that this rating was by, increment the
+                // appropriate element of numItemsTrainingSet.
+                numItemsTrainingSet(roundToInt(rating[USER_ROW]))++;
+            });
     
 }
 
@@ -246,6 +232,17 @@ void SVDPP::initInternalData()
     bUser.zeros();
     bItem.zeros();
     yMat.zeros();
+
+    // Start over with the initial step sizes.
+    SVDPP_GAMMA_B_I = SVDPP_GAMMA_B_I_INIT;
+    SVDPP_GAMMA_B_U = SVDPP_GAMMA_B_U_INIT;
+    SVDPP_GAMMA_Q_I = SVDPP_GAMMA_Q_I_INIT;
+    SVDPP_GAMMA_P_U = SVDPP_GAMMA_P_U_INIT;
+    SVDPP_GAMMA_Y_J = SVDPP_GAMMA_Y_J_INIT;
+    iterationsDone = 0;
+
+    // The old prediction state is out of date now.
+    frozen = false;
 }
 
 
@@ -256,41 +253,16 @@ void SVDPP::initInternalData()
  * @param data:                     This is the training data to use for
  *                                  our algorithm. See train() for more
  *                                  details.
- * @param fileNameBUser:            Name of file where we'll save bUser (in
- *                                  Armadillo's machine-dependent binary
- *                                  format).
- * @param fileNameBItem:            Same as above, but for bItem.
- * @param fileNameUserFacMat:       Same as above, but for userFacMat.
- * @param fileNameItemFacMat:       Same as above, but for itemFacMat.
- * @param fileNameYMat:             Same as above, but for yMat.
- * @param fileNameSumMovieWeights:  Same as above, but for sumMovieWeights.
+ * @param fileNameCheckpoint:       Name of the checkpoint file to save to.
+ *                                  See saveCheckpoint().
  * 
  */
-void SVDPP::trainAndCache(const fmat &data, const string &fileNameBUser,
-                          const string &fileNameBItem,
-                          const string &fileNameUserFacMat,
-                          const string &fileNameItemFacMat,
-                          const string &fileNameYMat,
-                          const string &fileNameSumMovieWeights)
+void SVDPP::trainAndCache(const RatingView &data,
+                          const string &fileNameCheckpoint)
 {
     // Train the SVD++ algorithm, then save internal data to file.
     train(data);
-
-    bUser.save(fileNameBUser, arma_binary);
-    bItem.save(fileNameBItem, arma_binary);
-    userFacMat.save(fileNameUserFacMat, arma_binary);
-    itemFacMat.save(fileNameItemFacMat, arma_binary);
-    yMat.save(fileNameYMat, arma_binary);
-    sumMovieWeights.save(fileNameSumMovieWeights, arma_binary);
-    
-#ifndef NDEBUG
-    cout << "Saved bUser to " << fileNameBUser << endl;
-    cout << "Saved bItem to " << fileNameBItem << endl;
-    cout << "Saved userFacMat to " << fileNameUserFacMat << endl;
-    cout << "Saved itemFacMat to " << fileNameItemFacMat << endl;
-    cout << "Saved yMat to " << fileNameYMat << endl;
-    cout << "Saved sumMovieWeights to " << fileNameSumMovieWeights << endl;
-#endif
+    saveCheckpoint(fileNameCheckpoint);
 }
 
 
@@ -307,22 +279,178 @@ void SVDPP::trainAndCache(const fmat &data, const string &fileNameBUser,
  *
  */
 void SVDPP::trainAndCache(const string &fileNameData,
-                          const string &fileNameBUser,
-                          const string &fileNameBItem,
-                          const string &fileNameUserFacMat,
-                          const string &fileNameItemFacMat,
-                          const string &fileNameYMat,
-                          const string &fileNameSumMovieWeights)
+                          const string &fileNameCheckpoint)
 {
     fmat data;
 
     data.load(fileNameData, arma_binary);
-    trainAndCache(data, fileNameBUser, fileNameBItem, fileNameUserFacMat,
-                  fileNameItemFacMat, fileNameYMat,
-                  fileNameSumMovieWeights);
+    trainAndCache(RatingView(data), fileNameCheckpoint);
+}
+
+
+/**
+ * Saves bUser, bItem, userFacMat, itemFacMat, yMat and sumMovieWeights to
+ * a single checkpoint file, which the caching constructor can load. The
+ * step sizes and the number of iterations done are saved too, so training
+ * can be resumed from the checkpoint (see resumeTraining()).
+ *
+ * @param fileNameCheckpoint:   Name of the checkpoint file to (over)write.
+ *
+ */
+void SVDPP::saveCheckpoint(const string &fileNameCheckpoint) const
+{
+    CheckpointWriter writer("SVDPP");
+    addCheckpointSections(writer);
+    writer.write(fileNameCheckpoint);
+
+#ifndef NDEBUG
+    cout << "Saved SVD++ checkpoint to " << fileNameCheckpoint << endl;
+#endif
+}
+
+
+/**
+ * Adds this model's parameters and training state to a checkpoint.
+ */
+void SVDPP::addCheckpointSections(CheckpointWriter &writer) const
+{
+    writer.add("bUser", bUser);
+    writer.add("bItem", bItem);
+    writer.add("userFacMat", userFacMat);
+    writer.add("itemFacMat", itemFacMat);
+    writer.add("yMat", yMat);
+    itemMap.addTo(writer, "itemIds");
+    writer.add("sumMovieWeights", sumMovieWeights);
+
+    std::vector<float> gammas = {SVDPP_GAMMA_B_I, SVDPP_GAMMA_B_U,
+                                 SVDPP_GAMMA_Q_I, SVDPP_GAMMA_P_U,
+                                 SVDPP_GAMMA_Y_J};
+    writer.add("training.gammas", std::move(gammas), 1, 5);
+    writer.add("training.iterations",
+               std::vector<uint64_t>(1, iterationsDone), 1, 1);
 }
 
 
+/**
+ * Points this model's parameters at their sections of the open checkpoint,
+ * and restores its training state.
+ */
+void SVDPP::loadCheckpointSections()
+{
+    bUser = checkpoint.column("bUser", numUsers);
+    bItem = checkpoint.column("bItem", numItems);
+    userFacMat = checkpoint.matrix("userFacMat", numFactors, numUsers);
+    itemFacMat = checkpoint.matrix("itemFacMat", numFactors, numItems);
+    yMat = checkpoint.matrix("yMat", numFactors, numItems);
+    setItemMap(IdMap::load(checkpoint, "itemIds", numItems));
+    sumMovieWeights = checkpoint.matrix("sumMovieWeights", numFactors,
+                                        numUsers);
+
+    const float *gammas = static_cast<const float *>(
+        checkpoint.data("training.gammas", CheckpointDType::F32, 5));
+    SVDPP_GAMMA_B_I = gammas[0];
+    SVDPP_GAMMA_B_U = gammas[1];
+    SVDPP_GAMMA_Q_I = gammas[2];
+    SVDPP_GAMMA_P_U = gammas[3];
+    SVDPP_GAMMA_Y_J = gammas[4];
+
+    iterationsDone = *static_cast<const uint64_t *>(
+        checkpoint.data("training.iterations", CheckpointDType::U64, 1));
+}
+
+
+/**
+ * Makes training save a snapshot of its progress every "interval"
+ * iterations. Snapshots are written on a background thread while the next
+ * iteration runs. They're meant for resumeTraining(); sumMovieWeights is
+ * only brought up to date at the very end of training, so don't predict
+ * with one.
+ *
+ * @param fileNameCheckpoint:   Name of the checkpoint file to keep
+ *                              overwriting with the latest snapshot.
+ * @param interval:             The number of iterations between snapshots,
+ *                              or 0 to stop saving them.
+ *
+ */
+void SVDPP::setIterationCheckpoints(const string &fileNameCheckpoint,
+                                    int interval)
+{
+    if (interval < 0)
+    {
+        throw invalid_argument("The checkpoint interval can't be negative!");
+    }
+
+    fileNameIterCheckpoint = fileNameCheckpoint;
+    iterCheckpointInterval = interval;
+}
+
+
+/**
+ * Makes training stop once the probe RMSE hasn't improved for "patience"
+ * scored iterations, and leave the model at its best iteration. See
+ * SVD::setEarlyStopping() for the details.
+ *
+ * @param patience:             The number of scored iterations without an
+ *                              improvement to stop after, or 0 to never
+ *                              stop early.
+ * @param fileNameCheckpoint:   Name of the checkpoint file to keep the
+ *                              best iteration in.
+ *
+ */
+void SVDPP::setEarlyStopping(int patience, const string &fileNameCheckpoint)
+{
+    if (patience < 0)
+    {
+        throw invalid_argument("The early stopping patience can't be "
+                               "negative!");
+    }
+
+    earlyStoppingPatience = patience;
+    fileNameBestCheckpoint = fileNameCheckpoint;
+}
+
+
+/**
+ * Continues training from a checkpoint written by saveCheckpoint() or by a
+ * snapshot (see setIterationCheckpoints()). The parameters and step sizes
+ * are restored exactly, so the result is bit-for-bit the same as if
+ * training had never been interrupted.
+ *
+ * @param data:                 The training data the checkpoint was made
+ *                              with. See train() for more details.
+ * @param fileNameCheckpoint:   Name of the checkpoint file to resume from.
+ *
+ */
+void SVDPP::resumeTraining(const RatingView &data,
+                           const string &fileNameCheckpoint)
+{
+    if (usingCachedData)
+    {
+        throw logic_error("This algorithm shouldn't be trained if you're "
+                          "using cached data!");
+    }
+
+    checkpoint.open(fileNameCheckpoint, "SVDPP");
+    loadCheckpointSections();
+
+    if (iterationsDone > numIterations)
+    {
+        throw invalid_argument("The checkpoint at " + fileNameCheckpoint +
+                               " is past the last iteration!");
+    }
+
+#ifndef NDEBUG
+    cout << "Resuming SVD++ after iteration " << iterationsDone << endl;
+#endif
+
+    numItemsTrainingSet.zeros();
+    populateNumItemsTrainingSet(data);
+    trainIterations([this, &data]() -> size_t
+            {
+                trainUsers(data, NULL, 0, numUsers);
+                return data.size();
+            });
+}
 
 
 /**
@@ -369,6 +497,42 @@ inline void SVDPP::updateUserSumMovieWeights(int user)
 }
 
 
+/**
+ * Makes train() renumber items by descending number of ratings, so the
+ * most rated items' factors (q_i and y_j) sit next to each other (see
+ * idmap.hh). The numbering is saved with the model, and item IDs passed in
+ * or handed out are always the original ones.
+ *
+ * @param enabled:  Whether to renumber items on the next train().
+ *
+ */
+void SVDPP::setItemRenumbering(bool enabled)
+{
+    renumberItems = enabled;
+}
+
+
+/**
+ * Switches to a new item numbering, translating the items in N (which
+ * y_j is looked up by) to it.
+ *
+ * @param map:  The new numbering.
+ *
+ */
+void SVDPP::setItemMap(IdMap &&map)
+{
+    for (auto &nu : N)
+    {
+        for (int &item : nu.second)
+        {
+            item = map.internal(itemMap.external(item));
+        }
+    }
+
+    itemMap = std::move(map);
+}
+
+
 /**
  * This function uses the given training data in order to set up all of the
  * internal matrices needed for SVD++. After training has been completed,
@@ -389,6 +553,40 @@ inline void SVDPP::updateUserSumMovieWeights(int user)
  */
 
 void SVDPP::train(const fmat &data)
+{
+    train(RatingView(data), NULL);
+}
+
+
+/**
+ * Trains on a view of a rating store (see train(const fmat &)), walking
+ * its runs rather than copying them into a matrix.
+ *
+ */
+void SVDPP::train(const RatingView &view)
+{
+    train(view, NULL);
+}
+
+
+/**
+ * Trains on data's users and items with ratings taken from a separate
+ * column (e.g. the residuals of an earlier model), so that no copy of the
+ * training matrix is made.
+ *
+ */
+void SVDPP::trainWithRatings(const RatingView &data, const float *ratings)
+{
+    train(data, ratings);
+}
+
+
+/**
+ * Does the work of train(), taking the i-th rating of data from ratings[i]
+ * (or from data itself if ratings is NULL).
+ *
+ */
+void SVDPP::train(const RatingView &data, const float *ratings)
 {
     // The predicted rating given by SVD++ for user u and item i is:
     //
@@ -413,12 +611,6 @@ void SVDPP::train(const fmat &data)
     // This minimization is accomplished via stochastic gradient descent on
     // the free parameters of b_u, b_i, q_i, p_u, and y_j.
     
-    // Check that the data does in fact have four rows!
-    if (data.n_rows != 4)
-    {
-        throw invalid_argument("Data array must have four rows!");
-    }
-
     // If we're using cached data, we shouldn't be calling this method!
     if (usingCachedData)
     {
@@ -437,161 +629,136 @@ void SVDPP::train(const fmat &data)
 #endif
     }
     
+    // Number the items for this training set, most rated first, if we've
+    // been asked to (see setItemRenumbering()).
+    setItemMap(renumberItems ? IdMap::byFrequency(data, MOVIE_ROW, numItems)
+                             : IdMap());
+
     // We want to find the number of items rated by each user in the
     // training set, since this will help us go through our training data
     // in a more organized fashion.
     populateNumItemsTrainingSet(data);
-    
-#ifndef NDEBUG
-    time_point<system_clock> start, end;
-    duration<float, ratio<60>> minutes_elapsed; 
-#endif
-    
-    // Iterate for the specified number of iterations.
-    for(int iterCount = 0; iterCount < numIterations; iterCount++)
+
+    trainIterations([this, &data, ratings]() -> size_t
+            {
+                trainUsers(data, ratings, 0, numUsers);
+                return data.size();
+            });
+}
+
+
+/**
+ * Trains on ratings streamed from disk a shard at a time (see
+ * shardsource.hh) instead of a matrix held in memory, so only the
+ * parameters and two shards are ever resident. Shards are visited in user
+ * order, so the result is the same as train() on all of their ratings.
+ *
+ * @param shards:   The shards to train on. Every user in them must be
+ *                  below numUsers.
+ *
+ */
+void SVDPP::trainStreaming(ShardSource &shards)
+{
+    if (usingCachedData)
+    {
+        throw logic_error("This algorithm shouldn't be trained if you're "
+                          "using cached data!");
+    }
+
+    if (shards.numUsers() > numUsers)
     {
+        throw invalid_argument("The shards have more users than the "
+                               "model!");
+    }
+
+    if (trained)
+    {
+        initInternalData();
+
 #ifndef NDEBUG
-        start = system_clock::now();
+        cout << "Cleared old internal data" << endl;
 #endif
-        
-        // The rating number that we're looking at right now (i.e. the
-        // column in our training set).
-        unsigned int ratingNum = 0;
-        
-        // Iterate through all users in the training data. We're assuming
-        // that the data is sorted (column-wise) by user ID!
-        for (unsigned int user = 0; user < (unsigned int) numUsers;
-             user ++)
+    }
+
+    // Count each user's ratings (and each item's, to renumber them) with
+    // one pass over the shards before training.
+    vector<size_t> itemCounts(renumberItems ? numItems : 0, 0);
+    RatingShard shard;
+
+    shards.rewind();
+    while (shards.next(shard))
+    {
+        const RatingView view(shard.ratings);
+        populateNumItemsTrainingSet(view);
+
+        if (renumberItems)
         {
-            // Update sumMovieWeights for this user.
-            updateUserSumMovieWeights(user);
+            IdMap::countIds(view, MOVIE_ROW, itemCounts);
+        }
+    }
 
-            // Check N(u) to see if this user has implicit feedback data.
-            vector<int> nu = N[user];
-            int nuSize = nu.size();
-            
-            if (nuSize == 0)
-            {
-                // If they don't, ignore them. After all, we're not gonna
-                // predict anything for them anyways.
-                continue;
-            }
-            
-            // Norm factor put in front of userSumMovieWeights, etc.
-            float nuNormFac = 1.0/sqrt((float) nu.size());
-            
-            // Find the number of items rated by this user in the training
-            // set, so we know how many entries to parse.
-            int numItemsUserTrainSet = numItemsTrainingSet[user];
+    setItemMap(renumberItems ? IdMap::fromCounts(itemCounts)
+                             : IdMap());
 
-            // The value of sum_{j in N(u)} y_j for this user.
-            fcolvec userSumMovieWeights(sumMovieWeights.col(user));
-            
-            // The sum of all values of e_{ui} |N(u)|^{-1/2} * q_i over all
-            // items watched by this user. This is used to update yMat via
-            // gradient descent at the very end.
-            fcolvec sumErrNuNormQi = zeros<fcolvec>(numFactors);
-            
-            // Increment ratingNum as we iterate over items rated by the
-            // user.
-            for(int itemNum = 0; itemNum < numItemsUserTrainSet; itemNum++,
-                                                                 ratingNum++)
-            {
-                int item = roundToInt(data(MOVIE_ROW, ratingNum));
-                float actualRating = data(RATING_ROW, ratingNum);
-                
-                // Get the predicted rating for this user and item, using the
-                // aforementioned formula for rHat_{ui}.
-                float predictedRating = meanRating + bUser(user) + bItem(item);
-                
-                // Compute the factorized term (i.e. q_i^T * (p_u + ...)).
-                // First find p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j, the
-                // "userFactorTerm". Start off by making a copy of
-                // p_u.
-                fcolvec userFactorTerm(userFacMat.col(user));
-
-                // sumMovieWeights should already have sum_{j in N(u)} y_j
-                // cached (from the previous iteration), so use that old
-                // value.
-                userFactorTerm += userSumMovieWeights * nuNormFac;
-                
-                // Add the factorized term (q_i^T * userFactorTerm) to the
-                // prediction.
-                fcolvec qi(itemFacMat.col(item));
-                predictedRating += dot(qi, userFactorTerm);
-
-                // Apply gradient descent on all of the free parameters in our
-                // algorithm EXCEPT FOR yMat (which only needs to be updated at
-                // the end for this user). This just involves subtracting off
-                // the gradient of the error metric (which we're trying to
-                // minimize) with respect to each free parameter. Note that
-                // factors of 2 have been absorbed into the "gamma" step
-                // sizes.
-                
-                // The error in our prediction for this user and item.
-                float eUI = actualRating - predictedRating;
-
-                // b_u <- b_u + gamma_b_u * (e_{ui} - SVDPP_LAM_B_U * b_u)
-                bUser(user) += SVDPP_GAMMA_B_U * (eUI - SVDPP_LAM_B_U *
-                                                      bUser(user));
-                
-                // b_i <- b_i + gamma_b_i * (e_{ui} - SVDPP_LAM_B_I * b_i)
-                bItem(item) += SVDPP_GAMMA_B_I * (eUI - SVDPP_LAM_B_I *
-                                                        bItem(item));
-
-                // q_i <- q_i + gamma_2 * (e_{ui} * (p_u + |N(u)|^{-1/2} *
-                //                                   sum_{j in N(u)} y_j)
-                //                         - SVDPP_LAM_Q_I * q_i)
-                itemFacMat.col(item) += SVDPP_GAMMA_Q_I * (eUI * 
-                        userFactorTerm - SVDPP_LAM_Q_I * qi);
-                
-                // p_u <- p_u + gamma_2 * (e_{ui} * q_i - SVDPP_LAM_P_U * 
-                //                                        p_u)
-                userFacMat.col(user) += SVDPP_GAMMA_P_U * (eUI * qi - 
-                        SVDPP_LAM_P_U * userFacMat.col(user));
-                
-                // Ideally, for all j in N(u) (for each rating), we'd want
-                // to set:
-                //
-                // y_j <- y_j + SVDPP_GAMMA_Y_J * (e_{ui} |N(u)|^{-1/2} * q_i
-                //                                  - SVDPP_LAM_Y_J * y_j)
-                // 
-                // However, repeatedly changing all y_j for j in N(u) is
-                // very expensive. Instead, we just note that the term
-                // e_{ui} |N(u)|^{-1/2} * q_i is independent of j, and so
-                // we can actually update yMat's columns at the very end by
-                // adding the sum of all e_{ui} |N(u)|^{-1/2} * q_i. This
-                // is what sumErrNuNormQi is. Of course, we also need to
-                // modify the regularization constant on y_j since we're
-                // adding a much bigger quantity on each SGD update step.
-                //
-                // This is pretty hacky and not going to give an accurate
-                // result as per the gradient. But it's fast.
-                //
-                // For now, just update sumErrNuNormQi.
-                sumErrNuNormQi += eUI * nuNormFac * qi;
-                
-            }
+    auto epoch = [this, &shards]() -> size_t
+    {
+        RatingShard shard;
+        size_t numRatings = 0;
 
-            
-            // Go through each item in N[u] and update yMat for those
-            // columns. Don't update sumMovieWeights for this user yet;
-            // that'll happen on the next iteration.
-            for (vector<int>::size_type ind = 0; ind < nu.size(); ind++)
-            {
-                int j = nu[ind];
-                yMat.col(j) += SVDPP_GAMMA_Y_J * (sumErrNuNormQi -
-                                                SVDPP_LAM_Y_J * yMat.col(j));
-            }
+        shards.rewind();
+        while (shards.next(shard))
+        {
+            trainUsers(RatingView(shard.ratings), NULL, shard.firstUser,
+                       shard.endUser);
+            numRatings += shard.ratings.n_cols;
+        }
 
-#if 0
-            if (user % 10000 == 0)
-            {
-                cout << "Finished processing user #" << user << "." 
-                     << endl;
-            }
+#ifndef NDEBUG
+        cout << "Waited " << shards.secondsWaited() << " seconds for "
+             << "shards to be read" << endl;
 #endif
-        }
+
+        return numRatings;
+    };
+
+    trainIterations(epoch);
+}
+
+
+/**
+ * Runs the remaining iterations of stochastic gradient descent (from
+ * iterationsDone up to numIterations), saving snapshots along the way if
+ * requested, and scoring the probe set in the background. Training stops
+ * early, at its best epoch, if asked to (see setEarlyStopping()). See
+ * train() for the details.
+ *
+ * @param epoch:    Makes one pass over every user's training ratings (by
+ *                  calling trainUsers() on all of them, in order), and
+ *                  returns the number of ratings it trained on.
+ *
+ */
+void SVDPP::trainIterations(const function<size_t()> &epoch)
+{
+    ProbeValidator validator("SVD++");
+    validator.setPatience(earlyStoppingPatience);
+    if (earlyStoppingPatience > 0)
+    {
+        validator.keepBest(fileNameBestCheckpoint);
+    }
+
+    // Iterate for the specified number of iterations.
+    for(int iterCount = iterationsDone; iterCount < numIterations;
+        iterCount++)
+    {
+        telemetry::Epoch record("SVD++", iterCount + 1);
+        record.learningRate("gamma_b_u", SVDPP_GAMMA_B_U);
+        record.learningRate("gamma_b_i", SVDPP_GAMMA_B_I);
+        record.learningRate("gamma_q_i", SVDPP_GAMMA_Q_I);
+        record.learningRate("gamma_p_u", SVDPP_GAMMA_P_U);
+        record.learningRate("gamma_y_j", SVDPP_GAMMA_Y_J);
+
+        // One pass over the training data.
+        record.ratings.add(epoch());
 
         // At the end of each iteration, decrease the gammas by the
         // constant factor declared in the header file.
@@ -600,22 +767,78 @@ void SVDPP::train(const fmat &data)
         SVDPP_GAMMA_Q_I *= SVDPP_GAMMA_MULT_PER_ITER;
         SVDPP_GAMMA_P_U *= SVDPP_GAMMA_MULT_PER_ITER; 
         SVDPP_GAMMA_Y_J *= SVDPP_GAMMA_MULT_PER_ITER;
+        iterationsDone = iterCount + 1;
 
+        // Snapshot our progress if it's time to. Only the copy of the
+        // parameters holds up training; they're written in the background.
+        if (iterCheckpointInterval > 0
+            && iterationsDone % iterCheckpointInterval == 0
+            && iterationsDone < numIterations)
+        {
+            record.phase("snapshot");
+            CheckpointWriter writer("SVDPP");
+            addCheckpointSections(writer);
+            iterCheckpointWriter.write(std::move(writer),
+                                       fileNameIterCheckpoint);
+        }
 
-#ifndef NDEBUG
-        end = system_clock::now();
-        minutes_elapsed = end - start;
-        cout << "\nFinished iteration " << (iterCount + 1) << " of SVD++ "
-             << "in " << minutes_elapsed.count() << " minutes" << endl;
+        // Hand the probe set's share of the parameters to the validator,
+        // which scores it while the next epoch trains. Predictions need
+        // sumMovieWeights to be current and the user terms frozen. Both
+        // are rebuilt from the parameters, so this doesn't change the
+        // course of training.
+        if (record.probeDue() && validator.enabled())
+        {
+            record.phase("probe");
+            updateSumMovieWeights(0, numUsers);
+            freeze();
+            std::unique_ptr<ProbeSnapshot> snapshot(
+                new FactorSnapshot(*this, ProbeSet::resident()));
+
+            if (earlyStoppingPatience > 0)
+            {
+                CheckpointWriter writer("SVDPP");
+                addCheckpointSections(writer);
+                validator.submit(iterationsDone, std::move(snapshot),
+                                 &writer);
+            }
+            else
+            {
+                validator.submit(iterationsDone, std::move(snapshot));
+            }
+        }
+
+        record.finish();
+
+        if (validator.shouldStop())
+        {
+            break;
+        }
+    }
+
+    // Wait for the last probe RMSE, and roll back to the best epoch if
+    // early stopping is on and we've gone past it.
+    validator.wait();
+
+    if (earlyStoppingPatience > 0 && validator.bestEpoch() > 0
+        && validator.bestEpoch() != iterationsDone)
+    {
+        checkpoint.open(fileNameBestCheckpoint, "SVDPP");
+        loadCheckpointSections();
 
-        float probeRMSE = computeRMSE(PROBE_BIN);
-        cout << "Probe RMSE: " << probeRMSE << endl;
+#ifndef NDEBUG
+        cout << "Rolled SVD++ back to iteration " << iterationsDone
+             << " (probe RMSE " << validator.bestRMSE() << ")" << endl;
 #endif
     }
 
     // Update sumMovieWeights for the last time, so that the data used by
     // predict() (and the data cached to file) is accurate!
     updateSumMovieWeights(0, numUsers);
+    freeze();
+
+    // Make sure the last snapshot made it to disk.
+    iterCheckpointWriter.wait();
 
     trained = true;
 
@@ -626,113 +849,359 @@ void SVDPP::train(const fmat &data)
 
 
 /**
+ * Carries out one pass of stochastic gradient descent over the ratings of
+ * the users in [firstUser, endUser). See train() for the details.
  *
- * TODO: remove this later!
- *
- * Compute the RMSE of this algorithm on a certain set of data. Note that
- * testFileName must refer to an **Armadillo binary** in this case. This
- * binary must represent a 4 x N matrix, where N is the number of test
- * points.
+ * @param data:         The ratings of exactly those users, sorted by user.
+ * @param ratings:      The i-th rating of data is ratings[i] (e.g. a
+ *                      residual), or its own if ratings is NULL.
+ * @param firstUser:    The first user to train on.
+ * @param endUser:      One past the last user to train on.
  *
  */
-float SVDPP::computeRMSE(const string &testFileName)
+void SVDPP::trainUsers(const RatingView &data, const float *ratings,
+                       int firstUser, int endUser)
 {
-    // Load from binary.
-    fmat testSet;
-    testSet.load(testFileName, arma_binary);
+    RatingCursor cursor(data);
 
-    // The test set should have four rows.
-    if (testSet.n_rows != 4)
+    // The rating number that we're looking at right now (i.e. the
+    // column in our training set).
+    size_t ratingNum = 0;
+    
+    // Iterate through the users in the range. We're assuming that the data
+    // is sorted (column-wise) by user ID!
+    for (int user = firstUser; user < endUser; user++)
     {
-        throw invalid_argument("File " + testFileName + " did not "
-                               + "have four rows!");
+        // Update sumMovieWeights for this user.
+        updateUserSumMovieWeights(user);
+
+        // Check N(u) to see if this user has implicit feedback data.
+        vector<int> nu = N[user];
+        int nuSize = nu.size();
+        
+        if (nuSize == 0)
+        {
+            // If they don't, ignore them. After all, we're not gonna
+            // predict anything for them anyways.
+            continue;
+        }
+        
+        // Norm factor put in front of userSumMovieWeights, etc.
+        float nuNormFac = 1.0/sqrt((float) nu.size());
+        
+        // Find the number of items rated by this user in the training
+        // set, so we know how many entries to parse.
+        int numItemsUserTrainSet = numItemsTrainingSet[user];
+
+        // The value of sum_{j in N(u)} y_j for this user.
+        fcolvec userSumMovieWeights(sumMovieWeights.col(user));
+        
+        // The sum of all values of e_{ui} |N(u)|^{-1/2} * q_i over all
+        // items watched by this user. This is used to update yMat via
+        // gradient descent at the very end.
+        fcolvec sumErrNuNormQi = zeros<fcolvec>(numFactors);
+        
+        // Increment ratingNum as we iterate over items rated by the
+        // user.
+        for(int itemNum = 0; itemNum < numItemsUserTrainSet; itemNum++,
+                                                             ratingNum++)
+        {
+            const float *rating = cursor.next();
+            int item = itemMap.internal(roundToInt(rating[MOVIE_ROW]));
+            float actualRating = ratings != NULL ? ratings[ratingNum]
+                                                 : rating[RATING_ROW];
+            
+            // Get the predicted rating for this user and item, using the
+            // aforementioned formula for rHat_{ui}.
+            float predictedRating = meanRating + bUser(user) + bItem(item);
+            
+            // Compute the factorized term (i.e. q_i^T * (p_u + ...)).
+            // First find p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j, the
+            // "userFactorTerm". Start off by making a copy of
+            // p_u.
+            fcolvec userFactorTerm(userFacMat.col(user));
+
+            // sumMovieWeights should already have sum_{j in N(u)} y_j
+            // cached (from the previous iteration), so use that old
+            // value.
+            userFactorTerm += userSumMovieWeights * nuNormFac;
+            
+            // Add the factorized term (q_i^T * userFactorTerm) to the
+            // prediction.
+            fcolvec qi(itemFacMat.col(item));
+            predictedRating += dot(qi, userFactorTerm);
+
+            // Apply gradient descent on all of the free parameters in our
+            // algorithm EXCEPT FOR yMat (which only needs to be updated at
+            // the end for this user). This just involves subtracting off
+            // the gradient of the error metric (which we're trying to
+            // minimize) with respect to each free parameter. Note that
+            // factors of 2 have been absorbed into the "gamma" step
+            // sizes.
+            
+            // The error in our prediction for this user and item.
+            float eUI = actualRating - predictedRating;
+
+            // b_u <- b_u + gamma_b_u * (e_{ui} - SVDPP_LAM_B_U * b_u)
+            bUser(user) += SVDPP_GAMMA_B_U * (eUI - SVDPP_LAM_B_U *
+                                                  bUser(user));
+            
+            // b_i <- b_i + gamma_b_i * (e_{ui} - SVDPP_LAM_B_I * b_i)
+            bItem(item) += SVDPP_GAMMA_B_I * (eUI - SVDPP_LAM_B_I *
+                                                    bItem(item));
+
+            // q_i <- q_i + gamma_2 * (e_{ui} * (p_u + |N(u)|^{-1/2} *
+            //                                   sum_{j in N(u)} y_j)
+            //                         - SVDPP_LAM_Q_I * q_i)
+            itemFacMat.col(item) += SVDPP_GAMMA_Q_I * (eUI * 
+                    userFactorTerm - SVDPP_LAM_Q_I * qi);
+            
+            // p_u <- p_u + gamma_2 * (e_{ui} * q_i - SVDPP_LAM_P_U * 
+            //                                        p_u)
+            userFacMat.col(user) += SVDPP_GAMMA_P_U * (eUI * qi - 
+                    SVDPP_LAM_P_U * userFacMat.col(user));
+            
+            // Ideally, for all j in N(u) (for each rating), we'd want
+            // to set:
+            //
+            // y_j <- y_j + SVDPP_GAMMA_Y_J * (e_{ui} |N(u)|^{-1/2} * q_i
+            //                                  - SVDPP_LAM_Y_J * y_j)
+            // 
+            // However, repeatedly changing all y_j for j in N(u) is
+            // very expensive. Instead, we just note that the term
+            // e_{ui} |N(u)|^{-1/2} * q_i is independent of j, and so
+            // we can actually update yMat's columns at the very end by
+            // adding the sum of all e_{ui} |N(u)|^{-1/2} * q_i. This
+            // is what sumErrNuNormQi is. Of course, we also need to
+            // modify the regularization constant on y_j since we're
+            // adding a much bigger quantity on each SGD update step.
+            //
+            // This is pretty hacky and not going to give an accurate
+            // result as per the gradient. But it's fast.
+            //
+            // For now, just update sumErrNuNormQi.
+            sumErrNuNormQi += eUI * nuNormFac * qi;
+            
+        }
+
+        
+        // Go through each item in N[u] and update yMat for those
+        // columns. Don't update sumMovieWeights for this user yet;
+        // that'll happen on the next iteration.
+        for (vector<int>::size_type ind = 0; ind < nu.size(); ind++)
+        {
+            int j = nu[ind];
+            yMat.col(j) += SVDPP_GAMMA_Y_J * (sumErrNuNormQi -
+                                            SVDPP_LAM_Y_J * yMat.col(j));
+        }
+
+#if 0
+        if (user % 10000 == 0)
+        {
+            cout << "Finished processing user #" << user << "." 
+                 << endl;
+        }
+#endif
     }
+}
 
-    // The number we divide by in computing the RMSE.
-    int nMinusOne = testSet.n_cols - 1;
 
-    // Accumulator for RMSE (take square root at the end)
-    float rmse = 0.0;
+/**
+ * Materializes the per-user state that predict() reads: each user's
+ * effective factor vector p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j, and
+ * their bias mu + b_u. Doing this once means every prediction is a single
+ * dot product plus two bias lookups, instead of rebuilding the user's term
+ * (and looking up |N(u)|) each time.
+ *
+ * train() and the caching constructor call this; it only has to be called
+ * again if the parameters are changed some other way.
+ *
+ */
+void SVDPP::freeze()
+{
+    userFactorTerms.set_size(numFactors, numUsers);
+    userBiasTerms.set_size(numUsers);
 
-    for (unsigned int i = 0; i < testSet.n_cols; i ++)
+    #pragma omp parallel for schedule(static)
+    for (int user = 0; user < numUsers; user++)
     {
-        int user = roundToInt(testSet(USER_ROW, i));
-        int item = roundToInt(testSet(MOVIE_ROW, i));
-        int date = roundToInt(testSet(DATE_ROW, i));
-        float actualRating = testSet(RATING_ROW, i);
-        
-        float prediction = predict(user, item, date, true);
-        
-        rmse += pow(actualRating - prediction, 2.0)/nMinusOne;
+        float *userFactorTerm = userFactorTerms.colptr(user);
+
+        std::copy(userFacMat.colptr(user),
+                  userFacMat.colptr(user) + numFactors, userFactorTerm);
+        simd::axpy(nuNormFactor(user), sumMovieWeights.colptr(user),
+                   userFactorTerm, numFactors);
+
+        userBiasTerms(user) = meanRating + bUser(user);
     }
 
-    return sqrt(rmse);
+    frozen = true;
 }
 
 
-
 /** 
  * This function predicts a rating for a given user and item. If the SVDPP
- * has not been trained yet, a logic_error is thrown.
+ * has not been frozen yet (see freeze()), a logic_error is thrown.
  *
  * @param user: the user ID of interest.
  * @param item: the item ID of interest.
  * @param date: the date ID of interest (not used in SVD++).
  *
- * @return A prediction of the user's rating for the given item. This will
- *         always end up being between MIN_RATING and MAX_RATING.
- *
- * Precondition: It is assumed that sumMovieWeights has been accurately set
- * after training!
+ * @return A prediction of the user's rating for the given item. If bound
+ *         is set, this will always end up being between MIN_RATING and
+ *         MAX_RATING.
  *
  */
 float SVDPP::predict(int user, int item, int date, bool bound)
 {
-    /*if (!trained)
+    if (!frozen)
     {
         throw logic_error("Tried to predict a rating but the SVD++ "
-                          "algorithm was not done training!");
-    }*/
+                          "algorithm was not frozen after training!");
+    }
 
     // The formula for the predicted rating for user u and item i is:
     //
     //      rHat_{ui} = mu + b_u + b_i + 
     //                  q_i^T * (p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j)
     //
-    // Where we use the same naming convention as in the Koren paper.
-    
-    float predictedRating = meanRating + bUser(user) + bItem(item);
-
-    // Compute the factorized term (i.e. q_i^T * (p_u + ...)).
-    // First find p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j, the
-    // "userFactorTerm".
-    fcolvec userFactorTerm(userFacMat.col(user)); // p_u
-    
-    vector<int> nu = N[user];
-    float nuNormFac = 1.0/sqrt(nu.size());
-
-    // Get sum_{j in N(u)} y_j and multiply by nuNormFac.
-    userFactorTerm += sumMovieWeights.col(user) * nuNormFac;
-
-    // Add the factorized term (q_i^T * userFactorTerm) to the prediction.
-    fcolvec qi(itemFacMat.col(item));
-    predictedRating += dot(qi, userFactorTerm);
+    // Where we use the same naming convention as in the Koren paper. Both
+    // user terms were materialized by freeze().
+    item = itemMap.internal(item);
+    float predictedRating = userBiasTerms(user) + bItem(item) +
+        simd::dot(itemFacMat.colptr(item), userFactorTerms.colptr(user),
+                  numFactors);
 
     if (bound)
     {
         // Put the rating between MIN_RATING and MAX_RATING! Otherwise, the
         // error will be bad.
-        if (predictedRating < MIN_RATING)
-        {
-            predictedRating = (float) MIN_RATING;
-        }
-        else if (predictedRating > MAX_RATING)
+        predictedRating = std::min(std::max(predictedRating,
+            (float) MIN_RATING), (float) MAX_RATING);
+    }
+
+    return predictedRating;
+}
+
+
+/**
+ * Returns |N(u)|^{-1/2} for the given user, or zero if the user has no
+ * implicit preferences (in which case sum_{j in N(u)} y_j is zero too).
+ * This only reads N, so it is safe to call from several threads.
+ *
+ * @param user: the user ID of interest.
+ *
+ */
+float SVDPP::nuNormFactor(int user) const
+{
+    unordered_map<int, vector<int> >::const_iterator nu = N.find(user);
+
+    if (nu == N.end() || nu->second.empty())
+    {
+        return 0.0;
+    }
+
+    return 1.0 / sqrt(nu->second.size());
+}
+
+
+/**
+ * Predicts a batch (see BaseAlgorithm::predictBatch), after checking that
+ * freeze() has been called. The check can't be made in predictRange(),
+ * which runs on OpenMP threads.
+ *
+ */
+void SVDPP::predictBatch(const int *users, const int *items,
+                         const int *dates, float *output, size_t n,
+                         bool bound)
+{
+    if (!frozen)
+    {
+        throw logic_error("Tried to predict a rating but the SVD++ "
+                          "algorithm was not frozen after training!");
+    }
+
+    BaseAlgorithm::predictBatch(users, items, dates, output, n, bound);
+}
+
+
+/**
+ * Predicts one chunk of a batch (see BaseAlgorithm::predictBatch). With the
+ * user terms materialized by freeze(), each prediction is a single dot
+ * product against the item's factors.
+ *
+ */
+void SVDPP::predictRange(const int *users, const int *items,
+                         const int * /* dates */, float *output,
+                         size_t n, bool bound)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        int user = users[i];
+        int item = itemMap.internal(items[i]);
+
+        float predictedRating = userBiasTerms(user) + bItem(item) +
+            simd::dot(itemFacMat.colptr(item), userFactorTerms.colptr(user),
+                      numFactors);
+
+        if (bound)
         {
-            predictedRating = (float) MAX_RATING;
+            predictedRating = std::min(std::max(predictedRating,
+                (float) MIN_RATING), (float) MAX_RATING);
         }
+
+        output[i] = predictedRating;
     }
+}
 
-    return predictedRating;
+
+/**
+ * FactorModel: queries are ready once the model has been frozen (see
+ * freeze()).
+ */
+bool SVDPP::readyForQueries() const
+{
+    return frozen;
+}
+
+
+/**
+ * FactorModel: the item factors q_i, in internal item order.
+ */
+const fmat &SVDPP::itemFactors() const
+{
+    return itemFacMat;
+}
+
+
+/**
+ * FactorModel: the item biases b_i.
+ */
+const fcolvec &SVDPP::itemBiases() const
+{
+    return bItem;
+}
+
+
+/**
+ * FactorModel: how items map to columns of itemFactors().
+ */
+const IdMap &SVDPP::itemIds() const
+{
+    return itemMap;
+}
+
+
+/**
+ * FactorModel: writes the user's effective factor vector
+ * (p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j) to factors, and returns
+ * mu + b_u.
+ */
+float SVDPP::userQuery(int user, float *factors) const
+{
+    std::copy(userFactorTerms.colptr(user),
+              userFactorTerms.colptr(user) + numFactors, factors);
+    return userBiasTerms(user);
 }
 
 
@@ -29,12 +29,17 @@
 
 #include <netflix.hh>
 #include <basealgorithm.hh>
+#include <checkpoint.hh>
+#include <factormodel.hh>
+#include <idmap.hh>
+#include <shardsource.hh>
+#include <simd.hh>
 
 using namespace std;
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
 
-class SVDPP : public BaseAlgorithm
+class SVDPP : public BaseAlgorithm, public FactorModel
 {
 private:
     // Regularization constants for each internal variable. See the train()
@@ -52,11 +57,19 @@ private:
     // method for more on which parameters these apply to. These came from
     // a combination of the Koren paper, the abovementioned forum link, and
     // other tweaks.
-    float SVDPP_GAMMA_B_I = 0.007;
-    float SVDPP_GAMMA_B_U = 0.007;
-    float SVDPP_GAMMA_Q_I = 0.007;
-    float SVDPP_GAMMA_P_U = 0.007;
-    float SVDPP_GAMMA_Y_J = 0.007;
+    static constexpr float SVDPP_GAMMA_B_I_INIT = 0.007;
+    static constexpr float SVDPP_GAMMA_B_U_INIT = 0.007;
+    static constexpr float SVDPP_GAMMA_Q_I_INIT = 0.007;
+    static constexpr float SVDPP_GAMMA_P_U_INIT = 0.007;
+    static constexpr float SVDPP_GAMMA_Y_J_INIT = 0.007;
+
+    // The current step sizes. These start out at the values above, and
+    // decay after every iteration.
+    float SVDPP_GAMMA_B_I = SVDPP_GAMMA_B_I_INIT;
+    float SVDPP_GAMMA_B_U = SVDPP_GAMMA_B_U_INIT;
+    float SVDPP_GAMMA_Q_I = SVDPP_GAMMA_Q_I_INIT;
+    float SVDPP_GAMMA_P_U = SVDPP_GAMMA_P_U_INIT;
+    float SVDPP_GAMMA_Y_J = SVDPP_GAMMA_Y_J_INIT;
 
     // The fraction by which the step sizes will be multiplied on each
     // iteration (as recommended in the Koren paper).
@@ -82,6 +95,10 @@ private:
     // paper.
     unordered_map<int, vector<int> > N;
 
+    // The checkpoint that the matrices below are mapped from, when using
+    // cached data. It must outlive them, so it is declared first.
+    Checkpoint checkpoint;
+
     // The bias for each user. Referred to as "b_u" in the Koren paper. The
     // uth element in this is the bias for user u.
     fcolvec bUser;
@@ -117,18 +134,66 @@ private:
     // preferences in N(u)).
     fmat yMat;
 
+    // The state predict() reads, materialized by freeze(). The uth column
+    // of userFactorTerms is p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j, and
+    // the uth element of userBiasTerms is mu + b_u, so a prediction is
+    // just userBiasTerms(u) + b_i + q_i^T * userFactorTerms.col(u).
+    fmat userFactorTerms;
+    fcolvec userBiasTerms;
+
+    // Whether the state above reflects the current parameters.
+    bool frozen = false;
+
+    // Whether train() renumbers items by popularity, and the numbering in
+    // use (see idmap.hh). bItem, itemFacMat, yMat and N are indexed by
+    // internal IDs; every other item ID is an original one.
+    bool renumberItems = false;
+    IdMap itemMap;
+
     // Whether the algorithm has been trained yet or not.
     bool trained = false;
 
     // Whether we're using cached data or not.
     bool usingCachedData = false;
 
+    // The number of training iterations completed so far.
+    int iterationsDone = 0;
+
+    // Where, and every how many iterations, training saves a snapshot of
+    // its progress. An interval of 0 means no snapshots are saved.
+    string fileNameIterCheckpoint;
+    int iterCheckpointInterval = 0;
+    BackgroundCheckpointWriter iterCheckpointWriter;
+
+    // After how many probe scores without an improvement training stops (0
+    // never stops early), and the checkpoint file it rolls back through.
+    int earlyStoppingPatience = 0;
+    string fileNameBestCheckpoint;
+
     void initInternalData();
     void populateN(const string &fileNameN);
-    void populateNumItemsTrainingSet(const fmat &data);
+    void setItemMap(IdMap &&map);
+    void populateNumItemsTrainingSet(const RatingView &data);
+    void train(const RatingView &data, const float *ratings);
+    void trainIterations(const function<size_t()> &epoch);
+    void trainUsers(const RatingView &data, const float *ratings,
+                    int firstUser, int endUser);
+    void addCheckpointSections(CheckpointWriter &writer) const;
+    void loadCheckpointSections();
     void updateSumMovieWeights(int lowUserNum, int highUserNum);
     inline void updateUserSumMovieWeights(int user);
-    float computeRMSE(const string &testFileName);
+    float nuNormFactor(int user) const;
+
+protected:
+    void idBounds(int &users, int &items, int &dates) const
+    {
+        users = numUsers;
+        items = numItems;
+        dates = INT_MAX;
+    }
+
+    void predictRange(const int *users, const int *items, const int *dates,
+                      float *output, size_t n, bool bound);
 
 public:
     SVDPP(int numUsers, int numItems, float meanRating, int numFactors,
@@ -136,31 +201,48 @@ public:
 
     SVDPP(int numUsers, int numItems, float meanRating, int numFactors,
           int numIterations, const string &fileNameN,
-          const string &fileNameBUser, const string &fileNameBItem,
-          const string &fileNameUserFacMat,
-          const string &fileNameItemFacMat, const string &fileNameYMat,
-          const string &fileNameSumMovieWeights);
+          const string &fileNameCheckpoint);
      
     ~SVDPP();
     
     void train(const fmat &data);
 
-    void trainAndCache(const fmat &data, const string &fileNameBUser,
-                       const string &fileNameBItem,
-                       const string &fileNameUserFacMat,
-                       const string &fileNameItemFacMat,
-                       const string &fileNameYMat,
-                       const string &fileNameSumMovieWeights);
+    void train(const RatingView &view);
+
+    void trainWithRatings(const RatingView &data, const float *ratings);
+
+    void trainStreaming(ShardSource &shards);
+
+    void trainAndCache(const RatingView &data,
+                       const string &fileNameCheckpoint);
     
     void trainAndCache(const string &fileNameData,
-                       const string &fileNameBUser,
-                       const string &fileNameBItem,
-                       const string &fileNameUserFacMat,
-                       const string &fileNameItemFacMat,
-                       const string &fileNameYMat,
-                       const string &fileNameSumMovieWeights); 
+                       const string &fileNameCheckpoint);
+
+    void saveCheckpoint(const string &fileNameCheckpoint) const;
+
+    void setIterationCheckpoints(const string &fileNameCheckpoint,
+                                 int interval);
+
+    void setEarlyStopping(int patience, const string &fileNameCheckpoint);
+
+    void resumeTraining(const RatingView &data,
+                        const string &fileNameCheckpoint);
+
+    void setItemRenumbering(bool enabled);
     
+    void freeze();
+
     float predict(int user, int item, int date, bool bound);
+
+    bool readyForQueries() const;
+    const fmat &itemFactors() const;
+    const fcolvec &itemBiases() const;
+    const IdMap &itemIds() const;
+    float userQuery(int user, float *factors) const;
+
+    void predictBatch(const int *users, const int *items, const int *dates,
+                      float *output, size_t n, bool bound);
 };
 
 #endif // SVDPP_HH
@@ -17,6 +17,8 @@
 #include <vector>
 
 #include <netflix.hh>
+#include <ratingstore.hh>
+#include <shardsource.hh>
 #include <svdpp.hh>
 
 using namespace std;
@@ -26,8 +28,8 @@ using namespace netflix; // challenge-related constants/functions.
 
 /* Constants */
 
-// The Armadillo binary file to use for training.
-const string SVDPP_TRAIN_FILE = BASE_HIDDEN_VALID_BIN;
+// The sets to train on (views of the rating store).
+const set<int> SVDPP_TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
 
 // The number of factors to use for SVD++.
 const int NUM_FACTORS = 200;
@@ -44,17 +46,21 @@ const int RATING_SIG_FIGS = 4;
 // Whether the data will be cached after training.
 const bool WILL_CACHE_DATA = true;
 
+// Whether to renumber movies by popularity before training (see idmap.hh).
+// The numbering is cached with the model.
+const bool RENUMBER_ITEMS = true;
+
+// Whether to train on the training sets a shard at a time, from the shards
+// at RATING_SHARDS (see shardsource.hh), rather than on all of them at
+// once. Run shard_ratings to create the shards first.
+const bool STREAM_SHARDS = false;
+
 // Whether we're using cached data **instead of** training.
 const bool USING_CACHED_DATA = false;
 
-// The locations of the files we'll use for caching (and read from if we're
-// using cached data). These must be in Armadillo binary format!
-const string B_USER_FN =            "data/svdpp_cached/b_user.mat";
-const string B_ITEM_FN =            "data/svdpp_cached/b_item.mat";
-const string USER_FAC_MAT_FN =      "data/svdpp_cached/user_fac.mat";
-const string ITEM_FAC_MAT_FN =      "data/svdpp_cached/item_fac.mat";
-const string Y_MAT_FN =             "data/svdpp_cached/y.mat";
-const string SUM_MOVIE_WEIGHTS_FN = "data/svdpp_cached/user_sum_y.mat";
+// The checkpoint we'll cache the trained model in (and read from if we're
+// using cached data).
+const string CHECKPOINT_FN = "data/svdpp_cached/svdpp.ckpt";
 
 
 // Helper function that carries out "predAlgo" on the test file specified
@@ -77,48 +83,67 @@ int main(void)
                           "data\" flag if you're using cached data!");
     }
     
+    // Map the rating store. Models are sized from its dimensions.
+    RatingStore ratings(RATINGS_STORE);
+
     // If we've cached the matrices produced by SVD++, use those to skip
     // the training step.
     if (USING_CACHED_DATA)
     {
-        // Construct an SVDPP object and pass in the cached data file
-        // names.
-        SVDPP predAlgo(NUM_USERS, NUM_MOVIES, MEAN_RATING_TRAINING_SET,
-                       NUM_FACTORS, NUM_ITERATIONS, N_FN,
-                       B_USER_FN, B_ITEM_FN, USER_FAC_MAT_FN,
-                       ITEM_FAC_MAT_FN, Y_MAT_FN, SUM_MOVIE_WEIGHTS_FN);
+        // Construct an SVDPP object and pass in the cached checkpoint.
+        SVDPP predAlgo(ratings.numUsers(), ratings.numItems(),
+                       MEAN_RATING_TRAINING_SET, NUM_FACTORS, NUM_ITERATIONS,
+                       N_FN, CHECKPOINT_FN);
         
         // Go through qual.dta and produce a prediction file.
         testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
     }
     else // If not using cached data, we need to train.
     {
-        // Load from binary.
-        fmat trainingSet;
-        trainingSet.load(SVDPP_TRAIN_FILE, arma_binary);
-        
-        SVDPP predAlgo(NUM_USERS, NUM_MOVIES, MEAN_RATING_TRAINING_SET,
-                       NUM_FACTORS, NUM_ITERATIONS, N_FN);
-        
-        // Check if we want to cache.
-        if (WILL_CACHE_DATA)
+        SVDPP predAlgo(ratings.numUsers(), ratings.numItems(),
+                       MEAN_RATING_TRAINING_SET, NUM_FACTORS, NUM_ITERATIONS,
+                       N_FN);
+        predAlgo.setItemRenumbering(RENUMBER_ITEMS);
+
+        if (STREAM_SHARDS)
         {
-            // If so, train and then cache the results after training.
-            cout << "\nTraining SVD++. The resulting matrices will be "
-                    "cached." << endl;
-            
-            predAlgo.trainAndCache(trainingSet, B_USER_FN, B_ITEM_FN,
-                                   USER_FAC_MAT_FN, ITEM_FAC_MAT_FN,
-                                   Y_MAT_FN, SUM_MOVIE_WEIGHTS_FN);
+            // Read the training set a shard at a time (see shardsource.hh)
+            // instead of holding all of it in memory.
+            cout << "\nTraining SVD++ on the shards at " << RATING_SHARDS
+                 << "." << endl;
+
+            ShardSource shards(RATING_SHARDS, SVDPP_TRAIN_SETS);
+            predAlgo.trainStreaming(shards);
+
+            if (WILL_CACHE_DATA)
+            {
+                predAlgo.saveCheckpoint(CHECKPOINT_FN);
+            }
         }
         else
         {
-            // If not, just train.
-            cout << "\nTraining SVD++. The resulting matrices won't be "
-                    "cached." << endl;
-            predAlgo.train(trainingSet);
-        }        
-        
+            // The training set is a view of the rating store (and isn't
+            // copied if it's all of the training data).
+            RatingView trainingSet = ratings.view(SVDPP_TRAIN_SETS);
+
+            // Check if we want to cache.
+            if (WILL_CACHE_DATA)
+            {
+                // If so, train and then cache the results after training.
+                cout << "\nTraining SVD++. The resulting matrices will be "
+                        "cached." << endl;
+            
+                predAlgo.trainAndCache(trainingSet, CHECKPOINT_FN);
+            }
+            else
+            {
+                // If not, just train.
+                cout << "\nTraining SVD++. The resulting matrices won't be "
+                        "cached." << endl;
+                predAlgo.train(trainingSet);
+            }
+        }
+
         // Go through qual.dta to produce a prediction file.
         testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
     }
@@ -170,52 +195,21 @@ void shuffleVector(vector<int> &data, int numRows, int numCols)
 void testOnDataFile(SVDPP &predAlgo, const string &testFileName,
                     const string &outputFileName)
 {
-    ifstream qualDataFile(testFileName);
-    ofstream outputFile(outputFileName); 
-    
-    if (qualDataFile.fail())
-    {
-        throw runtime_error("Couldn't find test file at " + testFileName);
-    }
-
-    if (outputFile.fail())
-    {
-        throw runtime_error("Couldn't open output file at " 
-                            + outputFileName);
-    }
-
-    string qualDataLine;
-    
     cout << "\nTesting on data in " << testFileName << "..." << endl;
 
-    while (getline(qualDataFile, qualDataLine))
-    {
-        // Read the line and split it.
-        vector<int> thisLineVec;
-        splitIntoInts(qualDataLine, DELIMITER,
-                      thisLineVec);
+    // Load the (cached) binary index of the test file and predict it in
+    // one batch.
+    Mat<int> testIndex = loadQualIndex(testFileName);
+    vector<float> predictions(testIndex.n_rows);
+    predAlgo.predictBatch(testIndex.colptr(USER_ROW),
+                          testIndex.colptr(MOVIE_ROW),
+                          testIndex.colptr(DATE_ROW),
+                          predictions.data(), testIndex.n_rows, true);
+
+    // Output the predictions to file.
+    writePredictions(outputFileName, predictions.data(), predictions.size(),
+                     RATING_SIG_FIGS);
 
-        if (thisLineVec.size() != 3)
-        {
-            throw logic_error("The line \"" + qualDataLine + "\" did not "
-                              "contain three delimiter-separated "
-                              "entries!");
-        }
-        
-        // The first entry is the user ID, the second entry is the item ID,
-        // and the third entry is the date. All of these should be
-        // zero-indexed!
-        int user = thisLineVec[0];
-        int item = thisLineVec[1];
-        int date = thisLineVec[2];
-        
-        // Output the prediction to file.
-        float prediction = predAlgo.predict(user, item, date, true);
-        outputFile << setprecision(RATING_SIG_FIGS) << prediction << endl;
-    }
-    
-    outputFile.close();
-    
     cout << "\nOutputted predictions on " << testFileName << " to the " 
         "output file " << outputFileName << endl;
 }
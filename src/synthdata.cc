@@ -0,0 +1,569 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#ifndef NDEBUG
+#include <iostream>
+#endif
+
+#include <netflix.hh>
+#include <ratingstore.hh>
+#include <synthdata.hh>
+
+using namespace netflix; // challenge-related constants/functions.
+
+// Users who rate more than this fraction of the movies pick them by
+// weighted sampling of all movies at once, rather than by drawing one at a
+// time and skipping repeats.
+static constexpr double HEAVY_USER_FRACTION = 0.125;
+
+// The sets a held out rating can go to, chosen uniformly: two fifths of
+// them go to qual, and a fifth each to probe, hidden and valid (roughly as
+// in the real data).
+static const uint8_t HELD_OUT_SETS[] = {QUAL_SET, QUAL_SET, PROBE_SET,
+                                        HIDDEN_SET, VALID_SET};
+
+// Salts that give each use of the seed its own stream.
+static constexpr uint64_t MOVIE_STREAM = 0;
+static constexpr uint64_t COUNT_STREAM = 1;
+static constexpr uint64_t USER_STREAM = 2;
+
+
+/**
+ * Mixes a seed, a salt and an index into the seed of an independent
+ * stream (the splitmix64 finalizer), so each user gets their own stream
+ * however the users are split between threads.
+ */
+static uint64_t streamSeed(uint64_t seed, uint64_t salt, uint64_t index)
+{
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL * (salt * 0x100000000ULL
+                                                  + index + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+/**
+ * Picks numPicks distinct movies, each with probability proportional to
+ * its weight, and returns them in ascending order.
+ *
+ * @param weights:      The weight of each movie.
+ * @param cumWeights:   The running sums of weights.
+ * @param numPicks:     The number of movies to pick.
+ * @param rng:          The user's random stream.
+ * @param taken:        Scratch space of one flag per movie, all clear.
+ *
+ */
+static std::vector<int> pickMovies(const std::vector<double> &weights,
+                                   const std::vector<double> &cumWeights,
+                                   int numPicks, std::mt19937_64 &rng,
+                                   std::vector<uint8_t> &taken)
+{
+    const int numMovies = weights.size();
+    std::vector<int> movies;
+    movies.reserve(numPicks);
+
+    if (numPicks > HEAVY_USER_FRACTION * numMovies)
+    {
+        // Weighted sampling without replacement (Efraimidis and Spirakis):
+        // the picks are the movies with the largest log(U) / weight.
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::vector<std::pair<double, int> > keys(numMovies);
+        for (int movie = 0; movie < numMovies; movie++)
+        {
+            keys[movie] = std::make_pair(
+                std::log(1.0 - uniform(rng)) / weights[movie], movie);
+        }
+
+        std::nth_element(keys.begin(), keys.begin() + numPicks, keys.end(),
+                         std::greater<std::pair<double, int> >());
+        for (int i = 0; i < numPicks; i++)
+        {
+            movies.push_back(keys[i].second);
+        }
+    }
+    else
+    {
+        std::uniform_real_distribution<double> uniform(0.0,
+                                                       cumWeights.back());
+        while ((int) movies.size() < numPicks)
+        {
+            int movie = std::upper_bound(cumWeights.begin(),
+                                         cumWeights.end(), uniform(rng))
+                        - cumWeights.begin();
+            movie = std::min(movie, numMovies - 1);
+
+            if (!taken[movie])
+            {
+                taken[movie] = 1;
+                movies.push_back(movie);
+            }
+        }
+
+        for (int movie : movies)
+        {
+            taken[movie] = 0;
+        }
+    }
+
+    std::sort(movies.begin(), movies.end());
+    return movies;
+}
+
+
+/**
+ * Generates a synthetic dataset (see the top of synthdata.hh).
+ *
+ * @param config:   The size and shape of the data.
+ *
+ */
+SynthData generateSynthData(const SynthConfig &config)
+{
+    const int numUsers = config.numUsers;
+    const int numMovies = config.numMovies;
+    const int rank = config.rank;
+
+    if (numUsers < 1 || numMovies < 1 || config.numDates < 1 || rank < 1
+        || config.heldOutPerUser < 0)
+    {
+        throw std::invalid_argument("Synthetic data needs at least one "
+                                    "user, movie, date and factor!");
+    }
+
+    if (config.userSkew <= 0.0 || config.movieSkew < 0.0)
+    {
+        throw std::invalid_argument("Invalid synthetic data skew!");
+    }
+
+    // The standard deviation of each factor, so that q_i^T * p_u (a sum
+    // of rank products) has the requested spread.
+    const float factorStd = std::sqrt(config.signalStd / std::sqrt(rank));
+
+    // Movies: Zipf popularity over a random order, and the movies' half of
+    // the planted model.
+    std::mt19937_64 movieRng(streamSeed(config.seed, MOVIE_STREAM, 0));
+    std::vector<int> popularityRank(numMovies);
+    std::iota(popularityRank.begin(), popularityRank.end(), 1);
+    std::shuffle(popularityRank.begin(), popularityRank.end(), movieRng);
+
+    std::vector<double> movieWeights(numMovies), cumWeights(numMovies);
+    for (int movie = 0; movie < numMovies; movie++)
+    {
+        movieWeights[movie] = std::pow(popularityRank[movie],
+                                       -config.movieSkew);
+    }
+    std::partial_sum(movieWeights.begin(), movieWeights.end(),
+                     cumWeights.begin());
+
+    std::normal_distribution<float> movieBiasDist(0.0, config.movieBiasStd);
+    std::normal_distribution<float> factorDist(0.0, factorStd);
+    std::vector<float> movieBiases(numMovies);
+    std::vector<float> movieFactors((size_t) numMovies * rank);
+    for (int movie = 0; movie < numMovies; movie++)
+    {
+        movieBiases[movie] = movieBiasDist(movieRng);
+        for (int k = 0; k < rank; k++)
+        {
+            movieFactors[(size_t) movie * rank + k] = factorDist(movieRng);
+        }
+    }
+
+    // Users: Pareto activity, scaled so that the ratings (each user
+    // capped at every movie) add up to about numRatings.
+    std::vector<double> activity(numUsers);
+    #pragma omp parallel for schedule(static)
+    for (int user = 0; user < numUsers; user++)
+    {
+        std::mt19937_64 rng(streamSeed(config.seed, COUNT_STREAM, user));
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        activity[user] = std::pow(1.0 - uniform(rng), -1.0 / config.userSkew);
+    }
+
+    auto totalAt = [&activity, numMovies](double scale)
+    {
+        double total = 0.0;
+        for (double a : activity)
+        {
+            total += std::min((double) numMovies, std::max(1.0, scale * a));
+        }
+        return total;
+    };
+
+    double low = 0.0, high = 1.0;
+    while (totalAt(high) < config.numRatings && high < 1e30)
+    {
+        high *= 2.0;
+    }
+    for (int i = 0; i < 60; i++)
+    {
+        double mid = 0.5 * (low + high);
+        if (totalAt(mid) < config.numRatings)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    // Round each user's expected count up or down at random, so the total
+    // stays unbiased.
+    std::vector<size_t> firstRating(numUsers + 1, 0);
+    for (int user = 0; user < numUsers; user++)
+    {
+        double expected = std::min((double) numMovies,
+                                   std::max(1.0, high * activity[user]));
+        std::mt19937_64 rng(streamSeed(config.seed, COUNT_STREAM,
+                                       (uint64_t) numUsers + user));
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        size_t count = (size_t) expected
+                       + (uniform(rng) < expected - std::floor(expected));
+        firstRating[user + 1] = firstRating[user]
+                                + std::min(count, (size_t) numMovies);
+    }
+
+    SynthData data;
+    data.ratings.resize(firstRating[numUsers] * COLUMNS);
+    data.splits.resize(firstRating[numUsers]);
+
+    #pragma omp parallel
+    {
+        std::vector<uint8_t> taken(numMovies, 0);
+        std::vector<float> userFactors(rank);
+        std::vector<int> dates, byDate;
+
+        #pragma omp for schedule(dynamic, 256)
+        for (int user = 0; user < numUsers; user++)
+        {
+            std::mt19937_64 rng(streamSeed(config.seed, USER_STREAM, user));
+            const int count = firstRating[user + 1] - firstRating[user];
+            std::vector<int> movies = pickMovies(movieWeights, cumWeights,
+                                                 count, rng, taken);
+
+            std::normal_distribution<float> userBiasDist(
+                0.0, config.userBiasStd);
+            std::normal_distribution<float> userFactorDist(0.0, factorStd);
+            std::normal_distribution<float> noiseDist(0.0, config.noiseStd);
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+            float userBias = userBiasDist(rng);
+            for (int k = 0; k < rank; k++)
+            {
+                userFactors[k] = userFactorDist(rng);
+            }
+
+            // Users join more often later on (the density of first dates
+            // grows linearly), and stay for a random part of the rest.
+            const int lastDate = config.numDates - 1;
+            int firstDate = (int) (lastDate * std::sqrt(uniform(rng)));
+            int endDate = firstDate
+                          + (int) ((lastDate - firstDate) * uniform(rng));
+            std::uniform_int_distribution<int> dateDist(firstDate, endDate);
+
+            dates.resize(count);
+            for (int i = 0; i < count; i++)
+            {
+                dates[i] = dateDist(rng);
+            }
+
+            // Hold out the user's most recent ratings (see HELD_OUT_SETS).
+            byDate.resize(count);
+            std::iota(byDate.begin(), byDate.end(), 0);
+            std::stable_sort(byDate.begin(), byDate.end(),
+                             [&dates](int a, int b)
+                             {
+                                 return dates[a] < dates[b];
+                             });
+
+            float *out = data.ratings.data() + firstRating[user] * COLUMNS;
+            uint8_t *splits = data.splits.data() + firstRating[user];
+            std::fill(splits, splits + count, (uint8_t) BASE_SET);
+
+            const int heldOut = std::min(config.heldOutPerUser, count / 2);
+            std::uniform_int_distribution<int> heldOutDist(0, 4);
+            for (int i = count - heldOut; i < count; i++)
+            {
+                splits[byDate[i]] = HELD_OUT_SETS[heldOutDist(rng)];
+            }
+
+            for (int i = 0; i < count; i++)
+            {
+                const int movie = movies[i];
+                const float *q = movieFactors.data() + (size_t) movie * rank;
+
+                float rating = config.meanRating + userBias
+                               + movieBiases[movie] + noiseDist(rng);
+                for (int k = 0; k < rank; k++)
+                {
+                    rating += q[k] * userFactors[k];
+                }
+
+                out[i * COLUMNS + USER_ROW] = user;
+                out[i * COLUMNS + MOVIE_ROW] = movie;
+                out[i * COLUMNS + DATE_ROW] = dates[i];
+                out[i * COLUMNS + RATING_ROW] =
+                    std::min(std::max(std::round(rating), (float) MIN_RATING),
+                             (float) MAX_RATING);
+            }
+        }
+    }
+
+#ifndef NDEBUG
+    std::cout << "Generated " << data.size() << " synthetic ratings of "
+              << numUsers << " users and " << numMovies << " movies."
+              << std::endl;
+#endif
+
+    return data;
+}
+
+
+/*
+ * Buffers text output, since streaming hundreds of millions of numbers
+ * through an ofstream one at a time is far slower than generating them.
+ */
+class TextWriter
+{
+private:
+    std::ofstream file;
+    std::string buffer;
+
+public:
+    TextWriter(const std::string &fileName) : file(fileName)
+    {
+        if (file.fail())
+        {
+            throw std::runtime_error("Couldn't open " + fileName +
+                                     " for writing!");
+        }
+        buffer.reserve(1 << 20);
+    }
+
+    ~TextWriter() { flush(); }
+
+    void flush()
+    {
+        file.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    TextWriter &operator<<(int value)
+    {
+        char digits[12];
+        int numDigits = 0;
+        unsigned int rest = value < 0 ? -(unsigned int) value : value;
+
+        do
+        {
+            digits[numDigits++] = '0' + rest % 10;
+            rest /= 10;
+        }
+        while (rest != 0);
+
+        if (value < 0)
+        {
+            buffer += '-';
+        }
+        while (numDigits > 0)
+        {
+            buffer += digits[--numDigits];
+        }
+        return *this;
+    }
+
+    TextWriter &operator<<(char c)
+    {
+        buffer += c;
+        if (c == '\n' && buffer.size() >= (1 << 20) - 64)
+        {
+            flush();
+        }
+        return *this;
+    }
+};
+
+
+/**
+ * Writes a dataset as the text files the real data comes in.
+ *
+ * @param data:             The data to write.
+ * @param dataPath:         The data file to write (like DATA_PATH).
+ * @param indexPath:        The index file to write (like INDEX_PATH).
+ * @param qualPath:         The qual file to write (like QUAL_DATA_FN).
+ * @param qualRatingsPath:  Where to write the qual ratings.
+ * @param nPath:            The N file to write (like N_FN).
+ *
+ */
+void writeSynthText(const SynthData &data, const std::string &dataPath,
+                    const std::string &indexPath,
+                    const std::string &qualPath,
+                    const std::string &qualRatingsPath,
+                    const std::string &nPath)
+{
+    TextWriter dataFile(dataPath), indexFile(indexPath), qualFile(qualPath),
+               qualRatingsFile(qualRatingsPath), nFile(nPath);
+
+    int lastUser = -1;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        const float *rating = data.ratings.data() + i * COLUMNS;
+        const int user = roundToInt(rating[USER_ROW]);
+        const int movie = roundToInt(rating[MOVIE_ROW]);
+        const int date = roundToInt(rating[DATE_ROW]);
+        const bool inQual = data.splits[i] == QUAL_SET;
+
+        dataFile << user << ' ' << movie << ' ' << date << ' '
+                 << (inQual ? NO_RATING : roundToInt(rating[RATING_ROW]))
+                 << '\n';
+        indexFile << (int) data.splits[i] << '\n';
+
+        if (inQual)
+        {
+            qualFile << user << ' ' << movie << ' ' << date << '\n';
+            qualRatingsFile << roundToInt(rating[RATING_ROW]) << '\n';
+        }
+
+        // N(u) is every movie the user rated, in any set.
+        if (user != lastUser)
+        {
+            if (lastUser != -1)
+            {
+                nFile << '\n';
+            }
+            nFile << user;
+            lastUser = user;
+        }
+        nFile << ' ' << movie;
+    }
+
+    if (lastUser != -1)
+    {
+        nFile << '\n';
+    }
+}
+
+
+/**
+ * Writes the Time-SVD++ inputs of a dataset. For user u with mean rating
+ * date t_u, dev_u(t) = sign(t - t_u) * |t - t_u|^0.4, and hat{dev_u(t)}
+ * is that less its mean over u's ratings. f_{ut} is the floor of the log
+ * base A_CONST of the number of ratings u made on t. Both cover every
+ * (user, date) with a rating in any set, one "user date value" line each.
+ *
+ * @param data:         The data to write the inputs of.
+ * @param hatDevUTPath: The hat{dev_u(t)} file to write.
+ * @param fUTPath:      The f_{ut} file to write.
+ *
+ */
+void writeSynthTimeFiles(const SynthData &data,
+                         const std::string &hatDevUTPath,
+                         const std::string &fUTPath)
+{
+    std::ofstream hatDevUTFile(hatDevUTPath), fUTFile(fUTPath);
+
+    if (hatDevUTFile.fail() || fUTFile.fail())
+    {
+        throw std::runtime_error("Couldn't open " + hatDevUTPath + " or " +
+                                 fUTPath + " for writing!");
+    }
+
+    hatDevUTFile << std::fixed << std::setprecision(6);
+
+    // Each user's ratings are contiguous, so go a user at a time.
+    std::vector<int> dates;
+    size_t first = 0;
+    while (first < data.size())
+    {
+        const int user = roundToInt(data.ratings[first * COLUMNS
+                                                 + USER_ROW]);
+        size_t last = first;
+        dates.clear();
+        while (last < data.size()
+               && roundToInt(data.ratings[last * COLUMNS + USER_ROW]) == user)
+        {
+            dates.push_back(roundToInt(data.ratings[last * COLUMNS
+                                                    + DATE_ROW]));
+            last++;
+        }
+        first = last;
+
+        double meanDate = std::accumulate(dates.begin(), dates.end(), 0.0)
+                          / dates.size();
+        auto devUT = [meanDate](int date)
+        {
+            double delta = date - meanDate;
+            double sign = (delta > 0) - (delta < 0);
+            return sign * std::pow(std::fabs(delta), 0.4);
+        };
+
+        double meanDevUT = 0.0;
+        for (int date : dates)
+        {
+            meanDevUT += devUT(date) / dates.size();
+        }
+
+        std::sort(dates.begin(), dates.end());
+        for (size_t i = 0; i < dates.size(); )
+        {
+            size_t j = i;
+            while (j < dates.size() && dates[j] == dates[i])
+            {
+                j++;
+            }
+
+            hatDevUTFile << user << ' ' << dates[i] << ' '
+                         << devUT(dates[i]) - meanDevUT << '\n';
+            fUTFile << user << ' ' << dates[i] << ' '
+                    << (int) (std::log((double) (j - i)) / std::log(A_CONST))
+                    << '\n';
+            i = j;
+        }
+    }
+}
+
+
+/**
+ * Writes a dataset's ratings outside of qual as a rating store.
+ *
+ * @param data:         The data to write.
+ * @param storePath:    The store to (over)write.
+ *
+ */
+void writeSynthStore(const SynthData &data, const std::string &storePath)
+{
+    std::vector<float> ratings;
+    std::vector<uint8_t> splits;
+    ratings.reserve(data.ratings.size());
+    splits.reserve(data.size());
+
+    // The store's dims cover qual too (see ratingstore.hh).
+    size_t qualDims[3] = {0, 0, 0};
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        if (data.splits[i] == QUAL_SET)
+        {
+            const float *rating = data.ratings.data() + i * COLUMNS;
+            qualDims[0] = std::max(qualDims[0],
+                (size_t) roundToInt(rating[USER_ROW]) + 1);
+            qualDims[1] = std::max(qualDims[1],
+                (size_t) roundToInt(rating[MOVIE_ROW]) + 1);
+            qualDims[2] = std::max(qualDims[2],
+                (size_t) roundToInt(rating[DATE_ROW]) + 1);
+            continue;
+        }
+
+        ratings.insert(ratings.end(), data.ratings.begin() + i * COLUMNS,
+                       data.ratings.begin() + (i + 1) * COLUMNS);
+        splits.push_back(data.splits[i]);
+    }
+
+    RatingStore::write(std::move(ratings), std::move(splits), storePath,
+                       qualDims);
+}
@@ -0,0 +1,100 @@
+/*
+ * Generates synthetic ratings shaped like the Netflix data, so every
+ * algorithm can be benchmarked at full scale on machines that don't have
+ * the real data (which can't be distributed).
+ *
+ * Ratings come from a planted model of the same form SVD fits:
+ *
+ *      r_{ui} = round(mu + b_u + b_i + q_i^T * p_u + noise), in [1, 5]
+ *
+ * with Gaussian biases, factors and noise. How many ratings each user
+ * makes follows a Pareto (power law) distribution, and which movies they
+ * rate follows Zipf popularity, as in the real data. Each user is active
+ * over a range of dates, and users join more often later on, as Netflix
+ * grew. As in the real data, each user's most recent ratings are held out
+ * into qual, probe, hidden and valid, and the rest are base.
+ *
+ * Everything is derived from one seed, and each user from their own
+ * stream of it, so the data is the same however many threads make it.
+ *
+ */
+
+#ifndef SYNTHDATA_HH
+#define SYNTHDATA_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <netflix.hh>
+
+struct SynthConfig
+{
+    // The size of the data. numRatings includes qual, and is matched
+    // closely but not exactly.
+    int numUsers = netflix::NUM_USERS;
+    int numMovies = netflix::NUM_MOVIES;
+    int numDates = netflix::NUM_DATES;
+    size_t numRatings = 102416306;
+
+    // The Pareto exponent of user activity (smaller is heavier tailed),
+    // and the Zipf exponent of movie popularity (larger is more skewed).
+    double userSkew = 1.2;
+    double movieSkew = 0.8;
+
+    // The planted model: the rank and standard deviation of q_i^T * p_u,
+    // the standard deviations of the biases and noise, and mu.
+    int rank = 10;
+    float signalStd = 0.6;
+    float userBiasStd = 0.4;
+    float movieBiasStd = 0.5;
+    float noiseStd = 0.7;
+    float meanRating = netflix::MEAN_RATING_TRAINING_SET;
+
+    // The number of each user's most recent ratings held out of base (but
+    // never more than half of them).
+    int heldOutPerUser = 9;
+
+    uint64_t seed = 1;
+};
+
+
+struct SynthData
+{
+    // The ratings in (user, movie) order, COLUMNS values per rating as in
+    // the columns of a ratings matrix (qual ratings included), and the set
+    // of each.
+    std::vector<float> ratings;
+    std::vector<uint8_t> splits;
+
+    size_t size() const { return splits.size(); }
+};
+
+
+/* Generate a dataset (see above). */
+SynthData generateSynthData(const SynthConfig &config);
+
+/* Write the data as the text files the real data comes in: data and index
+ * files like DATA_PATH and INDEX_PATH (qual ratings given as 0), a qual
+ * file like QUAL_DATA_FN, and N like N_FN. The held back qual ratings are
+ * written to qualRatingsPath, one per line of the qual file. */
+void writeSynthText(const SynthData &data, const std::string &dataPath,
+                    const std::string &indexPath,
+                    const std::string &qualPath,
+                    const std::string &qualRatingsPath,
+                    const std::string &nPath);
+
+/* Write the per (user, date) inputs of Time-SVD++, as the helper scripts
+ * create_dev_u.py and create_f_u_t.py would from the data file: the
+ * centered hat{dev_u(t)} (like HAT_DEV_U_T_FN) and f_{ut} (like
+ * F_U_T_FN). */
+void writeSynthTimeFiles(const SynthData &data,
+                         const std::string &hatDevUTPath,
+                         const std::string &fUTPath);
+
+/* Write the data, leaving out qual, as a rating store (see
+ * ratingstore.hh). */
+void writeSynthStore(const SynthData &data, const std::string &storePath);
+
+#endif // SYNTHDATA_HH
@@ -0,0 +1,239 @@
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <netflix.hh>
+#include <ratingstore.hh>
+#include <telemetry.hh>
+
+using namespace std;
+using namespace std::chrono;
+
+
+namespace telemetry
+{
+    // The stream, opened at TELEMETRY_FN when the first record is written
+    // unless open() was called first. Writes are serialized by the mutex.
+    static mutex streamMutex;
+    static ofstream stream;
+    static bool streamChosen = false;
+
+    static int probeEvery = 1;
+
+
+    void open(const string &path)
+    {
+        lock_guard<mutex> lock(streamMutex);
+
+        if (stream.is_open())
+        {
+            stream.close();
+        }
+        if (!path.empty())
+        {
+            stream.open(path, ios::app);
+        }
+        streamChosen = true;
+    }
+
+
+    void setProbeInterval(int numEpochs)
+    {
+        probeEvery = numEpochs;
+    }
+
+    int probeInterval()
+    {
+        return probeEvery;
+    }
+
+
+    const arma::fmat &probeSet()
+    {
+        static const arma::fmat probe = []()
+        {
+            try
+            {
+                return loadRatings(netflix::PROBE_IDX);
+            }
+            catch (const runtime_error &)
+            {
+                return arma::fmat();
+            }
+        }();
+
+        return probe;
+    }
+
+
+    // Append a record to the stream.
+    static void writeRecord(const string &record)
+    {
+        lock_guard<mutex> lock(streamMutex);
+
+        if (!streamChosen)
+        {
+            stream.open(netflix::TELEMETRY_FN, ios::app);
+            streamChosen = true;
+        }
+        if (stream.is_open())
+        {
+            stream << record << endl;
+        }
+    }
+
+
+    void probeResult(const string &model, int epoch, double rmse,
+                     double seconds, int bestEpoch)
+    {
+        ostringstream record;
+        record << setprecision(6) << "{\"model\": \"" << model << "\", "
+               << "\"epoch\": " << epoch << ", "
+               << "\"probe_rmse\": " << rmse << ", "
+               << "\"probe_seconds\": " << seconds << ", "
+               << "\"best_epoch\": " << bestEpoch << "}";
+
+        writeRecord(record.str());
+
+#ifndef NDEBUG
+        cout << "\nProbe RMSE of " << model << " after epoch " << epoch
+             << ": " << rmse << " (best: epoch " << bestEpoch << ")" << endl;
+#endif
+    }
+
+
+    // The resident set size of this process, in kB (from /proc).
+    static long residentKB()
+    {
+        long totalPages = 0, residentPages = 0;
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if (statm == NULL)
+        {
+            return 0;
+        }
+        if (fscanf(statm, "%ld %ld", &totalPages, &residentPages) != 2)
+        {
+            residentPages = 0;
+        }
+        fclose(statm);
+
+        return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+
+    Epoch::Epoch(const string &model, int epoch)
+        : model(model), epoch(epoch), currentPhase("train"),
+          phaseStart(steady_clock::now())
+    {
+    }
+
+
+    void Epoch::endPhase()
+    {
+        if (!currentPhase.empty())
+        {
+            duration<double> seconds = steady_clock::now() - phaseStart;
+            phases.emplace_back(currentPhase, seconds.count());
+            currentPhase.clear();
+        }
+    }
+
+
+    void Epoch::phase(const string &name)
+    {
+        endPhase();
+        currentPhase = name;
+        phaseStart = steady_clock::now();
+    }
+
+
+    void Epoch::learningRate(const string &name, double value)
+    {
+        learningRates.emplace_back(name, value);
+    }
+
+
+    bool Epoch::probeDue() const
+    {
+        return probeEvery > 0 && epoch % probeEvery == 0;
+    }
+
+
+    void Epoch::setProbeRMSE(double rmse)
+    {
+        haveProbeRMSE = true;
+        probeRMSE = rmse;
+    }
+
+
+    void Epoch::finish()
+    {
+        endPhase();
+
+        double totalSeconds = 0.0, trainSeconds = 0.0;
+        for (const pair<string, double> &p : phases)
+        {
+            totalSeconds += p.second;
+            if (p.first == "train")
+            {
+                trainSeconds += p.second;
+            }
+        }
+
+        const uint64_t numRatings = ratings.total();
+        const double ratingsPerSecond = trainSeconds > 0.0
+            ? numRatings / trainSeconds : 0.0;
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        duration<double> now = system_clock::now().time_since_epoch();
+
+        ostringstream record;
+        record << setprecision(6) << "{\"model\": \"" << model << "\", "
+               << "\"epoch\": " << epoch << ", "
+               << "\"time\": " << fixed << setprecision(1) << now.count()
+               << defaultfloat << setprecision(6) << ", "
+               << "\"seconds\": " << totalSeconds << ", "
+               << "\"phases\": {";
+        for (size_t i = 0; i < phases.size(); i++)
+        {
+            record << (i > 0 ? ", " : "") << "\"" << phases[i].first
+                   << "\": " << phases[i].second;
+        }
+        record << "}, "
+               << "\"ratings\": " << numRatings << ", "
+               << "\"ratings_per_second\": " << ratingsPerSecond << ", "
+               << "\"learning_rates\": {";
+        for (size_t i = 0; i < learningRates.size(); i++)
+        {
+            record << (i > 0 ? ", " : "") << "\"" << learningRates[i].first
+                   << "\": " << learningRates[i].second;
+        }
+        record << "}, ";
+        if (haveProbeRMSE)
+        {
+            record << "\"probe_rmse\": " << probeRMSE << ", ";
+        }
+        record << "\"rss_kb\": " << residentKB() << ", "
+               << "\"peak_rss_kb\": " << usage.ru_maxrss << "}";
+
+        writeRecord(record.str());
+
+#ifndef NDEBUG
+        cout << "\nFinished epoch " << epoch << " of " << model << " in "
+             << totalSeconds << " seconds (" << ratingsPerSecond
+             << " ratings/s)" << endl;
+        if (haveProbeRMSE)
+        {
+            cout << "Probe RMSE: " << probeRMSE << endl;
+        }
+#endif
+    }
+}
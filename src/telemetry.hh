@@ -0,0 +1,162 @@
+/*
+ * Structured telemetry for long trainings. Every model that trains in
+ * epochs (SVD, SVD++, Time-SVD++ and RBM_New) writes one record per epoch
+ * to the telemetry stream, which is appended to TELEMETRY_FN unless it's
+ * redirected with telemetry::open(). A record is one line of JSON, e.g.
+ *
+ *      {"model": "SVD", "epoch": 3, "time": 1429000000.5,
+ *       "seconds": 52.1, "phases": {"train": 50.9, "probe": 1.2},
+ *       "ratings": 99072112, "ratings_per_second": 1946407,
+ *       "learning_rates": {"gamma_b_u": 0.00567, ...},
+ *       "probe_rmse": 0.9123, "rss_kb": 2104332, "peak_rss_kb": 2231004}
+ *
+ * (on one line). "time" is when the epoch ended, in seconds since the Unix
+ * epoch, and ratings_per_second is over the "train" phase. The probe RMSE
+ * is only there in epochs where it was computed (see probeInterval()).
+ *
+ * Models that score the probe set in the background (see validation.hh)
+ * write its result as a record of its own once it's ready, e.g.
+ *
+ *      {"model": "SVD", "epoch": 3, "probe_rmse": 0.9123,
+ *       "probe_seconds": 0.84, "best_epoch": 3}
+ *
+ * In their epoch records, the "probe" phase is just the time it took to
+ * hand over a snapshot.
+ *
+ * Recording is cheap enough to always leave on: ratings are counted into
+ * a slot of their thread's own (with no atomics or locks in the training
+ * loop), and the slots are summed and the record written once per epoch.
+ * In debug builds, a summary of each record is also printed.
+ *
+ */
+
+#ifndef TELEMETRY_HH
+#define TELEMETRY_HH
+
+#include <armadillo>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <omp.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <simd.hh>
+
+namespace telemetry
+{
+    /* Send records to path (appending to it), or nowhere if path is
+     * empty. */
+    void open(const std::string &path);
+
+    /* Compute the probe RMSE every numEpochs epochs (the default is 1),
+     * or never if numEpochs is 0. */
+    void setProbeInterval(int numEpochs);
+    int probeInterval();
+
+    /* The probe set, loaded from the rating store the first time it's
+     * asked for and kept. It's empty if there's no rating store. */
+    const arma::fmat &probeSet();
+
+    /* Write the probe RMSE of the given epoch of model, scored in
+     * seconds, and the best epoch so far. */
+    void probeResult(const std::string &model, int epoch, double rmse,
+                     double seconds, int bestEpoch);
+
+
+    /*
+     * A count that every thread of an OpenMP team adds to without
+     * synchronizing: thread t adds to slot t, and the slots are a cache
+     * line apart so they don't share one. Only read it between parallel
+     * regions.
+     *
+     */
+    class ThreadCounter
+    {
+    private:
+        // The uint64_ts in a cache line; slot t is at t * SLOT_STRIDE.
+        static constexpr size_t SLOT_STRIDE =
+            simd::ALIGNMENT / sizeof(uint64_t);
+
+        int numSlots;
+        uint64_t *slots;
+
+    public:
+        ThreadCounter()
+            : numSlots(omp_get_max_threads()),
+              slots(simd::alignedAlloc<uint64_t>(numSlots * SLOT_STRIDE))
+        {
+        }
+
+        ~ThreadCounter() { simd::alignedFree(slots); }
+
+        ThreadCounter(const ThreadCounter &) = delete;
+        ThreadCounter &operator=(const ThreadCounter &) = delete;
+
+        void add(uint64_t n)
+        {
+            slots[omp_get_thread_num() * SLOT_STRIDE] += n;
+        }
+
+        uint64_t total() const
+        {
+            uint64_t sum = 0;
+            for (int t = 0; t < numSlots; t++)
+            {
+                sum += slots[t * SLOT_STRIDE];
+            }
+            return sum;
+        }
+    };
+
+
+    /*
+     * The record of one epoch. It starts timing the "train" phase when
+     * it's made, and is written by finish().
+     *
+     */
+    class Epoch
+    {
+    private:
+        std::string model;
+        int epoch;
+
+        // The phases so far, with their times, and the current one.
+        std::vector<std::pair<std::string, double> > phases;
+        std::string currentPhase;
+        std::chrono::steady_clock::time_point phaseStart;
+
+        std::vector<std::pair<std::string, double> > learningRates;
+
+        bool haveProbeRMSE = false;
+        double probeRMSE = 0.0;
+
+        void endPhase();
+
+    public:
+        // The ratings trained on in this epoch.
+        ThreadCounter ratings;
+
+        /* Start the record of epoch (counted from 1) of model. */
+        Epoch(const std::string &model, int epoch);
+
+        /* End the current phase, and start timing the named one. */
+        void phase(const std::string &name);
+
+        /* Record the value of a learning rate (or step size) that was used
+         * in this epoch. */
+        void learningRate(const std::string &name, double value);
+
+        /* Whether the probe RMSE should be computed in this epoch (see
+         * setProbeInterval()). */
+        bool probeDue() const;
+
+        void setProbeRMSE(double rmse);
+
+        /* End the epoch, and write its record. */
+        void finish();
+    };
+}
+
+#endif // TELEMETRY_HH
@@ -5,7 +5,10 @@
 using namespace std::chrono;
 #endif
 
+#include <ratingstore.hh>
+#include <telemetry.hh>
 #include <timesvdpp.hh>
+#include <validation.hh>
 
 
 /** 
@@ -82,11 +85,78 @@ TimeSVDPP::TimeSVDPP(int numUsers, int numItems, int numTimes,
 }
 
 
+/**
+ * Adds a sparse matrix to a checkpoint as three sections: name.values,
+ * name.rowIndices and name.colPtrs (its compressed sparse column arrays).
+ *
+ * Iterating (rather than reading the matrix's internal arrays directly)
+ * makes sure any pending element insertions are included.
+ *
+ */
+static void addSparse(CheckpointWriter &writer, const std::string &name,
+                      const sp_fmat &matrix)
+{
+    std::vector<float> values;
+    std::vector<uint64_t> rowIndices;
+    std::vector<uint64_t> colPtrs(matrix.n_cols + 1, 0);
+
+    values.reserve(matrix.n_nonzero);
+    rowIndices.reserve(matrix.n_nonzero);
+
+    for (sp_fmat::const_iterator it = matrix.begin(); it != matrix.end();
+         ++it)
+    {
+        values.push_back(*it);
+        rowIndices.push_back(it.row());
+        colPtrs[it.col() + 1]++;
+    }
+
+    for (uword col = 0; col < matrix.n_cols; col++)
+    {
+        colPtrs[col + 1] += colPtrs[col];
+    }
+
+    const size_t numNonZero = values.size();
+    writer.add(name + ".values", std::move(values), 1, numNonZero);
+    writer.add(name + ".rowIndices", std::move(rowIndices), 1, numNonZero);
+    writer.add(name + ".colPtrs", std::move(colPtrs), 1, matrix.n_cols + 1);
+}
+
+
+/**
+ * Rebuilds a numRows x numCols sparse matrix saved by addSparse().
+ */
+static sp_fmat loadSparse(const Checkpoint &checkpoint,
+                          const std::string &name, int numRows, int numCols)
+{
+    const uint64_t *colPtrs = static_cast<const uint64_t *>(
+        checkpoint.data(name + ".colPtrs", CheckpointDType::U64,
+                        numCols + 1));
+    const size_t numNonZero = colPtrs[numCols];
+    const uint64_t *rowIndices = static_cast<const uint64_t *>(
+        checkpoint.data(name + ".rowIndices", CheckpointDType::U64,
+                        numNonZero));
+
+    // Armadillo's index type may be narrower than what we store.
+    uvec rowIndicesVec(numNonZero);
+    uvec colPtrsVec(numCols + 1);
+    std::copy(rowIndices, rowIndices + numNonZero, rowIndicesVec.begin());
+    std::copy(colPtrs, colPtrs + numCols + 1, colPtrsVec.begin());
+
+    return sp_fmat(rowIndicesVec, colPtrsVec,
+                   checkpoint.column(name + ".values", numNonZero),
+                   numRows, numCols);
+}
+
+
 /**
  * This constructor uses cached data to initialize the internals of the
- * TimeSVDPP object. It is assumed that all of the cached data (except the
- * file containing N) is stored in Armadillo's machine-dependent binary
- * format.
+ * TimeSVDPP object. Apart from N, hatDevUT and fUT, the cached data is a
+ * checkpoint written by saveCheckpoint(). The dense matrices and cubes are
+ * mapped straight from the checkpoint; only the sparse matrices and
+ * userFacMatTime have to be rebuilt.
+ *
+ * Note: This constructor should be used for blending, not the other one!
  *
  * @param numUsers:                 Number of users in the entire data set
  *                                  (not just training set).
@@ -112,31 +182,9 @@ TimeSVDPP::TimeSVDPP(int numUsers, int numItems, int numTimes,
  *                                  .dta file (or equivalent).
  * @param fileNameHatDevUT:         Same as above, but for hatDevUT.
  * @param fileNameFUT:              Same as above, but for fUT.
- * @param fileNameBUserConst:       Name of file containing data for
- *                                  bUserConst, in Armadillo's
- *                                  machine-dependent binary format.
- * @param fileNameBUserAlpha:       Same as above, but for bUserAlpha.
- * @param fileNameBUserTime:        Same as above, but for bUserTime.
- * @param fileNameBItemConst:       Same as above, but for bItemConst.
- * @param fileNameBItemTimewise:    Same as above, but for bItemTimewise.
- * @param fileNameBItemFreq:        Same as above, but for bItemFreq.
- * @param fileNameCUserConst:       Same as above, but for cUserConst.
- * @param fileNameCUserTime:        Same as above, but for cUserTime.
- * @param fileNameUserFacMat:       Same as above, but for userFacMat.
- * @param fileNameUserFacMatAlpha:  Same as above, but for userFacMatAlpha.
- * @param fileNameUserFacMatTime:   A time-dependent user factor matrix.
- *                                  Note that this must be stored as a
- *                                  plain-text file since we treat
- *                                  userFacMatTime as a mapping from
- *                                  UserDates to a vector of size
- *                                  numFactors.
- * @param fileNameItemFacMat:       Another Armadillo binary matrix file,
- *                                  but for itemFacMat.
- * @param fileNameItemFacMatTimewise:   Same as above, but for
- *                                      itemFacMatTimewise.
- * @param fileNameItemFacMatFreq:   Same as above, but for itemFacMatFreq.
- * @param fileNameYMat:             Same as above, but for yMat.
- * @param fileNameSumMovieWeights:  Same as above, but for sumMovieWeights.
+ * @param fileNameCheckpoint:       Name of the checkpoint file holding the
+ *                                  biases and factors. Their shapes must
+ *                                  match the arguments above.
  *
  */
 TimeSVDPP::TimeSVDPP(int numUsers, int numItems, int numTimes,
@@ -146,37 +194,11 @@ TimeSVDPP::TimeSVDPP(int numUsers, int numItems, int numTimes,
                      const std::string &fileNameN,
                      const std::string &fileNameHatDevUT,
                      const std::string &fileNameFUT,
-                     const std::string &fileNameBUserConst,
-                     const std::string &fileNameBUserAlpha,
-                     const std::string &fileNameBUserTime,
-                     const std::string &fileNameBItemConst,
-                     const std::string &fileNameBItemTimewise,
-                     const std::string &fileNameBItemFreq,
-                     const std::string &fileNameCUserConst,
-                     const std::string &fileNameCUserTime,
-                     const std::string &fileNameUserFacMat,
-                     const std::string &fileNameUserFacMatAlpha,
-                     const std::string &fileNameUserFacMatTime,
-                     const std::string &fileNameItemFacMat,
-                     const std::string &fileNameItemFacMatTimewise,
-                     const std::string &fileNameItemFacMatFreq,
-                     const std::string &fileNameYMat,
-                     const std::string &fileNameSumMovieWeights) :
+                     const std::string &fileNameCheckpoint) :
     numUsers(numUsers), numItems(numItems), numTimes(numTimes),
     meanRating(meanRating), numFactors(numFactors),
     numIterations(numIterations), numTimeBins(numTimeBins),
-    bUserConst(numUsers), bUserAlpha(numUsers),
-    bUserTime(numTimes, numUsers), bItemConst(numItems),
-    bItemTimewise(numTimeBins, numItems), 
-    bItemFreq(MAX_F_U_T + 1, numItems),
-    cUserConst(numUsers), /* initialized later */ cUserTime(),
-    userFacMat(numFactors, numUsers), userFacMatAlpha(numFactors, numUsers),
-    userFacMatTime(numUsers), yMat(numFactors, numItems),
-    itemFacMat(numFactors, numItems), 
-    itemFacMatTimewise(numFactors, numTimeBins, numItems),
-    itemFacMatFreq(numFactors, MAX_F_U_T + 1, numItems),
     numItemsTrainingSet() /* unused */,
-    sumMovieWeights(numFactors, numUsers),
     includeUserFacMatTime(includeUserFacMatTime)
 {
     // Populate N by reading from fileNameN.
@@ -188,34 +210,9 @@ TimeSVDPP::TimeSVDPP(int numUsers, int numItems, int numTimes,
     // Populate fUT by reading from fileNameFUT.
     populateFUT(fileNameFUT);
 
-    // Initialize bUserConst, bUserAlpha, bUserTime, bItemConst,
-    // bItemTimewise, bItemFreq, cUserConst, cUserTime, userFacMat,
-    // userFacMatAlpha, userFacMatTime, itemFacMat, itemFacMatTimewise,
-    // itemFacMatFreq, yMat, and sumMovieWeights by reading from their
-    // plain-text or binary files.
-    bUserConst.load(fileNameBUserConst, arma_binary);
-    bUserAlpha.load(fileNameBUserAlpha, arma_binary);
-    bUserTime.load(fileNameBUserTime, arma_binary);
-    bItemConst.load(fileNameBItemConst, arma_binary);
-    bItemTimewise.load(fileNameBItemTimewise, arma_binary);
-    bItemFreq.load(fileNameBItemFreq, arma_binary);
-    cUserConst.load(fileNameCUserConst, arma_binary);
-    cUserTime.load(fileNameCUserTime, arma_binary);
-    userFacMat.load(fileNameUserFacMat, arma_binary);
-    userFacMatAlpha.load(fileNameUserFacMatAlpha, arma_binary);
-    
-    if (includeUserFacMatTime)
-    {
-        // userFacMatTime has to be loaded separately since it is in a separate
-        // format.
-        loadUserFacMatTime(fileNameUserFacMatTime);
-    }
-    
-    itemFacMat.load(fileNameItemFacMat, arma_binary);
-    itemFacMatTimewise.load(fileNameItemFacMatTimewise, arma_binary);
-    itemFacMatFreq.load(fileNameItemFacMatFreq, arma_binary);
-    yMat.load(fileNameYMat, arma_binary);
-    sumMovieWeights.load(fileNameSumMovieWeights, arma_binary);
+    checkpoint.open(fileNameCheckpoint, "TimeSVDPP");
+    loadCheckpointSections();
+    freeze();
     
     trained = true;
     usingCachedData = true;
@@ -227,113 +224,36 @@ TimeSVDPP::TimeSVDPP(int numUsers, int numItems, int numTimes,
 
 
 /**
- * This function loads data from a plain-text file into userFacMatTime.
- * Each line in this file will be in the format <USER ID> <DATE ID>
- * <"numFactors" FLOATS>, where the "numFactors" floats correspond to the
- * vector being mapped to by p_{ut}.
- *
- * @param fileNameUserFacMatTime:   Name of the file that contains the
- *                                  information needed to populate the
- *                                  userFacMatTime mapping. Should be a
- *                                  plain text .dta file.
+ * This function rebuilds userFacMatTime from the open checkpoint. Its keys
+ * are stored as a 2 x K int32 section (user ID, date ID) and its vectors
+ * as a numFactors x K float section, in the same order; see
+ * saveCheckpoint().
  *
  */
-void TimeSVDPP::loadUserFacMatTime(const std::string
-                                   &fileNameUserFacMatTime)
+void TimeSVDPP::loadUserFacMatTime()
 {
-    std::ifstream fileUserFacMat(fileNameUserFacMatTime);
-
-    if (fileUserFacMat.fail())
+    const size_t numKeys =
+        checkpoint.section("userFacMatTime.keys").dims[1];
+    const int32_t *keys = static_cast<const int32_t *>(
+        checkpoint.data("userFacMatTime.keys", CheckpointDType::I32,
+                        2 * numKeys));
+    const float *values = static_cast<const float *>(
+        checkpoint.data("userFacMatTime.values", CheckpointDType::F32,
+                        numFactors * numKeys));
+
+    userFacMatTime.clear();
+    userFacMatTime.reserve(numKeys);
+
+    for (size_t i = 0; i < numKeys; i++)
     {
-        throw std::runtime_error("Couldn't find file containing "
-                                 "userFacMatTime at " + 
-                                 fileNameUserFacMatTime);
-    }
-
-    std::string line;
-
-    while (getline(fileUserFacMat, line))
-    {
-        // Split the string around single whitespaces.
-        std::stringstream lineSS(line);
-        std::string item;
-        char delim = ' ';
-
-        int i = 0;
         UserDate thisUserDate;
-        std::vector<float> userFacVecTime(numFactors);
+        thisUserDate.userID = keys[2 * i];
+        thisUserDate.dateID = (unsigned short) keys[2 * i + 1];
 
-        while (std::getline(lineSS, item, delim))
-        {
-            if (i == 0)
-            {
-                // This is the user ID.
-                thisUserDate.userID = stoi(item);
-            }
-            else if (i == 1)
-            {
-                // This is the date ID.
-                thisUserDate.dateID = (unsigned short) stoi(item);
-            }
-            else
-            {
-                // This is an element of the user's factor vector.
-                userFacVecTime[i - 2] = stof(item);
-            }
-
-            i ++;
-        }
-
-        // Add this data to the map userFacMatTime.
-        userFacMatTime[thisUserDate] = userFacVecTime;
+        const float *userFacVecTime = values + i * numFactors;
+        userFacMatTime[thisUserDate] =
+            std::vector<float>(userFacVecTime, userFacVecTime + numFactors);
     }
-
-    fileUserFacMat.close();
-}
-
-
-/**
- * This function stores the data in userFacMatTime into a plain-text file.
- * Each line in this file will be in the format <USER ID> <DATE ID>
- * <"numFactors" FLOATS>.
- *
- * @param fileNameUserFacMatTime:   Name of the file where the data in
- *                                  userFacMatTime will be stored. Should
- *                                  be a plain-text .dta file.
- *
- */
-void TimeSVDPP::saveUserFacMatTime(const std::string
-                                   &fileNameUserFacMatTime)
-{
-    std::ofstream userFacMatOut(fileNameUserFacMatTime);
-
-    // Iterate over map and output accordingly.
-    for (auto &iter : userFacMatTime)
-    {
-        UserDate thisUserDate = iter.first;
-        std::vector<float> userFacVecTime = iter.second;
-
-        // Output the user ID and date ID first, separated by spaces.
-        userFacMatOut << thisUserDate.userID << " " << thisUserDate.dateID
-                      << " ";
-
-        // Output each element of the vector, separated by a space.
-        for (unsigned int i = 0; i < userFacVecTime.size(); i ++)
-        {
-            userFacMatOut << userFacVecTime[i];
-
-            if (i != userFacVecTime.size() - 1)
-            {
-                userFacMatOut << " ";
-            }
-            else
-            {
-                userFacMatOut << std::endl;
-            }
-        }
-    }
-
-    userFacMatOut.close();
 }
 
 
@@ -489,16 +409,14 @@ void TimeSVDPP::populateFUT(const std::string &fileNameFUT)
  *              train() for more details.
  *
  */
-void TimeSVDPP::populateNumItemsTrainingSet(const fmat &data)
+void TimeSVDPP::populateNumItemsTrainingSet(const RatingView &data)
 {
-    for(unsigned int i = 0; i < data.n_cols; i++)
-    {
-        // Based on the user that this rating was by, increment the
-        // appropriate element of numItemsTrainingSet.
-        int user = roundToInt(data(USER_ROW, i));
-        
-        numItemsTrainingSet(user) ++;
-    }
+    data.forEach([this](const float *rating)
+            {
+                // Based on the user that this rating was by, increment the
+                // appropriate element of numItemsTrainingSet.
+                numItemsTrainingSet(roundToInt(rating[USER_ROW]))++;
+            });
     
 }
 
@@ -580,6 +498,27 @@ void TimeSVDPP::initInternalData()
     numItemsTrainingSet.zeros();
     
     // sumMovieWeights will be set up while training.
+
+    // Start over with the initial step sizes.
+    TIMESVDPP_GAMMA_B_U = TIMESVDPP_GAMMA_B_U_INIT;
+    TIMESVDPP_GAMMA_ALPHA_B_U = TIMESVDPP_GAMMA_ALPHA_B_U_INIT;
+    TIMESVDPP_GAMMA_B_U_T = TIMESVDPP_GAMMA_B_U_T_INIT;
+    TIMESVDPP_GAMMA_B_I = TIMESVDPP_GAMMA_B_I_INIT;
+    TIMESVDPP_GAMMA_B_I_T = TIMESVDPP_GAMMA_B_I_T_INIT;
+    TIMESVDPP_GAMMA_B_I_F_U_T = TIMESVDPP_GAMMA_B_I_F_U_T_INIT;
+    TIMESVDPP_GAMMA_C_U = TIMESVDPP_GAMMA_C_U_INIT;
+    TIMESVDPP_GAMMA_C_U_T = TIMESVDPP_GAMMA_C_U_T_INIT;
+    TIMESVDPP_GAMMA_Q_I = TIMESVDPP_GAMMA_Q_I_INIT;
+    TIMESVDPP_GAMMA_Q_I_BIN = TIMESVDPP_GAMMA_Q_I_BIN_INIT;
+    TIMESVDPP_GAMMA_Q_I_F = TIMESVDPP_GAMMA_Q_I_F_INIT;
+    TIMESVDPP_GAMMA_P_U = TIMESVDPP_GAMMA_P_U_INIT;
+    TIMESVDPP_GAMMA_ALPHA_P_U = TIMESVDPP_GAMMA_ALPHA_P_U_INIT;
+    TIMESVDPP_GAMMA_P_U_T = TIMESVDPP_GAMMA_P_U_T_INIT;
+    TIMESVDPP_GAMMA_Y_J = TIMESVDPP_GAMMA_Y_J_INIT;
+    iterationsDone = 0;
+
+    // The old prediction state is out of date now.
+    frozen = false;
 }
 
 
@@ -590,101 +529,16 @@ void TimeSVDPP::initInternalData()
  * @param data:                     This is the training data to use for
  *                                  our algorithm. See train() for more
  *                                  details.
- * @param fileNameBUserConst:       Name of file containing data for
- *                                  bUserConst, in Armadillo's
- *                                  machine-dependent binary format.
- * @param fileNameBUserAlpha:       Same as above, but for bUserAlpha.
- * @param fileNameBUserTime:        Same as above, but for bUserTime.
- * @param fileNameBItemConst:       Same as above, but for bItemConst.
- * @param fileNameBItemTimewise:    Same as above, but for bItemTimewise.
- * @param fileNameBItemFreq:        Same as above, but for bItemFreq.
- * @param fileNameCUserConst:       Same as above, but for cUserConst.
- * @param fileNameCUserTime:        Same as above, but for cUserTime.
- * @param fileNameUserFacMat:       Same as above, but for userFacMat.
- * @param fileNameUserFacMatAlpha:  Same as above, but for userFacMatAlpha.
- * @param fileNameUserFacMatTime:   A plain-text (.dta) file where
- *                                  userFacMatTime will be saved.
- * @param fileNameItemFacMat:       Name of the Armadillo binary file where 
- *                                  itemFacMat will be saved.
- * @param fileNameItemFacMatTimewise:   Same as above, but for
- *                                      itemFacMatTimewise.
- * @param fileNameItemFacMatFreq:   Same as above, but for itemFacMatFreq.
- * @param fileNameYMat:             Same as above, but for yMat.
- * @param fileNameSumMovieWeights:  Same as above, but for sumMovieWeights.
+ * @param fileNameCheckpoint:       Name of the checkpoint file to save to.
+ *                                  See saveCheckpoint().
  * 
  */
-void TimeSVDPP::trainAndCache(const fmat &data, 
-                              const std::string &fileNameBUserConst,
-                              const std::string &fileNameBUserAlpha,
-                              const std::string &fileNameBUserTime,
-                              const std::string &fileNameBItemConst,
-                              const std::string &fileNameBItemTimewise,
-                              const std::string &fileNameBItemFreq,
-                              const std::string &fileNameCUserConst,
-                              const std::string &fileNameCUserTime,
-                              const std::string &fileNameUserFacMat,
-                              const std::string &fileNameUserFacMatAlpha,
-                              const std::string &fileNameUserFacMatTime,
-                              const std::string &fileNameItemFacMat,
-                              const std::string &fileNameItemFacMatTimewise,
-                              const std::string &fileNameItemFacMatFreq,
-                              const std::string &fileNameYMat,
-                              const std::string &fileNameSumMovieWeights)
+void TimeSVDPP::trainAndCache(const RatingView &data, 
+                              const std::string &fileNameCheckpoint)
 {
     // Train the Time-SVD++ algorithm, then save internal data to file.
     train(data);
-
-    // Save bUserConst, bUserAlpha, bUserTime, bItemConst, bItemTimewise,
-    // bItemFreq, cUserConst, cUserTime, userFacMat, userFacMatAlpha,
-    // userFacMatTime, itemFacMat, itemFacMatTimewise, itemFacMatFreq,
-    // yMat, and sumMovieWeights.
-    bUserConst.save(fileNameBUserConst, arma_binary);
-    bUserAlpha.save(fileNameBUserAlpha, arma_binary);
-    bUserTime.save(fileNameBUserTime, arma_binary);
-    bItemConst.save(fileNameBItemConst, arma_binary);
-    bItemTimewise.save(fileNameBItemTimewise, arma_binary);
-    bItemFreq.save(fileNameBItemFreq, arma_binary);
-    cUserConst.save(fileNameCUserConst, arma_binary);
-    cUserTime.save(fileNameCUserTime, arma_binary);
-    userFacMat.save(fileNameUserFacMat, arma_binary);
-    userFacMatAlpha.save(fileNameUserFacMatAlpha, arma_binary);
-    
-    if (includeUserFacMatTime)
-    {
-        // userFacMatTime needs to be handled separately.
-        saveUserFacMatTime(fileNameUserFacMatTime);
-    }
-    
-    itemFacMat.save(fileNameItemFacMat, arma_binary);
-    itemFacMatTimewise.save(fileNameItemFacMatTimewise, arma_binary);
-    itemFacMatFreq.save(fileNameItemFacMatFreq, arma_binary);
-    yMat.save(fileNameYMat, arma_binary);
-    sumMovieWeights.save(fileNameSumMovieWeights, arma_binary);
-    
-#ifndef NDEBUG
-    cout << "Saved bUserConst to " << fileNameBUserConst << endl;
-    cout << "Saved bUserAlpha to " << fileNameBUserAlpha << endl;
-    cout << "Saved bUserTime to " << fileNameBUserTime << endl;
-    cout << "Saved bItemConst to " << fileNameBItemConst << endl; 
-    cout << "Saved bItemTimewise to " << fileNameBItemTimewise << endl;
-    cout << "Saved bItemFreq to " << fileNameBItemFreq << endl;
-    cout << "Saved cUserConst to " << fileNameCUserConst << endl;
-    cout << "Saved cUserTime to " << fileNameCUserTime << endl;
-    cout << "Saved userFacMat to " << fileNameUserFacMat << endl;
-    cout << "Saved userFacMatAlpha to " << fileNameUserFacMatAlpha << endl;
-    
-    if (includeUserFacMatTime)
-    {
-        cout << "Saved userFacMatTime to " << fileNameUserFacMatTime << endl;
-    }
-    
-    cout << "Saved itemFacMat to " << fileNameItemFacMat << endl;
-    cout << "Saved itemFacMatTimewise to " << fileNameItemFacMatTimewise
-        << endl;
-    cout << "Saved itemFacMatFreq to " << fileNameItemFacMatFreq << endl;
-    cout << "Saved yMat to " << fileNameYMat << endl;
-    cout << "Saved sumMovieWeights to " << fileNameSumMovieWeights << endl;
-#endif
+    saveCheckpoint(fileNameCheckpoint);
 }
 
 
@@ -701,39 +555,268 @@ void TimeSVDPP::trainAndCache(const fmat &data,
  *
  */
 void TimeSVDPP::trainAndCache(const std::string &fileNameData,
-                              const std::string &fileNameBUserConst,
-                              const std::string &fileNameBUserAlpha,
-                              const std::string &fileNameBUserTime,
-                              const std::string &fileNameBItemConst, 
-                              const std::string &fileNameBItemTimewise,
-                              const std::string &fileNameBItemFreq,
-                              const std::string &fileNameCUserConst,
-                              const std::string &fileNameCUserTime,
-                              const std::string &fileNameUserFacMat,
-                              const std::string &fileNameUserFacMatAlpha,
-                              const std::string &fileNameUserFacMatTime,
-                              const std::string &fileNameItemFacMat,
-                              const std::string &fileNameItemFacMatTimewise,
-                              const std::string &fileNameItemFacMatFreq,
-                              const std::string &fileNameYMat,
-                              const std::string &fileNameSumMovieWeights)
+                              const std::string &fileNameCheckpoint)
 {
     fmat data;
 
     data.load(fileNameData, arma_binary);
-    trainAndCache(data, fileNameBUserConst, fileNameBUserAlpha,
-                  fileNameBUserTime,
-                  fileNameBItemConst,fileNameBItemTimewise, 
-                  fileNameBItemFreq,
-                  fileNameCUserConst, fileNameCUserTime,
-                  fileNameUserFacMat,
-                  fileNameUserFacMatAlpha, fileNameUserFacMatTime,
-                  fileNameItemFacMat, fileNameItemFacMatTimewise,
-                  fileNameItemFacMatFreq,
-                  fileNameYMat, fileNameSumMovieWeights);
+    trainAndCache(RatingView(data), fileNameCheckpoint);
+}
+
+
+/**
+ * Saves bUserConst, bUserAlpha, bUserTime, bItemConst, bItemTimewise,
+ * bItemFreq, cUserConst, cUserTime, userFacMat, userFacMatAlpha,
+ * userFacMatTime, itemFacMat, itemFacMatTimewise, itemFacMatFreq, yMat,
+ * and sumMovieWeights to a single checkpoint file, which the caching
+ * constructor can load.
+ *
+ * The sparse bUserTime and cUserTime are stored as their compressed
+ * sparse column arrays. userFacMatTime is stored as a 2 x K int32 matrix
+ * of (user ID, date ID) keys and a numFactors x K matrix holding the
+ * corresponding vectors.
+ *
+ * @param fileNameCheckpoint:   Name of the checkpoint file to (over)write.
+ *
+ */
+void TimeSVDPP::saveCheckpoint(const std::string &fileNameCheckpoint) const
+{
+    CheckpointWriter writer("TimeSVDPP");
+    addCheckpointSections(writer);
+    writer.write(fileNameCheckpoint);
+
+#ifndef NDEBUG
+    cout << "Saved Time-SVD++ checkpoint to " << fileNameCheckpoint << endl;
+#endif
+}
+
+
+/**
+ * Adds this model's parameters and training state to a checkpoint. The
+ * flattened sections are moved into the writer, so it doesn't depend on
+ * anything that goes out of scope here.
+ */
+void TimeSVDPP::addCheckpointSections(CheckpointWriter &writer) const
+{
+    writer.add("format.version",
+               std::vector<int32_t>(1, CHECKPOINT_VERSION), 1, 1);
+    writer.add("bUserConst", bUserConst);
+    writer.add("bUserAlpha", bUserAlpha);
+    addSparse(writer, "bUserTime", bUserTime);
+    writer.add("bItemConst", bItemConst);
+    writer.add("bItemTimewise", bItemTimewise);
+    writer.add("bItemFreq", bItemFreq);
+    writer.add("cUserConst", cUserConst);
+    addSparse(writer, "cUserTime", cUserTime);
+    writer.add("userFacMat", userFacMat);
+    writer.add("userFacMatAlpha", userFacMatAlpha);
+
+    // Flatten userFacMatTime (this is empty unless includeUserFacMatTime
+    // is set).
+    std::vector<int32_t> userFacMatTimeKeys;
+    std::vector<float> userFacMatTimeValues;
+    userFacMatTimeKeys.reserve(2 * userFacMatTime.size());
+    userFacMatTimeValues.reserve(numFactors * userFacMatTime.size());
+
+    for (const auto &iter : userFacMatTime)
+    {
+        userFacMatTimeKeys.push_back(iter.first.userID);
+        userFacMatTimeKeys.push_back(iter.first.dateID);
+        userFacMatTimeValues.insert(userFacMatTimeValues.end(),
+                                    iter.second.begin(), iter.second.end());
+    }
+
+    writer.add("userFacMatTime.keys", std::move(userFacMatTimeKeys), 2, 2,
+               userFacMatTime.size());
+    writer.add("userFacMatTime.values", std::move(userFacMatTimeValues), 2,
+               numFactors, userFacMatTime.size());
+
+    writer.add("itemFacMat", itemFacMat);
+    writer.add("itemFacMatTimewise", itemFacMatTimewise);
+    writer.add("itemFacMatFreq", itemFacMatFreq);
+    writer.add("yMat", yMat);
+    writer.add("sumMovieWeights", sumMovieWeights);
+
+    std::vector<float> gammas = {
+        TIMESVDPP_GAMMA_B_U, TIMESVDPP_GAMMA_ALPHA_B_U,
+        TIMESVDPP_GAMMA_B_U_T, TIMESVDPP_GAMMA_B_I, TIMESVDPP_GAMMA_B_I_T,
+        TIMESVDPP_GAMMA_B_I_F_U_T, TIMESVDPP_GAMMA_C_U,
+        TIMESVDPP_GAMMA_C_U_T, TIMESVDPP_GAMMA_Q_I, TIMESVDPP_GAMMA_Q_I_BIN,
+        TIMESVDPP_GAMMA_Q_I_F, TIMESVDPP_GAMMA_P_U,
+        TIMESVDPP_GAMMA_ALPHA_P_U, TIMESVDPP_GAMMA_P_U_T,
+        TIMESVDPP_GAMMA_Y_J};
+    const size_t numGammas = gammas.size();
+    writer.add("training.gammas", std::move(gammas), 1, numGammas);
+    writer.add("training.iterations",
+               std::vector<uint64_t>(1, iterationsDone), 1, 1);
+}
+
+
+/**
+ * Points bUserConst, bUserAlpha, bItemConst, bItemTimewise, bItemFreq,
+ * cUserConst, userFacMat, userFacMatAlpha, itemFacMat, itemFacMatTimewise,
+ * itemFacMatFreq, yMat, and sumMovieWeights at their sections of the open
+ * checkpoint, rebuilds bUserTime, cUserTime and (if it's included)
+ * userFacMatTime from theirs, and restores the training state. Checkpoints
+ * of another version than CHECKPOINT_VERSION are rejected.
+ */
+void TimeSVDPP::loadCheckpointSections()
+{
+    if (!checkpoint.hasSection("format.version")
+        || *static_cast<const int32_t *>(
+               checkpoint.data("format.version", CheckpointDType::I32, 1))
+           != CHECKPOINT_VERSION)
+    {
+        throw std::invalid_argument("This Time-SVD++ checkpoint was saved "
+                                    "by an incompatible version (time bins "
+                                    "have changed); retrain it!");
+    }
+
+    bUserConst = checkpoint.column("bUserConst", numUsers);
+    bUserAlpha = checkpoint.column("bUserAlpha", numUsers);
+    bUserTime = loadSparse(checkpoint, "bUserTime", numTimes, numUsers);
+    bItemConst = checkpoint.column("bItemConst", numItems);
+    bItemTimewise = checkpoint.matrix("bItemTimewise", numTimeBins,
+                                      numItems);
+    bItemFreq = checkpoint.matrix("bItemFreq", MAX_F_U_T + 1, numItems);
+    cUserConst = checkpoint.column("cUserConst", numUsers);
+    cUserTime = loadSparse(checkpoint, "cUserTime", numTimes, numUsers);
+    userFacMat = checkpoint.matrix("userFacMat", numFactors, numUsers);
+    userFacMatAlpha = checkpoint.matrix("userFacMatAlpha", numFactors,
+                                        numUsers);
+    
+    if (includeUserFacMatTime)
+    {
+        loadUserFacMatTime();
+    }
+    
+    itemFacMat = checkpoint.matrix("itemFacMat", numFactors, numItems);
+    itemFacMatTimewise = checkpoint.cube("itemFacMatTimewise", numFactors,
+                                         numTimeBins, numItems);
+    itemFacMatFreq = checkpoint.cube("itemFacMatFreq", numFactors,
+                                     MAX_F_U_T + 1, numItems);
+    yMat = checkpoint.matrix("yMat", numFactors, numItems);
+    sumMovieWeights = checkpoint.matrix("sumMovieWeights", numFactors,
+                                        numUsers);
+
+    const float *gammas = static_cast<const float *>(
+        checkpoint.data("training.gammas", CheckpointDType::F32,
+                        15));
+    TIMESVDPP_GAMMA_B_U = gammas[0];
+    TIMESVDPP_GAMMA_ALPHA_B_U = gammas[1];
+    TIMESVDPP_GAMMA_B_U_T = gammas[2];
+    TIMESVDPP_GAMMA_B_I = gammas[3];
+    TIMESVDPP_GAMMA_B_I_T = gammas[4];
+    TIMESVDPP_GAMMA_B_I_F_U_T = gammas[5];
+    TIMESVDPP_GAMMA_C_U = gammas[6];
+    TIMESVDPP_GAMMA_C_U_T = gammas[7];
+    TIMESVDPP_GAMMA_Q_I = gammas[8];
+    TIMESVDPP_GAMMA_Q_I_BIN = gammas[9];
+    TIMESVDPP_GAMMA_Q_I_F = gammas[10];
+    TIMESVDPP_GAMMA_P_U = gammas[11];
+    TIMESVDPP_GAMMA_ALPHA_P_U = gammas[12];
+    TIMESVDPP_GAMMA_P_U_T = gammas[13];
+    TIMESVDPP_GAMMA_Y_J = gammas[14];
+
+    iterationsDone = *static_cast<const uint64_t *>(
+        checkpoint.data("training.iterations", CheckpointDType::U64, 1));
+}
+
+
+/**
+ * Makes training save a snapshot of its progress every "interval"
+ * iterations. Snapshots are written on a background thread while the next
+ * iteration runs. They're meant for resumeTraining(); sumMovieWeights is
+ * only brought up to date at the very end of training, so don't predict
+ * with one.
+ *
+ * @param fileNameCheckpoint:   Name of the checkpoint file to keep
+ *                              overwriting with the latest snapshot.
+ * @param interval:             The number of iterations between snapshots,
+ *                              or 0 to stop saving them.
+ *
+ */
+void TimeSVDPP::setIterationCheckpoints(const std::string &fileNameCheckpoint,
+                                        int interval)
+{
+    if (interval < 0)
+    {
+        throw std::invalid_argument("The checkpoint interval can't be "
+                                    "negative!");
+    }
+
+    fileNameIterCheckpoint = fileNameCheckpoint;
+    iterCheckpointInterval = interval;
 }
 
 
+/**
+ * Makes training stop once the probe RMSE hasn't improved for "patience"
+ * scored iterations, and leave the model at its best iteration. See
+ * SVD::setEarlyStopping() for the details.
+ *
+ * @param patience:             The number of scored iterations without an
+ *                              improvement to stop after, or 0 to never
+ *                              stop early.
+ * @param fileNameCheckpoint:   Name of the checkpoint file to keep the
+ *                              best iteration in.
+ *
+ */
+void TimeSVDPP::setEarlyStopping(int patience,
+                                 const std::string &fileNameCheckpoint)
+{
+    if (patience < 0)
+    {
+        throw std::invalid_argument("The early stopping patience can't be "
+                                    "negative!");
+    }
+
+    earlyStoppingPatience = patience;
+    fileNameBestCheckpoint = fileNameCheckpoint;
+}
+
+
+/**
+ * Continues training from a checkpoint written by saveCheckpoint() or by a
+ * snapshot (see setIterationCheckpoints()). The parameters, including the
+ * sparse bUserTime and cUserTime entries, and the step sizes are restored
+ * exactly, so the result is bit-for-bit the same as if training had never
+ * been interrupted. The checkpoint must have been written with the same
+ * includeUserFacMatTime setting as this object's.
+ *
+ * @param data:                 The training data the checkpoint was made
+ *                              with. See train() for more details.
+ * @param fileNameCheckpoint:   Name of the checkpoint file to resume from.
+ *
+ */
+void TimeSVDPP::resumeTraining(const RatingView &data,
+                               const std::string &fileNameCheckpoint)
+{
+    if (usingCachedData)
+    {
+        throw std::logic_error("This algorithm shouldn't be trained if "
+                               "you're using cached data!");
+    }
+
+    checkpoint.open(fileNameCheckpoint, "TimeSVDPP");
+    loadCheckpointSections();
+
+    if (iterationsDone > numIterations)
+    {
+        throw std::invalid_argument("The checkpoint at " +
+                                    fileNameCheckpoint +
+                                    " is past the last iteration!");
+    }
+
+#ifndef NDEBUG
+    cout << "Resuming Time-SVD++ after iteration " << iterationsDone
+         << endl;
+#endif
+
+    numItemsTrainingSet.zeros();
+    populateNumItemsTrainingSet(data);
+    trainIterations(data, NULL);
+}
 
 
 /**
@@ -800,6 +883,41 @@ inline void TimeSVDPP::updateUserSumMovieWeights(int user)
  */
 
 void TimeSVDPP::train(const fmat &data)
+{
+    train(RatingView(data), NULL);
+}
+
+
+/**
+ * Trains on a view of a rating store (see train(const fmat &)), walking
+ * its runs rather than copying them into a matrix.
+ *
+ */
+void TimeSVDPP::train(const RatingView &view)
+{
+    train(view, NULL);
+}
+
+
+/**
+ * Trains on data's users, items and dates with ratings taken from a
+ * separate column (e.g. the residuals of an earlier model), so that no
+ * copy of the training matrix is made.
+ *
+ */
+void TimeSVDPP::trainWithRatings(const RatingView &data,
+                                 const float *ratings)
+{
+    train(data, ratings);
+}
+
+
+/**
+ * Does the work of train(), taking the i-th rating of data from ratings[i]
+ * (or from data itself if ratings is NULL).
+ *
+ */
+void TimeSVDPP::train(const RatingView &data, const float *ratings)
 {
     // The predicted rating given by Time-SVD++ for user u and item i at
     // time t is:
@@ -840,12 +958,6 @@ void TimeSVDPP::train(const fmat &data)
     // This minimization is accomplished via stochastic gradient descent on
     // the free parameters.
 
-    // Check that the data does in fact have four rows!
-    if (data.n_rows != 4)
-    {
-        throw std::invalid_argument("Data array must have four rows!");
-    }
-
     // If we're using cached data, we shouldn't be calling this method!
     if (usingCachedData)
     {
@@ -894,8 +1006,8 @@ void TimeSVDPP::train(const fmat &data)
         float epsilon = 1.0e-9;
 
         // Locations and values for both bUserTime and cUserTime.
-        umat locations(2, data.n_cols);
-        fcolvec values(data.n_cols);
+        umat locations(2, data.size());
+        fcolvec values(data.size());
         
         // Keep track of previous user (assuming that the "data" matrix is
         // sorted by user IDs first).
@@ -905,21 +1017,21 @@ void TimeSVDPP::train(const fmat &data)
         std::unordered_set<unsigned short> dateIDsForThisUser;
         
         // The number of non-garbage entries in locations (and values).
-        unsigned int numEntriesLocations = 0;
+        size_t numEntriesLocations = 0;
         
-        for (unsigned int i = 0; i < data.n_cols; i++)
+        data.forEach([&](const float *rating)
         {
-            int user = roundToInt(data(USER_ROW, i));
+            int user = roundToInt(rating[USER_ROW]);
             unsigned short date = 
-                (unsigned short) roundToInt(data(DATE_ROW, i));
+                (unsigned short) roundToInt(rating[DATE_ROW]);
 
             if (user == prevUser)
             {
                 // Check if we've seen this date ID for this user before.
-                // If so, continue.
+                // If so, skip it.
                 if (dateIDsForThisUser.count(date) != 0)
                 {
-                    continue;
+                    return;
                 }
             }
             else
@@ -953,11 +1065,11 @@ void TimeSVDPP::train(const fmat &data)
             prevUser = user;
 
             numEntriesLocations++;
-        }
+        });
 
         // Remove unused entries from "locations" and "values".
-        locations.shed_cols(numEntriesLocations, data.n_cols - 1);
-        values.shed_rows(numEntriesLocations, data.n_cols - 1);
+        locations.shed_cols(numEntriesLocations, data.size() - 1);
+        values.shed_rows(numEntriesLocations, data.size() - 1);
 
         // Batch insertion constructors for bUserTime and cUserTime.
         bUserTime = sp_fmat(locations, values, numTimes, numUsers,
@@ -982,17 +1094,55 @@ void TimeSVDPP::train(const fmat &data)
 #endif
 
 
-    
+    trainIterations(data, ratings);
+}
+
+
+/**
+ * Runs the remaining iterations of stochastic gradient descent (from
+ * iterationsDone up to numIterations), saving snapshots along the way if
+ * requested, and scoring the probe set in the background. Training stops
+ * early, at its best epoch, if asked to (see setEarlyStopping()).
+ * bUserTime, cUserTime and userFacMatTime must already hold every (user,
+ * date) entry that the data uses. See train() for the details. The i-th
+ * rating of data is ratings[i] (or its own if ratings is NULL).
+ *
+ */
+void TimeSVDPP::trainIterations(const RatingView &data,
+                                const float *ratings)
+{
+    ProbeValidator validator("Time-SVD++");
+    validator.setPatience(earlyStoppingPatience);
+    if (earlyStoppingPatience > 0)
+    {
+        validator.keepBest(fileNameBestCheckpoint);
+    }
+
     // Iterate for the specified number of iterations.
-    for(int iterCount = 0; iterCount < numIterations; iterCount++)
+    for(int iterCount = iterationsDone; iterCount < numIterations;
+        iterCount++)
     {
-#ifndef NDEBUG
-        start = system_clock::now();
-#endif
-         
+        telemetry::Epoch record("Time-SVD++", iterCount + 1);
+        record.learningRate("gamma_b_u", TIMESVDPP_GAMMA_B_U);
+        record.learningRate("gamma_alpha_b_u", TIMESVDPP_GAMMA_ALPHA_B_U);
+        record.learningRate("gamma_b_u_t", TIMESVDPP_GAMMA_B_U_T);
+        record.learningRate("gamma_b_i", TIMESVDPP_GAMMA_B_I);
+        record.learningRate("gamma_b_i_t", TIMESVDPP_GAMMA_B_I_T);
+        record.learningRate("gamma_b_i_f_u_t", TIMESVDPP_GAMMA_B_I_F_U_T);
+        record.learningRate("gamma_c_u", TIMESVDPP_GAMMA_C_U);
+        record.learningRate("gamma_c_u_t", TIMESVDPP_GAMMA_C_U_T);
+        record.learningRate("gamma_q_i", TIMESVDPP_GAMMA_Q_I);
+        record.learningRate("gamma_q_i_bin", TIMESVDPP_GAMMA_Q_I_BIN);
+        record.learningRate("gamma_q_i_f", TIMESVDPP_GAMMA_Q_I_F);
+        record.learningRate("gamma_p_u", TIMESVDPP_GAMMA_P_U);
+        record.learningRate("gamma_alpha_p_u", TIMESVDPP_GAMMA_ALPHA_P_U);
+        record.learningRate("gamma_p_u_t", TIMESVDPP_GAMMA_P_U_T);
+        record.learningRate("gamma_y_j", TIMESVDPP_GAMMA_Y_J);
+
         // The rating number that we're looking at right now (i.e. the
         // column in our training set).
-        unsigned int ratingNum = 0;
+        size_t ratingNum = 0;
+        RatingCursor cursor(data);
         
         // Iterate through all users in the training data. We're assuming
         // that the data is sorted (column-wise) by user ID!
@@ -1040,16 +1190,18 @@ void TimeSVDPP::train(const fmat &data)
             for(int itemNum = 0; itemNum < numItemsUserTrainSet; itemNum++,
                                                                  ratingNum++)
             {
-                int item = roundToInt(data(MOVIE_ROW, ratingNum));
-                int date = roundToInt(data(DATE_ROW, ratingNum));
-                float actualRating = data(RATING_ROW, ratingNum);
+                const float *rating = cursor.next();
+                int item = roundToInt(rating[MOVIE_ROW]);
+                int date = roundToInt(rating[DATE_ROW]);
+                float actualRating = ratings != NULL ? ratings[ratingNum]
+                                                     : rating[RATING_ROW];
                 
                 // Update the UserDate struct.
                 thisUserDate.dateID = (unsigned short) date;
 
                 // Item-wise time bins can range from 0 to numTimeBins. We
                 // evenly divide (zero-indexed) dates into these bins.
-                int timeBin = floor(date / NUM_DATES * numTimeBins);
+                int timeBin = timeBinOf(date);
 
                 float thisHatDevUT = hatDevUT[thisUserDate];
                 int thisFUT = fUT[thisUserDate];
@@ -1261,6 +1413,8 @@ void TimeSVDPP::train(const fmat &data)
 #endif
         }
 
+        record.ratings.add(data.size());
+
         // At the end of each iteration, decrease the gammas by the
         // constant factor declared in the header file.
         TIMESVDPP_GAMMA_B_U *= TIMESVDPP_GAMMA_MULT_PER_ITER;
@@ -1278,23 +1432,78 @@ void TimeSVDPP::train(const fmat &data)
         TIMESVDPP_GAMMA_ALPHA_P_U *= TIMESVDPP_GAMMA_MULT_PER_ITER;
         TIMESVDPP_GAMMA_P_U_T *= TIMESVDPP_GAMMA_MULT_PER_ITER;
         TIMESVDPP_GAMMA_Y_J *= TIMESVDPP_GAMMA_MULT_PER_ITER;
-        
-#ifndef NDEBUG
-        end = system_clock::now();
-        minutesElapsed = end - start;
-        cout << "\nFinished iteration " << (iterCount + 1) << " of Time-"
-             "SVD++ in " << minutesElapsed.count() << " minutes" 
-             << endl;
+        iterationsDone = iterCount + 1;
+
+        // Snapshot our progress if it's time to. Only the copy of the
+        // parameters holds up training; they're written in the background.
+        if (iterCheckpointInterval > 0
+            && iterationsDone % iterCheckpointInterval == 0
+            && iterationsDone < numIterations)
+        {
+            record.phase("snapshot");
+            CheckpointWriter writer("TimeSVDPP");
+            addCheckpointSections(writer);
+            iterCheckpointWriter.write(std::move(writer),
+                                       fileNameIterCheckpoint);
+        }
+
+        // Hand the probe set's share of the parameters to the validator,
+        // which scores it while the next epoch trains. Predictions need
+        // sumMovieWeights to be current and the user terms frozen. Both
+        // are rebuilt from the parameters, so this doesn't change the
+        // course of training.
+        if (record.probeDue() && validator.enabled())
+        {
+            record.phase("probe");
+            updateSumMovieWeights(0, numUsers);
+            freeze();
+            std::unique_ptr<ProbeSnapshot> snapshot =
+                probeSnapshot(ProbeSet::resident());
+
+            if (earlyStoppingPatience > 0)
+            {
+                CheckpointWriter writer("TimeSVDPP");
+                addCheckpointSections(writer);
+                validator.submit(iterationsDone, std::move(snapshot),
+                                 &writer);
+            }
+            else
+            {
+                validator.submit(iterationsDone, std::move(snapshot));
+            }
+        }
+
+        record.finish();
+
+        if (validator.shouldStop())
+        {
+            break;
+        }
+    }
 
-        float probeRMSE = computeRMSE(PROBE_BIN);
+    // Wait for the last probe RMSE, and roll back to the best epoch if
+    // early stopping is on and we've gone past it.
+    validator.wait();
 
-        cout << "Probe RMSE: " << probeRMSE << endl;
+    if (earlyStoppingPatience > 0 && validator.bestEpoch() > 0
+        && validator.bestEpoch() != iterationsDone)
+    {
+        checkpoint.open(fileNameBestCheckpoint, "TimeSVDPP");
+        loadCheckpointSections();
+
+#ifndef NDEBUG
+        cout << "Rolled Time-SVD++ back to iteration " << iterationsDone
+             << " (probe RMSE " << validator.bestRMSE() << ")" << endl;
 #endif
     }
 
     // Update sumMovieWeights for the last time, so that the data used by
     // predict() (and the data cached to file) is accurate!
     updateSumMovieWeights(0, numUsers);
+    freeze();
+
+    // Make sure the last snapshot made it to disk.
+    iterCheckpointWriter.wait();
 
     trained = true;
 
@@ -1304,78 +1513,269 @@ void TimeSVDPP::train(const fmat &data)
 }
 
 
+/*
+ * A snapshot of Time-SVD++'s prediction state for the probe set (see
+ * TimeSVDPP::probeSnapshot()). Everything that depends on a rating's user
+ * and date is worked out when the snapshot is taken, so what's left to
+ * score is the item terms and one fused pass over the factors, as in
+ * predictFrozen(). Predictions aren't bounded.
+ */
+class TimeSVDPPSnapshot : public ProbeSnapshot
+{
+public:
+    int numFactors;
+
+    // Copies of the item parameters.
+    fcolvec bItemConst;
+    fmat bItemTimewise;
+    fmat bItemFreq;
+    fmat itemFacMat;
+    fcube itemFacMatTimewise;
+    fcube itemFacMatFreq;
+
+    // Column s is the frozen factor term (or alpha_{p_u}) of probe user s.
+    fmat userFactorBase;
+    fmat userFacMatAlpha;
+
+    // For each probe rating: mu + b_u + alpha_{b_u} * hat{dev_u(t)} +
+    // b_{ut}, c_u + c_{ut}, hat{dev_u(t)}, Bin(t), f_{ut}, and the column
+    // of puTimes holding p_{ut} (or -1 if there isn't one).
+    std::vector<float> userBiases;
+    std::vector<float> itemBiasScales;
+    std::vector<float> hatDevs;
+    std::vector<int> timeBins;
+    std::vector<int> fUTs;
+    std::vector<int> puTimeCols;
+    fmat puTimes;
+
+    // numFactors zeros, standing in for p_{ut} when there isn't one.
+    std::vector<float> zeroFactors;
+
+    void predict(const ProbeSet &probe, size_t begin, size_t end,
+                 float *predictions) const
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            int slot = probe.userSlots[i];
+            int item = probe.items[i];
+            int timeBin = timeBins[i];
+            int thisFUT = fUTs[i];
+
+            float predictedRating = userBiases[i] +
+                (bItemConst(item) + bItemTimewise(timeBin, item)) *
+                itemBiasScales[i] + bItemFreq(thisFUT, item);
+
+            const float *puTime = puTimeCols[i] < 0 ? zeroFactors.data()
+                : puTimes.colptr(puTimeCols[i]);
+
+            predictedRating += simd::dotOfSums(itemFacMat.colptr(item),
+                itemFacMatTimewise.slice(item).colptr(timeBin),
+                itemFacMatFreq.slice(item).colptr(thisFUT),
+                userFactorBase.colptr(slot), hatDevs[i],
+                userFacMatAlpha.colptr(slot), puTime, numFactors);
+
+            predictions[i - begin] = predictedRating;
+        }
+    }
+};
+
+
 /**
+ * Takes a snapshot of the state predict() reads, for scoring the probe set
+ * while training carries on (see validation.hh): the item parameters, the
+ * frozen terms of the probe users, and every probe rating's user and date
+ * terms, including the few p_{ut} that exist. The model must be frozen.
  *
- * TODO: remove this later!
- *
- * Compute the RMSE of this algorithm on a certain set of data. Note that
- * testFileName must refer to an **Armadillo binary** in this case. This
- * binary must represent a 4 x N matrix, where N is the number of test
- * points.
+ * @param probe:    The probe set the snapshot is for.
  *
  */
-float TimeSVDPP::computeRMSE(const std::string &testFileName)
+std::unique_ptr<ProbeSnapshot> TimeSVDPP::probeSnapshot(
+    const ProbeSet &probe) const
 {
-    // Load from binary.
-    fmat testSet;
-    testSet.load(testFileName, arma_binary);
-
-    // The test set should have four rows.
-    if (testSet.n_rows != 4)
+    std::unique_ptr<TimeSVDPPSnapshot> snapshot(new TimeSVDPPSnapshot());
+
+    snapshot->numFactors = numFactors;
+    snapshot->bItemConst = bItemConst;
+    snapshot->bItemTimewise = bItemTimewise;
+    snapshot->bItemFreq = bItemFreq;
+    snapshot->itemFacMat = itemFacMat;
+    snapshot->itemFacMatTimewise = itemFacMatTimewise;
+    snapshot->itemFacMatFreq = itemFacMatFreq;
+    snapshot->zeroFactors.assign(numFactors, 0.0);
+
+    const int numProbeUsers = probe.users.size();
+    snapshot->userFactorBase.set_size(numFactors, numProbeUsers);
+    snapshot->userFacMatAlpha.set_size(numFactors, numProbeUsers);
+
+    #pragma omp parallel for schedule(static)
+    for (int slot = 0; slot < numProbeUsers; slot++)
     {
-        throw std::invalid_argument("File " + testFileName + " did not "
-                                    + "have four rows!");
+        int user = probe.users[slot];
+
+        std::copy(userFactorBase.colptr(user),
+                  userFactorBase.colptr(user) + numFactors,
+                  snapshot->userFactorBase.colptr(slot));
+        std::copy(userFacMatAlpha.colptr(user),
+                  userFacMatAlpha.colptr(user) + numFactors,
+                  snapshot->userFacMatAlpha.colptr(slot));
     }
 
-    // The number we divide by in computing the RMSE.
-    int nMinusOne = testSet.n_cols - 1;
+    const long numRatings = probe.size();
+    snapshot->userBiases.resize(numRatings);
+    snapshot->itemBiasScales.resize(numRatings);
+    snapshot->hatDevs.resize(numRatings);
+    snapshot->timeBins.resize(numRatings);
+    snapshot->fUTs.resize(numRatings);
+    snapshot->puTimeCols.assign(numRatings, -1);
 
-    // Accumulator for RMSE (take square root at the end)
-    float rmse = 0.0;
+    // The p_{ut} of each rating that has one, found in parallel and then
+    // copied out.
+    std::vector<const float *> puTimeFound(numRatings, NULL);
 
-    for (unsigned int i = 0; i < testSet.n_cols; i ++)
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < numRatings; i++)
     {
-        int user = roundToInt(testSet(USER_ROW, i));
-        int item = roundToInt(testSet(MOVIE_ROW, i));
-        int date = roundToInt(testSet(DATE_ROW, i));
-        float actualRating = testSet(RATING_ROW, i);
-        
-        // Don't bound while computing RMSE for diagnosis purposes.
-        float prediction = predict(user, item, date, false);
-        
-        rmse += pow(actualRating - prediction, 2.0)/nMinusOne;
+        int user = probe.users[probe.userSlots[i]];
+        int date = probe.dates[i];
+
+        UserDate thisUserDate;
+        thisUserDate.userID = user;
+        thisUserDate.dateID = (unsigned short) date;
+
+        float thisHatDevUT = hatDevUTOf(thisUserDate);
+
+        snapshot->hatDevs[i] = thisHatDevUT;
+        snapshot->timeBins[i] = timeBinOf(date);
+        snapshot->fUTs[i] = fUTOf(thisUserDate);
+        snapshot->userBiases[i] = userBiasBase(user) +
+            bUserAlpha(user) * thisHatDevUT + bUserTime(date, user);
+        snapshot->itemBiasScales[i] = cUserConst(user) +
+            cUserTime(date, user);
+
+        if (includeUserFacMatTime)
+        {
+            auto found = userFacMatTime.find(thisUserDate);
+
+            if (found != userFacMatTime.end())
+            {
+                puTimeFound[i] = found->second.data();
+            }
+        }
     }
 
-    return sqrt(rmse);
+    long numPUTimes = 0;
+    for (long i = 0; i < numRatings; i++)
+    {
+        if (puTimeFound[i] != NULL)
+        {
+            snapshot->puTimeCols[i] = numPUTimes++;
+        }
+    }
+
+    snapshot->puTimes.set_size(numFactors, numPUTimes);
+    for (long i = 0; i < numRatings; i++)
+    {
+        if (puTimeFound[i] != NULL)
+        {
+            std::copy(puTimeFound[i], puTimeFound[i] + numFactors,
+                      snapshot->puTimes.colptr(snapshot->puTimeCols[i]));
+        }
+    }
+
+    return snapshot;
 }
 
 
+/**
+ * Materializes the per-user state that predict() reads: the
+ * time-independent part of each user's factor term, p_u + |N(u)|^{-1/2}
+ * sum_{j in N(u)} y_j, and their bias mu + b_u. What's left for each
+ * prediction is a handful of bias lookups and a single fused pass over the
+ * item's and the user's three factor components (see simd::dotOfSums()).
+ *
+ * train() and the caching constructor call this; it only has to be called
+ * again if the parameters are changed some other way.
+ *
+ */
+void TimeSVDPP::freeze()
+{
+    userFactorBase.set_size(numFactors, numUsers);
+    userBiasBase.set_size(numUsers);
+    zeroFactors.assign(numFactors, 0.0);
+
+    #pragma omp parallel for schedule(static)
+    for (int user = 0; user < numUsers; user++)
+    {
+        float *userFactorTerm = userFactorBase.colptr(user);
+
+        std::copy(userFacMat.colptr(user),
+                  userFacMat.colptr(user) + numFactors, userFactorTerm);
+        simd::axpy(nuNormFactor(user), sumMovieWeights.colptr(user),
+                   userFactorTerm, numFactors);
+
+        userBiasBase(user) = meanRating + bUserConst(user);
+    }
+
+    frozen = true;
+}
+
 
 /** 
  * This function predicts a rating for a given user, item, and date. If the
- * TimeSVDPP has not been trained yet, a logic_error is thrown.
+ * TimeSVDPP has not been frozen yet (see freeze()), a logic_error is
+ * thrown.
  *
  * @param user: the user ID of interest.
  * @param item: the item ID of interest.
  * @param date: the date ID of interest.
  *
  * @return A prediction of the user's rating for the given item at the
- *         given time. This will always end up being between MIN_RATING and
- *         MAX_RATING.
- *
- * Precondition: It is assumed that sumMovieWeights has been accurately set
- * after training!
+ *         given time. If bound is set, this will always end up being
+ *         between MIN_RATING and MAX_RATING.
  *
  */
 float TimeSVDPP::predict(int user, int item, int date, bool bound)
 {
-    // TODO: uncomment?
-    /*if (!trained)
+    if (!frozen)
     {
         throw std::logic_error("Tried to predict a rating but the Time-"
-                               "SVD++ algorithm was not done training!");
-    }*/
+                               "SVD++ algorithm was not frozen after "
+                               "training!");
+    }
+
+    return predictFrozen(user, item, date, bound);
+}
+
+
+/**
+ * Predicts a batch (see BaseAlgorithm::predictBatch), after checking that
+ * freeze() has been called. The check can't be made in predictRange(),
+ * which runs on OpenMP threads.
+ *
+ */
+void TimeSVDPP::predictBatch(const int *users, const int *items,
+                             const int *dates, float *output, size_t n,
+                             bool bound)
+{
+    if (!frozen)
+    {
+        throw std::logic_error("Tried to predict a rating but the Time-"
+                               "SVD++ algorithm was not frozen after "
+                               "training!");
+    }
 
+    BaseAlgorithm::predictBatch(users, items, dates, output, n, bound);
+}
+
+
+/**
+ * Does the work of predict(), using the state materialized by freeze().
+ * This only reads model state, so it's safe to call from several threads.
+ *
+ */
+inline float TimeSVDPP::predictFrozen(int user, int item, int date,
+                                      bool bound) const
+{
     // The predicted rating given by Time-SVD++ for user u and item i at
     // time t is:
     //      
@@ -1385,6 +1785,9 @@ float TimeSVDPP::predict(int user, int item, int date, bool bound)
     //                     (q_i + q_{i, Bin(t)} + q_{i, f_{ut}})^T * 
     //                     (p_u + alpha_{p_u} * hat{dev_u(t)} + p_{ut} +
     //                      |N(u)|^{-1/2} sum_{j in N(u)} y_j)
+    //
+    // mu + b_u and p_u + |N(u)|^{-1/2} sum_{j in N(u)} y_j come from
+    // freeze().
     
     // Construct a UserDate for this rating, and use this to find
     // hat{dev_u(t)}.
@@ -1392,19 +1795,16 @@ float TimeSVDPP::predict(int user, int item, int date, bool bound)
     thisUserDate.userID = user;
     thisUserDate.dateID = (unsigned short) date;
     
-    std::vector<int> nu = N[user];
-    float nuNormFac = 1.0/sqrt(nu.size());
-    float thisHatDevUT = hatDevUT[thisUserDate];
-    int thisFUT = fUT[thisUserDate];
+    float thisHatDevUT = hatDevUTOf(thisUserDate);
+    int thisFUT = fUTOf(thisUserDate);
     
     // Item-wise time bins can range from 0 to numTimeBins. We evenly
     // divide (zero-indexed) dates into these bins.
-    int timeBin = floor(date / NUM_DATES * numTimeBins);
+    int timeBin = timeBinOf(date);
 
-    // Get the predicted rating for this user, item, and time, using the
-    // aformentioned formula for rHat_{ui}(t). First, combine the bias
-    // terms.
-    float predictedRating = meanRating + bUserConst(user) +
+    // Combine the bias terms. This is a const member, so element access
+    // never touches the sparse matrices' write caches.
+    float predictedRating = userBiasBase(user) +
         bUserAlpha(user) * thisHatDevUT + bUserTime(date, user) + 
         (bItemConst(item) + bItemTimewise(timeBin, item)) *
         (cUserConst(user) + cUserTime(date, user)) +
@@ -1412,58 +1812,119 @@ float TimeSVDPP::predict(int user, int item, int date, bool bound)
 
     // p_{ut} for this user and time (if this user date combination
     // is valid).
-    fcolvec puTime;
+    const float *puTime = zeroFactors.data();
     
-    if (includeUserFacMatTime && userFacMatTime.count(thisUserDate) != 0)
-    {
-        puTime = userFacMatTime[thisUserDate];
-    }
-    else
+    if (includeUserFacMatTime)
     {
-        puTime = zeros<fcolvec>(numFactors);
-    }
-    
-    // Compute the factorized term (i.e. itemFactorTerm^T * (p_u +
-    // alpha_{p_u} * hat{dev_u(t)} + p_{ut} + |N(u)|^{-1/2} sum_{j in N(u)}
-    // y_j)).
-    //
-    // First find p_u + alpha_{p_u} * hat{dev_u(t)} + p_{ut} +
-    // |N(u)|^{-1/2} sum_{j in N(u)} y_j, the "userFactorTerm".  Start off
-    // by making a copy of p_u.
-    fcolvec userFactorTerm(userFacMat.col(user));
+        auto found = userFacMatTime.find(thisUserDate);
 
-    // Add the time-dependent user factor biases.
-    userFactorTerm += userFacMatAlpha.col(user) * thisHatDevUT + puTime;
+        if (found != userFacMatTime.end())
+        {
+            puTime = found->second.data();
+        }
+    }
 
-    // Get sum_{j in N(u)} y_j and multiply by nuNormFac.
-    userFactorTerm += sumMovieWeights.col(user) * nuNormFac;
-    
-    // Add the factorized term (itemFactorTerm^T * userFactorTerm) to the
-    // prediction.
-    fcolvec itemFactorTerm(itemFacMat.col(item) +
-                           itemFacMatTimewise.slice(item).col(timeBin) +
-                           itemFacMatFreq.slice(item).col(thisFUT));
-    
-    predictedRating += dot(itemFactorTerm, userFactorTerm);
+    // (q_i + q_{i, Bin(t)} + q_{i, f_{ut}})^T * (userFactorBase.col(u) +
+    // alpha_{p_u} * hat{dev_u(t)} + p_{ut}), in one pass.
+    predictedRating += simd::dotOfSums(itemFacMat.colptr(item),
+        itemFacMatTimewise.slice(item).colptr(timeBin),
+        itemFacMatFreq.slice(item).colptr(thisFUT),
+        userFactorBase.colptr(user), thisHatDevUT,
+        userFacMatAlpha.colptr(user), puTime, numFactors);
     
     // Put the rating between MIN_RATING and MAX_RATING! Otherwise, the
     // error will be bad.
     if (bound)
     {
-        if (predictedRating < MIN_RATING)
-        {
-            predictedRating = (float) MIN_RATING;
-        }
-        else if (predictedRating > MAX_RATING)
-        {
-            predictedRating = (float) MAX_RATING;
-        }
+        predictedRating = std::min(std::max(predictedRating,
+            (float) MIN_RATING), (float) MAX_RATING);
     }
     
     return predictedRating;
 }
 
 
+/**
+ * Returns |N(u)|^{-1/2} for the given user, or zero if the user has no
+ * implicit preferences (in which case sum_{j in N(u)} y_j is zero too).
+ *
+ * @param user: the user ID of interest.
+ *
+ */
+float TimeSVDPP::nuNormFactor(int user) const
+{
+    auto nu = N.find(user);
+
+    if (nu == N.end() || nu->second.empty())
+    {
+        return 0.0;
+    }
+
+    return 1.0 / sqrt(nu->second.size());
+}
+
+
+/**
+ * Returns hat{dev_u(t)} for a user and date, or zero if the pair never
+ * appeared in the data hatDevUT was built from. Unlike operator[], this
+ * never inserts, so predictions can run on several threads.
+ *
+ * @param userDate: the user and date of interest.
+ *
+ */
+float TimeSVDPP::hatDevUTOf(const UserDate &userDate) const
+{
+    auto found = hatDevUT.find(userDate);
+    return found == hatDevUT.end() ? 0.0 : found->second;
+}
+
+
+/**
+ * Returns the frequency bin f_{ut} for a user and date, or zero if the pair
+ * is unknown. See hatDevUTOf().
+ *
+ * @param userDate: the user and date of interest.
+ *
+ */
+int TimeSVDPP::fUTOf(const UserDate &userDate) const
+{
+    auto found = fUT.find(userDate);
+    return found == fUT.end() ? 0 : found->second;
+}
+
+
+/**
+ * Returns the item time bin Bin(t) of a date: dates are split evenly into
+ * numTimeBins bins over the numTimes dates of the dataset.
+ *
+ * @param date: the (zero-indexed) date ID of interest.
+ *
+ */
+int TimeSVDPP::timeBinOf(int date) const
+{
+    // Multiply first; date / numTimes is always 0 in integer arithmetic.
+    int timeBin = (int) ((long) date * numTimeBins / numTimes);
+    return std::min(std::max(timeBin, 0), numTimeBins - 1);
+}
+
+
+/**
+ * Predicts one chunk of a batch (see BaseAlgorithm::predictBatch). All of
+ * the per-user work was done by freeze(), so this just predicts each point
+ * in turn.
+ *
+ */
+void TimeSVDPP::predictRange(const int *users, const int *items,
+                             const int *dates, float *output, size_t n,
+                             bool bound)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        output[i] = predictFrozen(users[i], items[i], dates[i], bound);
+    }
+}
+
+
 TimeSVDPP::~TimeSVDPP()
 {
     // No dynamically allocated resources to free at the moment.
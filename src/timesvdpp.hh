@@ -20,11 +20,13 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
 #include <functional>
 #include <iterator>
+#include <memory>
 #include <random>
 #include <stdexcept>
 #include <string>
@@ -34,6 +36,9 @@
 
 #include <netflix.hh>
 #include <basealgorithm.hh>
+#include <checkpoint.hh>
+#include <simd.hh>
+#include <validation.hh>
 
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
@@ -123,21 +128,39 @@ private:
     // method for more on which parameters these apply to. These came from
     // a combination of the abovementioned forum link, BellKor's [PQ1]
     // model, and other tweaks.
-    float TIMESVDPP_GAMMA_B_U = 0.0054;                 // Laksh
-    float TIMESVDPP_GAMMA_ALPHA_B_U = 0.00003;          // Laksh
-    float TIMESVDPP_GAMMA_B_U_T = 0.0028;               // Laksh
-    float TIMESVDPP_GAMMA_B_I = 0.005;                  // Laksh
-    float TIMESVDPP_GAMMA_B_I_T = 0.0001;               // Laksh
-    float TIMESVDPP_GAMMA_B_I_F_U_T = 0.00236;          // Laksh
-    float TIMESVDPP_GAMMA_C_U = 0.006;                  // Laksh
-    float TIMESVDPP_GAMMA_C_U_T = 0.001;                // Laksh
-    float TIMESVDPP_GAMMA_Q_I = 0.005;                  // Laksh
-    float TIMESVDPP_GAMMA_Q_I_BIN = 0.0007;             // Laksh
-    float TIMESVDPP_GAMMA_Q_I_F = 0.00003;              // Laksh
-    float TIMESVDPP_GAMMA_P_U = 0.0050;                 // Laksh
-    float TIMESVDPP_GAMMA_ALPHA_P_U = 0.00001;          // Laksh
-    float TIMESVDPP_GAMMA_P_U_T = 0.0040;               // Laksh
-    float TIMESVDPP_GAMMA_Y_J = 0.0050;                 // Laksh 
+    static constexpr float TIMESVDPP_GAMMA_B_U_INIT = 0.0054;           // Laksh
+    static constexpr float TIMESVDPP_GAMMA_ALPHA_B_U_INIT = 0.00003;   // Laksh
+    static constexpr float TIMESVDPP_GAMMA_B_U_T_INIT = 0.0028;         // Laksh
+    static constexpr float TIMESVDPP_GAMMA_B_I_INIT = 0.005;            // Laksh
+    static constexpr float TIMESVDPP_GAMMA_B_I_T_INIT = 0.0001;         // Laksh
+    static constexpr float TIMESVDPP_GAMMA_B_I_F_U_T_INIT = 0.00236;   // Laksh
+    static constexpr float TIMESVDPP_GAMMA_C_U_INIT = 0.006;            // Laksh
+    static constexpr float TIMESVDPP_GAMMA_C_U_T_INIT = 0.001;          // Laksh
+    static constexpr float TIMESVDPP_GAMMA_Q_I_INIT = 0.005;            // Laksh
+    static constexpr float TIMESVDPP_GAMMA_Q_I_BIN_INIT = 0.0007;       // Laksh
+    static constexpr float TIMESVDPP_GAMMA_Q_I_F_INIT = 0.00003;        // Laksh
+    static constexpr float TIMESVDPP_GAMMA_P_U_INIT = 0.0050;           // Laksh
+    static constexpr float TIMESVDPP_GAMMA_ALPHA_P_U_INIT = 0.00001;   // Laksh
+    static constexpr float TIMESVDPP_GAMMA_P_U_T_INIT = 0.0040;         // Laksh
+    static constexpr float TIMESVDPP_GAMMA_Y_J_INIT = 0.0050;           // Laksh
+
+    // The current step sizes. These start out at the values above, and
+    // decay after every iteration.
+    float TIMESVDPP_GAMMA_B_U = TIMESVDPP_GAMMA_B_U_INIT;
+    float TIMESVDPP_GAMMA_ALPHA_B_U = TIMESVDPP_GAMMA_ALPHA_B_U_INIT;
+    float TIMESVDPP_GAMMA_B_U_T = TIMESVDPP_GAMMA_B_U_T_INIT;
+    float TIMESVDPP_GAMMA_B_I = TIMESVDPP_GAMMA_B_I_INIT;
+    float TIMESVDPP_GAMMA_B_I_T = TIMESVDPP_GAMMA_B_I_T_INIT;
+    float TIMESVDPP_GAMMA_B_I_F_U_T = TIMESVDPP_GAMMA_B_I_F_U_T_INIT;
+    float TIMESVDPP_GAMMA_C_U = TIMESVDPP_GAMMA_C_U_INIT;
+    float TIMESVDPP_GAMMA_C_U_T = TIMESVDPP_GAMMA_C_U_T_INIT;
+    float TIMESVDPP_GAMMA_Q_I = TIMESVDPP_GAMMA_Q_I_INIT;
+    float TIMESVDPP_GAMMA_Q_I_BIN = TIMESVDPP_GAMMA_Q_I_BIN_INIT;
+    float TIMESVDPP_GAMMA_Q_I_F = TIMESVDPP_GAMMA_Q_I_F_INIT;
+    float TIMESVDPP_GAMMA_P_U = TIMESVDPP_GAMMA_P_U_INIT;
+    float TIMESVDPP_GAMMA_ALPHA_P_U = TIMESVDPP_GAMMA_ALPHA_P_U_INIT;
+    float TIMESVDPP_GAMMA_P_U_T = TIMESVDPP_GAMMA_P_U_T_INIT;
+    float TIMESVDPP_GAMMA_Y_J = TIMESVDPP_GAMMA_Y_J_INIT;
     // float TIMESVDPP_GAMMA_Y_J_BIN = 0.0001;          // ?
     
     // The fraction by which the step sizes will be multiplied on each
@@ -181,6 +204,10 @@ private:
     // paper.
     std::unordered_map<int, std::vector<int> > N;
 
+    // The checkpoint that the matrices below are mapped from, when using
+    // cached data. It must outlive them, so it is declared first.
+    Checkpoint checkpoint;
+
     // The constant bias for each user. Referred to as "b_u" in the BellKor
     // paper. The uth element in this is the constant bias for user u. Note
     // that this doesn't include times.
@@ -252,7 +279,7 @@ private:
     // A mapping from UserDates to a time-dependent user factor vector of
     // size numFactors. This is called p_{ut} in the BellKor paper. Note:
     // to see the format that this is stored in on disk, refer to
-    // loadUserFacMatTime().
+    // saveCheckpoint().
     std::unordered_map<UserDate, std::vector<float>, UserDateHasher> 
         userFacMatTime;
 
@@ -283,6 +310,19 @@ private:
     // dense numFactors x numTimeBins x numItems cube.
     // fcube yMatBinwise;
 
+    // The per-user state predict() reads, materialized by freeze(). The
+    // uth column of userFactorBase is p_u + |N(u)|^{-1/2} sum_{j in N(u)}
+    // y_j (the time-independent part of the user's factor term), and the
+    // uth element of userBiasBase is mu + b_u.
+    fmat userFactorBase;
+    fcolvec userBiasBase;
+
+    // numFactors zeros, standing in for p_{ut} when there isn't one.
+    std::vector<float> zeroFactors;
+
+    // Whether the state above reflects the current parameters.
+    bool frozen = false;
+
     // Whether the algorithm has been trained yet or not.
     bool trained = false;
 
@@ -292,16 +332,57 @@ private:
     // Whether we're using cached data or not.
     bool usingCachedData = false;
 
+    // The number of training iterations completed so far.
+    int iterationsDone = 0;
+
+    // The version of the parameters saved in checkpoints (their
+    // "format.version" section). Version 2 spreads ratings over all of the
+    // item time bins (see timeBinOf()); earlier checkpoints, which have no
+    // version section, only ever trained bin 0 and are rejected.
+    static constexpr int32_t CHECKPOINT_VERSION = 2;
+
+    // Where, and every how many iterations, training saves a snapshot of
+    // its progress. An interval of 0 means no snapshots are saved.
+    std::string fileNameIterCheckpoint;
+    int iterCheckpointInterval = 0;
+    BackgroundCheckpointWriter iterCheckpointWriter;
+
+    // After how many probe scores without an improvement training stops (0
+    // never stops early), and the checkpoint file it rolls back through.
+    int earlyStoppingPatience = 0;
+    std::string fileNameBestCheckpoint;
+
     void initInternalData();
     void populateHatDevUT(const std::string &fileNameHatDevUT);
     void populateN(const std::string &fileNameN);
     void populateFUT(const std::string &fileNamePUT);
-    void populateNumItemsTrainingSet(const fmat &data);
+    void populateNumItemsTrainingSet(const RatingView &data);
     void updateSumMovieWeights(int lowUserNum, int highUserNum);
     inline void updateUserSumMovieWeights(int user);
-    void loadUserFacMatTime(const std::string &fileNameUserFacMatTime);
-    void saveUserFacMatTime(const std::string &fileNameUserFacMatTime);
-    float computeRMSE(const std::string &testFileName);
+    void loadUserFacMatTime();
+    void train(const RatingView &data, const float *ratings);
+    void trainIterations(const RatingView &data, const float *ratings);
+    void addCheckpointSections(CheckpointWriter &writer) const;
+    void loadCheckpointSections();
+    float nuNormFactor(int user) const;
+    float hatDevUTOf(const UserDate &userDate) const;
+    int fUTOf(const UserDate &userDate) const;
+    int timeBinOf(int date) const;
+    std::unique_ptr<ProbeSnapshot> probeSnapshot(
+        const ProbeSet &probe) const;
+    inline float predictFrozen(int user, int item, int date,
+                               bool bound) const;
+
+protected:
+    void idBounds(int &users, int &items, int &dates) const
+    {
+        users = numUsers;
+        items = numItems;
+        dates = numTimes;
+    }
+
+    void predictRange(const int *users, const int *items, const int *dates,
+                      float *output, size_t n, bool bound);
 
 public:
     TimeSVDPP(int numUsers, int numItems, int numTimes, float meanRating,
@@ -317,64 +398,39 @@ public:
               const std::string &fileNameN,
               const std::string &fileNameHatDevUT,
               const std::string &fileNameFUT,
-              const std::string &fileNameBUserConst,
-              const std::string &fileNameBUserAlpha,
-              const std::string &fileNameBUserTime,
-              const std::string &fileNameBItemConst,
-              const std::string &fileNameBItemTimewise,
-              const std::string &fileNameBItemFreq,
-              const std::string &fileNameCUserConst,
-              const std::string &fileNameCUserTime,
-              const std::string &fileNameUserFacMat,
-              const std::string &fileNameUserFacMatAlpha,
-              const std::string &fileNameUserFacMatTime,
-              const std::string &fileNameItemFacMat,
-              const std::string &fileNameItemFacMatTimewise,
-              const std::string &fileNameItemFacMatFreq,
-              const std::string &fileNameYMat,
-              const std::string &fileNameSumMovieWeights);
+              const std::string &fileNameCheckpoint);
      
     ~TimeSVDPP();
     
     void train(const fmat &data);
+
+    void train(const RatingView &view);
+
+    void trainWithRatings(const RatingView &data, const float *ratings);
     
-    void trainAndCache(const fmat &data,
-                       const std::string &fileNameBUserConst,
-                       const std::string &fileNameBUserAlpha,
-                       const std::string &fileNameBUserTime,
-                       const std::string &fileNameBItemConst,
-                       const std::string &fileNameBItemTimewise,
-                       const std::string &fileNameBItemFreq,
-                       const std::string &fileNameCUserConst,
-                       const std::string &fileNameCUserTime,
-                       const std::string &fileNameUserFacMat,
-                       const std::string &fileNameUserFacMatAlpha,
-                       const std::string &fileNameUserFacMatTime,
-                       const std::string &fileNameItemFacMat,
-                       const std::string &fileNameItemFacMatTimewise,
-                       const std::string &fileNameItemFacMatFreq,
-                       const std::string &fileNameYMat,
-                       const std::string &fileNameSumMovieWeights);
+    void trainAndCache(const RatingView &data,
+                       const std::string &fileNameCheckpoint);
     
     void trainAndCache(const std::string &fileNameData,
-                       const std::string &fileNameBUserConst,
-                       const std::string &fileNameBUserAlpha,
-                       const std::string &fileNameBUserTime,
-                       const std::string &fileNameBItemConst,
-                       const std::string &fileNameBItemTimewise,
-                       const std::string &fileNameBItemFreq,
-                       const std::string &fileNameCUserConst,
-                       const std::string &fileNameCUserTime,
-                       const std::string &fileNameUserFacMat,
-                       const std::string &fileNameUserFacMatAlpha,
-                       const std::string &fileNameUserFacMatTime,
-                       const std::string &fileNameItemFacMat,
-                       const std::string &fileNameItemFacMatTimewise,
-                       const std::string &fileNameItemFacMatFreq,
-                       const std::string &fileNameYMat,
-                       const std::string &fileNameSumMovieWeights);
+                       const std::string &fileNameCheckpoint);
+
+    void saveCheckpoint(const std::string &fileNameCheckpoint) const;
+
+    void setIterationCheckpoints(const std::string &fileNameCheckpoint,
+                                 int interval);
+
+    void setEarlyStopping(int patience,
+                          const std::string &fileNameCheckpoint);
+
+    void resumeTraining(const RatingView &data,
+                        const std::string &fileNameCheckpoint);
     
+    void freeze();
+
     float predict(int user, int item, int date, bool bound);
+
+    void predictBatch(const int *users, const int *items, const int *dates,
+                      float *output, size_t n, bool bound);
 };
 
 #endif // TIMESVDPP_HH
@@ -16,6 +16,7 @@
 #include <vector>
 
 #include <netflix.hh>
+#include <ratingstore.hh>
 #include <timesvdpp.hh>
 
 using namespace std;
@@ -25,10 +26,10 @@ using namespace netflix; // challenge-related constants/functions.
 
 /* Constants */
 
-// The Armadillo binary file to use for training.
-// const string TIMESVDPP_TRAIN_FILE = HIDDEN_BIN;
-// const string TIMESVDPP_TRAIN_FILE = BASE_HIDDEN_VALID_BIN;
-const string TIMESVDPP_TRAIN_FILE = ALL_TRAIN_BIN;
+// The sets to train on (views of the rating store).
+// const set<int> TIMESVDPP_TRAIN_SETS = HIDDEN_IDX;
+// const set<int> TIMESVDPP_TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
+const set<int> TIMESVDPP_TRAIN_SETS = ALL_TRAIN_IDX;
 
 // The number of factors to use for Time-SVD++.
 const int NUM_FACTORS = 110;
@@ -56,39 +57,26 @@ const bool WILL_CACHE_DATA = false;
 // Whether we're using cached data **instead of** training.
 const bool USING_CACHED_DATA = false;
 
-// The locations of the files we'll use for caching (and read from if we're
-// using cached data). These must be in Armadillo binary format!
-const string B_USER_CONST_FN =          "data/timesvdpp_cached/"
-                                        "b_user_const.mat";
-const string B_USER_ALPHA_FN =          "data/timesvdpp_cached/"
-                                        "b_user_alpha.mat";
-const string B_USER_TIME_FN =           "data/timesvdpp_cached/"
-                                        "b_user_time.mat";
-const string B_ITEM_CONST_FN =          "data/timesvdpp_cached/"
-                                        "b_item_const.mat";
-const string B_ITEM_TIMEWISE_FN =       "data/timesvdpp_cached/"
-                                        "b_item_timewise.mat";
-const string B_ITEM_FREQ_FN =           "data/timesvdpp_cached/"
-                                        "b_item_freq.mat";
-const string C_USER_CONST_FN =          "data/timesvdpp_cached/"
-                                        "c_user_const.mat";
-const string C_USER_TIME_FN =           "data/timesvdpp_cached/"
-                                        "c_user_time.mat";
-const string USER_FAC_MAT_FN =          "data/timesvdpp_cached/"
-                                        "user_fac.mat";
-const string USER_FAC_MAT_ALPHA_FN =    "data/timesvdpp_cached/"
-                                        "user_fac_alpha.mat";
-const string USER_FAC_MAT_TIME_FN =     "data/timesvdpp_cached/"
-                                        "user_fac_time.dta";
-const string ITEM_FAC_MAT_FN =          "data/timesvdpp_cached/"
-                                        "item_fac.mat";
-const string ITEM_FAC_MAT_TIMEWISE_FN = "data/timesvdpp_cached/"
-                                        "item_fac_timewise.mat";
-const string ITEM_FAC_MAT_FREQ_FN =     "data/timesvdpp_cached/"
-                                        "item_fac_freq.mat";
-const string Y_MAT_FN =                 "data/timesvdpp_cached/y.mat";
-const string SUM_MOVIE_WEIGHTS_FN =     "data/timesvdpp_cached/"
-                                        "user_sum_y.mat";
+// The checkpoint we'll cache the trained model in (and read from if we're
+// using cached data).
+const string CHECKPOINT_FN = "data/timesvdpp_cached/timesvdpp.ckpt";
+
+// Every how many iterations training saves a snapshot of its progress to
+// ITER_CHECKPOINT_FN (0 turns snapshots off).
+const int ITER_CHECKPOINT_INTERVAL = 5;
+
+// The snapshot file. It's overwritten with the latest snapshot each time.
+const string ITER_CHECKPOINT_FN = "data/timesvdpp_cached/training.ckpt";
+
+// Whether to pick up training from ITER_CHECKPOINT_FN instead of starting
+// over (e.g. after a crash).
+const bool RESUMING_TRAINING = false;
+
+// Stop training once the probe RMSE hasn't improved in this many scored
+// iterations, and roll back to the best one through BEST_CHECKPOINT_FN (0
+// turns early stopping off). Only useful if probe isn't trained on.
+const int EARLY_STOPPING_PATIENCE = 0;
+const string BEST_CHECKPOINT_FN = "data/timesvdpp_cached/best.ckpt";
 
 // Helper function that carries out "predAlgo" on the test file specified
 // by testFileName, and then puts the prediction results (for each (user,
@@ -96,11 +84,9 @@ const string SUM_MOVIE_WEIGHTS_FN =     "data/timesvdpp_cached/"
 void testOnDataFile(TimeSVDPP &predAlgo, const string &testFileName,
                     const string &outputFileName);
 
-// Helper function that carries out "predAlgo" on the test file specified
-// by testFileName (most likely the "probe" dataset), and calculates the
-// RMSE based on those results. Note that testFileName must refer to an
-// Armadillo binary in this case.
-float computeRMSE(TimeSVDPP &predAlgo, const string &testFileName);
+// Helper function that carries out "predAlgo" on testSet (most likely the
+// "probe" dataset), and calculates the RMSE based on those results.
+float computeRMSE(TimeSVDPP &predAlgo, const fmat &testSet);
 
 
 int main(void)
@@ -112,71 +98,72 @@ int main(void)
                           "data\" flag if you're using cached data!");
     }
     
+    // Map the rating store. Models are sized from its dimensions.
+    RatingStore ratings(RATINGS_STORE);
+
     // If we've cached the matrices produced by Time-SVD++, use those to
     // skip the training step.
     if (USING_CACHED_DATA)
     {
-        // Construct a TimeSVDPP object and pass in the cached data file
-        // names.
-        TimeSVDPP predAlgo(NUM_USERS, NUM_MOVIES, NUM_DATES,
+        // Construct a TimeSVDPP object and pass in the cached checkpoint.
+        TimeSVDPP predAlgo(ratings.numUsers(), ratings.numItems(),
+                           ratings.numDates(),
                            MEAN_RATING_TRAINING_SET, NUM_FACTORS,
                            NUM_ITERATIONS, NUM_TIME_BINS,
                            INCLUDE_USER_FAC_MAT_TIME,
                            N_FN, HAT_DEV_U_T_FN, F_U_T_FN,
-                           B_USER_CONST_FN, B_USER_ALPHA_FN,
-                           B_USER_TIME_FN,
-                           B_ITEM_CONST_FN, B_ITEM_TIMEWISE_FN,
-                           B_ITEM_FREQ_FN,
-                           C_USER_CONST_FN, C_USER_TIME_FN,
-                           USER_FAC_MAT_FN, USER_FAC_MAT_ALPHA_FN,
-                           USER_FAC_MAT_TIME_FN,
-                           ITEM_FAC_MAT_FN, ITEM_FAC_MAT_TIMEWISE_FN,
-                           ITEM_FAC_MAT_FREQ_FN,
-                           Y_MAT_FN,
-                           SUM_MOVIE_WEIGHTS_FN);
+                           CHECKPOINT_FN);
          
         // Go through qual.dta and produce a prediction file.
         testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
 
         // Get probe RMSE.
-        float probeRMSE = computeRMSE(predAlgo, PROBE_BIN);
+        float probeRMSE = computeRMSE(predAlgo, loadRatings(PROBE_IDX));
 
         cout << "\nProbe RMSE: " << probeRMSE << endl;
     }
     else // If not using cached data, we need to train.
     {
-        // Load from binary.
-        fmat trainingSet;
-        trainingSet.load(TIMESVDPP_TRAIN_FILE, arma_binary);
+        // The training set is a view of the rating store (and isn't
+        // copied if it's all of the training data).
+        RatingView trainingSet = ratings.view(TIMESVDPP_TRAIN_SETS);
         
-        cout << "Loaded training data from " << TIMESVDPP_TRAIN_FILE << "."
-            << endl;
+        cout << "Loaded " << trainingSet.size() << " training ratings from "
+            << RATINGS_STORE << "." << endl;
 
-        TimeSVDPP predAlgo(NUM_USERS, NUM_MOVIES, NUM_DATES,
+        TimeSVDPP predAlgo(ratings.numUsers(), ratings.numItems(),
+                           ratings.numDates(),
                            MEAN_RATING_TRAINING_SET, NUM_FACTORS,
                            NUM_ITERATIONS, NUM_TIME_BINS,
                            INCLUDE_USER_FAC_MAT_TIME,
                            N_FN, HAT_DEV_U_T_FN, F_U_T_FN);
         
+        predAlgo.setIterationCheckpoints(ITER_CHECKPOINT_FN,
+                                         ITER_CHECKPOINT_INTERVAL);
+        predAlgo.setEarlyStopping(EARLY_STOPPING_PATIENCE,
+                                  BEST_CHECKPOINT_FN);
+
+        // Check if we want to resume.
+        if (RESUMING_TRAINING)
+        {
+            cout << "\nResuming Time-SVD++ training from "
+                 << ITER_CHECKPOINT_FN << "." << endl;
+
+            predAlgo.resumeTraining(trainingSet, ITER_CHECKPOINT_FN);
+
+            if (WILL_CACHE_DATA)
+            {
+                predAlgo.saveCheckpoint(CHECKPOINT_FN);
+            }
+        }
         // Check if we want to cache.
-        if (WILL_CACHE_DATA)
+        else if (WILL_CACHE_DATA)
         {
             // If so, train and then cache the results after training.
             cout << "\nTraining Time-SVD++. The resulting matrices will be"
                     " cached." << endl;
             
-            predAlgo.trainAndCache(trainingSet,
-                                   B_USER_CONST_FN, B_USER_ALPHA_FN,
-                                   B_USER_TIME_FN,
-                                   B_ITEM_CONST_FN, B_ITEM_TIMEWISE_FN,
-                                   B_ITEM_FREQ_FN,
-                                   C_USER_CONST_FN, C_USER_TIME_FN,
-                                   USER_FAC_MAT_FN, USER_FAC_MAT_ALPHA_FN,
-                                   USER_FAC_MAT_TIME_FN,
-                                   ITEM_FAC_MAT_FN, ITEM_FAC_MAT_TIMEWISE_FN,
-                                   ITEM_FAC_MAT_FREQ_FN,
-                                   Y_MAT_FN,
-                                   SUM_MOVIE_WEIGHTS_FN);
+            predAlgo.trainAndCache(trainingSet, CHECKPOINT_FN);
         }
         else
         {
@@ -190,7 +177,7 @@ int main(void)
         testOnDataFile(predAlgo, QUAL_DATA_FN, OUTPUT_FN);
 
         // Get probe RMSE.
-        float probeRMSE = computeRMSE(predAlgo, PROBE_BIN);
+        float probeRMSE = computeRMSE(predAlgo, loadRatings(PROBE_IDX));
         
         cout << "\nProbe RMSE: " << probeRMSE << endl;
     }
@@ -200,40 +187,26 @@ int main(void)
 
 /**
  * Compute the RMSE of a given prediction algorithm on a certain set of
- * data. Note that testFileName must refer to an **Armadillo binary** in
- * this case. This binary must represent a 4 x N matrix, where N is the
- * number of test points.
+ * data: a 4 x N matrix, where N is the number of test points.
  *
  */
-float computeRMSE(TimeSVDPP &predAlgo, const string &testFileName)
+float computeRMSE(TimeSVDPP &predAlgo, const fmat &testSet)
 {
-    // Load from binary.
-    fmat testSet;
-    testSet.load(testFileName, arma_binary);
-
-    // The test set should have four rows.
-    if (testSet.n_rows != 4)
-    {
-        throw invalid_argument("File " + testFileName + " did not have " +
-                               "four rows!");
-    }
-
     // The number we divide by in computing the RMSE.
     int nMinusOne = testSet.n_cols - 1;
 
+    // Predict the whole test set in one batch.
+    vector<float> predictions(testSet.n_cols);
+    predAlgo.predictAll(testSet, predictions.data(), true);
+
     // Accumulator for RMSE (take square root at the end)
     float rmse = 0.0;
 
     for (unsigned int i = 0; i < testSet.n_cols; i ++)
     {
-        int user = roundToInt(testSet(USER_ROW, i));
-        int item = roundToInt(testSet(MOVIE_ROW, i));
-        int date = roundToInt(testSet(DATE_ROW, i));
         float actualRating = testSet(RATING_ROW, i);
         
-        float prediction = predAlgo.predict(user, item, date, true);
-        
-        rmse += pow(actualRating - prediction, 2.0)/nMinusOne;
+        rmse += pow(actualRating - predictions[i], 2.0)/nMinusOne;
     }
 
     return sqrt(rmse);
@@ -248,50 +221,20 @@ float computeRMSE(TimeSVDPP &predAlgo, const string &testFileName)
 void testOnDataFile(TimeSVDPP &predAlgo, const string &testFileName,
                     const string &outputFileName)
 {
-    ifstream testDataFile(testFileName);
-    ofstream outputFile(outputFileName); 
-    
-    if (testDataFile.fail())
-    {
-        throw runtime_error("Couldn't find test file at " + testFileName);
-    }
-
-    if (outputFile.fail())
-    {
-        throw runtime_error("Couldn't open output file at " 
-                            + outputFileName);
-    }
-
-    string testDataLine;
-    
     cout << "\nTesting on data in " << testFileName << "..." << endl;
 
-    while (getline(testDataFile, testDataLine))
-    {
-        // Read the line and split it.
-        vector<int> thisLineVec;
-        splitIntoInts(testDataLine, DELIMITER, thisLineVec);
-
-        if (thisLineVec.size() != 3)
-        {
-            throw logic_error("The line \"" + testDataLine + "\" did not "
-                              "contain three delimiter-separated "
-                              "entries!");
-        }
-        
-        // The first entry is the user ID, the second entry is the item ID,
-        // and the third entry is the date. All of these should be
-        // zero-indexed!
-        int user = thisLineVec[0];
-        int item = thisLineVec[1];
-        int date = thisLineVec[2];
-        
-        // Output the prediction to file.
-        float prediction = predAlgo.predict(user, item, date, true);
-        outputFile << setprecision(RATING_SIG_FIGS) << prediction << endl;
-    }
-    
-    outputFile.close();
+    // Load the (cached) binary index of the test file and predict it in
+    // one batch.
+    Mat<int> testIndex = loadQualIndex(testFileName);
+    vector<float> predictions(testIndex.n_rows);
+    predAlgo.predictBatch(testIndex.colptr(USER_ROW),
+                          testIndex.colptr(MOVIE_ROW),
+                          testIndex.colptr(DATE_ROW),
+                          predictions.data(), testIndex.n_rows, true);
+
+    // Output the predictions to file.
+    writePredictions(outputFileName, predictions.data(), predictions.size(),
+                     RATING_SIG_FIGS);
 
     cout << "\nOutputted predictions on " << testFileName << " to the " 
         "output file " << outputFileName << endl;
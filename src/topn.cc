@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <netflix.hh>
+#include <topn.hh>
+
+using namespace netflix; // challenge-related constants/functions.
+
+/**
+ * Offers a block of scores for items firstItem, firstItem + 1, ... (columns
+ * of the model's item factors) to a user's heap of at most n
+ * recommendations. nextRated walks the user's sorted rated columns
+ * alongside, so masking costs one comparison per item.
+ */
+static void offerScores(std::vector<Recommendation> &heap, size_t n,
+                        const float *scores, const float *itemBiases,
+                        int firstItem, int numItems, const int *&nextRated,
+                        const int *endRated)
+{
+    for (int i = 0; i < numItems; i++)
+    {
+        int item = firstItem + i;
+
+        while (nextRated != endRated && *nextRated < item)
+        {
+            nextRated++;
+        }
+
+        if (nextRated != endRated && *nextRated == item)
+        {
+            continue;
+        }
+
+        Recommendation candidate;
+        candidate.item = item;
+        candidate.score = scores[i] + itemBiases[item];
+        offerRecommendation(heap, n, candidate);
+    }
+}
+
+
+RatedItems::RatedItems(const fmat &data, int numUsers) :
+    offsets(numUsers + 1, 0)
+{
+    // Count each user's ratings, then turn the counts into offsets.
+    for (uword i = 0; i < data.n_cols; i++)
+    {
+        offsets[roundToInt(data(USER_ROW, i)) + 1]++;
+    }
+
+    for (int user = 0; user < numUsers; user++)
+    {
+        offsets[user + 1] += offsets[user];
+    }
+
+    items.resize(data.n_cols);
+    std::vector<size_t> next(offsets);
+
+    for (uword i = 0; i < data.n_cols; i++)
+    {
+        int user = roundToInt(data(USER_ROW, i));
+        items[next[user]++] = roundToInt(data(MOVIE_ROW, i));
+    }
+
+    for (int user = 0; user < numUsers; user++)
+    {
+        std::sort(items.data() + offsets[user],
+                  items.data() + offsets[user + 1]);
+    }
+}
+
+
+RatedItems::RatedItems(const RatingView &view, int numUsers) :
+    offsets(numUsers + 1, 0)
+{
+    // Count each user's ratings, then turn the counts into offsets.
+    view.forEach([this](const float *rating)
+    {
+        offsets[roundToInt(rating[USER_ROW]) + 1]++;
+    });
+
+    for (int user = 0; user < numUsers; user++)
+    {
+        offsets[user + 1] += offsets[user];
+    }
+
+    items.resize(view.size());
+    std::vector<size_t> next(offsets);
+
+    view.forEach([this, &next](const float *rating)
+    {
+        int user = roundToInt(rating[USER_ROW]);
+        items[next[user]++] = roundToInt(rating[MOVIE_ROW]);
+    });
+
+    for (int user = 0; user < numUsers; user++)
+    {
+        std::sort(items.data() + offsets[user],
+                  items.data() + offsets[user + 1]);
+    }
+}
+
+
+TopN::TopN(const FactorModel &model, const RatedItems *rated) :
+    model(model),
+    rated(rated)
+{
+}
+
+
+/**
+ * Ranks every item for up to TOPN_USER_BLOCK users. See recommendBatch()
+ * for the layout of output.
+ *
+ */
+void TopN::recommendBlock(const int *users, size_t numQueryUsers, size_t n,
+                          Recommendation *output) const
+{
+    if (n == 0)
+    {
+        return;
+    }
+
+    const fmat &itemFactors = model.itemFactors();
+    const float *itemBiases = model.itemBiases().memptr();
+    const IdMap &itemIds = model.itemIds();
+    const int numFactors = itemFactors.n_rows;
+    const int numItems = itemFactors.n_cols;
+
+    // One column of effective user factors per user.
+    fmat queries(numFactors, numQueryUsers);
+    std::vector<float> userBiases(numQueryUsers);
+
+    std::vector<std::vector<Recommendation> > heaps(numQueryUsers);
+    std::vector<const int *> nextRated(numQueryUsers, NULL);
+    std::vector<const int *> endRated(numQueryUsers, NULL);
+
+    // If the model renumbers its items, each user's rated items as
+    // (sorted) columns, for the masking walk.
+    std::vector<std::vector<int> > ratedColumns(numQueryUsers);
+
+    for (size_t j = 0; j < numQueryUsers; j++)
+    {
+        userBiases[j] = model.userQuery(users[j], queries.colptr(j));
+        heaps[j].reserve(n);
+
+        if (rated != NULL)
+        {
+            nextRated[j] = rated->begin(users[j]);
+            endRated[j] = rated->end(users[j]);
+
+            if (!itemIds.isIdentity())
+            {
+                std::vector<int> &columns = ratedColumns[j];
+                for (const int *item = nextRated[j]; item != endRated[j];
+                     item++)
+                {
+                    columns.push_back(itemIds.internal(*item));
+                }
+
+                std::sort(columns.begin(), columns.end());
+                nextRated[j] = columns.data();
+                endRated[j] = columns.data() + columns.size();
+            }
+        }
+    }
+
+    for (int firstItem = 0; firstItem < numItems;
+         firstItem += TOPN_ITEM_BLOCK)
+    {
+        int blockSize = std::min(TOPN_ITEM_BLOCK, numItems - firstItem);
+
+        // A view of this block's item factors (no copy is made).
+        const fmat itemBlock(const_cast<float *>(
+                                 itemFactors.colptr(firstItem)),
+                             numFactors, blockSize, false, true);
+
+        // blockSize x numQueryUsers; the jth column holds q_i^T x_u for the
+        // jth user.
+        fmat scores = itemBlock.t() * queries;
+
+        for (size_t j = 0; j < numQueryUsers; j++)
+        {
+            offerScores(heaps[j], n, scores.colptr(j), itemBiases,
+                        firstItem, blockSize, nextRated[j], endRated[j]);
+        }
+    }
+
+    for (size_t j = 0; j < numQueryUsers; j++)
+    {
+        std::sort_heap(heaps[j].begin(), heaps[j].end(),
+                       betterRecommendation);
+
+        Recommendation *userOutput = output + j * n;
+        for (size_t k = 0; k < n; k++)
+        {
+            if (k < heaps[j].size())
+            {
+                // Back to the original item ID (ties were broken by
+                // column, which is the same thing unless the model
+                // renumbers its items).
+                userOutput[k].item = itemIds.external(heaps[j][k].item);
+                userOutput[k].score = heaps[j][k].score + userBiases[j];
+            }
+            else
+            {
+                userOutput[k].item = -1;
+                userOutput[k].score =
+                    -std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+}
+
+
+/**
+ * Returns the n items with the highest predicted ratings for user, best
+ * first, skipping items the user has rated (if a RatedItems was given).
+ * All items are scored with one blocked matrix-vector product.
+ *
+ * @param user: The user ID of interest.
+ * @param n:    The number of items to recommend.
+ *
+ */
+std::vector<Recommendation> TopN::recommend(int user, size_t n) const
+{
+    if (!model.readyForQueries())
+    {
+        throw std::logic_error("Tried to recommend items, but the model "
+                               "isn't ready for queries!");
+    }
+
+    std::vector<Recommendation> recommendations(n);
+    recommendBlock(&user, 1, n, recommendations.data());
+
+    // Drop the padding, if there is any.
+    while (!recommendations.empty() && recommendations.back().item < 0)
+    {
+        recommendations.pop_back();
+    }
+
+    return recommendations;
+}
+
+
+/**
+ * Recommends n items to each of numQueryUsers users at once. Users are
+ * split into blocks of TOPN_USER_BLOCK, which are ranked on OpenMP threads;
+ * each block scores its items with a matrix-matrix product.
+ *
+ * @param users:            The user IDs of interest.
+ * @param numQueryUsers:    The number of users.
+ * @param n:                The number of items to recommend to each user.
+ * @param output:           numQueryUsers * n recommendations; see topn.hh.
+ *
+ */
+void TopN::recommendBatch(const int *users, size_t numQueryUsers, size_t n,
+                          Recommendation *output) const
+{
+    if (!model.readyForQueries())
+    {
+        throw std::logic_error("Tried to recommend items, but the model "
+                               "isn't ready for queries!");
+    }
+
+    const long numBlocks = (long) ((numQueryUsers + TOPN_USER_BLOCK - 1)
+                                   / TOPN_USER_BLOCK);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long block = 0; block < numBlocks; block++)
+    {
+        size_t start = (size_t) block * TOPN_USER_BLOCK;
+        size_t count = std::min((size_t) TOPN_USER_BLOCK,
+                                numQueryUsers - start);
+
+        recommendBlock(users + start, count, n, output + start * n);
+    }
+}
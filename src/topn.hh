@@ -0,0 +1,134 @@
+/*
+ * Top-N recommendation over a trained FactorModel. For each user, every
+ * item is scored against the user's effective factor vector, items the
+ * user has already rated are masked out, and the N best are kept.
+ *
+ * Users are processed in blocks of TOPN_USER_BLOCK and items in blocks of
+ * TOPN_ITEM_BLOCK: each (user block, item block) pair is scored with a
+ * single matrix product (an sgemm through Armadillo's BLAS), which leaves
+ * the block's item factors in cache while every user in the block reuses
+ * them. Scores are streamed into a bounded heap per user, so the full
+ * score vector is never sorted (or even kept).
+ *
+ */
+
+#ifndef TOPN_HH
+#define TOPN_HH
+
+#include <algorithm>
+#include <armadillo>
+#include <cstddef>
+#include <vector>
+
+#include <factormodel.hh>
+#include <ratingstore.hh>
+
+using namespace arma;
+
+// The number of users scored by one matrix product (and handed to one
+// OpenMP task by TopN::recommendBatch()).
+#define TOPN_USER_BLOCK 64
+
+// The number of items scored by one matrix product. A block of item
+// factors (numFactors x TOPN_ITEM_BLOCK floats) should fit in L2.
+#define TOPN_ITEM_BLOCK 1024
+
+// One recommended item and its (unbounded) predicted rating.
+struct Recommendation
+{
+    int item;
+    float score;
+};
+
+/**
+ * Orders recommendations best first (ties go to the lower item ID). As the
+ * comparison of a heap, this keeps the worst of the current best at the
+ * front.
+ */
+inline bool betterRecommendation(const Recommendation &a,
+                                 const Recommendation &b)
+{
+    return a.score > b.score || (a.score == b.score && a.item < b.item);
+}
+
+/**
+ * Offers a candidate to a heap holding the (at most) n best
+ * recommendations seen so far. std::sort_heap() with betterRecommendation
+ * puts the final heap in order, best first.
+ */
+inline void offerRecommendation(std::vector<Recommendation> &heap, size_t n,
+                                const Recommendation &candidate)
+{
+    if (heap.size() < n)
+    {
+        heap.push_back(candidate);
+        std::push_heap(heap.begin(), heap.end(), betterRecommendation);
+    }
+    else if (candidate.score > heap.front().score)
+    {
+        std::pop_heap(heap.begin(), heap.end(), betterRecommendation);
+        heap.back() = candidate;
+        std::push_heap(heap.begin(), heap.end(), betterRecommendation);
+    }
+}
+
+
+/*
+ * The items each user has rated, sorted by item ID, in compressed sparse
+ * row form. TopN uses this to skip items a user has already seen.
+ */
+class RatedItems
+{
+private:
+    // User u's items are items[offsets[u]] to items[offsets[u + 1] - 1].
+    std::vector<size_t> offsets;
+    std::vector<int> items;
+
+public:
+    /* Collect the rated items of every user in data (a 4 x N ratings
+     * matrix, in any order). */
+    RatedItems(const fmat &data, int numUsers);
+
+    /* The same, for a view of a rating store (which isn't copied). */
+    RatedItems(const RatingView &view, int numUsers);
+
+    const int *begin(int user) const { return items.data() + offsets[user]; }
+    const int *end(int user) const
+    {
+        return items.data() + offsets[user + 1];
+    }
+
+    /* Whether user has rated item (a binary search of their items). */
+    bool hasRated(int user, int item) const
+    {
+        return std::binary_search(begin(user), end(user), item);
+    }
+};
+
+
+class TopN
+{
+private:
+    const FactorModel &model;
+
+    // Items to mask out per user, or NULL to rank every item.
+    const RatedItems *rated;
+
+    void recommendBlock(const int *users, size_t numQueryUsers, size_t n,
+                        Recommendation *output) const;
+
+public:
+    TopN(const FactorModel &model, const RatedItems *rated = NULL);
+
+    /* The user's n best items, best first. Fewer than n are returned if
+     * the user hasn't rated enough items. */
+    std::vector<Recommendation> recommend(int user, size_t n) const;
+
+    /* The n best items of each of numQueryUsers users, best first, written
+     * to output[u * n] to output[u * n + n - 1] for the uth user. Slots
+     * without a recommendation have item -1. */
+    void recommendBatch(const int *users, size_t numQueryUsers, size_t n,
+                        Recommendation *output) const;
+};
+
+#endif // TOPN_HH
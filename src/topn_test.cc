@@ -0,0 +1,89 @@
+/**
+ * A simple test of top-N recommendation. This loads a cached SVD++ model,
+ * recommends movies to a block of users (skipping movies they've already
+ * rated), and reports how many users per second were ranked.
+ *
+ * Note: The main method does not expect any arguments in this case.
+ *
+ */
+
+#include <armadillo>
+#include <chrono>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <netflix.hh>
+#include <ratingstore.hh>
+#include <svdpp.hh>
+#include <topn.hh>
+
+using namespace std;
+using namespace std::chrono;
+using namespace arma;
+using namespace netflix; // challenge-related constants/functions.
+
+
+/* Constants */
+
+// The sets the cached model was trained on. Movies rated in them are never
+// recommended.
+const set<int> TRAIN_SETS = BASE_HIDDEN_VALID_IDX;
+
+// These must match the cached model (see svdpp_test.cc).
+const int NUM_FACTORS = 200;
+const int NUM_ITERATIONS = 25;
+const string CHECKPOINT_FN = "data/svdpp_cached/svdpp.ckpt";
+
+// The number of movies to recommend to each user.
+const int NUM_RECOMMENDATIONS = 10;
+
+// The number of users to rank in the timed batch.
+const int NUM_QUERY_USERS = 100000;
+
+
+int main(void)
+{
+    // The model is sized from the rating store's dimensions.
+    RatingStore ratings(RATINGS_STORE);
+
+    SVDPP predAlgo(ratings.numUsers(), ratings.numItems(),
+                   MEAN_RATING_TRAINING_SET, NUM_FACTORS, NUM_ITERATIONS,
+                   N_FN, CHECKPOINT_FN);
+
+    RatedItems rated(ratings.view(TRAIN_SETS), ratings.numUsers());
+
+    TopN topN(predAlgo, &rated);
+
+    // Show one user's recommendations.
+    vector<Recommendation> recommendations =
+        topN.recommend(0, NUM_RECOMMENDATIONS);
+
+    cout << "Top " << NUM_RECOMMENDATIONS << " movies for user 0:" << endl;
+    for (const Recommendation &recommendation : recommendations)
+    {
+        cout << "    movie " << recommendation.item << " (predicted "
+             << recommendation.score << ")" << endl;
+    }
+
+    // Time a batch of users.
+    vector<int> users(NUM_QUERY_USERS);
+    for (int i = 0; i < NUM_QUERY_USERS; i++)
+    {
+        users[i] = i % ratings.numUsers();
+    }
+
+    vector<Recommendation> batch((size_t) NUM_QUERY_USERS
+                                 * NUM_RECOMMENDATIONS);
+
+    time_point<system_clock> start = system_clock::now();
+    topN.recommendBatch(users.data(), users.size(), NUM_RECOMMENDATIONS,
+                        batch.data());
+    duration<float> secondsElapsed = system_clock::now() - start;
+
+    cout << "\nRanked " << NUM_QUERY_USERS << " users in "
+         << secondsElapsed.count() << " seconds ("
+         << NUM_QUERY_USERS / secondsElapsed.count() << " users/second)."
+         << endl;
+}
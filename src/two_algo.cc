@@ -1,19 +1,20 @@
+#include <ratingstore.hh>
 #include <two_algo.hh>
 
 
-Two_Algo::Two_Algo(const std::string &trainingSet,
+Two_Algo::Two_Algo(const std::set<int> &trainingSets,
         const std::string &intermediatePredFileName,
         const int ratingSigFig,
         const bool deleteIntermedPredFile) :
+    store(RATINGS_STORE),
+    trainingSet(store.view(trainingSets)),
     intermediatePredFileName(intermediatePredFileName),
     ratingSigFig(ratingSigFig),
     deleteIntermedPredFile(deleteIntermedPredFile)
 {
-    currentTrain.load(trainingSet, arma_binary);
-    
 #ifndef NDEBUG
-    cout << "Set up Two_Algo by loading data from " <<
-        trainingSet << endl;
+    cout << "Set up Two_Algo by loading " << trainingSet.size() <<
+        " ratings" << endl;
     cout << "The intermediate predictions file " << 
         "generated by the first model ";
 
@@ -33,7 +34,7 @@ void Two_Algo::trainFirst(BaseAlgorithm &firstAlgo)
     cout << "\nStarted training first model." << endl;
 #endif
 
-    firstAlgo.train(currentTrain);
+    firstAlgo.train(trainingSet);
 
 #ifndef NDEBUG
     cout << "Finished training first model." << endl;
@@ -44,52 +45,23 @@ void Two_Algo::trainFirst(BaseAlgorithm &firstAlgo)
 void Two_Algo::saveFirstQualPredictions(BaseAlgorithm &firstAlgo,
         const std::string &qualFileName)
 {
-    // Output predictions to intermediatePredFileName
-    std::ifstream qualDataFile(qualFileName);
-    std::ofstream outputFile(intermediatePredFileName); 
-
-    if (qualDataFile.fail())
-    {
-        throw std::runtime_error("Couldn't find qual file at "
-            + qualFileName);
-    }
-
-    if (outputFile.fail())
+    Mat<int> qualIndex = loadQualIndex(qualFileName);
+
+    // Predict all of qual in one batch. Don't bound predictions since we
+    // want the second algorithm to correct on where the first went awry.
+    fcolvec predictions(qualIndex.n_rows);
+    firstAlgo.predictBatch(qualIndex.colptr(USER_ROW),
+                           qualIndex.colptr(MOVIE_ROW),
+                           qualIndex.colptr(DATE_ROW),
+                           predictions.memptr(), qualIndex.n_rows, false);
+
+    // Keep them as raw floats, in the same order as the qual index.
+    if (!predictions.save(intermediatePredFileName, arma_binary))
     {
         throw std::runtime_error("Couldn't open output file at " 
             + intermediatePredFileName);
     }
 
-    std::string qualDataLine;
-
-    while (getline(qualDataFile, qualDataLine))
-    {
-        // Read the line and split it.
-        std::vector<int> thisLineVec;
-        splitIntoInts(qualDataLine, DELIMITER, thisLineVec);
-
-        if (thisLineVec.size() != 3)
-        {
-            throw std::logic_error("The line \"" + qualDataLine + "\" did not "
-                              "contain three delimiter-separated "
-                              "entries!");
-        }
-
-        // The first entry is the user ID, the second entry is the item ID,
-        // and the third entry is the date.
-        int user = thisLineVec[0];
-        int item = thisLineVec[1];
-        int date = thisLineVec[2];
-
-        // Output the prediction of the first algorithm to
-        // intermediatePredFileName. Don't bound predictions since we want
-        // the second algorithm to correct on where the first went awry.
-        float prediction = firstAlgo.predict(user, item, date, false);
-        outputFile << std::setprecision(ratingSigFig) << prediction << endl;
-    }
-
-    outputFile.close();
-
 #ifndef NDEBUG
     cout << "Outputted first algorithm's qual predictions to the temporary"
         << " file " << intermediatePredFileName << "." << endl;
@@ -99,26 +71,27 @@ void Two_Algo::saveFirstQualPredictions(BaseAlgorithm &firstAlgo,
 
 
 /**
- * Computes and saves residuals of firstAlgo's predictions on the current
- * training set. If the "residualsFile" is an uninitialized string, then
- * saving isn't performed.
+ * Computes and saves residuals of firstAlgo's predictions on the training
+ * set. The residuals are kept in memory for trainSecond(); the training
+ * set itself is left untouched. If the "residualsFile" is an uninitialized
+ * string, then saving isn't performed.
  */
 void Two_Algo::computeAndSaveFirstResiduals(BaseAlgorithm &firstAlgo,
         const std::string residualsFile)
 {
-    int user, item, date;
-    float actualRating, predictedRating;
-    unsigned int i;
-    for(i = 0; i < currentTrain.n_cols; i++)
-    {
-        user = roundToInt(currentTrain(USER_ROW, i));
-        item = roundToInt(currentTrain(MOVIE_ROW, i));
-        date = roundToInt(currentTrain(DATE_ROW, i));
-        actualRating = currentTrain(RATING_ROW, i);
-
-        predictedRating = firstAlgo.predict(user, item, date, false);
-        currentTrain.at(RATING_ROW, i) = actualRating - predictedRating;
-    }
+    // Predict straight into the residual column, then turn each prediction
+    // into rating - prediction.
+    std::vector<float> firstResiduals(trainingSet.size());
+    firstAlgo.predictAll(trainingSet, firstResiduals.data(), false);
+
+    size_t i = 0;
+    trainingSet.forEach([&firstResiduals, &i](const float *rating)
+            {
+                firstResiduals[i] = rating[RATING_ROW] - firstResiduals[i];
+                i++;
+            });
+
+    residuals.assign(std::move(firstResiduals));
     
 #ifndef NDEBUG
     cout << "Finished computing residuals of first model." << endl;
@@ -126,11 +99,10 @@ void Two_Algo::computeAndSaveFirstResiduals(BaseAlgorithm &firstAlgo,
 
     if (!residualsFile.empty())
     {
-        currentTrain.save(residualsFile, arma_binary);
+        FloatColumn::save(residualsFile, residuals.data(), residuals.size());
 
 #ifndef NDEBUG
-        cout << "Saved first model's residuals in binary format to "
-            << residualsFile << endl;
+        cout << "Saved first model's residuals to " << residualsFile << endl;
 #endif
     }
     else
@@ -142,13 +114,21 @@ void Two_Algo::computeAndSaveFirstResiduals(BaseAlgorithm &firstAlgo,
 }
 
 
-/* Load residuals of the first model from a specific file. */
+/* Map the residuals of the first model from a specific file. */
 void Two_Algo::loadResiduals(const std::string residualsFile)
 {
-    currentTrain.load(residualsFile, arma_binary);
+    residuals.map(residualsFile);
+
+    if (residuals.size() != trainingSet.size())
+    {
+        residuals.clear();
+        throw std::logic_error("The residuals at " + residualsFile + " were "
+                "not computed on this training set!");
+    }
+
 #ifndef NDEBUG
-    cout << "Loaded residuals of first model from "
-        << residualsFile << " into \"currentTrain\"." << endl;
+    cout << "Mapped residuals of first model from " << residualsFile
+        << "." << endl;
 #endif
 }
 
@@ -156,10 +136,19 @@ void Two_Algo::loadResiduals(const std::string residualsFile)
 float Two_Algo::getAverage()
 {
     float sum = 0;
-    unsigned int i;
-    for(i = 0; i < currentTrain.n_cols; i++)
-        sum += currentTrain(RATING_ROW, i);
-    return sum / currentTrain.n_cols;
+    if (residuals.empty())
+    {
+        trainingSet.forEach([&sum](const float *rating)
+                {
+                    sum += rating[RATING_ROW];
+                });
+    }
+    else
+    {
+        for(size_t i = 0; i < residuals.size(); i++)
+            sum += residuals[i];
+    }
+    return sum / trainingSet.size();
 }
 
 
@@ -169,7 +158,13 @@ void Two_Algo::trainSecond(BaseAlgorithm &secondAlgo)
     cout << "\nStarted training second model." << endl;
 #endif
 
-    secondAlgo.train(currentTrain);
+    if (residuals.empty())
+    {
+        throw std::logic_error("The first model's residuals must be computed "
+                "or loaded before training the second model!");
+    }
+
+    secondAlgo.trainWithRatings(trainingSet, residuals.data());
 
 #ifndef NDEBUG
     cout << "Finished training second model." << endl;
@@ -186,76 +181,38 @@ void Two_Algo::saveSecondQualPredictions(BaseAlgorithm &secondAlgo,
     const std::string &qualFileName,
     const std::string &outputFileName)
 {
-    // Open up the first algorithm's qual predictions too.
-    std::ifstream qualDataFile(qualFileName);
-    std::ifstream firstAlgoPredFile(intermediatePredFileName);
-    std::ofstream outputFile(outputFileName); 
+    Mat<int> qualIndex = loadQualIndex(qualFileName);
 
-    if (qualDataFile.fail())
-    {
-        throw std::runtime_error("Couldn't find qual file at "
-            + qualFileName);
-    }
+    // Load the first algorithm's qual predictions too.
+    fcolvec predictions;
 
-    if (firstAlgoPredFile.fail())
+    if (!predictions.load(intermediatePredFileName, arma_binary))
     {
         throw std::runtime_error("Couldn't find first algorithm's "
                 "predictions at " + intermediatePredFileName);
     }
 
-    if (outputFile.fail())
+    if (predictions.n_elem != qualIndex.n_rows)
     {
-        throw std::runtime_error("Couldn't open output file at " 
-            + outputFileName);
+        throw std::logic_error("The first algorithm's predictions at " +
+                intermediatePredFileName + " don't match the qual file at "
+                + qualFileName + "!");
     }
 
-    std::string qualDataLine;
-    float firstAlgoPred;
+    fcolvec secondAlgoPreds(qualIndex.n_rows);
+    secondAlgo.predictBatch(qualIndex.colptr(USER_ROW),
+                            qualIndex.colptr(MOVIE_ROW),
+                            qualIndex.colptr(DATE_ROW),
+                            secondAlgoPreds.memptr(), qualIndex.n_rows,
+                            false);
 
-    while (getline(qualDataFile, qualDataLine))
-    {
-        // Store the previous algorithm's rating in firstAlgoPred.
-        firstAlgoPredFile >> firstAlgoPred;
-
-        // Read a line from the qual dataset and split it.
-        std::vector<int> thisLineVec;
-        splitIntoInts(qualDataLine, DELIMITER, thisLineVec);
-        
-        if (thisLineVec.size() != 3)
-        {
-            throw std::logic_error("The line \"" + qualDataLine + "\" did not "
-                              "contain three delimiter-separated "
-                              "entries!");
-        }
-
-        // The first entry is the user ID, the second entry is the item ID,
-        // and the third entry is the date. All of these should be
-        // zero-indexed!
-        int user = thisLineVec[0];
-        int item = thisLineVec[1];
-        int date = thisLineVec[2];
-        
-        // Combine the second algorithm's prediction with the first
-        // algorithm's prediction. Bound the sum and then save that to
-        // file.
-        float secondAlgoPred = secondAlgo.predict(user, item, date, false);
-        float comboPred = firstAlgoPred + secondAlgoPred;
-
-        if (comboPred > MAX_RATING)
-        {
-            comboPred = MAX_RATING;
-        }
-        if (comboPred < MIN_RATING)
-        {
-            comboPred = MIN_RATING;
-        }
-
-        outputFile << std::setprecision(ratingSigFig) << comboPred << endl;
-    }
+    // Combine the second algorithm's prediction with the first
+    // algorithm's prediction, and bound the sum.
+    predictions += secondAlgoPreds;
+    predictions = clamp(predictions, (float) MIN_RATING, (float) MAX_RATING);
 
-    qualDataFile.close();
-    firstAlgoPredFile.close();
-    outputFile.close();
+    writePredictions(outputFileName, predictions.memptr(),
+                     predictions.n_elem, ratingSigFig);
 
 #ifndef NDEBUG
     cout << "\nOutputted combined algorithm's qual predictions to " <<
@@ -16,6 +16,7 @@
 #include <functional>
 #include <iterator>
 #include <random>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -24,6 +25,8 @@
 #include <iomanip>
 #include <netflix.hh>
 #include <comboalgorithm.hh>
+#include <floatcolumn.hh>
+#include <ratingstore.hh>
 
 using namespace arma;
 using namespace netflix; // challenge-related constants/functions.
@@ -33,11 +36,26 @@ using std::endl;
 class Two_Algo : public ComboAlgorithm
 {
     private:
-        fmat currentTrain;
+        /* The rating store the training set is taken from. */
+        RatingStore store;
+
+        /*
+         * The training set, a view of the store. Models train on it (and
+         * predict it) without it ever being copied.
+         */
+        RatingView trainingSet;
+
+        /*
+         * The first model's residuals on trainingSet (one per column), once
+         * they have been computed or mapped from a cache file. The second
+         * model trains on these in place of the ratings.
+         */
+        FloatColumn residuals;
         
         /*
          * The file name where intermediate qual predictions will be stored
-         * (i.e. the unbounded predictions made by the first algorithm).
+         * (i.e. the unbounded predictions made by the first algorithm). This
+         * is an Armadillo binary fcolvec.
          */
         std::string intermediatePredFileName;
 
@@ -47,7 +65,7 @@ class Two_Algo : public ComboAlgorithm
         int ratingSigFig;
 
     public:
-        Two_Algo(const std::string &trainingSet,
+        Two_Algo(const std::set<int> &trainingSets,
                  const std::string &intermediatePredFileName,
                  const int ratingSigFig,
                  const bool deleteIntermedPredFile);
@@ -57,19 +75,26 @@ class Two_Algo : public ComboAlgorithm
         
         /* 
          * Save the first algorithm's qual predictions to 
-         * intermediatePredFileName.
+         * intermediatePredFileName, as a float vector in Armadillo's binary
+         * format (in the order of loadQualIndex(qualFileName)).
          */
         void saveFirstQualPredictions(BaseAlgorithm &firstAlgo,
                 const std::string &qualFileName);
          
-        /* Update the fmat for the residuals of training set. */
-       void computeAndSaveFirstResiduals(BaseAlgorithm &firstAlgo,
+        /*
+         * Compute the first model's residuals on the training set, and
+         * save them (as a FloatColumn cache) unless residualsFile is empty.
+         */
+        void computeAndSaveFirstResiduals(BaseAlgorithm &firstAlgo,
                 const std::string residualsFile);
 
-        /* Return the current average for the training set. */
+        /*
+         * Return the current average for the training set (of the residuals
+         * if there are any).
+         */
         float getAverage();
 
-        /* Load the residuals from a file. */
+        /* Map residuals saved by computeAndSaveFirstResiduals(). */
         void loadResiduals(const std::string residualsFile);
 
         /* Train on the second model with residuals. */
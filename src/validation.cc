@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <omp.h>
+#include <stdexcept>
+
+#include <netflix.hh>
+#include <ratingstore.hh>
+#include <simd.hh>
+#include <telemetry.hh>
+#include <validation.hh>
+
+using namespace std;
+using namespace std::chrono;
+using namespace netflix;
+
+
+/**
+ * Loads the probe set from the rating store into compact form, once per
+ * process. The 4 x N matrix it's read into is dropped straight away.
+ *
+ */
+const ProbeSet &ProbeSet::resident()
+{
+    static const ProbeSet probe = []()
+    {
+        ProbeSet compact;
+        fmat data;
+
+        try
+        {
+            data = loadRatings(PROBE_IDX);
+        }
+        catch (const runtime_error &)
+        {
+            return compact;
+        }
+
+        compact.userSlots.reserve(data.n_cols);
+        compact.items.reserve(data.n_cols);
+        compact.dates.reserve(data.n_cols);
+        compact.ratings.reserve(data.n_cols);
+
+        for (uword i = 0; i < data.n_cols; i++)
+        {
+            int user = roundToInt(data(USER_ROW, i));
+
+            // Ratings are grouped by user, so a new user gets a new slot.
+            if (compact.users.empty() || compact.users.back() != user)
+            {
+                compact.users.push_back(user);
+            }
+
+            compact.userSlots.push_back(compact.users.size() - 1);
+            compact.items.push_back(roundToInt(data(MOVIE_ROW, i)));
+            compact.dates.push_back(roundToInt(data(DATE_ROW, i)));
+            compact.ratings.push_back(roundToInt(data(RATING_ROW, i)));
+        }
+
+        return compact;
+    }();
+
+    return probe;
+}
+
+
+/**
+ * Copies the item side of the model, and the queries of the probe users.
+ * The queries are built on all cores, since training waits for them.
+ *
+ */
+FactorSnapshot::FactorSnapshot(const FactorModel &model,
+                               const ProbeSet &probe)
+    : numFactors(model.itemFactors().n_rows),
+      itemFactors(model.itemFactors()),
+      itemBiases(model.itemBiases()),
+      itemIds(model.itemIds()),
+      userFactors(numFactors, probe.users.size()),
+      userBiases(probe.users.size())
+{
+    const int numProbeUsers = probe.users.size();
+
+    #pragma omp parallel for schedule(static)
+    for (int slot = 0; slot < numProbeUsers; slot++)
+    {
+        userBiases(slot) = model.userQuery(probe.users[slot],
+                                           userFactors.colptr(slot));
+    }
+}
+
+
+void FactorSnapshot::predict(const ProbeSet &probe, size_t begin,
+                             size_t end, float *predictions) const
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        int slot = probe.userSlots[i];
+        int item = itemIds.internal(probe.items[i]);
+
+        float predictedRating = userBiases(slot) + itemBiases(item) +
+            simd::dot(itemFactors.colptr(item), userFactors.colptr(slot),
+                      numFactors);
+
+        predictions[i - begin] = std::min(std::max(predictedRating,
+            (float) MIN_RATING), (float) MAX_RATING);
+    }
+}
+
+
+ProbeValidator::ProbeValidator(const string &model, int numThreads)
+    : model(model),
+      numThreads(numThreads > 0 ? numThreads
+                                : std::max(1, omp_get_max_threads() - 1))
+{
+}
+
+
+ProbeValidator::~ProbeValidator()
+{
+    // A failure can't be reported from here; whoever cares about it should
+    // have called wait().
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+
+    // The parameters of an epoch that wasn't the best aren't needed.
+    if (!fileNameBest.empty())
+    {
+        try
+        {
+            parameterWriter.wait();
+        }
+        catch (const exception &)
+        {
+        }
+
+        std::remove((fileNameBest + ".pending").c_str());
+    }
+}
+
+
+bool ProbeValidator::enabled() const
+{
+    return ProbeSet::resident().size() > 0;
+}
+
+
+void ProbeValidator::setPatience(int patience)
+{
+    if (patience < 0)
+    {
+        throw invalid_argument("The early stopping patience can't be "
+                               "negative!");
+    }
+
+    this->patience = patience;
+}
+
+
+void ProbeValidator::keepBest(const string &fileName)
+{
+    fileNameBest = fileName;
+}
+
+
+/**
+ * Starts scoring a snapshot on a background thread, which predicts the
+ * probe set a block at a time on a pool of numThreads OpenMP threads. The
+ * previous evaluation (if any) is waited for and recorded first.
+ *
+ * @param epoch:        The epoch the snapshot was taken after.
+ * @param snapshot:     The model's prediction state after that epoch.
+ * @param parameters:   The model's checkpoint sections after that epoch,
+ *                      to keep in case the epoch is the best (or NULL).
+ *                      They're copied before this returns, and written
+ *                      next to the keepBest() checkpoint in the background.
+ *
+ */
+void ProbeValidator::submit(int epoch, unique_ptr<ProbeSnapshot> &&snapshot,
+                            CheckpointWriter *parameters)
+{
+    wait();
+
+    if (parameters != NULL)
+    {
+        if (fileNameBest.empty())
+        {
+            throw logic_error("There's nowhere to keep the parameters of " +
+                              model + "'s best epoch!");
+        }
+
+        parameterWriter.write(std::move(*parameters),
+                              fileNameBest + ".pending");
+        pendingParameters = true;
+    }
+
+    pendingEpoch = epoch;
+
+    shared_ptr<ProbeSnapshot> pending(std::move(snapshot));
+
+    worker = thread([this, pending]()
+            {
+                try
+                {
+                    steady_clock::time_point start = steady_clock::now();
+                    const ProbeSet &probe = ProbeSet::resident();
+
+                    const long numRatings = probe.size();
+                    const long numBlocks =
+                        (numRatings + VALIDATION_BLOCK - 1) /
+                        VALIDATION_BLOCK;
+                    double sumSquaredErrors = 0.0;
+
+                    #pragma omp parallel for num_threads(numThreads) \
+                        schedule(dynamic) reduction(+:sumSquaredErrors)
+                    for (long block = 0; block < numBlocks; block++)
+                    {
+                        float predictions[VALIDATION_BLOCK];
+                        size_t begin = block * VALIDATION_BLOCK;
+                        size_t end = std::min(begin + VALIDATION_BLOCK,
+                                              (size_t) numRatings);
+
+                        pending->predict(probe, begin, end, predictions);
+
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            double error = probe.ratings[i] -
+                                predictions[i - begin];
+                            sumSquaredErrors += error * error;
+                        }
+                    }
+
+                    pendingRMSE = sqrt(sumSquaredErrors / numRatings);
+
+                    duration<double> seconds = steady_clock::now() - start;
+                    pendingSeconds = seconds.count();
+                }
+                catch (...)
+                {
+                    error = current_exception();
+                }
+            });
+}
+
+
+void ProbeValidator::wait()
+{
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+
+    if (error)
+    {
+        exception_ptr failure = error;
+        error = nullptr;
+        pendingEpoch = 0;
+        pendingParameters = false;
+        rethrow_exception(failure);
+    }
+
+    collect();
+}
+
+
+/**
+ * Records the result of the evaluation that just finished (if any), and
+ * keeps its parameters if it's the best so far, by renaming the file they
+ * were written to once the write is done.
+ *
+ */
+void ProbeValidator::collect()
+{
+    if (pendingEpoch == 0)
+    {
+        return;
+    }
+
+    if (bestEpochSoFar == 0 || pendingRMSE < bestRMSESoFar)
+    {
+        if (pendingParameters)
+        {
+            const string fileNamePending = fileNameBest + ".pending";
+
+            parameterWriter.wait();
+            if (std::rename(fileNamePending.c_str(),
+                            fileNameBest.c_str()) != 0)
+            {
+                throw runtime_error("Couldn't keep the parameters of " +
+                                    model + "'s best epoch in " +
+                                    fileNameBest + "!");
+            }
+        }
+
+        bestEpochSoFar = pendingEpoch;
+        bestRMSESoFar = pendingRMSE;
+        sinceBest = 0;
+    }
+    else
+    {
+        sinceBest++;
+    }
+
+    telemetry::probeResult(model, pendingEpoch, pendingRMSE, pendingSeconds,
+                           bestEpochSoFar);
+
+    pendingEpoch = 0;
+    pendingParameters = false;
+}
+
+
+bool ProbeValidator::shouldStop() const
+{
+    return patience > 0 && sinceBest >= patience;
+}
+
@@ -0,0 +1,186 @@
+/*
+ * Probe validation that runs alongside training. Scoring the probe set
+ * after every epoch used to stall the training thread (which also reloaded
+ * the probe set and predicted it serially). Instead, a model now hands a
+ * ProbeValidator a snapshot of the state its predictions read, taken at the
+ * end of the epoch, and the validator scores the snapshot on a pool of its
+ * own threads while the next epoch trains:
+ *
+ *      epoch e trains      | epoch e + 1 trains  | epoch e + 2 trains
+ *                          | probe e is scored   | probe e + 1 is scored
+ *
+ * The probe set is loaded once per process and kept resident in a compact,
+ * user-grouped form (see ProbeSet), and a snapshot only copies the state
+ * of the users in it.
+ *
+ * Since results arrive an epoch late, so does early stopping: once the
+ * best probe RMSE is "patience" evaluated epochs old, training stops after
+ * the epoch in progress, and the model can be rolled back to its best
+ * epoch from the checkpoint the validator kept of it. Those parameters are
+ * written to disk in the background while the epoch is scored, rather than
+ * held in memory, and only the best epoch's file is kept.
+ *
+ */
+
+#ifndef VALIDATION_HH
+#define VALIDATION_HH
+
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <checkpoint.hh>
+#include <factormodel.hh>
+#include <idmap.hh>
+
+using namespace arma;
+
+// The number of probe ratings predicted at a time by one thread of a
+// ProbeValidator.
+#define VALIDATION_BLOCK 4096
+
+/*
+ * The probe set in compact form: 13 bytes a rating instead of the 16 of a
+ * 4 x N fmat. Ratings are grouped by user, as they are in the rating store;
+ * users lists each probe user once, and userSlots gives the index of each
+ * rating's user in it.
+ */
+struct ProbeSet
+{
+    std::vector<int32_t> users;
+    std::vector<int32_t> userSlots;
+    std::vector<int32_t> items;
+    std::vector<int32_t> dates;
+    std::vector<uint8_t> ratings;
+
+    size_t size() const { return ratings.size(); }
+
+    /* The probe set of the rating store, loaded the first time it's asked
+     * for and kept. It's empty if there's no rating store. */
+    static const ProbeSet &resident();
+};
+
+
+/*
+ * A model's prediction state, copied at the end of an epoch so that it can
+ * be scored while training changes the model. Predictions are the ones the
+ * model would make (bounded or not, as it reports its probe RMSE).
+ */
+class ProbeSnapshot
+{
+public:
+    /* Predict probe ratings [begin, end) into predictions[0, end - begin).
+     * This is called from several threads at once. */
+    virtual void predict(const ProbeSet &probe, size_t begin, size_t end,
+                         float *predictions) const = 0;
+
+    virtual ~ProbeSnapshot() {}
+};
+
+
+/*
+ * A snapshot of a FactorModel: the item factors and biases, and the query
+ * of every probe user. The model's queries must reflect its parameters
+ * (i.e. SVD++ has to be frozen first). Predictions are bounded.
+ */
+class FactorSnapshot : public ProbeSnapshot
+{
+private:
+    int numFactors;
+    fmat itemFactors;
+    fcolvec itemBiases;
+    IdMap itemIds;
+
+    // Column s of userFactors and element s of userBiases are the query of
+    // probe user s (see ProbeSet::users).
+    fmat userFactors;
+    fcolvec userBiases;
+
+public:
+    FactorSnapshot(const FactorModel &model, const ProbeSet &probe);
+
+    void predict(const ProbeSet &probe, size_t begin, size_t end,
+                 float *predictions) const;
+};
+
+
+/*
+ * Scores snapshots on a background thread, at most one at a time, and
+ * keeps track of the best epoch.
+ */
+class ProbeValidator
+{
+private:
+    std::string model;
+    int numThreads;
+
+    // Stop once the best epoch is this many evaluated epochs old (0 never
+    // stops early).
+    int patience = 0;
+    int sinceBest = 0;
+
+    // The evaluation in flight, and the error it failed with (if any).
+    std::thread worker;
+    std::exception_ptr error;
+    int pendingEpoch = 0;
+    double pendingRMSE = 0.0;
+    double pendingSeconds = 0.0;
+
+    // Where the parameters of the best epoch are kept (see keepBest()), and
+    // the writer that saves those of the epoch in flight next to them. At
+    // most one epoch's parameters are being written at a time.
+    std::string fileNameBest;
+    BackgroundCheckpointWriter parameterWriter;
+    bool pendingParameters = false;
+
+    // The best result so far.
+    int bestEpochSoFar = 0;
+    double bestRMSESoFar = 0.0;
+
+    void collect();
+
+public:
+    /* Validate the named model on the resident probe set, with numThreads
+     * threads (by default, all but the one training). */
+    ProbeValidator(const std::string &model, int numThreads = 0);
+    ProbeValidator(const ProbeValidator &) = delete;
+    ProbeValidator &operator=(const ProbeValidator &) = delete;
+    ~ProbeValidator();
+
+    /* Whether there's a probe set to validate on (which loads it). */
+    bool enabled() const;
+
+    /* Stop after the best epoch is patience evaluated epochs old (0 turns
+     * early stopping off). */
+    void setPatience(int patience);
+
+    /* Keep the parameters of the best epoch in the checkpoint fileName
+     * (see submit()), so that the model can be rolled back to it. */
+    void keepBest(const std::string &fileName);
+
+    /* Start scoring the snapshot taken after the given epoch (counted from
+     * 1), once the previous one is done. If parameters (a writer holding
+     * the model's checkpoint sections) is given, they're written out in the
+     * background, and become the keepBest() checkpoint if the epoch turns
+     * out to be the best. */
+    void submit(int epoch, std::unique_ptr<ProbeSnapshot> &&snapshot,
+                CheckpointWriter *parameters = NULL);
+
+    /* Wait for the evaluation in flight (if any) to finish, and rethrow the
+     * error it failed with (if any). */
+    void wait();
+
+    /* Whether the best epoch is patience evaluated epochs old. */
+    bool shouldStop() const;
+
+    /* The best epoch so far (0 if none has been scored) and its RMSE. */
+    int bestEpoch() const { return bestEpochSoFar; }
+    double bestRMSE() const { return bestRMSESoFar; }
+};
+
+#endif // VALIDATION_HH